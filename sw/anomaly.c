@@ -0,0 +1,329 @@
+//-----------------------------------------------------------------
+//                       USB Sniffer
+//                           V0.1
+//                     Ultra-Embedded.com
+//                       Copyright 2015
+//
+//               Email: admin@ultra-embedded.com
+//
+//                       License: LGPL
+//-----------------------------------------------------------------
+//
+// Copyright (C) 2011 - 2013 Ultra-Embedded.com
+//
+// This source file may be used and distributed without         
+// restriction provided that this copyright statement is not    
+// removed from the file and that any derivative work contains  
+// the original copyright notice and the associated disclaimer. 
+//
+// This source file is free software; you can redistribute it   
+// and/or modify it under the terms of the GNU Lesser General   
+// Public License as published by the Free Software Foundation; 
+// either version 2.1 of the License, or (at your option) any   
+// later version.
+//
+// This source is distributed in the hope that it will be       
+// useful, but WITHOUT ANY WARRANTY; without even the implied   
+// warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR      
+// PURPOSE.  See the GNU Lesser General Public License for more 
+// details.
+//
+// You should have received a copy of the GNU Lesser General    
+// Public License along with this source; if not, write to the 
+// Free Software Foundation, Inc., 59 Temple Place, Suite 330, 
+// Boston, MA  02111-1307  USA
+//-----------------------------------------------------------------
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <assert.h>
+
+#include "usb_defs.h"
+#include "log_format.h"
+#include "usb_helpers.h"
+#include "log_decode.h"
+#include "capture_filter.h"
+#include "transaction.h"
+#include "anomaly.h"
+
+//-----------------------------------------------------------------
+// Defines
+//-----------------------------------------------------------------
+#define ANOMALY_SLOTS           (128 * 16)
+
+// Pipe within an endpoint entry
+#define PIPE_OUT                0
+#define PIPE_IN                 1
+
+//-----------------------------------------------------------------
+// Structures
+//-----------------------------------------------------------------
+struct anomaly_pipe
+{
+    int8_t   toggle;        // Expected DATA PID nibble (-1 = unknown)
+    uint8_t  failures;      // Consecutive failed transactions
+};
+
+struct anomaly_endpoint
+{
+    struct anomaly_pipe pipe[2];
+    uint8_t  handshaked;    // Handshake seen (not isochronous)
+};
+
+struct anomaly_detector
+{
+    FILE                   *file;
+    tAnomalyHeader          hdr;
+    tTxnBuilder             builder;
+
+    uint64_t                record;     // Number of current record
+    uint64_t                txn_record; // Number of first record of open transaction
+
+    struct anomaly_endpoint eps[ANOMALY_SLOTS];
+};
+
+//-----------------------------------------------------------------
+// anomaly_report: Append entry to index
+//-----------------------------------------------------------------
+static int anomaly_report(tAnomalyDetector *det, int type, uint64_t time, uint64_t record,
+                          uint8_t device, uint8_t endpoint, uint8_t pid)
+{
+    tAnomaly a;
+
+    memset(&a, 0, sizeof(a));
+    a.time     = time;
+    a.record   = record;
+    a.type     = type;
+    a.device   = device;
+    a.endpoint = endpoint;
+    a.pid      = pid;
+
+    det->hdr.count++;
+    det->hdr.type_count[type]++;
+
+    if (fwrite(&a, sizeof(a), 1, det->file) != 1)
+    {
+        fprintf(stderr, "ERROR: Could not write anomaly index\n");
+        return -1;
+    }
+
+    return 0;
+}
+//-----------------------------------------------------------------
+// anomaly_reset_state: Forget per endpoint state (bus reset)
+//-----------------------------------------------------------------
+static void anomaly_reset_state(tAnomalyDetector *det)
+{
+    int i;
+
+    memset(det->eps, 0, sizeof(det->eps));
+    for (i=0;i<ANOMALY_SLOTS;i++)
+    {
+        det->eps[i].pipe[PIPE_OUT].toggle = -1;
+        det->eps[i].pipe[PIPE_IN].toggle  = -1;
+    }
+}
+//-----------------------------------------------------------------
+// anomaly_check_toggle: DATA0/DATA1 alternate per pipe after each
+// accepted packet
+//-----------------------------------------------------------------
+static int anomaly_check_toggle(tAnomalyDetector *det, struct anomaly_pipe *pipe, const tTransaction *txn)
+{
+    int pid = txn->data & 0xF;
+    int err = 0;
+
+    if (pid != (PID_DATA0 & 0xF) && pid != (PID_DATA1 & 0xF))
+        return 0;
+
+    if (pipe->toggle >= 0 && pid != pipe->toggle)
+        err = anomaly_report(det, ANOMALY_TOGGLE, txn->time, det->txn_record, txn->device, txn->endpoint, txn->data);
+
+    // Resync on what was accepted
+    pipe->toggle = (pid == (PID_DATA0 & 0xF)) ? (PID_DATA1 & 0xF) : (PID_DATA0 & 0xF);
+    return err;
+}
+//-----------------------------------------------------------------
+// anomaly_failed: Count failed transaction, report retries
+//-----------------------------------------------------------------
+static int anomaly_failed(tAnomalyDetector *det, struct anomaly_pipe *pipe, const tTransaction *txn, int type)
+{
+    if (anomaly_report(det, type, txn->time, det->txn_record, txn->device, txn->endpoint, txn->token) != 0)
+        return -1;
+
+    if (++pipe->failures == ANOMALY_RETRY_LIMIT)
+        return anomaly_report(det, ANOMALY_RETRY, txn->time, det->txn_record, txn->device, txn->endpoint, txn->token);
+
+    return 0;
+}
+//-----------------------------------------------------------------
+// anomaly_txn: Check completed transaction
+//-----------------------------------------------------------------
+static int anomaly_txn(void *ctx, const tTransaction *txn, const uint8_t *data)
+{
+    tAnomalyDetector *det = (tAnomalyDetector *)ctx;
+    struct anomaly_endpoint *ep;
+    struct anomaly_pipe *pipe;
+
+    if (!txn->token)
+    {
+        uint8_t pid = txn->data ? txn->data : txn->hshake;
+        return anomaly_report(det, ANOMALY_ORPHAN, txn->time, det->txn_record, 0, 0, pid);
+    }
+
+    ep   = &det->eps[(txn->device & 0x7F) * 16 + (txn->endpoint & 0xF)];
+    pipe = &ep->pipe[(txn->token == PID_IN) ? PIPE_IN : PIPE_OUT];
+
+    if (txn->hshake)
+        ep->handshaked = 1;
+
+    if (txn->hshake == PID_STALL)
+    {
+        pipe->failures = 0;
+        return anomaly_report(det, ANOMALY_STALL, txn->time, det->txn_record, txn->device, txn->endpoint, txn->token);
+    }
+
+    if (txn->token != PID_IN && txn->token != PID_OUT && txn->token != PID_SETUP)
+        return 0;
+
+    // SETUP is DATA0, data and status stages then start at DATA1
+    if (txn->token == PID_SETUP)
+    {
+        ep->pipe[PIPE_OUT].toggle = PID_DATA0 & 0xF;
+        ep->pipe[PIPE_IN].toggle  = PID_DATA1 & 0xF;
+    }
+
+    // Isochronous endpoints never handshake, nothing to check
+    if (!ep->handshaked)
+        return 0;
+
+    if (!txn->data && !txn->hshake)
+        return anomaly_failed(det, pipe, txn, ANOMALY_TIMEOUT);
+
+    if (txn->data && !txn->hshake)
+        return anomaly_failed(det, pipe, txn, ANOMALY_NO_HSHAKE);
+
+    pipe->failures = 0;
+
+    if (txn->hshake == PID_NAK || !txn->data)
+        return 0;
+
+    return anomaly_check_toggle(det, pipe, txn);
+}
+//-----------------------------------------------------------------
+// anomaly_create: Check records, writing index to filename
+//-----------------------------------------------------------------
+tAnomalyDetector* anomaly_create(const char *filename)
+{
+    tAnomalyDetector *det = (tAnomalyDetector *)calloc(1, sizeof(tAnomalyDetector));
+    assert(det);
+
+    det->file = fopen(filename, "wb");
+    if (!det->file)
+    {
+        fprintf(stderr, "ERROR: Could not create %s\n", filename);
+        free(det);
+        return NULL;
+    }
+
+    // Header rewritten with the totals when finished
+    det->hdr.version = ANOMALY_VERSION;
+    if (fwrite(&det->hdr, sizeof(det->hdr), 1, det->file) != 1)
+    {
+        fclose(det->file);
+        free(det);
+        return NULL;
+    }
+
+    txn_builder_init(&det->builder);
+    anomaly_reset_state(det);
+    return det;
+}
+//-----------------------------------------------------------------
+// anomaly_add: Feed next record
+//-----------------------------------------------------------------
+int anomaly_add(tAnomalyDetector *det, const tLogRecord *rec)
+{
+    int err = 0;
+
+    if (!log_decode_pid_valid(rec))
+        err = anomaly_report(det, ANOMALY_PID, rec->time, det->record,
+                             rec->has_addr ? rec->device : 0, rec->has_addr ? rec->endpoint : 0, rec->pid);
+
+    if (!err && !log_decode_crc_valid(rec))
+        err = anomaly_report(det, ANOMALY_CRC, rec->time, det->record,
+                             rec->has_addr ? rec->device : 0, rec->has_addr ? rec->endpoint : 0, rec->pid);
+
+    if (!err && txn_builder_add(&det->builder, rec, anomaly_txn, det) != 0)
+        err = -1;
+
+    // Transaction opened by this record
+    if (det->builder.open && det->builder.cur.time == rec->time &&
+        (rec->type == LOG_CTRL_TYPE_TOKEN || !det->builder.cur.token))
+        det->txn_record = det->record;
+
+    if (rec->type == LOG_CTRL_TYPE_RST && usb_get_rst_state(rec->value))
+    {
+        if (!err)
+            err = anomaly_report(det, ANOMALY_RESET, rec->time, det->record, 0, 0, 0);
+        anomaly_reset_state(det);
+    }
+
+    det->record++;
+    return err;
+}
+//-----------------------------------------------------------------
+// anomaly_finish: Complete index; totals copied to summary (if set)
+//-----------------------------------------------------------------
+int anomaly_finish(tAnomalyDetector *det, uint64_t source_size, tAnomalyHeader *summary)
+{
+    int err;
+
+    err = txn_builder_flush(&det->builder, anomaly_txn, det);
+
+    det->hdr.magic       = ANOMALY_MAGIC;
+    det->hdr.source_size = source_size;
+    det->hdr.records     = det->record;
+
+    if (fseek(det->file, 0, SEEK_SET) != 0 || fwrite(&det->hdr, sizeof(det->hdr), 1, det->file) != 1)
+        err = -1;
+    if (fclose(det->file) != 0)
+        err = -1;
+
+    if (summary)
+        *summary = det->hdr;
+
+    free(det);
+    return err;
+}
+//-----------------------------------------------------------------
+// anomaly_read_header: Read and check index header
+//-----------------------------------------------------------------
+int anomaly_read_header(FILE *f, tAnomalyHeader *hdr)
+{
+    if (fread(hdr, sizeof(*hdr), 1, f) != 1 ||
+        hdr->magic != ANOMALY_MAGIC || hdr->version != ANOMALY_VERSION)
+        return -1;
+
+    return 0;
+}
+//-----------------------------------------------------------------
+// anomaly_type_str
+//-----------------------------------------------------------------
+const char* anomaly_type_str(int type)
+{
+    static const char *names[ANOMALY_TYPES] =
+    {
+        "TOGGLE",
+        "RETRY",
+        "STALL",
+        "NO_HSHAKE",
+        "TIMEOUT",
+        "BAD_PID",
+        "ORPHAN",
+        "RESET",
+        "BAD_CRC"
+    };
+
+    return (type >= 0 && type < ANOMALY_TYPES) ? names[type] : "UNKNOWN";
+}
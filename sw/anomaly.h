@@ -0,0 +1,81 @@
+#ifndef __ANOMALY_H__
+#define __ANOMALY_H__
+
+//--------------------------------------------------------------------
+// Defines
+//--------------------------------------------------------------------
+#define ANOMALY_MAGIC           0x4D4E4155  // "UANM"
+#define ANOMALY_VERSION         2
+
+// Sidecar file name is the capture path plus this suffix
+#define ANOMALY_SUFFIX          ".anm"
+
+// Consecutive failed transactions on an endpoint reported as retries
+#define ANOMALY_RETRY_LIMIT     3
+
+//--------------------------------------------------------------------
+// Enums
+//--------------------------------------------------------------------
+typedef enum
+{
+    ANOMALY_TOGGLE,         // DATA0/DATA1 did not alternate
+    ANOMALY_RETRY,          // ANOMALY_RETRY_LIMIT failed attempts in a row
+    ANOMALY_STALL,
+    ANOMALY_NO_HSHAKE,      // Data not handshaked on a handshaked endpoint
+    ANOMALY_TIMEOUT,        // Token with no response
+    ANOMALY_PID,            // PID not valid for the packet type
+    ANOMALY_ORPHAN,         // Data / handshake without a token
+    ANOMALY_RESET,
+    ANOMALY_CRC,            // Data packet CRC16 mismatch
+    ANOMALY_TYPES
+} tAnomalyType;
+
+//--------------------------------------------------------------------
+// Structures
+//--------------------------------------------------------------------
+// Index entry. record is the record number within the capture (the
+// block holding it is found from the block record counts).
+typedef struct
+{
+    uint64_t time;
+    uint64_t record;
+    uint8_t  type;          // tAnomalyType
+    uint8_t  device;
+    uint8_t  endpoint;
+    uint8_t  pid;           // Offending PID (0 = n/a)
+    uint32_t reserved;
+} tAnomaly;
+
+// Index header, followed by count entries in capture order
+typedef struct
+{
+    uint32_t magic;
+    uint16_t version;
+    uint16_t reserved;
+    uint64_t source_size;   // Size of capture checked (0 = unknown)
+    uint64_t records;       // Records checked
+    uint64_t count;
+    uint64_t type_count[ANOMALY_TYPES];
+} tAnomalyHeader;
+
+typedef struct anomaly_detector tAnomalyDetector;
+
+//--------------------------------------------------------------------
+// Prototypes
+//--------------------------------------------------------------------
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+tAnomalyDetector* anomaly_create(const char *filename);
+int               anomaly_add(tAnomalyDetector *det, const tLogRecord *rec);
+int               anomaly_finish(tAnomalyDetector *det, uint64_t source_size, tAnomalyHeader *summary);
+
+int               anomaly_read_header(FILE *f, tAnomalyHeader *hdr);
+const char*       anomaly_type_str(int type);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
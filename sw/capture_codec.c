@@ -0,0 +1,400 @@
+//-----------------------------------------------------------------
+//                       USB Sniffer
+//                           V0.1
+//                     Ultra-Embedded.com
+//                       Copyright 2015
+//
+//               Email: admin@ultra-embedded.com
+//
+//                       License: LGPL
+//-----------------------------------------------------------------
+//
+// Copyright (C) 2011 - 2013 Ultra-Embedded.com
+//
+// This source file may be used and distributed without         
+// restriction provided that this copyright statement is not    
+// removed from the file and that any derivative work contains  
+// the original copyright notice and the associated disclaimer. 
+//
+// This source file is free software; you can redistribute it   
+// and/or modify it under the terms of the GNU Lesser General   
+// Public License as published by the Free Software Foundation; 
+// either version 2.1 of the License, or (at your option) any   
+// later version.
+//
+// This source is distributed in the hope that it will be       
+// useful, but WITHOUT ANY WARRANTY; without even the implied   
+// warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR      
+// PURPOSE.  See the GNU Lesser General Public License for more 
+// details.
+//
+// You should have received a copy of the GNU Lesser General    
+// Public License along with this source; if not, write to the 
+// Free Software Foundation, Inc., 59 Temple Place, Suite 330, 
+// Boston, MA  02111-1307  USA
+//-----------------------------------------------------------------
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <stdint.h>
+
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+#include "capture_codec.h"
+
+//-----------------------------------------------------------------
+// Defines
+//-----------------------------------------------------------------
+// LZ block format: sequences of
+//   [token] [literal length ext] [literals] [offset lo/hi] [match length ext]
+// token high nibble = literal length, low nibble = match length - 4,
+// a nibble of 15 is followed by length bytes until one is < 255.
+// The final sequence holds literals only.
+#define LZ_HASH_BITS        14
+#define LZ_MIN_MATCH        4
+#define LZ_MAX_OFFSET       65535
+#define LZ_LAST_LITERALS    8
+#define LZ_SKIP_SHIFT       6
+
+#define ZSTD_LEVEL          1
+
+//-----------------------------------------------------------------
+// lz_read32
+//-----------------------------------------------------------------
+static inline uint32_t lz_read32(const uint8_t *p)
+{
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+//-----------------------------------------------------------------
+// lz_hash
+//-----------------------------------------------------------------
+static inline uint32_t lz_hash(uint32_t v)
+{
+    return (v * 2654435761u) >> (32 - LZ_HASH_BITS);
+}
+//-----------------------------------------------------------------
+// lz_match_length: Length of common run (capped at limit)
+//-----------------------------------------------------------------
+static inline uint32_t lz_match_length(const uint8_t *a, const uint8_t *b, const uint8_t *limit)
+{
+    const uint8_t *start = a;
+
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    while (a + 8 <= limit)
+    {
+        uint64_t x, y;
+        memcpy(&x, a, 8);
+        memcpy(&y, b, 8);
+        if (x != y)
+            return (a - start) + (__builtin_ctzll(x ^ y) >> 3);
+        a += 8;
+        b += 8;
+    }
+#endif
+
+    while (a < limit && *a == *b)
+    {
+        a++;
+        b++;
+    }
+
+    return a - start;
+}
+//-----------------------------------------------------------------
+// lz_put_length: Extended length bytes
+//-----------------------------------------------------------------
+static inline uint8_t *lz_put_length(uint8_t *op, uint32_t len)
+{
+    while (len >= 255)
+    {
+        *op++ = 255;
+        len  -= 255;
+    }
+    *op++ = len;
+    return op;
+}
+//-----------------------------------------------------------------
+// lz_put_sequence: Emit literals plus optional match
+//-----------------------------------------------------------------
+static uint8_t *lz_put_sequence(uint8_t *op, uint8_t *oend, const uint8_t *lit, uint32_t lit_len, uint32_t offset, uint32_t match_len)
+{
+    uint8_t *token;
+
+    // Worst case space for this sequence
+    if ((oend - op) < (1 + (lit_len / 255) + 1 + lit_len + 2 + (match_len / 255) + 1))
+        return NULL;
+
+    token  = op++;
+    *token = 0;
+
+    if (lit_len >= 15)
+    {
+        *token = 15 << 4;
+        op = lz_put_length(op, lit_len - 15);
+    }
+    else
+        *token = lit_len << 4;
+
+    memcpy(op, lit, lit_len);
+    op += lit_len;
+
+    if (match_len == 0)
+        return op;
+
+    *op++ = offset;
+    *op++ = offset >> 8;
+
+    match_len -= LZ_MIN_MATCH;
+    if (match_len >= 15)
+    {
+        *token |= 15;
+        op = lz_put_length(op, match_len - 15);
+    }
+    else
+        *token |= match_len;
+
+    return op;
+}
+//-----------------------------------------------------------------
+// lz_compress: Greedy single pass hash-chain-less LZ77
+//-----------------------------------------------------------------
+static int lz_compress(const uint8_t *src, uint32_t src_size, uint8_t *dst, uint32_t dst_size)
+{
+    uint32_t table[1 << LZ_HASH_BITS];
+    const uint8_t *ip     = src;
+    const uint8_t *anchor = src;
+    const uint8_t *iend   = src + src_size;
+    const uint8_t *limit  = (src_size > LZ_LAST_LITERALS + LZ_MIN_MATCH) ? (iend - LZ_LAST_LITERALS) : src;
+    uint8_t *op   = dst;
+    uint8_t *oend = dst + dst_size;
+
+    memset(table, 0, sizeof(table));
+
+    while (ip + LZ_MIN_MATCH <= limit)
+    {
+        uint32_t v   = lz_read32(ip);
+        uint32_t h   = lz_hash(v);
+        const uint8_t *ref = src + table[h];
+
+        table[h] = ip - src;
+
+        if (ref < ip && (ip - ref) <= LZ_MAX_OFFSET && lz_read32(ref) == v)
+        {
+            uint32_t len = LZ_MIN_MATCH + lz_match_length(ip + LZ_MIN_MATCH, ref + LZ_MIN_MATCH, limit);
+
+            op = lz_put_sequence(op, oend, anchor, ip - anchor, ip - ref, len);
+            if (!op)
+                return -1;
+
+            ip    += len;
+            anchor = ip;
+
+            if (ip - 2 + LZ_MIN_MATCH <= iend)
+                table[lz_hash(lz_read32(ip - 2))] = (ip - 2) - src;
+        }
+        // Step faster through data which is not compressing
+        else
+            ip += 1 + ((ip - anchor) >> LZ_SKIP_SHIFT);
+    }
+
+    op = lz_put_sequence(op, oend, anchor, iend - anchor, 0, 0);
+    if (!op)
+        return -1;
+
+    return op - dst;
+}
+//-----------------------------------------------------------------
+// lz_get_length: Read extended length bytes
+//-----------------------------------------------------------------
+static inline int lz_get_length(const uint8_t **ip, const uint8_t *iend, uint32_t *len)
+{
+    uint8_t b;
+
+    do
+    {
+        if (*ip >= iend)
+            return -1;
+        b = *(*ip)++;
+        *len += b;
+    }
+    while (b == 255);
+
+    return 0;
+}
+//-----------------------------------------------------------------
+// lz_decompress
+//-----------------------------------------------------------------
+static int lz_decompress(const uint8_t *src, uint32_t src_size, uint8_t *dst, uint32_t dst_size)
+{
+    const uint8_t *ip   = src;
+    const uint8_t *iend = src + src_size;
+    uint8_t *op   = dst;
+    uint8_t *oend = dst + dst_size;
+
+    while (ip < iend)
+    {
+        uint8_t  token   = *ip++;
+        uint32_t lit_len = token >> 4;
+        uint32_t len     = token & 15;
+        uint32_t offset;
+        const uint8_t *match;
+
+        if (lit_len == 15 && lz_get_length(&ip, iend, &lit_len) != 0)
+            return -1;
+
+        if (lit_len > (uint32_t)(iend - ip) || lit_len > (uint32_t)(oend - op))
+            return -1;
+
+        // Short literal run with room to overrun both buffers
+        if (lit_len <= 16 && (iend - ip) >= 16 && (oend - op) >= 16)
+            memcpy(op, ip, 16);
+        else
+            memcpy(op, ip, lit_len);
+        op += lit_len;
+        ip += lit_len;
+
+        // Final sequence is literals only
+        if (ip >= iend)
+            break;
+
+        if (iend - ip < 2)
+            return -1;
+
+        offset = ip[0] | (ip[1] << 8);
+        ip += 2;
+
+        if (len == 15 && lz_get_length(&ip, iend, &len) != 0)
+            return -1;
+        len += LZ_MIN_MATCH;
+
+        if (offset == 0 || offset > (uint32_t)(op - dst) || len > (uint32_t)(oend - op))
+            return -1;
+
+        match = op - offset;
+
+        // Non-overlapping (in 8 byte steps) match with room to overrun
+        if (offset >= 8 && (uint32_t)(oend - op) >= len + 8)
+        {
+            uint8_t *end = op + len;
+            do
+            {
+                memcpy(op, match, 8);
+                op    += 8;
+                match += 8;
+            }
+            while (op < end);
+            op = end;
+        }
+        // Run of a single byte (zero filled payloads)
+        else if (offset == 1)
+        {
+            memset(op, *match, len);
+            op += len;
+        }
+        else
+        {
+            while (len--)
+                *op++ = *match++;
+        }
+    }
+
+    return op - dst;
+}
+//-----------------------------------------------------------------
+// capture_codec_parse: Codec from name (-1 if unknown)
+//-----------------------------------------------------------------
+int capture_codec_parse(const char *name)
+{
+    if (strcmp(name, "none") == 0)
+        return CAPTURE_CODEC_NONE;
+    else if (strcmp(name, "lz") == 0)
+        return CAPTURE_CODEC_LZ;
+    else if (strcmp(name, "zstd") == 0)
+        return CAPTURE_CODEC_ZSTD;
+
+    return -1;
+}
+//-----------------------------------------------------------------
+// capture_codec_supported: Codec available in this build?
+//-----------------------------------------------------------------
+int capture_codec_supported(int codec)
+{
+    switch (codec)
+    {
+        case CAPTURE_CODEC_NONE:
+        case CAPTURE_CODEC_LZ:
+            return 1;
+#ifdef HAVE_ZSTD
+        case CAPTURE_CODEC_ZSTD:
+            return 1;
+#endif
+        default:
+            return 0;
+    }
+}
+//-----------------------------------------------------------------
+// capture_codec_bound: Worst case compressed size
+//-----------------------------------------------------------------
+uint32_t capture_codec_bound(int codec, uint32_t size)
+{
+#ifdef HAVE_ZSTD
+    if (codec == CAPTURE_CODEC_ZSTD)
+        return ZSTD_compressBound(size);
+#endif
+    return size + (size / 255) + 16;
+}
+//-----------------------------------------------------------------
+// capture_codec_compress: Returns compressed size, -1 on failure
+//-----------------------------------------------------------------
+int capture_codec_compress(int codec, const uint8_t *src, uint32_t src_size, uint8_t *dst, uint32_t dst_size)
+{
+    switch (codec)
+    {
+        case CAPTURE_CODEC_NONE:
+            if (src_size > dst_size)
+                return -1;
+            memcpy(dst, src, src_size);
+            return src_size;
+        case CAPTURE_CODEC_LZ:
+            return lz_compress(src, src_size, dst, dst_size);
+#ifdef HAVE_ZSTD
+        case CAPTURE_CODEC_ZSTD:
+        {
+            size_t res = ZSTD_compress(dst, dst_size, src, src_size, ZSTD_LEVEL);
+            return ZSTD_isError(res) ? -1 : (int)res;
+        }
+#endif
+        default:
+            return -1;
+    }
+}
+//-----------------------------------------------------------------
+// capture_codec_decompress: Returns decompressed size, -1 on failure
+//-----------------------------------------------------------------
+int capture_codec_decompress(int codec, const uint8_t *src, uint32_t src_size, uint8_t *dst, uint32_t dst_size)
+{
+    switch (codec)
+    {
+        case CAPTURE_CODEC_NONE:
+            if (src_size > dst_size)
+                return -1;
+            memcpy(dst, src, src_size);
+            return src_size;
+        case CAPTURE_CODEC_LZ:
+            return lz_decompress(src, src_size, dst, dst_size);
+#ifdef HAVE_ZSTD
+        case CAPTURE_CODEC_ZSTD:
+        {
+            size_t res = ZSTD_decompress(dst, dst_size, src, src_size);
+            return ZSTD_isError(res) ? -1 : (int)res;
+        }
+#endif
+        default:
+            return -1;
+    }
+}
@@ -0,0 +1,32 @@
+#ifndef __CAPTURE_CODEC_H__
+#define __CAPTURE_CODEC_H__
+
+//--------------------------------------------------------------------
+// Enums
+//--------------------------------------------------------------------
+typedef enum
+{
+    CAPTURE_CODEC_NONE,
+    CAPTURE_CODEC_LZ,
+    CAPTURE_CODEC_ZSTD,
+    CAPTURE_CODEC_MAX
+} tCaptureCodec;
+
+//--------------------------------------------------------------------
+// Prototypes
+//--------------------------------------------------------------------
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+int      capture_codec_parse(const char *name);
+int      capture_codec_supported(int codec);
+uint32_t capture_codec_bound(int codec, uint32_t size);
+int      capture_codec_compress(int codec, const uint8_t *src, uint32_t src_size, uint8_t *dst, uint32_t dst_size);
+int      capture_codec_decompress(int codec, const uint8_t *src, uint32_t src_size, uint8_t *dst, uint32_t dst_size);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
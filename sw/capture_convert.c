@@ -0,0 +1,364 @@
+//-----------------------------------------------------------------
+//                       USB Sniffer
+//                           V0.1
+//                     Ultra-Embedded.com
+//                       Copyright 2015
+//
+//               Email: admin@ultra-embedded.com
+//
+//                       License: LGPL
+//-----------------------------------------------------------------
+//
+// Copyright (C) 2011 - 2013 Ultra-Embedded.com
+//
+// This source file may be used and distributed without         
+// restriction provided that this copyright statement is not    
+// removed from the file and that any derivative work contains  
+// the original copyright notice and the associated disclaimer. 
+//
+// This source file is free software; you can redistribute it   
+// and/or modify it under the terms of the GNU Lesser General   
+// Public License as published by the Free Software Foundation; 
+// either version 2.1 of the License, or (at your option) any   
+// later version.
+//
+// This source is distributed in the hope that it will be       
+// useful, but WITHOUT ANY WARRANTY; without even the implied   
+// warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR      
+// PURPOSE.  See the GNU Lesser General Public License for more 
+// details.
+//
+// You should have received a copy of the GNU Lesser General    
+// Public License along with this source; if not, write to the 
+// Free Software Foundation, Inc., 59 Temple Place, Suite 330, 
+// Boston, MA  02111-1307  USA
+//-----------------------------------------------------------------
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+
+#include "log_format.h"
+#include "usb_defs.h"
+#include "usb_sniffer.h"
+#include "log_file.h"
+#include "log_decode.h"
+#include "capture_filter.h"
+#include "payload_store.h"
+#include "capture_file.h"
+#include "capture_convert.h"
+#include "parallel.h"
+
+//-----------------------------------------------------------------
+// Structures
+//-----------------------------------------------------------------
+// Block converted into memory by a worker. Output state at block
+// entry is not known until earlier blocks are done, so the worker
+// starts from a guess and records what the fixup pass needs.
+struct convert_chunk
+{
+    tCaptureBlock   blk;
+    uint32_t       *words;
+
+    char           *buf;
+    size_t          size;
+
+    tLogFileState   start;      // Assumed entry state
+    tLogFileState   end;        // Exit state (relative to start)
+    int             saw_rst;    // Output depended on start.in_rst
+    int             tic_exact;  // end.last_tic independent of start
+
+    // Decoder times at block exit
+    uint64_t        end_time;
+    uint64_t        end_sof_time;
+
+    // First SOF (its gap depends on ticks carried in)
+    int             has_sof;
+    int             sof_exact;
+    uint32_t        sof_value;
+    uint32_t        pre_tic;
+    size_t          sof_start;
+    size_t          sof_end;
+
+    int             err;
+};
+
+struct convert_job
+{
+    tCaptureFile         *cap;
+    const tCaptureFilter *filter;
+    int                   is_hs;
+    struct convert_chunk  chunks[CAPTURE_BATCH_BLOCKS];
+
+    // End of the last block written, to spot skipped blocks
+    int                   anchored;
+    uint64_t              end_time;
+    uint64_t              end_sof_time;
+};
+
+//-----------------------------------------------------------------
+// convert_block: Decode block and pass records to the log file.
+// With chunk set, also note state dependencies for the fixup pass.
+//-----------------------------------------------------------------
+static int convert_block(struct convert_job *job, struct convert_chunk *c, FILE *f)
+{
+    tLogDecoder dec;
+    tLogRecord rec;
+    tLogFileState before;
+    tLogFileState after;
+    uint32_t count = c->blk.raw_words;
+    uint32_t idx;
+
+    capture_file_block_decoder(job->cap, &c->blk, &dec);
+
+    for (idx = 0; idx < count; idx += rec.words)
+    {
+        if (log_decode_next(&dec, c->words + idx, count - idx, &rec) <= 0)
+            return -1;
+
+        if (!capture_filter_match_record(job->filter, &rec))
+            continue;
+
+        switch (rec.type)
+        {
+            case LOG_CTRL_TYPE_SOF:
+                if (f && !c->has_sof)
+                {
+                    log_file_get_state(&before);
+                    c->has_sof   = 1;
+                    c->sof_value = rec.value;
+                    c->pre_tic   = before.last_tic;
+                    fflush(f);
+                    c->sof_start = c->size;
+                    log_file_add_sof(rec.value, job->is_hs);
+                    fflush(f);
+                    c->sof_end   = c->size;
+                }
+                else
+                    log_file_add_sof(rec.value, job->is_hs);
+                break;
+            case LOG_CTRL_TYPE_RST:
+                if (f)
+                {
+                    log_file_get_state(&before);
+                    log_file_add_rst(rec.value, job->is_hs);
+                    log_file_get_state(&after);
+
+                    // A reset change restarts the tick count
+                    if (!c->has_sof && !c->saw_rst && after.in_rst != before.in_rst)
+                        c->sof_exact = 1;
+                    c->saw_rst = 1;
+                }
+                else
+                    log_file_add_rst(rec.value, job->is_hs);
+                break;
+            case LOG_CTRL_TYPE_TOKEN:
+                log_file_add_token(rec.value);
+                break;
+            case LOG_CTRL_TYPE_HSHAKE:
+                log_file_add_handshake(rec.value);
+                break;
+            case LOG_CTRL_TYPE_DATA:
+                log_file_add_data(rec.value, rec.data, rec.length);
+                break;
+        }
+    }
+
+    c->end_time     = dec.time;
+    c->end_sof_time = dec.sof_time;
+    return 0;
+}
+//-----------------------------------------------------------------
+// convert_gap: Blocks before c were skipped (no record in them could
+// match the filter). Their SOFs are not decoded, the block header
+// carries the frame timing over the gap instead.
+//-----------------------------------------------------------------
+static void convert_gap(struct convert_job *job, struct convert_chunk *c)
+{
+    tLogFileState state;
+
+    if (c->blk.start_time == job->end_time)
+        return;
+
+    if (job->anchored && c->blk.sof_time > job->end_sof_time)
+        log_file_add_gap(c->blk.sof_time - job->end_sof_time, job->is_hs);
+
+    // Resets are only written when no PID filter is set
+    if (job->filter->pid_map == 0)
+    {
+        log_file_get_state(&state);
+        state.in_rst = c->blk.in_rst;
+        log_file_set_state(&state);
+    }
+}
+//-----------------------------------------------------------------
+// convert_done: Note where the block just written ended
+//-----------------------------------------------------------------
+static void convert_done(struct convert_job *job, struct convert_chunk *c)
+{
+    job->anchored     = 1;
+    job->end_time     = c->end_time;
+    job->end_sof_time = c->end_sof_time;
+}
+//-----------------------------------------------------------------
+// convert_worker: Convert one block into a memory buffer
+//-----------------------------------------------------------------
+static void convert_worker(void *ctx, int idx)
+{
+    struct convert_job *job = (struct convert_job *)ctx;
+    struct convert_chunk *c = &job->chunks[idx];
+    tLogFileState saved;
+    FILE *prev;
+    FILE *f;
+
+    f = open_memstream(&c->buf, &c->size);
+    if (!f)
+    {
+        c->err = 1;
+        return;
+    }
+
+    // Calling thread is also a worker, keep its real state aside
+    log_file_get_state(&saved);
+    prev = log_file_set_stream(f);
+
+    log_file_set_state(&c->start);
+    c->err = convert_block(job, c, f) != 0;
+    log_file_get_state(&c->end);
+    c->tic_exact = c->has_sof || c->sof_exact;
+
+    fclose(f);
+    log_file_set_stream(prev);
+    log_file_set_state(&saved);
+}
+//-----------------------------------------------------------------
+// convert_splice: Append a worker's output with the true entry state,
+// patching the first SOF (or redoing the block if the reset state
+// guess was wrong). Leaves the log file state as at block exit.
+//-----------------------------------------------------------------
+static int convert_splice(struct convert_job *job, struct convert_chunk *c, FILE *out)
+{
+    tLogFileState state;
+    tLogFileState sof;
+
+    convert_gap(job, c);
+    log_file_get_state(&state);
+
+    if (c->saw_rst && c->start.in_rst != state.in_rst)
+    {
+        if (convert_block(job, c, NULL) != 0)
+            return -1;
+        convert_done(job, c);
+        return 0;
+    }
+
+    if (c->has_sof && !c->sof_exact)
+    {
+        fwrite(c->buf, 1, c->sof_start, out);
+
+        sof.last_tic = state.last_tic + c->pre_tic;
+        sof.in_rst   = state.in_rst;
+        log_file_set_state(&sof);
+        log_file_add_sof(c->sof_value, job->is_hs);
+
+        fwrite(c->buf + c->sof_end, 1, c->size - c->sof_end, out);
+    }
+    else
+        fwrite(c->buf, 1, c->size, out);
+
+    state.last_tic = c->tic_exact ? c->end.last_tic : (state.last_tic + c->end.last_tic);
+    if (c->saw_rst)
+        state.in_rst = c->end.in_rst;
+
+    log_file_set_state(&state);
+    convert_done(job, c);
+    return 0;
+}
+//-----------------------------------------------------------------
+// capture_convert: Write capture out as .usb/.txt/.raw. Each batch
+// of blocks (cut before a SOF) is converted in parallel, then joined
+// in order; output matches a serial conversion byte for byte.
+//-----------------------------------------------------------------
+int capture_convert(const char *output_file, tCaptureFile *cap, const tCaptureFilter *filter)
+{
+    struct convert_job job;
+    tCaptureBlock blks[CAPTURE_BATCH_BLOCKS];
+    uint32_t *words[CAPTURE_BATCH_BLOCKS];
+    tCaptureFilter all;
+    FILE *out;
+    int count;
+    int err = 0;
+    int i;
+
+    if (!filter)
+    {
+        capture_filter_init(&all);
+        filter = &all;
+    }
+
+    job.cap    = cap;
+    job.filter = filter;
+    job.is_hs  = (capture_file_speed(cap) == USB_SPEED_HS);
+
+    // Output starts at capture start, unless cut to a time window
+    job.anchored     = (filter->t_start == 0);
+    job.end_time     = 0;
+    job.end_sof_time = 0;
+
+    // Skip blocks which cannot contain matching records
+    capture_file_set_filter(cap, filter);
+
+    // Create log file (left empty if no block matches)
+    if (log_file_create(output_file) != 0)
+        return -1;
+    out = log_file_set_stream(NULL);
+
+    while (!err && (count = capture_file_next_batch(cap, blks, words)) > 0)
+    {
+
+        for (i=0;i<count;i++)
+        {
+            struct convert_chunk *c = &job.chunks[i];
+
+            memset(c, 0, sizeof(*c));
+            c->blk   = blks[i];
+            c->words = words[i];
+
+            // Reset state guess: the stream's, unless the filter may
+            // have kept resets from the log file
+            c->start.last_tic = 0;
+            c->start.in_rst   = (filter->pid_map == 0 && filter->t_start == 0) ? blks[i].in_rst : -1;
+        }
+
+        // Single thread: straight to file
+        if (parallel_threads() == 1)
+        {
+            for (i=0;i<count && !err;i++)
+            {
+                convert_gap(&job, &job.chunks[i]);
+                err = convert_block(&job, &job.chunks[i], NULL);
+                convert_done(&job, &job.chunks[i]);
+            }
+            continue;
+        }
+
+        parallel_for(count, convert_worker, &job);
+
+        for (i=0;i<count;i++)
+        {
+            struct convert_chunk *c = &job.chunks[i];
+
+            if (c->err || (!err && convert_splice(&job, c, out) != 0))
+                err = -1;
+
+            free(c->buf);
+        }
+    }
+
+    if (count < 0)
+        err = -1;
+
+    log_file_close();
+
+    return err;
+}
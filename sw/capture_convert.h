@@ -0,0 +1,17 @@
+#ifndef __CAPTURE_CONVERT_H__
+#define __CAPTURE_CONVERT_H__
+
+//--------------------------------------------------------------------
+// Prototypes
+//--------------------------------------------------------------------
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+int capture_convert(const char *output_file, tCaptureFile *cap, const tCaptureFilter *filter);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
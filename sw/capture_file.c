@@ -0,0 +1,1108 @@
+//-----------------------------------------------------------------
+//                       USB Sniffer
+//                           V0.1
+//                     Ultra-Embedded.com
+//                       Copyright 2015
+//
+//               Email: admin@ultra-embedded.com
+//
+//                       License: LGPL
+//-----------------------------------------------------------------
+//
+// Copyright (C) 2011 - 2013 Ultra-Embedded.com
+//
+// This source file may be used and distributed without         
+// restriction provided that this copyright statement is not    
+// removed from the file and that any derivative work contains  
+// the original copyright notice and the associated disclaimer. 
+//
+// This source file is free software; you can redistribute it   
+// and/or modify it under the terms of the GNU Lesser General   
+// Public License as published by the Free Software Foundation; 
+// either version 2.1 of the License, or (at your option) any   
+// later version.
+//
+// This source is distributed in the hope that it will be       
+// useful, but WITHOUT ANY WARRANTY; without even the implied   
+// warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR      
+// PURPOSE.  See the GNU Lesser General Public License for more 
+// details.
+//
+// You should have received a copy of the GNU Lesser General    
+// Public License along with this source; if not, write to the 
+// Free Software Foundation, Inc., 59 Temple Place, Suite 330, 
+// Boston, MA  02111-1307  USA
+//-----------------------------------------------------------------
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <stdint.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "usb_defs.h"
+#include "log_format.h"
+#include "usb_sniffer.h"
+#include "log_decode.h"
+#include "capture_filter.h"
+#include "payload_store.h"
+#include "capture_file.h"
+#include "capture_codec.h"
+#include "log_encode.h"
+#include "parallel.h"
+
+//-----------------------------------------------------------------
+// Structures
+//-----------------------------------------------------------------
+// Block staged for parallel (de)compression
+struct capture_slot
+{
+    tCaptureBlock   blk;
+    uint32_t       *raw;
+    uint32_t        raw_size;
+    uint8_t        *stored;
+    uint32_t        stored_size;
+
+    // Block data as read (may point into file mapping)
+    uint32_t       *words;
+    const uint8_t  *src;
+    int             copy;       // Kept in stored form only
+    int             err;
+};
+
+struct capture_file
+{
+    FILE           *file;
+    int             writing;
+    tCaptureHeader  hdr;
+    const tCaptureFilter *filter;
+
+    // Block buffer
+    uint32_t       *buf;
+    uint32_t        buf_words;
+    uint32_t        used;
+    uint32_t        parsed;
+
+    // Run encoded copy of block
+    uint32_t       *enc;
+    uint32_t        enc_size;
+
+    // Deduplicated payloads (CAPTURE_FLAG_DEDUP)
+    tPayloadStore  *store;
+
+    // Reader: blocks fully inside filter are not decompressed
+    int             copy_mode;
+
+    // Reader: no trailer (writer stopped early), a damaged last
+    // block ends the capture rather than failing the read
+    int             unterminated;
+
+    // Reader: blocks before start_block are stepped over
+    uint32_t        block_index;
+    uint32_t        start_block;
+
+    // Reader: whole file mapped (NULL = stdio reads)
+    const uint8_t  *map;
+    size_t          map_size;
+    size_t          map_pos;
+
+    // Writer: decoder tracking current block
+    tLogDecoder     dec;
+    tCaptureBlock   blk;
+
+    // Writer: sees each record as it is captured
+    tCaptureObserver observer;
+    void           *observer_ctx;
+
+    // Batch of blocks being compressed / decompressed
+    struct capture_slot slots[CAPTURE_BATCH_BLOCKS];
+    int             slot_count;
+    int             slot_idx;
+    int             eof;
+};
+
+//-----------------------------------------------------------------
+// capture_file_realloc: Grow buffer to at least size bytes
+//-----------------------------------------------------------------
+static int capture_file_realloc(void **buf, uint32_t *alloc, uint32_t size)
+{
+    void *p;
+
+    if (size <= *alloc)
+        return 0;
+
+    p = realloc(*buf, size);
+    if (!p)
+    {
+        fprintf(stderr, "ERROR: Out of memory\n");
+        return -1;
+    }
+
+    *buf   = p;
+    *alloc = size;
+    return 0;
+}
+//-----------------------------------------------------------------
+// capture_file_alloc
+//-----------------------------------------------------------------
+static int capture_file_alloc(tCaptureFile *cap, uint32_t words)
+{
+    uint32_t size = cap->buf_words * sizeof(uint32_t);
+
+    if (capture_file_realloc((void **)&cap->buf, &size, words * sizeof(uint32_t)) != 0)
+        return -1;
+
+    cap->buf_words = size / sizeof(uint32_t);
+    return 0;
+}
+//-----------------------------------------------------------------
+// capture_file_begin_block: Snapshot decoder state for a new block
+//-----------------------------------------------------------------
+static void capture_file_begin_block(tCaptureFile *cap)
+{
+    memset(&cap->blk, 0, sizeof(cap->blk));
+    cap->blk.magic      = CAPTURE_BLOCK_MAGIC;
+    cap->blk.start_time = cap->dec.time;
+    cap->blk.sof_time   = cap->dec.sof_time;
+    cap->blk.token      = cap->dec.token;
+    cap->blk.in_rst     = cap->dec.in_rst;
+    capture_zone_init(&cap->blk.zone);
+}
+//-----------------------------------------------------------------
+// capture_file_compress_slot: Worker - compress one staged block,
+// falling back to storing it raw if it does not get smaller.
+//-----------------------------------------------------------------
+static void capture_file_compress_slot(void *ctx, int idx)
+{
+    tCaptureFile *cap = (tCaptureFile *)ctx;
+    struct capture_slot *slot = &cap->slots[idx];
+    uint32_t raw_bytes = slot->blk.raw_words * sizeof(uint32_t);
+    uint32_t bound     = capture_codec_bound(slot->blk.codec, raw_bytes);
+    int      res;
+
+    slot->err = capture_file_realloc((void **)&slot->stored, &slot->stored_size, bound);
+    if (slot->err)
+        return;
+
+    res = capture_codec_compress(slot->blk.codec, (uint8_t *)slot->raw, raw_bytes, slot->stored, bound);
+    if (res < 0 || res >= raw_bytes)
+    {
+        slot->blk.codec       = CAPTURE_CODEC_NONE;
+        slot->blk.stored_size = raw_bytes;
+    }
+    else
+        slot->blk.stored_size = res;
+}
+//-----------------------------------------------------------------
+// capture_file_write_batch: Compress staged blocks in parallel and
+// write them out in order
+//-----------------------------------------------------------------
+static int capture_file_write_batch(tCaptureFile *cap)
+{
+    int err = 0;
+    int i;
+
+    parallel_for(cap->slot_count, capture_file_compress_slot, cap);
+
+    for (i=0;i<cap->slot_count && !err;i++)
+    {
+        struct capture_slot *slot = &cap->slots[i];
+        const void *data = (slot->blk.codec == CAPTURE_CODEC_NONE) ? (void *)slot->raw : (void *)slot->stored;
+
+        if (slot->err ||
+            fwrite(&slot->blk, sizeof(slot->blk), 1, cap->file) != 1 ||
+            fwrite(data, 1, slot->blk.stored_size, cap->file) != slot->blk.stored_size)
+        {
+            fprintf(stderr, "ERROR: Failed to write capture block\n");
+            err = -1;
+        }
+    }
+
+    cap->slot_count = 0;
+    return err;
+}
+//-----------------------------------------------------------------
+// capture_file_write_payloads: Write payloads first seen since the
+// last block as a segment, ahead of any block referring to them
+//-----------------------------------------------------------------
+static int capture_file_write_payloads(tCaptureFile *cap)
+{
+    tCaptureBlock seg;
+    uint32_t size;
+    uint32_t count = payload_store_pending(cap->store, &size);
+
+    if (count == 0)
+        return 0;
+
+    memset(&seg, 0, sizeof(seg));
+    seg.magic       = PAYLOAD_STORE_MAGIC;
+    seg.records     = count;
+    seg.stored_size = size;
+
+    if (fwrite(&seg, sizeof(seg), 1, cap->file) != 1)
+    {
+        fprintf(stderr, "ERROR: Failed to write payload store\n");
+        return -1;
+    }
+
+    return payload_store_write_segment(cap->store, cap->file);
+}
+//-----------------------------------------------------------------
+// capture_file_flush_block: Write out all parsed records as a block
+//-----------------------------------------------------------------
+static int capture_file_flush_block(tCaptureFile *cap)
+{
+    int err = 0;
+    uint32_t *words = cap->buf;
+    int count = cap->parsed;
+
+    if (cap->parsed == 0)
+        return 0;
+
+    // Collapse predictable SOF / polling records
+    if (cap->hdr.flags & CAPTURE_FLAG_RUNS)
+    {
+        tLogDecoder dec;
+
+        if (capture_file_realloc((void **)&cap->enc, &cap->enc_size, cap->parsed * sizeof(uint32_t)) != 0)
+            return -1;
+
+        capture_file_block_decoder(cap, &cap->blk, &dec);
+        count = log_encode_runs(&dec, cap->buf, cap->parsed, cap->enc);
+        if (count < 0)
+            return -1;
+
+        words = cap->enc;
+    }
+
+    // Move payloads into the store (in place, output never grows)
+    if (cap->hdr.flags & CAPTURE_FLAG_DEDUP)
+    {
+        count = log_encode_payloads(cap->store, words, count, words);
+        if (count < 0 || capture_file_write_payloads(cap) != 0)
+            return -1;
+    }
+
+    cap->blk.raw_words   = count;
+    cap->blk.stored_size = count * sizeof(uint32_t);
+    cap->blk.codec       = cap->hdr.codec;
+
+    // Uncompressed: straight out
+    if (cap->hdr.codec == CAPTURE_CODEC_NONE)
+    {
+        if (fwrite(&cap->blk, sizeof(cap->blk), 1, cap->file) != 1 ||
+            fwrite(words, sizeof(uint32_t), count, cap->file) != count)
+        {
+            fprintf(stderr, "ERROR: Failed to write capture block\n");
+            return -1;
+        }
+    }
+    // Stage for batch compression
+    else
+    {
+        struct capture_slot *slot = &cap->slots[cap->slot_count++];
+
+        if (capture_file_realloc((void **)&slot->raw, &slot->raw_size, cap->blk.stored_size) != 0)
+            return -1;
+
+        slot->blk = cap->blk;
+        memcpy(slot->raw, words, cap->blk.stored_size);
+
+        if (cap->slot_count == CAPTURE_BATCH_BLOCKS)
+            err = capture_file_write_batch(cap);
+    }
+
+    // Move any incomplete trailing record to the front
+    memmove(cap->buf, cap->buf + cap->parsed, (cap->used - cap->parsed) * sizeof(uint32_t));
+    cap->used  -= cap->parsed;
+    cap->parsed = 0;
+
+    capture_file_begin_block(cap);
+    return err;
+}
+//-----------------------------------------------------------------
+// capture_info_init: Unknown / default capture conditions
+//-----------------------------------------------------------------
+void capture_info_init(tCaptureInfo *info)
+{
+    memset(info, 0, sizeof(*info));
+    info->match_device   = -1;
+    info->match_endpoint = -1;
+}
+//-----------------------------------------------------------------
+// capture_file_create: Start new capture on an open (empty) file
+//-----------------------------------------------------------------
+tCaptureFile* capture_file_create(FILE *f, int speed, int codec, int flags, const tCaptureInfo *info)
+{
+    tCaptureFile *cap;
+
+    if (!capture_codec_supported(codec))
+    {
+        fprintf(stderr, "ERROR: Compression not supported in this build\n");
+        return NULL;
+    }
+
+    cap = (tCaptureFile *)calloc(1, sizeof(tCaptureFile));
+    assert(cap);
+
+    cap->file    = f;
+    cap->writing = 1;
+
+    cap->hdr.magic       = CAPTURE_FILE_MAGIC;
+    cap->hdr.version     = CAPTURE_FILE_VERSION;
+    cap->hdr.flags       = flags;
+    cap->hdr.speed       = speed;
+    cap->hdr.block_words = CAPTURE_BLOCK_WORDS;
+    cap->hdr.codec       = codec;
+
+    if (info)
+        cap->hdr.info = *info;
+    else
+        capture_info_init(&cap->hdr.info);
+
+    if (fwrite(&cap->hdr, sizeof(cap->hdr), 1, f) != 1 ||
+        capture_file_alloc(cap, CAPTURE_BLOCK_WORDS * 2) != 0)
+    {
+        free(cap->buf);
+        free(cap);
+        return NULL;
+    }
+
+    if (flags & CAPTURE_FLAG_DEDUP)
+        cap->store = payload_store_create();
+
+    log_decode_init(&cap->dec, speed == USB_SPEED_HS);
+    capture_file_begin_block(cap);
+
+    return cap;
+}
+//-----------------------------------------------------------------
+// capture_file_write: Append dense records to capture. Blocks are
+// cut on the first SOF after the target size so that each block
+// starts on a frame boundary.
+//-----------------------------------------------------------------
+int capture_file_write(tCaptureFile *cap, const uint32_t *words, uint32_t count)
+{
+    tLogRecord rec;
+    uint32_t   limit = cap->hdr.block_words;
+    int        n;
+    int        type;
+
+    if (capture_file_alloc(cap, cap->used + count) != 0)
+        return -1;
+
+    memcpy(cap->buf + cap->used, words, count * sizeof(uint32_t));
+    cap->used += count;
+
+    while ((n = log_decode_record_words(cap->buf + cap->parsed, cap->used - cap->parsed)) > 0)
+    {
+        type = (cap->buf[cap->parsed] >> LOG_CTRL_TYPE_L) & LOG_CTRL_CYCLE_MASK;
+
+        // Cut on SOF, or anywhere if there has been no SOF for a while
+        if ((type == LOG_CTRL_TYPE_SOF && cap->parsed >= limit) ||
+            (cap->parsed + n > limit * 2))
+        {
+            if (capture_file_flush_block(cap) != 0)
+                return -1;
+        }
+
+        if (log_decode_next(&cap->dec, cap->buf + cap->parsed, cap->used - cap->parsed, &rec) < 0)
+            return -1;
+
+        capture_zone_add(&cap->blk.zone, &rec);
+        cap->blk.records++;
+        cap->parsed += n;
+
+        if (cap->observer && cap->observer(cap->observer_ctx, &rec) != 0)
+            return -1;
+    }
+
+    return 0;
+}
+//-----------------------------------------------------------------
+// capture_file_set_observer: Pass each record written to fn (live
+// analysis runs off the writer's decode, not a second one)
+//-----------------------------------------------------------------
+void capture_file_set_observer(tCaptureFile *cap, tCaptureObserver fn, void *ctx)
+{
+    cap->observer     = fn;
+    cap->observer_ctx = ctx;
+}
+//-----------------------------------------------------------------
+// capture_file_payload_stats: Deduplication stats (-1 if disabled)
+//-----------------------------------------------------------------
+int capture_file_payload_stats(tCaptureFile *cap, tPayloadStats *stats)
+{
+    if (!cap->store)
+        return -1;
+
+    payload_store_stats(cap->store, stats);
+    return 0;
+}
+//-----------------------------------------------------------------
+// capture_file_set_state: Close off current block and continue with
+// the given decoder state (used when records are carried across
+// from another capture)
+//-----------------------------------------------------------------
+int capture_file_set_state(tCaptureFile *cap, const tLogDecoder *dec)
+{
+    if (capture_file_flush_block(cap) != 0)
+        return -1;
+
+    cap->dec.time     = dec->time;
+    cap->dec.sof_time = dec->sof_time;
+    cap->dec.token    = dec->token;
+    cap->dec.in_rst   = dec->in_rst;
+
+    capture_file_begin_block(cap);
+    return 0;
+}
+//-----------------------------------------------------------------
+// capture_file_copy_block: Append a block taken verbatim from
+// another capture (same speed / flags)
+//-----------------------------------------------------------------
+int capture_file_copy_block(tCaptureFile *cap, const tCaptureBlock *blk, const uint8_t *stored)
+{
+    // Keep block order: anything pending goes first
+    if (capture_file_flush_block(cap) != 0)
+        return -1;
+    if (cap->slot_count && capture_file_write_batch(cap) != 0)
+        return -1;
+
+    if (fwrite(blk, sizeof(*blk), 1, cap->file) != 1 ||
+        fwrite(stored, 1, blk->stored_size, cap->file) != blk->stored_size)
+    {
+        fprintf(stderr, "ERROR: Failed to write capture block\n");
+        return -1;
+    }
+
+    return 0;
+}
+//-----------------------------------------------------------------
+// capture_file_write_footer: Append trailer (capture closed cleanly)
+//-----------------------------------------------------------------
+static int capture_file_write_footer(tCaptureFile *cap)
+{
+    tCaptureFooter footer;
+
+    memset(&footer, 0, sizeof(footer));
+    footer.magic = CAPTURE_FOOTER_MAGIC;
+
+    if (fwrite(&footer, sizeof(footer), 1, cap->file) != 1)
+        return -1;
+
+    return 0;
+}
+//-----------------------------------------------------------------
+// capture_file_read_footer: Check the trailer is there
+//-----------------------------------------------------------------
+static int capture_file_read_footer(tCaptureFile *cap)
+{
+    tCaptureFooter footer;
+
+    if (fseek(cap->file, -(long)sizeof(footer), SEEK_END) != 0 ||
+        fread(&footer, sizeof(footer), 1, cap->file) != 1 ||
+        footer.magic != CAPTURE_FOOTER_MAGIC)
+    {
+        fprintf(stderr, "WARNING: Capture file has no trailer, reading blocks up to end of file\n");
+        cap->unterminated = 1;
+    }
+
+    return fseek(cap->file, sizeof(cap->hdr), SEEK_SET);
+}
+//-----------------------------------------------------------------
+// capture_file_map: Map the file for zero-copy block access. Falls
+// back to stdio reads if the file cannot be mapped.
+//-----------------------------------------------------------------
+static void capture_file_map(tCaptureFile *cap)
+{
+    struct stat st;
+    void *map;
+
+    fflush(cap->file);
+    if (fstat(fileno(cap->file), &st) != 0 || st.st_size <= (off_t)sizeof(cap->hdr))
+        return;
+
+    map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fileno(cap->file), 0);
+    if (map == MAP_FAILED)
+        return;
+
+    // Blocks are visited front to back, once
+    madvise(map, st.st_size, MADV_SEQUENTIAL);
+#ifdef MADV_HUGEPAGE
+    madvise(map, st.st_size, MADV_HUGEPAGE);
+#endif
+
+    cap->map      = (const uint8_t *)map;
+    cap->map_size = st.st_size;
+    cap->map_pos  = sizeof(cap->hdr);
+}
+//-----------------------------------------------------------------
+// capture_file_get: Next size bytes of file; a pointer into the
+// mapping, else read into *buf. Returns NULL if truncated.
+//-----------------------------------------------------------------
+static const uint8_t* capture_file_get(tCaptureFile *cap, uint32_t size, uint8_t **buf, uint32_t *alloc)
+{
+    const uint8_t *p;
+
+    if (cap->map)
+    {
+        if (size > cap->map_size - cap->map_pos)
+            return NULL;
+
+        p = cap->map + cap->map_pos;
+        cap->map_pos += size;
+        return p;
+    }
+
+    if (capture_file_realloc((void **)buf, alloc, size) != 0 ||
+        fread(*buf, 1, size, cap->file) != size)
+        return NULL;
+
+    return *buf;
+}
+//-----------------------------------------------------------------
+// capture_file_read_header: Next block header
+//-----------------------------------------------------------------
+static int capture_file_read_header(tCaptureFile *cap, tCaptureBlock *blk)
+{
+    if (cap->map)
+    {
+        if (sizeof(*blk) > cap->map_size - cap->map_pos)
+            return -1;
+
+        memcpy(blk, cap->map + cap->map_pos, sizeof(*blk));
+        cap->map_pos += sizeof(*blk);
+        return 0;
+    }
+
+    return fread(blk, sizeof(*blk), 1, cap->file) == 1 ? 0 : -1;
+}
+//-----------------------------------------------------------------
+// capture_file_skip: Step over size bytes of file
+//-----------------------------------------------------------------
+static int capture_file_skip(tCaptureFile *cap, uint32_t size)
+{
+    if (cap->map)
+    {
+        if (size > cap->map_size - cap->map_pos)
+            return -1;
+
+        cap->map_pos += size;
+        return 0;
+    }
+
+    return fseek(cap->file, size, SEEK_CUR);
+}
+//-----------------------------------------------------------------
+// capture_file_load_payloads: Gather the payload segments spread
+// between the blocks into the store. Stops quietly where the file
+// does (the block readers report that).
+//-----------------------------------------------------------------
+static int capture_file_load_payloads(tCaptureFile *cap)
+{
+    tCaptureBlock blk;
+    const uint8_t *seg;
+    uint8_t *buf = NULL;
+    uint32_t alloc = 0;
+    int err = 0;
+
+    cap->store = payload_store_create();
+
+    while (capture_file_read_header(cap, &blk) == 0)
+    {
+        if (blk.magic == PAYLOAD_STORE_MAGIC)
+        {
+            seg = capture_file_get(cap, blk.stored_size, &buf, &alloc);
+            if (!seg)
+                break;
+
+            if (payload_store_load_segment(cap->store, seg, blk.records, blk.stored_size) != 0)
+            {
+                err = -1;
+                break;
+            }
+        }
+        else if (blk.magic != CAPTURE_BLOCK_MAGIC || capture_file_skip(cap, blk.stored_size) != 0)
+            break;
+    }
+
+    free(buf);
+
+    if (cap->map)
+        cap->map_pos = sizeof(cap->hdr);
+    else if (fseek(cap->file, sizeof(cap->hdr), SEEK_SET) != 0)
+        err = -1;
+
+    return err;
+}
+//-----------------------------------------------------------------
+// capture_file_open: Open existing capture for reading
+//-----------------------------------------------------------------
+tCaptureFile* capture_file_open(FILE *f)
+{
+    tCaptureFile *cap = (tCaptureFile *)calloc(1, sizeof(tCaptureFile));
+    assert(cap);
+
+    cap->file = f;
+
+    rewind(f);
+    if (fread(&cap->hdr, sizeof(cap->hdr.magic), 1, f) != 1 ||
+        cap->hdr.magic != CAPTURE_FILE_MAGIC)
+    {
+        fprintf(stderr, "ERROR: Not a capture file\n");
+        free(cap);
+        return NULL;
+    }
+
+    rewind(f);
+    if (fread(&cap->hdr, sizeof(cap->hdr), 1, f) != 1 ||
+        cap->hdr.version != CAPTURE_FILE_VERSION)
+    {
+        fprintf(stderr, "ERROR: Unsupported capture file version\n");
+        free(cap);
+        return NULL;
+    }
+
+    if (capture_file_read_footer(cap) != 0)
+    {
+        free(cap);
+        return NULL;
+    }
+
+    capture_file_map(cap);
+
+    if ((cap->hdr.flags & CAPTURE_FLAG_DEDUP) && capture_file_load_payloads(cap) != 0)
+    {
+        capture_file_close(cap);
+        return NULL;
+    }
+
+    return cap;
+}
+//-----------------------------------------------------------------
+// capture_file_speed: Bus speed capture was taken at
+//-----------------------------------------------------------------
+int capture_file_speed(tCaptureFile *cap)
+{
+    return cap->hdr.speed;
+}
+//-----------------------------------------------------------------
+// capture_file_flags: CAPTURE_FLAG_xxx
+//-----------------------------------------------------------------
+int capture_file_flags(tCaptureFile *cap)
+{
+    return cap->hdr.flags;
+}
+//-----------------------------------------------------------------
+// capture_file_codec: Codec capture was written with
+//-----------------------------------------------------------------
+int capture_file_codec(tCaptureFile *cap)
+{
+    return cap->hdr.codec;
+}
+//-----------------------------------------------------------------
+// capture_file_info: Conditions capture was taken under
+//-----------------------------------------------------------------
+const tCaptureInfo* capture_file_info(tCaptureFile *cap)
+{
+    return &cap->hdr.info;
+}
+//-----------------------------------------------------------------
+// capture_file_set_copy_mode: Leave blocks which the filter fully
+// contains in stored (compressed) form for capture_file_read_stored
+//-----------------------------------------------------------------
+void capture_file_set_copy_mode(tCaptureFile *cap, int enable)
+{
+    cap->copy_mode = enable;
+}
+//-----------------------------------------------------------------
+// capture_file_set_start: Begin reading at block index (earlier
+// blocks are skipped unread)
+//-----------------------------------------------------------------
+void capture_file_set_start(tCaptureFile *cap, uint32_t block)
+{
+    cap->start_block = block;
+}
+//-----------------------------------------------------------------
+// capture_file_set_filter: Skip blocks whose zone map cannot match
+//-----------------------------------------------------------------
+void capture_file_set_filter(tCaptureFile *cap, const tCaptureFilter *filter)
+{
+    cap->filter = (filter && capture_filter_active(filter)) ? filter : NULL;
+}
+//-----------------------------------------------------------------
+// capture_file_decompress_slot: Worker - expand one stored block
+//-----------------------------------------------------------------
+static void capture_file_decompress_slot(void *ctx, int idx)
+{
+    tCaptureFile *cap = (tCaptureFile *)ctx;
+    struct capture_slot *slot = &cap->slots[idx];
+    uint32_t raw_bytes = slot->blk.raw_words * sizeof(uint32_t);
+
+    if (slot->blk.codec == CAPTURE_CODEC_NONE || slot->copy)
+        return;
+
+    if (capture_codec_decompress(slot->blk.codec, slot->src, slot->blk.stored_size,
+                                 (uint8_t *)slot->raw, raw_bytes) != raw_bytes)
+        slot->err = 1;
+}
+//-----------------------------------------------------------------
+// capture_file_end_unterminated: A damaged block in a capture without
+// trailer is where the writer stopped, end the capture there
+//-----------------------------------------------------------------
+static int capture_file_end_unterminated(tCaptureFile *cap)
+{
+    if (!cap->unterminated)
+        return 0;
+
+    fprintf(stderr, "WARNING: Incomplete last block of capture dropped\n");
+    cap->eof = 1;
+    return 1;
+}
+//-----------------------------------------------------------------
+// capture_file_fill: Read the next batch of (matching) blocks and
+// decompress them across worker threads
+//-----------------------------------------------------------------
+static int capture_file_fill(tCaptureFile *cap)
+{
+    struct capture_slot *slot;
+    int i;
+
+    cap->slot_count = 0;
+    cap->slot_idx   = 0;
+
+    while (!cap->eof && cap->slot_count < CAPTURE_BATCH_BLOCKS)
+    {
+        slot = &cap->slots[cap->slot_count];
+
+        if (capture_file_read_header(cap, &slot->blk) != 0)
+        {
+            cap->eof = 1;
+            break;
+        }
+
+        if (slot->blk.magic == CAPTURE_FOOTER_MAGIC)
+        {
+            cap->eof = 1;
+            break;
+        }
+
+        // Payload segments were gathered on open
+        if (slot->blk.magic == PAYLOAD_STORE_MAGIC)
+        {
+            if (capture_file_skip(cap, slot->blk.stored_size) != 0)
+            {
+                if (capture_file_end_unterminated(cap))
+                    break;
+
+                fprintf(stderr, "ERROR: Truncated payload store\n");
+                return -1;
+            }
+            continue;
+        }
+
+        if (slot->blk.magic != CAPTURE_BLOCK_MAGIC)
+        {
+            if (capture_file_end_unterminated(cap))
+                break;
+
+            fprintf(stderr, "ERROR: Corrupt capture block\n");
+            return -1;
+        }
+
+        // Skip without touching payload
+        if (cap->block_index++ < cap->start_block ||
+            (cap->filter && !capture_filter_match_zone(cap->filter, &slot->blk.zone)))
+        {
+            if (capture_file_skip(cap, slot->blk.stored_size) != 0)
+            {
+                if (capture_file_end_unterminated(cap))
+                    break;
+                return -1;
+            }
+            continue;
+        }
+
+        slot->copy = cap->copy_mode &&
+                     (!cap->filter || capture_filter_contains_zone(cap->filter, &slot->blk.zone));
+
+        if (slot->blk.codec == CAPTURE_CODEC_NONE && slot->blk.stored_size != slot->blk.raw_words * sizeof(uint32_t))
+        {
+            fprintf(stderr, "ERROR: Corrupt capture block\n");
+            return -1;
+        }
+
+        if (!slot->copy && slot->blk.codec != CAPTURE_CODEC_NONE && !capture_codec_supported(slot->blk.codec))
+        {
+            fprintf(stderr, "ERROR: Compression not supported in this build\n");
+            return -1;
+        }
+
+        // Uncompressed blocks are read straight into (or used in place
+        // from the mapping as) the raw buffer
+        if (slot->blk.codec == CAPTURE_CODEC_NONE)
+            slot->src = capture_file_get(cap, slot->blk.stored_size, (uint8_t **)&slot->raw, &slot->raw_size);
+        else
+            slot->src = capture_file_get(cap, slot->blk.stored_size, &slot->stored, &slot->stored_size);
+
+        if (!slot->src)
+        {
+            if (capture_file_end_unterminated(cap))
+                break;
+
+            fprintf(stderr, "ERROR: Truncated capture block\n");
+            return -1;
+        }
+
+        if (slot->blk.codec == CAPTURE_CODEC_NONE && !((uintptr_t)slot->src & 3))
+            slot->words = (uint32_t *)slot->src;
+        else if (slot->blk.codec == CAPTURE_CODEC_NONE)
+        {
+            // Mapping not word aligned here (follows a compressed block)
+            if (capture_file_realloc((void **)&slot->raw, &slot->raw_size, slot->blk.stored_size) != 0)
+                return -1;
+            memcpy(slot->raw, slot->src, slot->blk.stored_size);
+            slot->words = slot->raw;
+        }
+        else if (!slot->copy)
+        {
+            if (capture_file_realloc((void **)&slot->raw, &slot->raw_size, slot->blk.raw_words * sizeof(uint32_t)) != 0)
+                return -1;
+            slot->words = slot->raw;
+        }
+
+        slot->err = 0;
+        cap->slot_count++;
+    }
+
+    parallel_for(cap->slot_count, capture_file_decompress_slot, cap);
+
+    for (i=0;i<cap->slot_count;i++)
+        if (cap->slots[i].err)
+        {
+            fprintf(stderr, "ERROR: Corrupt compressed block\n");
+            return -1;
+        }
+
+    return 0;
+}
+//-----------------------------------------------------------------
+// capture_file_next_block: Read next block header. Blocks which
+// cannot match the filter (if set) are skipped.
+// Returns 1 on success, 0 at end of file, -1 on error
+//-----------------------------------------------------------------
+int capture_file_next_block(tCaptureFile *cap, tCaptureBlock *blk)
+{
+    if (cap->slot_idx >= cap->slot_count)
+    {
+        if (capture_file_fill(cap) != 0)
+            return -1;
+
+        if (cap->slot_count == 0)
+            return 0;
+    }
+
+    *blk = cap->slots[cap->slot_idx++].blk;
+    return 1;
+}
+//-----------------------------------------------------------------
+// capture_file_next_header: Step to the next block header without
+// reading its payload (not mixed with the other block readers).
+// *offset is the file position of the block header.
+// Returns 1 on success, 0 at end of file, -1 on error
+//-----------------------------------------------------------------
+int capture_file_next_header(tCaptureFile *cap, tCaptureBlock *blk, uint64_t *offset)
+{
+    struct stat st;
+    uint64_t end;
+
+    // Only headers are touched, readahead of payload is wasted
+    if (cap->map && cap->block_index == 0)
+        madvise((void *)cap->map, cap->map_size, MADV_RANDOM);
+
+    do
+    {
+        if (cap->map)
+            *offset = cap->map_pos;
+        else
+            *offset = ftell(cap->file);
+
+        if (capture_file_read_header(cap, blk) != 0 || blk->magic == CAPTURE_FOOTER_MAGIC)
+            return 0;
+    }
+    while (blk->magic == PAYLOAD_STORE_MAGIC && capture_file_skip(cap, blk->stored_size) == 0);
+
+    if (blk->magic != CAPTURE_BLOCK_MAGIC)
+    {
+        if (capture_file_end_unterminated(cap))
+            return 0;
+
+        fprintf(stderr, "ERROR: Corrupt capture block\n");
+        return -1;
+    }
+
+    // Block still being written (or cut short) is not counted
+    end = *offset + sizeof(*blk) + blk->stored_size;
+    if (cap->map)
+        st.st_size = cap->map_size;
+    else if (fstat(fileno(cap->file), &st) != 0)
+        return -1;
+
+    if (end > (uint64_t)st.st_size || capture_file_skip(cap, blk->stored_size) != 0)
+    {
+        if (capture_file_end_unterminated(cap))
+            return 0;
+
+        fprintf(stderr, "ERROR: Truncated capture block\n");
+        return -1;
+    }
+
+    cap->block_index++;
+    return 1;
+}
+//-----------------------------------------------------------------
+// capture_file_read_block: Payload of the block last returned by
+// capture_file_next_block. Returns number of dense words.
+//-----------------------------------------------------------------
+int capture_file_read_block(tCaptureFile *cap, const tCaptureBlock *blk, uint32_t **words)
+{
+    if (cap->slot_idx == 0 || cap->slots[cap->slot_idx - 1].copy)
+        return -1;
+
+    *words = cap->slots[cap->slot_idx - 1].words;
+    return blk->raw_words;
+}
+//-----------------------------------------------------------------
+// capture_file_next_batch: Up to CAPTURE_BATCH_BLOCKS (matching)
+// blocks at once, payloads valid until the next call.
+// Returns number of blocks, 0 at end of file, -1 on error
+//-----------------------------------------------------------------
+int capture_file_next_batch(tCaptureFile *cap, tCaptureBlock *blks, uint32_t **words)
+{
+    int i;
+
+    if (cap->slot_idx >= cap->slot_count && capture_file_fill(cap) != 0)
+        return -1;
+
+    for (i=0;cap->slot_idx < cap->slot_count;i++)
+    {
+        struct capture_slot *slot = &cap->slots[cap->slot_idx++];
+
+        if (slot->copy)
+            return -1;
+
+        blks[i]  = slot->blk;
+        words[i] = slot->words;
+    }
+
+    return i;
+}
+//-----------------------------------------------------------------
+// capture_file_block_copyable: Was the last block left in stored
+// form (copy mode)?
+//-----------------------------------------------------------------
+int capture_file_block_copyable(tCaptureFile *cap)
+{
+    return cap->slot_idx != 0 && cap->slots[cap->slot_idx - 1].copy;
+}
+//-----------------------------------------------------------------
+// capture_file_read_stored: Stored bytes of a block left in stored
+// form by copy mode
+//-----------------------------------------------------------------
+const uint8_t* capture_file_read_stored(tCaptureFile *cap)
+{
+    if (!capture_file_block_copyable(cap))
+        return NULL;
+
+    return cap->slots[cap->slot_idx - 1].src;
+}
+//-----------------------------------------------------------------
+// capture_file_block_decoder: Decoder primed with block entry state
+//-----------------------------------------------------------------
+void capture_file_block_decoder(tCaptureFile *cap, const tCaptureBlock *blk, tLogDecoder *dec)
+{
+    log_decode_init(dec, cap->hdr.speed == USB_SPEED_HS);
+    dec->time     = blk->start_time;
+    dec->sof_time = blk->sof_time;
+    dec->token    = blk->token;
+    dec->in_rst   = blk->in_rst;
+    dec->store    = cap->store;
+}
+//-----------------------------------------------------------------
+// capture_file_scan: Decode remaining blocks, passing each record
+// which matches filter (may be NULL) to fn
+//-----------------------------------------------------------------
+int capture_file_scan(tCaptureFile *cap, const tCaptureFilter *filter, tCaptureObserver fn, void *ctx)
+{
+    tCaptureBlock blk;
+    tLogDecoder dec;
+    tLogRecord rec;
+    uint32_t *words;
+    int count;
+    int idx;
+    int res;
+
+    capture_file_set_filter(cap, filter);
+
+    while ((res = capture_file_next_block(cap, &blk)) > 0)
+    {
+        count = capture_file_read_block(cap, &blk, &words);
+        if (count < 0)
+            return -1;
+
+        capture_file_block_decoder(cap, &blk, &dec);
+
+        for (idx = 0; idx < count; idx += rec.words)
+        {
+            if (log_decode_next(&dec, words + idx, count - idx, &rec) <= 0)
+                return -1;
+
+            if (filter && !capture_filter_match_record(filter, &rec))
+                continue;
+
+            if (fn(ctx, &rec) != 0)
+                return -1;
+        }
+    }
+
+    return res;
+}
+//-----------------------------------------------------------------
+// capture_file_close: Flush outstanding blocks (writer) and release
+// handle. The underlying file is owned by the caller.
+//-----------------------------------------------------------------
+int capture_file_close(tCaptureFile *cap)
+{
+    int err = 0;
+    int i;
+
+    if (cap->writing)
+    {
+        if (cap->used != cap->parsed)
+            fprintf(stderr, "ERROR: Dropping %d words of incomplete record\n", cap->used - cap->parsed);
+
+        err = capture_file_flush_block(cap);
+        if (cap->slot_count && capture_file_write_batch(cap) != 0)
+            err = -1;
+        if (capture_file_write_footer(cap) != 0)
+            err = -1;
+        fflush(cap->file);
+    }
+
+    for (i=0;i<CAPTURE_BATCH_BLOCKS;i++)
+    {
+        free(cap->slots[i].raw);
+        free(cap->slots[i].stored);
+    }
+
+    if (cap->map)
+        munmap((void *)cap->map, cap->map_size);
+
+    payload_store_destroy(cap->store);
+    free(cap->enc);
+    free(cap->buf);
+    free(cap);
+    return err;
+}
@@ -0,0 +1,129 @@
+#ifndef __CAPTURE_FILE_H__
+#define __CAPTURE_FILE_H__
+
+//--------------------------------------------------------------------
+// Defines
+//--------------------------------------------------------------------
+#define CAPTURE_FILE_MAGIC      0x50414355  // "UCAP"
+#define CAPTURE_BLOCK_MAGIC     0x4B4C4255  // "UBLK"
+#define CAPTURE_FILE_VERSION    2
+#define CAPTURE_FOOTER_MAGIC    0x444E4555  // "UEND"
+
+// Target block size (dense words), blocks are cut before a SOF
+#define CAPTURE_BLOCK_WORDS     (64 * 1024)
+
+// Blocks compressed / decompressed together across worker threads
+#define CAPTURE_BATCH_BLOCKS    16
+
+// Header flags
+#define CAPTURE_FLAG_RUNS       (1 << 0)    // SOF / polling / frame run records
+#define CAPTURE_FLAG_DEDUP      (1 << 1)    // Payloads held in payload store
+
+//--------------------------------------------------------------------
+// Structures
+//--------------------------------------------------------------------
+// Capture conditions, kept so saved captures can be decoded later
+typedef struct
+{
+    int32_t  match_device;      // Hardware device match (-1 = any)
+    int32_t  match_endpoint;    // Hardware endpoint match (-1 = any)
+    uint8_t  match_inverse;     // Matches exclude rather than include
+    uint8_t  drop_sof;          // SOFs not captured
+    uint8_t  one_shot;          // Stopped on single buffer full
+    uint8_t  reserved;
+    uint32_t buffer_base;       // Capture buffer config
+    uint32_t buffer_size;
+    uint64_t start_time;        // Wall clock at start (seconds since epoch)
+} tCaptureInfo;
+
+// File header
+typedef struct
+{
+    uint32_t magic;
+    uint16_t version;
+    uint16_t flags;
+    uint32_t speed;         // tUsbSpeed
+    uint32_t block_words;
+    uint32_t codec;         // tCaptureCodec used when writing
+    uint32_t reserved;
+    tCaptureInfo info;
+} tCaptureHeader;
+
+// Block header, followed by stored_size bytes of dense records.
+// raw_words counts words after run encoding (if enabled).
+typedef struct
+{
+    uint32_t magic;
+    uint32_t raw_words;     // Dense words in block
+    uint32_t stored_size;   // Bytes following header
+    uint32_t records;       // Records in block
+    uint32_t codec;         // tCaptureCodec of stored data
+    uint32_t reserved;
+
+    // Decoder state at start of block
+    uint64_t start_time;
+    uint64_t sof_time;
+    uint32_t token;
+    int32_t  in_rst;
+
+    tCaptureZone zone;
+} tCaptureBlock;
+
+// Payload segments (CAPTURE_FLAG_DEDUP) share the block header:
+// magic PAYLOAD_STORE_MAGIC, records = payloads, stored_size = bytes
+// of lengths then data. Each comes ahead of the first block using it.
+
+// Trailer at end of file, marks a capture closed cleanly
+typedef struct
+{
+    uint32_t magic;
+    uint32_t reserved;
+    uint64_t reserved2;
+} tCaptureFooter;
+
+typedef struct capture_file tCaptureFile;
+
+// Called with each record as it is written (non-zero aborts write)
+typedef int (*tCaptureObserver)(void *ctx, const tLogRecord *rec);
+
+//--------------------------------------------------------------------
+// Prototypes
+//--------------------------------------------------------------------
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Writer
+void          capture_info_init(tCaptureInfo *info);
+tCaptureFile* capture_file_create(FILE *f, int speed, int codec, int flags, const tCaptureInfo *info);
+int           capture_file_write(tCaptureFile *cap, const uint32_t *words, uint32_t count);
+void          capture_file_set_observer(tCaptureFile *cap, tCaptureObserver fn, void *ctx);
+int           capture_file_payload_stats(tCaptureFile *cap, tPayloadStats *stats);
+int           capture_file_set_state(tCaptureFile *cap, const tLogDecoder *dec);
+int           capture_file_copy_block(tCaptureFile *cap, const tCaptureBlock *blk, const uint8_t *stored);
+
+// Reader
+tCaptureFile* capture_file_open(FILE *f);
+int           capture_file_speed(tCaptureFile *cap);
+int           capture_file_flags(tCaptureFile *cap);
+int           capture_file_codec(tCaptureFile *cap);
+const tCaptureInfo* capture_file_info(tCaptureFile *cap);
+void          capture_file_set_filter(tCaptureFile *cap, const tCaptureFilter *filter);
+void          capture_file_set_copy_mode(tCaptureFile *cap, int enable);
+void          capture_file_set_start(tCaptureFile *cap, uint32_t block);
+int           capture_file_block_copyable(tCaptureFile *cap);
+const uint8_t*capture_file_read_stored(tCaptureFile *cap);
+int           capture_file_next_block(tCaptureFile *cap, tCaptureBlock *blk);
+int           capture_file_next_header(tCaptureFile *cap, tCaptureBlock *blk, uint64_t *offset);
+int           capture_file_read_block(tCaptureFile *cap, const tCaptureBlock *blk, uint32_t **words);
+int           capture_file_next_batch(tCaptureFile *cap, tCaptureBlock *blks, uint32_t **words);
+void          capture_file_block_decoder(tCaptureFile *cap, const tCaptureBlock *blk, tLogDecoder *dec);
+int           capture_file_scan(tCaptureFile *cap, const tCaptureFilter *filter, tCaptureObserver fn, void *ctx);
+
+int           capture_file_close(tCaptureFile *cap);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
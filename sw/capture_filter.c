@@ -0,0 +1,267 @@
+//-----------------------------------------------------------------
+//                       USB Sniffer
+//                           V0.1
+//                     Ultra-Embedded.com
+//                       Copyright 2015
+//
+//               Email: admin@ultra-embedded.com
+//
+//                       License: LGPL
+//-----------------------------------------------------------------
+//
+// Copyright (C) 2011 - 2013 Ultra-Embedded.com
+//
+// This source file may be used and distributed without         
+// restriction provided that this copyright statement is not    
+// removed from the file and that any derivative work contains  
+// the original copyright notice and the associated disclaimer. 
+//
+// This source file is free software; you can redistribute it   
+// and/or modify it under the terms of the GNU Lesser General   
+// Public License as published by the Free Software Foundation; 
+// either version 2.1 of the License, or (at your option) any   
+// later version.
+//
+// This source is distributed in the hope that it will be       
+// useful, but WITHOUT ANY WARRANTY; without even the implied   
+// warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR      
+// PURPOSE.  See the GNU Lesser General Public License for more 
+// details.
+//
+// You should have received a copy of the GNU Lesser General    
+// Public License along with this source; if not, write to the 
+// Free Software Foundation, Inc., 59 Temple Place, Suite 330, 
+// Boston, MA  02111-1307  USA
+//-----------------------------------------------------------------
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <stdint.h>
+
+#include "usb_defs.h"
+#include "log_format.h"
+#include "usb_helpers.h"
+#include "log_decode.h"
+#include "capture_filter.h"
+
+//-----------------------------------------------------------------
+// capture_zone_init: Empty zone map
+//-----------------------------------------------------------------
+void capture_zone_init(tCaptureZone *zone)
+{
+    memset(zone, 0, sizeof(*zone));
+    zone->min_time = CAPTURE_TIME_MAX;
+    zone->max_time = 0;
+}
+//-----------------------------------------------------------------
+// capture_zone_add: Fold a decoded record into a zone map
+//-----------------------------------------------------------------
+void capture_zone_add(tCaptureZone *zone, const tLogRecord *rec)
+{
+    if (rec->has_addr)
+    {
+        zone->dev_map[rec->device >> 5] |= (1u << (rec->device & 31));
+        zone->ep_map |= (1 << rec->endpoint);
+    }
+    else if (rec->type != LOG_CTRL_TYPE_SOF && rec->type != LOG_CTRL_TYPE_RST)
+        zone->flags |= CAPTURE_ZONE_NOADDR;
+
+    if (rec->type == LOG_CTRL_TYPE_RST)
+        zone->flags |= CAPTURE_ZONE_RST;
+    else
+        zone->pid_map |= (1 << (rec->pid & 0xF));
+
+    if (rec->time < zone->min_time)
+        zone->min_time = rec->time;
+    if (rec->time > zone->max_time)
+        zone->max_time = rec->time;
+}
+//-----------------------------------------------------------------
+// capture_filter_init: Filter which matches everything
+//-----------------------------------------------------------------
+void capture_filter_init(tCaptureFilter *filter)
+{
+    filter->device   = -1;
+    filter->endpoint = -1;
+    filter->pid_map  = 0;
+    filter->t_start  = 0;
+    filter->t_end    = CAPTURE_TIME_MAX;
+}
+//-----------------------------------------------------------------
+// capture_filter_active: Does the filter drop anything?
+//-----------------------------------------------------------------
+int capture_filter_active(const tCaptureFilter *filter)
+{
+    return filter->device >= 0 || filter->endpoint >= 0 || filter->pid_map != 0 ||
+           filter->t_start != 0 || filter->t_end != CAPTURE_TIME_MAX;
+}
+//-----------------------------------------------------------------
+// capture_filter_add_pid: Add PID (name or value) to filter
+//-----------------------------------------------------------------
+int capture_filter_add_pid(tCaptureFilter *filter, const char *pid_str)
+{
+    char *end = NULL;
+    int i;
+    unsigned long pid = strtoul(pid_str, &end, 0);
+
+    // Numeric PID
+    if (end != pid_str && *end == 0)
+    {
+        filter->pid_map |= (1 << (pid & 0xF));
+        return 0;
+    }
+
+    // PID name (IN, OUT, DATA0, STALL, ...)
+    for (i=0;i<16;i++)
+    {
+        uint8_t full_pid = i | ((~(i << 4)) & 0xF0);
+        if (strcasecmp(usb_get_pid_str(full_pid), pid_str) == 0)
+        {
+            filter->pid_map |= (1 << i);
+            return 0;
+        }
+    }
+
+    fprintf(stderr, "ERROR: Unknown PID %s\n", pid_str);
+    return -1;
+}
+//-----------------------------------------------------------------
+// capture_filter_parse_time: Time window in seconds "start:end"
+// (either side may be left empty)
+//-----------------------------------------------------------------
+int capture_filter_parse_time(tCaptureFilter *filter, const char *range)
+{
+    const char *sep = strchr(range, ':');
+    char *end = NULL;
+    double t;
+
+    if (!sep)
+    {
+        fprintf(stderr, "ERROR: Time range should be start:end (seconds)\n");
+        return -1;
+    }
+
+    if (sep != range)
+    {
+        t = strtod(range, &end);
+        if (end != sep || t < 0)
+        {
+            fprintf(stderr, "ERROR: Bad start time\n");
+            return -1;
+        }
+        filter->t_start = (uint64_t)(t * TICKS_PER_SEC);
+    }
+
+    if (sep[1] != 0)
+    {
+        t = strtod(sep + 1, &end);
+        if (*end != 0 || t < 0)
+        {
+            fprintf(stderr, "ERROR: Bad end time\n");
+            return -1;
+        }
+        filter->t_end = (uint64_t)(t * TICKS_PER_SEC);
+    }
+
+    return 0;
+}
+//-----------------------------------------------------------------
+// capture_filter_match_zone: Can any record summarised by the
+// zone map pass the filter?
+//-----------------------------------------------------------------
+int capture_filter_match_zone(const tCaptureFilter *filter, const tCaptureZone *zone)
+{
+    // Empty block
+    if (zone->min_time > zone->max_time)
+        return 0;
+
+    if (zone->max_time < filter->t_start || zone->min_time > filter->t_end)
+        return 0;
+
+    if (filter->pid_map != 0 && !(zone->pid_map & filter->pid_map))
+        return 0;
+
+    // SOF / reset records of a block without the device or endpoint
+    // are not needed, readers take the timing over skipped blocks
+    // from the next block header
+    if (filter->device >= 0 && !(zone->dev_map[filter->device >> 5] & (1u << (filter->device & 31))))
+        return 0;
+
+    if (filter->endpoint >= 0 && !(zone->ep_map & (1 << filter->endpoint)))
+        return 0;
+
+    return 1;
+}
+//-----------------------------------------------------------------
+// capture_filter_contains_zone: Does every record summarised by the
+// zone map pass the filter? (block can be used untouched)
+//-----------------------------------------------------------------
+int capture_filter_contains_zone(const tCaptureFilter *filter, const tCaptureZone *zone)
+{
+    uint32_t dev_bit = 0;
+    int i;
+
+    // Empty block
+    if (zone->min_time > zone->max_time)
+        return 1;
+
+    if (zone->min_time < filter->t_start || zone->max_time > filter->t_end)
+        return 0;
+
+    if (filter->device >= 0)
+    {
+        if (zone->flags & CAPTURE_ZONE_NOADDR)
+            return 0;
+
+        for (i=0;i<4;i++)
+        {
+            dev_bit = (i == (filter->device >> 5)) ? (1u << (filter->device & 31)) : 0;
+            if (zone->dev_map[i] & ~dev_bit)
+                return 0;
+        }
+    }
+
+    if (filter->endpoint >= 0)
+    {
+        if ((zone->flags & CAPTURE_ZONE_NOADDR) || (zone->ep_map & ~(1 << filter->endpoint)))
+            return 0;
+    }
+
+    if (filter->pid_map != 0)
+    {
+        if ((zone->flags & CAPTURE_ZONE_RST) || (zone->pid_map & ~filter->pid_map))
+            return 0;
+    }
+
+    return 1;
+}
+//-----------------------------------------------------------------
+// capture_filter_match_record: Check single record against filter.
+// SOF / reset records carry the timing and are kept for device and
+// endpoint filters so the output still has a sensible time base
+// (blocks skipped whole pass theirs on through the block header).
+//-----------------------------------------------------------------
+int capture_filter_match_record(const tCaptureFilter *filter, const tLogRecord *rec)
+{
+    if (rec->time < filter->t_start || rec->time > filter->t_end)
+        return 0;
+
+    if (rec->type == LOG_CTRL_TYPE_RST)
+        return filter->pid_map == 0;
+
+    if (filter->pid_map != 0 && !(filter->pid_map & (1 << (rec->pid & 0xF))))
+        return 0;
+
+    if (rec->type == LOG_CTRL_TYPE_SOF)
+        return 1;
+
+    if (filter->device >= 0 && (!rec->has_addr || rec->device != filter->device))
+        return 0;
+
+    if (filter->endpoint >= 0 && (!rec->has_addr || rec->endpoint != filter->endpoint))
+        return 0;
+
+    return 1;
+}
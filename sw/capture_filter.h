@@ -0,0 +1,58 @@
+#ifndef __CAPTURE_FILTER_H__
+#define __CAPTURE_FILTER_H__
+
+//--------------------------------------------------------------------
+// Defines
+//--------------------------------------------------------------------
+#define CAPTURE_ZONE_RST        (1 << 0)
+#define CAPTURE_ZONE_NOADDR     (1 << 1)    // Data / handshake before any token
+
+#define CAPTURE_TIME_MAX        0xFFFFFFFFFFFFFFFFULL
+
+//--------------------------------------------------------------------
+// Structures
+//--------------------------------------------------------------------
+// Per-block summary of everything seen in the block
+typedef struct
+{
+    uint32_t dev_map[4];    // Device addresses seen (bit per address)
+    uint16_t ep_map;        // Endpoints seen (bit per endpoint)
+    uint16_t pid_map;       // PIDs seen (bit per 4-bit PID)
+    uint32_t flags;         // CAPTURE_ZONE_xxx
+    uint64_t min_time;
+    uint64_t max_time;
+} tCaptureZone;
+
+// Host side record filter
+typedef struct
+{
+    int      device;        // -1 = any
+    int      endpoint;      // -1 = any
+    uint16_t pid_map;       // 0 = any
+    uint64_t t_start;       // First tick included
+    uint64_t t_end;         // Last tick included
+} tCaptureFilter;
+
+//--------------------------------------------------------------------
+// Prototypes
+//--------------------------------------------------------------------
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+void capture_zone_init(tCaptureZone *zone);
+void capture_zone_add(tCaptureZone *zone, const tLogRecord *rec);
+
+void capture_filter_init(tCaptureFilter *filter);
+int  capture_filter_active(const tCaptureFilter *filter);
+int  capture_filter_add_pid(tCaptureFilter *filter, const char *pid_str);
+int  capture_filter_parse_time(tCaptureFilter *filter, const char *range);
+int  capture_filter_match_zone(const tCaptureFilter *filter, const tCaptureZone *zone);
+int  capture_filter_contains_zone(const tCaptureFilter *filter, const tCaptureZone *zone);
+int  capture_filter_match_record(const tCaptureFilter *filter, const tLogRecord *rec);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,168 @@
+//-----------------------------------------------------------------
+//                       USB Sniffer
+//                           V0.1
+//                     Ultra-Embedded.com
+//                       Copyright 2015
+//
+//               Email: admin@ultra-embedded.com
+//
+//                       License: LGPL
+//-----------------------------------------------------------------
+//
+// Copyright (C) 2011 - 2013 Ultra-Embedded.com
+//
+// This source file may be used and distributed without         
+// restriction provided that this copyright statement is not    
+// removed from the file and that any derivative work contains  
+// the original copyright notice and the associated disclaimer. 
+//
+// This source file is free software; you can redistribute it   
+// and/or modify it under the terms of the GNU Lesser General   
+// Public License as published by the Free Software Foundation; 
+// either version 2.1 of the License, or (at your option) any   
+// later version.
+//
+// This source is distributed in the hope that it will be       
+// useful, but WITHOUT ANY WARRANTY; without even the implied   
+// warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR      
+// PURPOSE.  See the GNU Lesser General Public License for more 
+// details.
+//
+// You should have received a copy of the GNU Lesser General    
+// Public License along with this source; if not, write to the 
+// Free Software Foundation, Inc., 59 Temple Place, Suite 330, 
+// Boston, MA  02111-1307  USA
+//-----------------------------------------------------------------
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+
+#include "log_format.h"
+#include "usb_defs.h"
+#include "log_decode.h"
+#include "log_encode.h"
+#include "capture_filter.h"
+#include "payload_store.h"
+#include "capture_file.h"
+#include "capture_slice.h"
+
+//-----------------------------------------------------------------
+// capture_slice_block: Re-encode the matching records of a block
+// which the filter only partly covers
+//-----------------------------------------------------------------
+static int capture_slice_block(tCaptureFile *in, tCaptureFile *out, const tCaptureBlock *blk, const tCaptureFilter *filter)
+{
+    uint32_t buf[1 + (MAX_PACKET_SIZE + 3) / 4];
+    tLogDecoder dec;
+    tLogDecoder prev;
+    tLogRecord rec;
+    uint32_t *words;
+    int count;
+    int idx;
+    int synced = 0;
+
+    count = capture_file_read_block(in, blk, &words);
+    if (count < 0)
+        return -1;
+
+    capture_file_block_decoder(in, blk, &dec);
+
+    for (idx = 0; idx < count; idx += rec.words)
+    {
+        prev = dec;
+        if (log_decode_next(&dec, words + idx, count - idx, &rec) <= 0)
+            return -1;
+
+        if (!capture_filter_match_record(filter, &rec))
+            continue;
+
+        // Carry decoder state up to the first kept record across so
+        // absolute times survive the records dropped before it
+        if (!synced)
+        {
+            if (capture_file_set_state(out, &prev) != 0)
+                return -1;
+            synced = 1;
+        }
+
+        if (capture_file_write(out, buf, log_encode_record(&rec, buf)) != 0)
+            return -1;
+    }
+
+    return 0;
+}
+//-----------------------------------------------------------------
+// capture_slice: Extract records matching filter into a new capture.
+// Blocks entirely inside the filter are copied without decoding,
+// blocks outside it are skipped.
+//-----------------------------------------------------------------
+int capture_slice(const char *in_file, const char *out_file, const tCaptureFilter *filter)
+{
+    FILE *fin;
+    FILE *fout;
+    tCaptureFile *in;
+    tCaptureFile *out;
+    tCaptureBlock blk;
+    int res;
+    int err = 0;
+
+    fin = fopen(in_file, "rb");
+    if (!fin)
+    {
+        fprintf(stderr, "ERROR: Could not open %s\n", in_file);
+        return -1;
+    }
+
+    in = capture_file_open(fin);
+    if (!in)
+    {
+        fclose(fin);
+        return -1;
+    }
+
+    fout = fopen(out_file, "wb");
+    if (!fout)
+    {
+        fprintf(stderr, "ERROR: Could not create %s\n", out_file);
+        capture_file_close(in);
+        fclose(fin);
+        return -1;
+    }
+
+    out = capture_file_create(fout, capture_file_speed(in), capture_file_codec(in), capture_file_flags(in), capture_file_info(in));
+    if (!out)
+    {
+        capture_file_close(in);
+        fclose(fout);
+        fclose(fin);
+        return -1;
+    }
+
+    // Payload ids are local to a capture, so deduplicated captures are
+    // re-encoded (the slice gets a store of just the payloads it uses)
+    capture_file_set_filter(in, filter);
+    capture_file_set_copy_mode(in, !(capture_file_flags(in) & CAPTURE_FLAG_DEDUP));
+
+    while ((res = capture_file_next_block(in, &blk)) > 0)
+    {
+        if (capture_file_block_copyable(in))
+            err = capture_file_copy_block(out, &blk, capture_file_read_stored(in));
+        else
+            err = capture_slice_block(in, out, &blk, filter);
+
+        if (err)
+            break;
+    }
+
+    if (res < 0)
+        err = -1;
+
+    if (capture_file_close(out) != 0)
+        err = -1;
+    capture_file_close(in);
+
+    fclose(fout);
+    fclose(fin);
+    return err;
+}
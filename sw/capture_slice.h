@@ -0,0 +1,17 @@
+#ifndef __CAPTURE_SLICE_H__
+#define __CAPTURE_SLICE_H__
+
+//--------------------------------------------------------------------
+// Prototypes
+//--------------------------------------------------------------------
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+int capture_slice(const char *in_file, const char *out_file, const tCaptureFilter *filter);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,89 @@
+#ifndef __CLASS_DECODER_H__
+#define __CLASS_DECODER_H__
+
+//--------------------------------------------------------------------
+// Class decoder interface, shared with decoders built as plugins
+// (shared objects exporting CLASS_DECODER_SYMBOL)
+//--------------------------------------------------------------------
+
+//--------------------------------------------------------------------
+// Defines
+//--------------------------------------------------------------------
+#define CLASS_DECODER_VERSION   1
+
+// const tClassDecoder* usb_sniffer_class_decoder(void)
+#define CLASS_DECODER_SYMBOL    "usb_sniffer_class_decoder"
+
+//--------------------------------------------------------------------
+// Structures
+//--------------------------------------------------------------------
+// Endpoint offered to a decoder the first time it carries traffic
+// (and again once its configuration descriptor has been seen)
+typedef struct
+{
+    uint8_t  device;
+    uint8_t  endpoint;
+    uint8_t  dir;               // PID_IN / PID_OUT (PID_OUT for endpoint 0)
+    uint8_t  described;         // Fields below are valid
+    uint8_t  attributes;        // bmAttributes
+    uint8_t  interface;         // bInterfaceNumber
+    uint8_t  iface_class;       // bInterfaceClass
+    uint8_t  iface_subclass;
+    uint8_t  iface_protocol;
+    uint8_t  reserved;
+    uint16_t max_packet;        // wMaxPacketSize
+} tDecoderEndpoint;
+
+// Data packet of a transfer
+typedef struct
+{
+    uint64_t time;
+    uint32_t offset;            // Payload position in transfer data
+    uint16_t length;            // Payload bytes (excl. CRC16)
+    uint8_t  pid;               // DATA PID
+    uint8_t  flags;             // TXN_FLAG_xxx
+} tDecoderPacket;
+
+// Reassembled transfer (see tTransfer), valid during decode call
+typedef struct
+{
+    uint64_t              start;
+    uint64_t              end;
+    uint32_t              bytes;        // Payload bytes (excl. CRC16)
+    uint16_t              naks;
+    uint8_t               device;
+    uint8_t               endpoint;
+    uint8_t               type;         // tTransferType
+    uint8_t               dir;          // PID_IN / PID_OUT
+    uint8_t               status;       // tTransferStatus
+    uint8_t               reserved;
+    uint8_t               setup[8];     // SETUP packet (control only)
+    uint32_t              packets;
+    const tDecoderPacket *packet;
+    const uint8_t        *data;         // Payloads back to back
+} tDecoderTransfer;
+
+// Decoder entry points. Each instance is driven by its own worker
+// thread, so calls for one instance never overlap.
+typedef struct
+{
+    uint32_t    version;            // CLASS_DECODER_VERSION
+    const char *name;
+
+    // New instance, args from the command line (may be NULL)
+    void*     (*create)(const char *args);
+
+    // Non-zero to receive transfers of endpoint
+    int       (*subscribe)(void *inst, const tDecoderEndpoint *ep);
+
+    // Batch of transfers in capture order (non-zero counts an error)
+    int       (*decode)(void *inst, const tDecoderTransfer *xfers, int count);
+
+    // End of capture: print results
+    void      (*report)(void *inst, FILE *f);
+    void      (*destroy)(void *inst);
+} tClassDecoder;
+
+typedef const tClassDecoder* (*tClassDecoderEntry)(void);
+
+#endif
@@ -0,0 +1,438 @@
+//-----------------------------------------------------------------
+//                       USB Sniffer
+//                           V0.1
+//                     Ultra-Embedded.com
+//                       Copyright 2015
+//
+//               Email: admin@ultra-embedded.com
+//
+//                       License: LGPL
+//-----------------------------------------------------------------
+//
+// Copyright (C) 2011 - 2013 Ultra-Embedded.com
+//
+// This source file may be used and distributed without         
+// restriction provided that this copyright statement is not    
+// removed from the file and that any derivative work contains  
+// the original copyright notice and the associated disclaimer. 
+//
+// This source file is free software; you can redistribute it   
+// and/or modify it under the terms of the GNU Lesser General   
+// Public License as published by the Free Software Foundation; 
+// either version 2.1 of the License, or (at your option) any   
+// later version.
+//
+// This source is distributed in the hope that it will be       
+// useful, but WITHOUT ANY WARRANTY; without even the implied   
+// warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR      
+// PURPOSE.  See the GNU Lesser General Public License for more 
+// details.
+//
+// You should have received a copy of the GNU Lesser General    
+// Public License along with this source; if not, write to the 
+// Free Software Foundation, Inc., 59 Temple Place, Suite 330, 
+// Boston, MA  02111-1307  USA
+//-----------------------------------------------------------------
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <errno.h>
+#include <sys/stat.h>
+
+#include "log_format.h"
+#include "usb_defs.h"
+#include "usb_sniffer.h"
+#include "log_decode.h"
+#include "capture_filter.h"
+#include "payload_store.h"
+#include "capture_file.h"
+#include "capture_codec.h"
+#include "column_export.h"
+#include "parallel.h"
+
+//-----------------------------------------------------------------
+// Defines
+//-----------------------------------------------------------------
+enum eColumns
+{
+    COL_TIME,
+    COL_TYPE,
+    COL_PID,
+    COL_DEVICE,
+    COL_ENDPOINT,
+    COL_LENGTH,
+    COL_CRC_OK,
+    COL_OFFSET,
+    COL_HEAP,
+    COL_MAX
+};
+
+//-----------------------------------------------------------------
+// Structures
+//-----------------------------------------------------------------
+struct column
+{
+    FILE        *file;
+    uint8_t     *data;
+    uint64_t     size;
+    uint64_t     alloc;
+    uint64_t     min;
+    uint64_t     max;
+
+    // Compressed row group
+    uint8_t     *stored;
+    uint64_t     stored_alloc;
+    tColumnChunk chunk;
+    int          err;
+};
+
+struct column_export
+{
+    struct column cols[COL_MAX];
+    uint32_t      rows;
+    uint64_t      total_rows;
+    uint64_t      heap_pos;
+    int           groups;
+    int           codec;
+};
+
+//-----------------------------------------------------------------
+// Locals
+//-----------------------------------------------------------------
+static const struct
+{
+    const char *name;
+    int         width;
+    int         encoding;
+} _column_defs[COL_MAX] =
+{
+    [COL_TIME]      = { "time.col",      8, COLUMN_ENC_DELTA },
+    [COL_TYPE]      = { "type.col",      1, COLUMN_ENC_PLAIN },
+    [COL_PID]       = { "pid.col",       1, COLUMN_ENC_PLAIN },
+    [COL_DEVICE]    = { "device.col",    1, COLUMN_ENC_PLAIN },
+    [COL_ENDPOINT]  = { "endpoint.col",  1, COLUMN_ENC_PLAIN },
+    [COL_LENGTH]    = { "length.col",    2, COLUMN_ENC_PLAIN },
+    [COL_CRC_OK]    = { "crc_ok.col",    1, COLUMN_ENC_PLAIN },
+    [COL_OFFSET]    = { "offset.col",    8, COLUMN_ENC_DELTA },
+    [COL_HEAP]      = { "payload.heap",  0, COLUMN_ENC_PLAIN },
+};
+
+// Chunk header layout, written to schema.txt
+#define COLUMN_CHUNK_FIELD(f, type) { #f, offsetof(tColumnChunk, f), type }
+static const struct
+{
+    const char *name;
+    size_t      offset;
+    const char *type;
+} _chunk_fields[] =
+{
+    COLUMN_CHUNK_FIELD(magic,       "u32"),
+    COLUMN_CHUNK_FIELD(rows,        "u32"),
+    COLUMN_CHUNK_FIELD(width,       "u32"),
+    COLUMN_CHUNK_FIELD(codec,       "u32"),
+    COLUMN_CHUNK_FIELD(encoding,    "u32"),
+    COLUMN_CHUNK_FIELD(reserved,    "u32"),
+    COLUMN_CHUNK_FIELD(raw_size,    "u64"),
+    COLUMN_CHUNK_FIELD(stored_size, "u64"),
+    COLUMN_CHUNK_FIELD(min,         "u64"),
+    COLUMN_CHUNK_FIELD(max,         "u64"),
+};
+
+//-----------------------------------------------------------------
+// column_reserve: Room for size more bytes
+//-----------------------------------------------------------------
+static int column_reserve(struct column *col, uint64_t size)
+{
+    if (col->size + size > col->alloc)
+    {
+        uint64_t alloc = col->alloc ? col->alloc : (1 << 20);
+        uint8_t *data;
+
+        while (alloc < col->size + size)
+            alloc *= 2;
+
+        data = (uint8_t *)realloc(col->data, alloc);
+        if (!data)
+        {
+            fprintf(stderr, "ERROR: Out of memory\n");
+            return -1;
+        }
+
+        col->data  = data;
+        col->alloc = alloc;
+    }
+
+    return 0;
+}
+//-----------------------------------------------------------------
+// column_add: Append value to column, tracking range
+//-----------------------------------------------------------------
+static void column_add(struct column *col, int width, uint64_t value, int first)
+{
+    memcpy(col->data + col->size, &value, width);
+    col->size += width;
+
+    if (first || value < col->min)
+        col->min = value;
+    if (first || value > col->max)
+        col->max = value;
+}
+//-----------------------------------------------------------------
+// column_compress: Worker - compress one column of the row group
+//-----------------------------------------------------------------
+static void column_compress(void *ctx, int idx)
+{
+    struct column_export *exp = (struct column_export *)ctx;
+    struct column *col = &exp->cols[idx];
+    uint64_t bound = capture_codec_bound(exp->codec, col->size);
+    int res = -1;
+
+    col->chunk.magic    = COLUMN_CHUNK_MAGIC;
+    col->chunk.rows     = exp->rows;
+    col->chunk.width    = _column_defs[idx].width;
+    col->chunk.encoding = _column_defs[idx].encoding;
+    col->chunk.raw_size = col->size;
+    col->chunk.min      = col->min;
+    col->chunk.max      = col->max;
+
+    if (bound > col->stored_alloc)
+    {
+        uint8_t *stored = (uint8_t *)realloc(col->stored, bound);
+        if (!stored)
+        {
+            col->err = 1;
+            return;
+        }
+        col->stored       = stored;
+        col->stored_alloc = bound;
+    }
+
+    // Monotonic 64-bit columns: small differences compress far better
+    if (col->chunk.encoding == COLUMN_ENC_DELTA)
+    {
+        uint64_t *v = (uint64_t *)col->data;
+        uint64_t i;
+
+        for (i = col->size / 8; i > 1; i--)
+            v[i - 1] -= v[i - 2];
+    }
+
+    if (col->size)
+        res = capture_codec_compress(exp->codec, col->data, col->size, col->stored, bound);
+
+    // Incompressible (or empty) chunks are kept as is
+    if (res < 0 || (uint64_t)res >= col->size)
+    {
+        memcpy(col->stored, col->data, col->size);
+        col->chunk.codec       = CAPTURE_CODEC_NONE;
+        col->chunk.stored_size = col->size;
+    }
+    else
+    {
+        col->chunk.codec       = exp->codec;
+        col->chunk.stored_size = res;
+    }
+}
+//-----------------------------------------------------------------
+// column_flush_group: Compress columns in parallel and append
+// a chunk to each column file
+//-----------------------------------------------------------------
+static int column_flush_group(struct column_export *exp)
+{
+    int i;
+
+    if (exp->rows == 0)
+        return 0;
+
+    parallel_for(COL_MAX, column_compress, exp);
+
+    for (i=0;i<COL_MAX;i++)
+    {
+        struct column *col = &exp->cols[i];
+
+        if (col->err ||
+            fwrite(&col->chunk, sizeof(col->chunk), 1, col->file) != 1 ||
+            fwrite(col->stored, 1, col->chunk.stored_size, col->file) != col->chunk.stored_size)
+        {
+            fprintf(stderr, "ERROR: Failed to write %s\n", _column_defs[i].name);
+            return -1;
+        }
+
+        col->size = 0;
+    }
+
+    exp->total_rows += exp->rows;
+    exp->rows = 0;
+    exp->groups++;
+    return 0;
+}
+//-----------------------------------------------------------------
+// column_add_record: Add one row
+//-----------------------------------------------------------------
+static int column_add_record(struct column_export *exp, const tLogRecord *rec)
+{
+    struct column *cols = exp->cols;
+    int first = (exp->rows == 0);
+    int i;
+
+    for (i=0;i<COL_HEAP;i++)
+        if (column_reserve(&cols[i], 8) != 0)
+            return -1;
+
+    column_add(&cols[COL_TIME],     8, rec->time, first);
+    column_add(&cols[COL_TYPE],     1, rec->type, first);
+    column_add(&cols[COL_PID],      1, rec->pid, first);
+    column_add(&cols[COL_DEVICE],   1, rec->has_addr ? rec->device : COLUMN_NO_ADDR, first);
+    column_add(&cols[COL_ENDPOINT], 1, rec->has_addr ? rec->endpoint : COLUMN_NO_ADDR, first);
+    column_add(&cols[COL_LENGTH],   2, rec->length, first);
+    column_add(&cols[COL_CRC_OK],   1, log_decode_crc_valid(rec), first);
+    column_add(&cols[COL_OFFSET],   8, exp->heap_pos, first);
+
+    if (first)
+    {
+        cols[COL_HEAP].min = exp->heap_pos;
+        cols[COL_HEAP].max = exp->heap_pos;
+    }
+
+    if (rec->length)
+    {
+        if (column_reserve(&cols[COL_HEAP], rec->length) != 0)
+            return -1;
+
+        memcpy(cols[COL_HEAP].data + cols[COL_HEAP].size, rec->data, rec->length);
+        cols[COL_HEAP].size += rec->length;
+        exp->heap_pos       += rec->length;
+        cols[COL_HEAP].max   = exp->heap_pos;
+    }
+
+    if (++exp->rows == COLUMN_GROUP_ROWS)
+        return column_flush_group(exp);
+
+    return 0;
+}
+//-----------------------------------------------------------------
+// column_write_schema: Describe the column set for loaders
+//-----------------------------------------------------------------
+static int column_write_schema(struct column_export *exp, const char *dir, int speed)
+{
+    static const char *speeds[] = { "hs", "fs", "ls" };
+    char path[1024];
+    FILE *f;
+    int i;
+
+    snprintf(path, sizeof(path), "%s/schema.txt", dir);
+    f = fopen(path, "w");
+    if (!f)
+        return -1;
+
+    fprintf(f, "rows %llu\n", (unsigned long long)exp->total_rows);
+    fprintf(f, "row_groups %d\n", exp->groups);
+    fprintf(f, "rows_per_group %d\n", COLUMN_GROUP_ROWS);
+    fprintf(f, "speed %s\n", (speed >= 0 && speed <= USB_SPEED_LS) ? speeds[speed] : "?");
+    fprintf(f, "ticks_per_sec %llu\n", (unsigned long long)TICKS_PER_SEC);
+
+    // Each column file is a run of chunks: header, then stored_size
+    // bytes (codec applied after encoding, little endian values)
+    fprintf(f, "codec %s\n", exp->codec == CAPTURE_CODEC_ZSTD ? "zstd" : "none");
+    fprintf(f, "chunk_header %d\n", (int)sizeof(tColumnChunk));
+    for (i=0;i<(int)(sizeof(_chunk_fields) / sizeof(_chunk_fields[0]));i++)
+        fprintf(f, "chunk_field %s %d %s\n", _chunk_fields[i].name, (int)_chunk_fields[i].offset, _chunk_fields[i].type);
+    fprintf(f, "chunk_magic 0x%08x\n", COLUMN_CHUNK_MAGIC);
+    fprintf(f, "chunk_codec %d none\n", CAPTURE_CODEC_NONE);
+    fprintf(f, "chunk_codec %d zstd\n", CAPTURE_CODEC_ZSTD);
+    fprintf(f, "chunk_encoding %d plain\n", COLUMN_ENC_PLAIN);
+    fprintf(f, "chunk_encoding %d delta\n", COLUMN_ENC_DELTA);
+
+    for (i=0;i<COL_MAX;i++)
+        fprintf(f, "column %s %d %s\n", _column_defs[i].name, _column_defs[i].width,
+                _column_defs[i].encoding == COLUMN_ENC_DELTA ? "delta" : "plain");
+
+    fclose(f);
+    return 0;
+}
+//-----------------------------------------------------------------
+// column_export: Write capture as a directory of column files
+// (time, type, pid, device, endpoint, length, CRC ok, payload offset) plus
+// payload heap, in compressed row group chunks with min/max stats.
+//-----------------------------------------------------------------
+int column_export(const char *dir, tCaptureFile *cap, const tCaptureFilter *filter)
+{
+    struct column_export exp;
+    tCaptureBlock blk;
+    tLogDecoder dec;
+    tLogRecord rec;
+    uint32_t *words;
+    char path[1024];
+    int count;
+    int idx;
+    int res = 0;
+    int err = 0;
+    int i;
+
+    memset(&exp, 0, sizeof(exp));
+
+    // Only codecs dataframe loaders can read themselves
+    exp.codec = capture_codec_supported(CAPTURE_CODEC_ZSTD) ? CAPTURE_CODEC_ZSTD : CAPTURE_CODEC_NONE;
+    if (exp.codec == CAPTURE_CODEC_NONE)
+        fprintf(stderr, "WARNING: Built without zstd, column files are written uncompressed\n");
+
+    if (mkdir(dir, 0755) != 0 && errno != EEXIST)
+    {
+        fprintf(stderr, "ERROR: Could not create %s\n", dir);
+        return -1;
+    }
+
+    for (i=0;i<COL_MAX;i++)
+    {
+        snprintf(path, sizeof(path), "%s/%s", dir, _column_defs[i].name);
+        exp.cols[i].file = fopen(path, "wb");
+        if (!exp.cols[i].file)
+        {
+            fprintf(stderr, "ERROR: Could not create %s\n", path);
+            err = -1;
+            break;
+        }
+    }
+
+    capture_file_set_filter(cap, filter);
+
+    while (!err && (res = capture_file_next_block(cap, &blk)) > 0)
+    {
+        count = capture_file_read_block(cap, &blk, &words);
+        if (count < 0)
+        {
+            err = -1;
+            break;
+        }
+
+        capture_file_block_decoder(cap, &blk, &dec);
+
+        for (idx = 0; idx < count && !err; idx += rec.words)
+        {
+            if (log_decode_next(&dec, words + idx, count - idx, &rec) <= 0)
+                err = -1;
+            else if (capture_filter_match_record(filter, &rec))
+                err = column_add_record(&exp, &rec);
+        }
+    }
+
+    if (!err && res < 0)
+        err = -1;
+
+    if (!err)
+        err = column_flush_group(&exp);
+    if (!err)
+        err = column_write_schema(&exp, dir, capture_file_speed(cap));
+
+    for (i=0;i<COL_MAX;i++)
+    {
+        if (exp.cols[i].file)
+            fclose(exp.cols[i].file);
+        free(exp.cols[i].data);
+        free(exp.cols[i].stored);
+    }
+
+    return err;
+}
@@ -0,0 +1,52 @@
+#ifndef __COLUMN_EXPORT_H__
+#define __COLUMN_EXPORT_H__
+
+//--------------------------------------------------------------------
+// Defines
+//--------------------------------------------------------------------
+#define COLUMN_CHUNK_MAGIC      0x4C4F4355  // "UCOL"
+
+// Rows per row group (one chunk per column file)
+#define COLUMN_GROUP_ROWS       (1 << 20)
+
+// Chunk value encodings
+#define COLUMN_ENC_PLAIN        0
+#define COLUMN_ENC_DELTA        1   // First value, then differences
+
+// Device / endpoint column value for records without an address
+#define COLUMN_NO_ADDR          0xFF
+
+//--------------------------------------------------------------------
+// Structures
+//--------------------------------------------------------------------
+// Row group chunk header, followed by stored_size bytes. Values are
+// little endian, width bytes each.
+typedef struct
+{
+    uint32_t magic;
+    uint32_t rows;
+    uint32_t width;         // Bytes per value (0 = payload heap)
+    uint32_t codec;         // tCaptureCodec (none or zstd)
+    uint32_t encoding;      // COLUMN_ENC_xxx (applied before codec)
+    uint32_t reserved;
+    uint64_t raw_size;
+    uint64_t stored_size;
+    uint64_t min;           // Value range of chunk (decoded values,
+                            // heap: offsets)
+    uint64_t max;
+} tColumnChunk;
+
+//--------------------------------------------------------------------
+// Prototypes
+//--------------------------------------------------------------------
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+int column_export(const char *dir, tCaptureFile *cap, const tCaptureFilter *filter);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
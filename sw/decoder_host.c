@@ -0,0 +1,603 @@
+//-----------------------------------------------------------------
+//                       USB Sniffer
+//                           V0.1
+//                     Ultra-Embedded.com
+//                       Copyright 2015
+//
+//               Email: admin@ultra-embedded.com
+//
+//                       License: LGPL
+//-----------------------------------------------------------------
+//
+// Copyright (C) 2011 - 2013 Ultra-Embedded.com
+//
+// This source file may be used and distributed without         
+// restriction provided that this copyright statement is not    
+// removed from the file and that any derivative work contains  
+// the original copyright notice and the associated disclaimer. 
+//
+// This source file is free software; you can redistribute it   
+// and/or modify it under the terms of the GNU Lesser General   
+// Public License as published by the Free Software Foundation; 
+// either version 2.1 of the License, or (at your option) any   
+// later version.
+//
+// This source is distributed in the hope that it will be       
+// useful, but WITHOUT ANY WARRANTY; without even the implied   
+// warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR      
+// PURPOSE.  See the GNU Lesser General Public License for more 
+// details.
+//
+// You should have received a copy of the GNU Lesser General    
+// Public License along with this source; if not, write to the 
+// Free Software Foundation, Inc., 59 Temple Place, Suite 330, 
+// Boston, MA  02111-1307  USA
+//-----------------------------------------------------------------
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <assert.h>
+#include <pthread.h>
+#include <dlfcn.h>
+
+#include "usb_defs.h"
+#include "log_format.h"
+#include "log_decode.h"
+#include "capture_filter.h"
+#include "transaction.h"
+#include "descriptor_snoop.h"
+#include "transfer.h"
+#include "class_decoder.h"
+#include "decoder_host.h"
+#include "storage_decoder.h"
+#include "media_decoder.h"
+
+//-----------------------------------------------------------------
+// Structures
+//-----------------------------------------------------------------
+// Transfers copied out of the assembler (pointers into the batch)
+struct decoder_batch
+{
+    struct decoder_batch *next;
+    int                   count;
+    uint32_t              packets;
+    uint32_t              used;
+    tDecoderTransfer      xfer[DECODER_BATCH_XFERS];
+    tDecoderPacket        packet[DECODER_BATCH_PACKETS];
+    uint8_t               data[DECODER_BATCH_DATA];
+};
+
+// Decoder instance and the worker thread driving it
+struct decoder_slot
+{
+    const tClassDecoder  *dec;
+    void                 *inst;
+    void                 *dl;           // Plugin handle (NULL = built in)
+
+    pthread_t             thread;
+    pthread_mutex_t       lock;
+    pthread_cond_t        cond;
+    int                   stop;
+
+    // Filled by the feeding thread
+    struct decoder_batch *cur;
+
+    // Handed to the worker / returned by it (under lock)
+    struct decoder_batch *queue;
+    struct decoder_batch *queue_tail;
+    struct decoder_batch *free;
+    int                   allocated;
+
+    // Live capture: full batches are dropped rather than waited on
+    int                   live;
+
+    uint64_t              transfers;    // Decoded (worker only)
+    uint64_t              errors;
+    uint64_t              waits;        // Feeding thread had to wait
+    uint64_t              dropped;      // Batches dropped (live)
+    uint64_t              dropped_xfers;
+};
+
+struct decoder_host
+{
+    int                  count;
+    struct decoder_slot  decoders[DECODER_HOST_MAX];
+
+    tTransferAssembler  *xa;
+    tDescriptorSnoop     snoop;
+
+    // Flat dispatch table: decoders subscribed per endpoint (bit
+    // per decoder), asked on first use of the endpoint
+    uint32_t             subs[SNOOP_SLOTS];
+    uint8_t              resolved[SNOOP_SLOTS];
+
+    // Records of the current token are passed on
+    int                  active;
+
+    int                  live;
+};
+
+//-----------------------------------------------------------------
+// Locals
+//-----------------------------------------------------------------
+// Decoders linked into the binary, selected by name
+static const tClassDecoderEntry _builtin_decoders[] =
+{
+    storage_decoder,
+    media_decoder,
+    NULL
+};
+
+//-----------------------------------------------------------------
+// decoder_worker: Run batches through a decoder instance
+//-----------------------------------------------------------------
+static void* decoder_worker(void *arg)
+{
+    struct decoder_slot *slot = (struct decoder_slot *)arg;
+    struct decoder_batch *batch;
+
+    pthread_mutex_lock(&slot->lock);
+    for (;;)
+    {
+        while (!slot->queue && !slot->stop)
+            pthread_cond_wait(&slot->cond, &slot->lock);
+
+        batch = slot->queue;
+        if (!batch)
+            break;
+
+        slot->queue = batch->next;
+        pthread_mutex_unlock(&slot->lock);
+
+        if (slot->dec->decode(slot->inst, batch->xfer, batch->count) != 0)
+            slot->errors++;
+        slot->transfers += batch->count;
+
+        pthread_mutex_lock(&slot->lock);
+        batch->next = slot->free;
+        slot->free  = batch;
+        pthread_cond_broadcast(&slot->cond);
+    }
+    pthread_mutex_unlock(&slot->lock);
+
+    return NULL;
+}
+//-----------------------------------------------------------------
+// decoder_submit: Queue current batch for the worker
+//-----------------------------------------------------------------
+static void decoder_submit(struct decoder_slot *slot)
+{
+    struct decoder_batch *batch = slot->cur;
+
+    if (!batch || !batch->count)
+        return;
+
+    slot->cur   = NULL;
+    batch->next = NULL;
+
+    pthread_mutex_lock(&slot->lock);
+    if (slot->queue)
+        slot->queue_tail->next = batch;
+    else
+        slot->queue = batch;
+    slot->queue_tail = batch;
+    pthread_cond_broadcast(&slot->cond);
+    pthread_mutex_unlock(&slot->lock);
+}
+//-----------------------------------------------------------------
+// decoder_batch_get: Empty batch, waiting for the worker once
+// DECODER_QUEUE_DEPTH are in flight
+//-----------------------------------------------------------------
+static struct decoder_batch* decoder_batch_get(struct decoder_slot *slot)
+{
+    struct decoder_batch *batch = NULL;
+
+    pthread_mutex_lock(&slot->lock);
+    if (!slot->free && slot->allocated >= DECODER_QUEUE_DEPTH)
+    {
+        slot->waits++;
+        while (!slot->free)
+            pthread_cond_wait(&slot->cond, &slot->lock);
+    }
+
+    if (slot->free)
+    {
+        batch = slot->free;
+        slot->free = batch->next;
+    }
+    else
+        slot->allocated++;
+    pthread_mutex_unlock(&slot->lock);
+
+    if (!batch)
+    {
+        batch = (struct decoder_batch *)malloc(sizeof(struct decoder_batch));
+        assert(batch);
+    }
+
+    batch->count   = 0;
+    batch->packets = 0;
+    batch->used    = 0;
+    return batch;
+}
+//-----------------------------------------------------------------
+// decoder_batch_ready: Can an empty batch be had without waiting?
+//-----------------------------------------------------------------
+static int decoder_batch_ready(struct decoder_slot *slot)
+{
+    int ready;
+
+    pthread_mutex_lock(&slot->lock);
+    ready = slot->free || slot->allocated < DECODER_QUEUE_DEPTH;
+    pthread_mutex_unlock(&slot->lock);
+    return ready;
+}
+//-----------------------------------------------------------------
+// decoder_copy: Append transfer to decoder's batch
+//-----------------------------------------------------------------
+static void decoder_copy(struct decoder_slot *slot, const tTransfer *xfer)
+{
+    struct decoder_batch *batch = slot->cur;
+    tDecoderTransfer *out;
+    const tTxnNode *node;
+    uint32_t packets = 0;
+
+    for (node = xfer->first; node; node = node->next)
+        packets++;
+
+    if (batch && (batch->count == DECODER_BATCH_XFERS ||
+                  batch->packets + packets > DECODER_BATCH_PACKETS ||
+                  batch->used + xfer->bytes > DECODER_BATCH_DATA))
+    {
+        // Capture never waits for a decoder which has fallen behind,
+        // the batch is thrown away and refilled
+        if (slot->live && !decoder_batch_ready(slot))
+        {
+            slot->dropped++;
+            slot->dropped_xfers += batch->count;
+            batch->count   = 0;
+            batch->packets = 0;
+            batch->used    = 0;
+        }
+        else
+        {
+            decoder_submit(slot);
+            batch = NULL;
+        }
+    }
+
+    if (!batch)
+        batch = slot->cur = decoder_batch_get(slot);
+
+    out = &batch->xfer[batch->count++];
+    out->start    = xfer->start;
+    out->end      = xfer->end;
+    out->bytes    = xfer->bytes;
+    out->naks     = xfer->naks;
+    out->device   = xfer->device;
+    out->endpoint = xfer->endpoint;
+    out->type     = xfer->type;
+    out->dir      = xfer->dir;
+    out->status   = xfer->status;
+    out->reserved = 0;
+    out->packets  = packets;
+    out->packet   = &batch->packet[batch->packets];
+    out->data     = &batch->data[batch->used];
+    memcpy(out->setup, xfer->setup, sizeof(out->setup));
+
+    for (node = xfer->first; node; node = node->next)
+    {
+        tDecoderPacket *pkt = &batch->packet[batch->packets++];
+        int len = node->txn.length >= 2 ? node->txn.length - 2 : 0;
+
+        pkt->time   = node->txn.time;
+        pkt->offset = batch->used - (uint32_t)(out->data - batch->data);
+        pkt->length = len;
+        pkt->pid    = node->txn.data;
+        pkt->flags  = node->txn.flags;
+
+        memcpy(&batch->data[batch->used], node->data, len);
+        batch->used += len;
+    }
+}
+//-----------------------------------------------------------------
+// decoder_host_slot: Dispatch table index of an endpoint (control
+// transfers run both ways on one entry)
+//-----------------------------------------------------------------
+static int decoder_host_slot(int device, int endpoint, int pid)
+{
+    return SNOOP_SLOT(device, endpoint, endpoint != 0 && pid == PID_IN);
+}
+//-----------------------------------------------------------------
+// decoder_host_emit: Transfer assembler callback
+//-----------------------------------------------------------------
+static int decoder_host_emit(void *ctx, const tTransfer *xfer)
+{
+    tDecoderHost *host = (tDecoderHost *)ctx;
+    uint32_t subs = host->subs[decoder_host_slot(xfer->device, xfer->endpoint, xfer->dir)];
+    int i;
+
+    for (i=0;subs;i++, subs >>= 1)
+        if (subs & 1)
+            decoder_copy(&host->decoders[i], xfer);
+
+    return 0;
+}
+//-----------------------------------------------------------------
+// decoder_host_resolve: Ask decoders about an endpoint
+//-----------------------------------------------------------------
+static void decoder_host_resolve(tDecoderHost *host, int slot)
+{
+    const tSnoopEndpoint *desc = &host->snoop.ep[slot];
+    tDecoderEndpoint ep;
+    uint32_t subs = 0;
+    int i;
+
+    memset(&ep, 0, sizeof(ep));
+    ep.device   = slot / 32;
+    ep.endpoint = (slot / 2) % 16;
+    ep.dir      = (slot & 1) ? PID_IN : PID_OUT;
+
+    if (desc->valid)
+    {
+        ep.described      = 1;
+        ep.attributes     = desc->attributes;
+        ep.interface      = desc->interface;
+        ep.iface_class    = desc->iface_class;
+        ep.iface_subclass = desc->iface_subclass;
+        ep.iface_protocol = desc->iface_protocol;
+        ep.max_packet     = desc->max_packet;
+    }
+
+    for (i=0;i<host->count;i++)
+        if (host->decoders[i].dec->subscribe(host->decoders[i].inst, &ep))
+            subs |= 1u << i;
+
+    host->subs[slot]     = subs;
+    host->resolved[slot] = 1;
+}
+//-----------------------------------------------------------------
+// decoder_host_create
+//-----------------------------------------------------------------
+tDecoderHost* decoder_host_create(void)
+{
+    tDecoderHost *host = (tDecoderHost *)calloc(1, sizeof(tDecoderHost));
+    assert(host);
+
+    host->xa = transfer_assembler_create(decoder_host_emit, host);
+    descriptor_snoop_init(&host->snoop);
+
+    // Only subscribed endpoints reach the assembler, enumeration
+    // traffic is seen by the host's snoop
+    transfer_assembler_set_snoop(host->xa, &host->snoop);
+    return host;
+}
+//-----------------------------------------------------------------
+// decoder_host_add: Start an instance of decoder
+//-----------------------------------------------------------------
+int decoder_host_add(tDecoderHost *host, const tClassDecoder *dec, const char *args)
+{
+    struct decoder_slot *slot;
+
+    if (!dec || dec->version != CLASS_DECODER_VERSION ||
+        !dec->create || !dec->subscribe || !dec->decode)
+    {
+        fprintf(stderr, "ERROR: Incompatible class decoder %s\n", (dec && dec->name) ? dec->name : "");
+        return -1;
+    }
+
+    if (host->count == DECODER_HOST_MAX)
+    {
+        fprintf(stderr, "ERROR: Too many class decoders\n");
+        return -1;
+    }
+
+    slot = &host->decoders[host->count];
+    memset(slot, 0, sizeof(*slot));
+    slot->dec  = dec;
+    slot->inst = dec->create(args);
+    if (!slot->inst)
+    {
+        fprintf(stderr, "ERROR: Could not start class decoder %s\n", dec->name);
+        return -1;
+    }
+
+    slot->live = host->live;
+    pthread_mutex_init(&slot->lock, NULL);
+    pthread_cond_init(&slot->cond, NULL);
+    if (pthread_create(&slot->thread, NULL, decoder_worker, slot) != 0)
+    {
+        fprintf(stderr, "ERROR: Could not start class decoder thread\n");
+        if (dec->destroy)
+            dec->destroy(slot->inst);
+        return -1;
+    }
+
+    // Endpoints already seen are offered again
+    memset(host->resolved, 0, sizeof(host->resolved));
+    host->count++;
+    return 0;
+}
+//-----------------------------------------------------------------
+// decoder_host_load: Add decoder by built in name or plugin path,
+// optionally followed by :args
+//-----------------------------------------------------------------
+int decoder_host_load(tDecoderHost *host, const char *spec)
+{
+    tClassDecoderEntry entry;
+    const char *args = strchr(spec, ':');
+    char name[1024];
+    void *dl;
+    int i;
+
+    snprintf(name, sizeof(name), "%.*s", args ? (int)(args - spec) : (int)strlen(spec), spec);
+    if (args)
+        args++;
+
+    for (i=0;_builtin_decoders[i];i++)
+        if (strcmp(_builtin_decoders[i]()->name, name) == 0)
+            return decoder_host_add(host, _builtin_decoders[i](), args);
+
+    dl = dlopen(name, RTLD_NOW | RTLD_LOCAL);
+    if (!dl)
+    {
+        fprintf(stderr, "ERROR: Could not load class decoder %s (%s)\n", name, dlerror());
+        return -1;
+    }
+
+    entry = (tClassDecoderEntry)dlsym(dl, CLASS_DECODER_SYMBOL);
+    if (!entry || decoder_host_add(host, entry(), args) != 0)
+    {
+        if (!entry)
+            fprintf(stderr, "ERROR: %s has no %s\n", name, CLASS_DECODER_SYMBOL);
+        dlclose(dl);
+        return -1;
+    }
+
+    host->decoders[host->count - 1].dl = dl;
+    return 0;
+}
+//-----------------------------------------------------------------
+// decoder_host_set_live: Records come from the acquisition loop, a
+// decoder which falls DECODER_QUEUE_DEPTH batches behind loses
+// batches instead of holding up the capture
+//-----------------------------------------------------------------
+void decoder_host_set_live(tDecoderHost *host, int live)
+{
+    int i;
+
+    host->live = live;
+    for (i=0;i<host->count;i++)
+        host->decoders[i].live = live;
+}
+//-----------------------------------------------------------------
+// decoder_host_add_record: Feed next record. Only endpoints some
+// decoder subscribed to are reassembled into transfers.
+//-----------------------------------------------------------------
+int decoder_host_add_record(tDecoderHost *host, const tLogRecord *rec)
+{
+    int device;
+    int slot;
+
+    // Configuration read: offer the device's endpoints again
+    device = descriptor_snoop_add(&host->snoop, rec);
+    if (device >= 0)
+        memset(&host->resolved[SNOOP_SLOT(device, 0, 0)], 0, 16 * 2);
+
+    switch (rec->type)
+    {
+        case LOG_CTRL_TYPE_TOKEN:
+            host->active = 0;
+            if (rec->pid != PID_IN && rec->pid != PID_OUT && rec->pid != PID_SETUP)
+                return 0;
+
+            slot = decoder_host_slot(rec->device, rec->endpoint, rec->pid);
+            if (!host->resolved[slot])
+                decoder_host_resolve(host, slot);
+
+            host->active = (host->subs[slot] != 0);
+            break;
+        case LOG_CTRL_TYPE_DATA:
+        case LOG_CTRL_TYPE_HSHAKE:
+            break;
+        default:
+            host->active = 1;
+            break;
+    }
+
+    if (!host->active)
+        return 0;
+
+    return transfer_assembler_add_record(host->xa, rec);
+}
+//-----------------------------------------------------------------
+// decoder_host_flush: Hand partly filled batches to the decoders
+// (e.g. periodically while capturing)
+//-----------------------------------------------------------------
+void decoder_host_flush(tDecoderHost *host)
+{
+    int i;
+
+    // Live: a batch with nothing to replace it keeps filling
+    for (i=0;i<host->count;i++)
+        if (!host->live || decoder_batch_ready(&host->decoders[i]))
+            decoder_submit(&host->decoders[i]);
+}
+//-----------------------------------------------------------------
+// decoder_host_finish: End of capture, wait for the decoders and
+// print their reports
+//-----------------------------------------------------------------
+int decoder_host_finish(tDecoderHost *host, FILE *f)
+{
+    int err = 0;
+    int i;
+
+    if (transfer_assembler_flush(host->xa) != 0)
+        err = -1;
+
+    for (i=0;i<host->count;i++)
+    {
+        struct decoder_slot *slot = &host->decoders[i];
+
+        decoder_submit(slot);
+
+        pthread_mutex_lock(&slot->lock);
+        slot->stop = 1;
+        pthread_cond_broadcast(&slot->cond);
+        pthread_mutex_unlock(&slot->lock);
+    }
+
+    for (i=0;i<host->count;i++)
+    {
+        struct decoder_slot *slot = &host->decoders[i];
+
+        pthread_join(slot->thread, NULL);
+
+        fprintf(f, "%s: %llu transfers", slot->dec->name, (unsigned long long)slot->transfers);
+        if (slot->errors)
+            fprintf(f, ", %llu failed batches", (unsigned long long)slot->errors);
+        if (slot->waits)
+            fprintf(f, ", capture waited %llu times", (unsigned long long)slot->waits);
+        if (slot->dropped)
+            fprintf(f, ", %llu batches (%llu transfers) dropped falling behind capture",
+                    (unsigned long long)slot->dropped, (unsigned long long)slot->dropped_xfers);
+        fprintf(f, "\n");
+
+        if (slot->dec->report)
+            slot->dec->report(slot->inst, f);
+    }
+
+    return err;
+}
+//-----------------------------------------------------------------
+// decoder_host_destroy: (after decoder_host_finish)
+//-----------------------------------------------------------------
+void decoder_host_destroy(tDecoderHost *host)
+{
+    struct decoder_batch *batch;
+    int i;
+
+    for (i=0;i<host->count;i++)
+    {
+        struct decoder_slot *slot = &host->decoders[i];
+
+        while ((batch = slot->free) != NULL)
+        {
+            slot->free = batch->next;
+            free(batch);
+        }
+
+        if (slot->dec->destroy)
+            slot->dec->destroy(slot->inst);
+
+        pthread_mutex_destroy(&slot->lock);
+        pthread_cond_destroy(&slot->cond);
+
+        if (slot->dl)
+            dlclose(slot->dl);
+    }
+
+    transfer_assembler_destroy(host->xa);
+    free(host);
+}
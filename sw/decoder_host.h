@@ -0,0 +1,44 @@
+#ifndef __DECODER_HOST_H__
+#define __DECODER_HOST_H__
+
+//--------------------------------------------------------------------
+// Defines
+//--------------------------------------------------------------------
+// Decoders per host (one bit each in the endpoint dispatch table)
+#define DECODER_HOST_MAX        32
+
+// Transfers are copied into batches handed to decoder threads
+#define DECODER_BATCH_XFERS     256
+#define DECODER_BATCH_PACKETS   4096
+#define DECODER_BATCH_DATA      (1024 * 1024)
+
+// Batches queued per decoder before the feeding thread waits (or,
+// live, drops batches)
+#define DECODER_QUEUE_DEPTH     8
+
+//--------------------------------------------------------------------
+// Structures
+//--------------------------------------------------------------------
+typedef struct decoder_host tDecoderHost;
+
+//--------------------------------------------------------------------
+// Prototypes
+//--------------------------------------------------------------------
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+tDecoderHost* decoder_host_create(void);
+int           decoder_host_add(tDecoderHost *host, const tClassDecoder *dec, const char *args);
+int           decoder_host_load(tDecoderHost *host, const char *spec);
+void          decoder_host_set_live(tDecoderHost *host, int live);
+int           decoder_host_add_record(tDecoderHost *host, const tLogRecord *rec);
+void          decoder_host_flush(tDecoderHost *host);
+int           decoder_host_finish(tDecoderHost *host, FILE *f);
+void          decoder_host_destroy(tDecoderHost *host);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,160 @@
+//-----------------------------------------------------------------
+//                       USB Sniffer
+//                           V0.1
+//                     Ultra-Embedded.com
+//                       Copyright 2015
+//
+//               Email: admin@ultra-embedded.com
+//
+//                       License: LGPL
+//-----------------------------------------------------------------
+//
+// Copyright (C) 2011 - 2013 Ultra-Embedded.com
+//
+// This source file may be used and distributed without         
+// restriction provided that this copyright statement is not    
+// removed from the file and that any derivative work contains  
+// the original copyright notice and the associated disclaimer. 
+//
+// This source file is free software; you can redistribute it   
+// and/or modify it under the terms of the GNU Lesser General   
+// Public License as published by the Free Software Foundation; 
+// either version 2.1 of the License, or (at your option) any   
+// later version.
+//
+// This source is distributed in the hope that it will be       
+// useful, but WITHOUT ANY WARRANTY; without even the implied   
+// warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR      
+// PURPOSE.  See the GNU Lesser General Public License for more 
+// details.
+//
+// You should have received a copy of the GNU Lesser General    
+// Public License along with this source; if not, write to the 
+// Free Software Foundation, Inc., 59 Temple Place, Suite 330, 
+// Boston, MA  02111-1307  USA
+//-----------------------------------------------------------------
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+
+#include "usb_defs.h"
+#include "log_format.h"
+#include "log_decode.h"
+#include "descriptor_snoop.h"
+
+//-----------------------------------------------------------------
+// Defines
+//-----------------------------------------------------------------
+#define DESC_TYPE_CONFIG        2
+#define DESC_TYPE_INTERFACE     4
+#define DESC_TYPE_ENDPOINT      5
+
+//-----------------------------------------------------------------
+// descriptor_snoop_init
+//-----------------------------------------------------------------
+void descriptor_snoop_init(tDescriptorSnoop *snoop)
+{
+    memset(snoop, 0, sizeof(*snoop));
+    snoop->cfg_device = -1;
+}
+//-----------------------------------------------------------------
+// descriptor_snoop_parse: Record endpoints of a configuration
+// descriptor against the interface that owns them
+//-----------------------------------------------------------------
+static void descriptor_snoop_parse(tDescriptorSnoop *snoop, int device)
+{
+    const uint8_t *d = snoop->cfg;
+    const uint8_t *iface = NULL;
+    uint32_t i = 0;
+
+    while (i + 2 <= snoop->cfg_length && d[i] >= 2)
+    {
+        if (d[i+1] == DESC_TYPE_INTERFACE && d[i] >= 9 && i + 9 <= snoop->cfg_length)
+            iface = &d[i];
+        else if (d[i+1] == DESC_TYPE_ENDPOINT && d[i] >= 7 && i + 7 <= snoop->cfg_length)
+        {
+            int addr = d[i+2];
+            tSnoopEndpoint *ep = &snoop->ep[SNOOP_SLOT(device, addr & 0xF, addr & 0x80)];
+
+            ep->valid          = 1;
+            ep->attributes     = d[i+3];
+            ep->max_packet     = d[i+4] | (d[i+5] << 8);
+            ep->interval       = d[i+6];
+            ep->interface      = iface ? iface[2] : 0;
+            ep->alt            = iface ? iface[3] : 0;
+            ep->iface_class    = iface ? iface[5] : 0;
+            ep->iface_subclass = iface ? iface[6] : 0;
+            ep->iface_protocol = iface ? iface[7] : 0;
+        }
+
+        i += d[i];
+    }
+}
+//-----------------------------------------------------------------
+// descriptor_snoop_control: Follow GET_DESCRIPTOR(configuration)
+//-----------------------------------------------------------------
+static void descriptor_snoop_control(tDescriptorSnoop *snoop, const tLogRecord *rec)
+{
+    int payload = rec->length - 2;
+
+    if (snoop->token == PID_SETUP && payload >= 8)
+    {
+        const uint8_t *setup = rec->data;
+
+        snoop->cfg_device = -1;
+        if (setup[0] == 0x80 && setup[1] == 0x06 && setup[3] == DESC_TYPE_CONFIG)
+        {
+            snoop->cfg_device = snoop->device;
+            snoop->cfg_length = 0;
+            snoop->cfg_pid    = 0;
+        }
+    }
+    else if (snoop->token == PID_IN && snoop->device == snoop->cfg_device)
+    {
+        // Retransmissions repeat the previous DATA PID
+        if (rec->pid == snoop->cfg_pid || payload <= 0)
+            return;
+
+        snoop->cfg_pid = rec->pid;
+        if (snoop->cfg_length + payload > SNOOP_CONFIG_MAX)
+            payload = SNOOP_CONFIG_MAX - snoop->cfg_length;
+
+        memcpy(snoop->cfg + snoop->cfg_length, rec->data, payload);
+        snoop->cfg_length += payload;
+    }
+}
+//-----------------------------------------------------------------
+// descriptor_snoop_add: Feed next record. Returns the device whose
+// configuration has just been read, else -1.
+//-----------------------------------------------------------------
+int descriptor_snoop_add(tDescriptorSnoop *snoop, const tLogRecord *rec)
+{
+    int device = -1;
+
+    switch (rec->type)
+    {
+        case LOG_CTRL_TYPE_RST:
+            snoop->cfg_device = -1;
+            break;
+        case LOG_CTRL_TYPE_TOKEN:
+            snoop->token    = rec->pid;
+            snoop->device   = rec->device;
+            snoop->endpoint = rec->endpoint;
+
+            // OUT on the control pipe is the status stage
+            if (rec->endpoint == 0 && rec->pid == PID_OUT && rec->device == snoop->cfg_device)
+            {
+                device = snoop->cfg_device;
+                descriptor_snoop_parse(snoop, device);
+                snoop->cfg_device = -1;
+            }
+            break;
+        case LOG_CTRL_TYPE_DATA:
+            if (rec->has_addr && snoop->endpoint == 0 && log_decode_crc_valid(rec))
+                descriptor_snoop_control(snoop, rec);
+            break;
+    }
+
+    return device;
+}
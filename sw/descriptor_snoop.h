@@ -0,0 +1,68 @@
+#ifndef __DESCRIPTOR_SNOOP_H__
+#define __DESCRIPTOR_SNOOP_H__
+
+//--------------------------------------------------------------------
+// Defines
+//--------------------------------------------------------------------
+// Endpoint address space (device, endpoint number, direction)
+#define SNOOP_SLOTS             (128 * 16 * 2)
+#define SNOOP_SLOT(dev, ep, in) (((((dev) & 0x7F) * 16) + ((ep) & 0xF)) * 2 + ((in) ? 1 : 0))
+
+// Largest configuration descriptor kept
+#define SNOOP_CONFIG_MAX        4096
+
+// Endpoint transfer types (bmAttributes & 0x3)
+#define SNOOP_EP_CONTROL        0
+#define SNOOP_EP_ISO            1
+#define SNOOP_EP_BULK           2
+#define SNOOP_EP_INTERRUPT      3
+
+//--------------------------------------------------------------------
+// Structures
+//--------------------------------------------------------------------
+// Endpoint as described by the last configuration descriptor seen
+typedef struct
+{
+    uint8_t  valid;
+    uint8_t  attributes;        // bmAttributes
+    uint8_t  interval;          // bInterval
+    uint8_t  interface;         // bInterfaceNumber
+    uint8_t  alt;               // bAlternateSetting
+    uint8_t  iface_class;       // bInterfaceClass
+    uint8_t  iface_subclass;
+    uint8_t  iface_protocol;
+    uint16_t max_packet;        // wMaxPacketSize
+} tSnoopEndpoint;
+
+// Picks configuration descriptors out of enumeration traffic
+typedef struct
+{
+    tSnoopEndpoint ep[SNOOP_SLOTS];
+
+    // Last token
+    uint8_t        token;
+    uint8_t        device;
+    uint8_t        endpoint;
+
+    // GET_DESCRIPTOR(configuration) being returned (-1 = none)
+    int            cfg_device;
+    uint8_t        cfg_pid;     // Last accepted DATA PID
+    uint32_t       cfg_length;
+    uint8_t        cfg[SNOOP_CONFIG_MAX];
+} tDescriptorSnoop;
+
+//--------------------------------------------------------------------
+// Prototypes
+//--------------------------------------------------------------------
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+void descriptor_snoop_init(tDescriptorSnoop *snoop);
+int  descriptor_snoop_add(tDescriptorSnoop *snoop, const tLogRecord *rec);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
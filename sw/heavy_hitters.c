@@ -0,0 +1,364 @@
+//-----------------------------------------------------------------
+//                       USB Sniffer
+//                           V0.1
+//                     Ultra-Embedded.com
+//                       Copyright 2015
+//
+//               Email: admin@ultra-embedded.com
+//
+//                       License: LGPL
+//-----------------------------------------------------------------
+//
+// Copyright (C) 2011 - 2013 Ultra-Embedded.com
+//
+// This source file may be used and distributed without         
+// restriction provided that this copyright statement is not    
+// removed from the file and that any derivative work contains  
+// the original copyright notice and the associated disclaimer. 
+//
+// This source file is free software; you can redistribute it   
+// and/or modify it under the terms of the GNU Lesser General   
+// Public License as published by the Free Software Foundation; 
+// either version 2.1 of the License, or (at your option) any   
+// later version.
+//
+// This source is distributed in the hope that it will be       
+// useful, but WITHOUT ANY WARRANTY; without even the implied   
+// warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR      
+// PURPOSE.  See the GNU Lesser General Public License for more 
+// details.
+//
+// You should have received a copy of the GNU Lesser General    
+// Public License along with this source; if not, write to the 
+// Free Software Foundation, Inc., 59 Temple Place, Suite 330, 
+// Boston, MA  02111-1307  USA
+//-----------------------------------------------------------------
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <assert.h>
+
+#include "usb_defs.h"
+#include "log_format.h"
+#include "log_decode.h"
+#include "payload_store.h"
+#include "heavy_hitters.h"
+
+//-----------------------------------------------------------------
+// Defines
+//-----------------------------------------------------------------
+#define HITTERS_HASH_SIZE       (HITTERS_ENTRIES * 2)
+#define HITTERS_NONE            (-1)
+
+//-----------------------------------------------------------------
+// Structures
+//-----------------------------------------------------------------
+// Space-saving (Metwally et al.) with the stream-summary layout:
+// entries with equal counts share a bucket, buckets are kept in
+// ascending count order so the minimum is always the list head and
+// a unit increment only ever moves an entry to the next bucket.
+struct hitter_entry
+{
+    tHitter  h;
+    uint64_t hash;
+    int32_t  hash_next;     // Chain in hash table
+    int32_t  bucket;
+    int32_t  prev;          // Siblings in bucket
+    int32_t  next;
+};
+
+struct hitter_bucket
+{
+    uint64_t count;
+    int32_t  first;         // Entries with this count
+    int32_t  prev;          // Neighbouring counts (ascending)
+    int32_t  next;
+};
+
+struct heavy_hitters
+{
+    int                  prefix;
+    int                  used;          // Entries handed out
+    uint64_t             packets;       // Data packets seen
+
+    int32_t              min_bucket;    // Lowest count bucket
+    int32_t              free_bucket;   // Unused bucket list (via next)
+
+    int32_t              table[HITTERS_HASH_SIZE];
+    struct hitter_entry  entries[HITTERS_ENTRIES];
+    struct hitter_bucket buckets[HITTERS_ENTRIES];
+};
+
+//-----------------------------------------------------------------
+// hitters_key_equal
+//-----------------------------------------------------------------
+static int hitters_key_equal(const tHitterKey *a, const tHitterKey *b)
+{
+    return a->device == b->device && a->endpoint == b->endpoint && a->length == b->length &&
+           memcmp(a->prefix, b->prefix, a->length) == 0;
+}
+//-----------------------------------------------------------------
+// hitters_bucket_alloc: New bucket for count, linked after 'after'
+// (HITTERS_NONE = as new minimum)
+//-----------------------------------------------------------------
+static int32_t hitters_bucket_alloc(tHeavyHitters *hh, uint64_t count, int32_t after)
+{
+    int32_t idx = hh->free_bucket;
+    struct hitter_bucket *b = &hh->buckets[idx];
+
+    hh->free_bucket = b->next;
+
+    b->count = count;
+    b->first = HITTERS_NONE;
+    b->prev  = after;
+    b->next  = (after == HITTERS_NONE) ? hh->min_bucket : hh->buckets[after].next;
+
+    if (b->next != HITTERS_NONE)
+        hh->buckets[b->next].prev = idx;
+    if (after == HITTERS_NONE)
+        hh->min_bucket = idx;
+    else
+        hh->buckets[after].next = idx;
+
+    return idx;
+}
+//-----------------------------------------------------------------
+// hitters_detach: Remove entry from its bucket, freeing the bucket
+// if it is left empty
+//-----------------------------------------------------------------
+static void hitters_detach(tHeavyHitters *hh, int32_t idx)
+{
+    struct hitter_entry *e = &hh->entries[idx];
+    struct hitter_bucket *b = &hh->buckets[e->bucket];
+
+    if (e->prev != HITTERS_NONE)
+        hh->entries[e->prev].next = e->next;
+    else
+        b->first = e->next;
+    if (e->next != HITTERS_NONE)
+        hh->entries[e->next].prev = e->prev;
+
+    if (b->first != HITTERS_NONE)
+        return;
+
+    if (b->prev != HITTERS_NONE)
+        hh->buckets[b->prev].next = b->next;
+    else
+        hh->min_bucket = b->next;
+    if (b->next != HITTERS_NONE)
+        hh->buckets[b->next].prev = b->prev;
+
+    b->next = hh->free_bucket;
+    hh->free_bucket = e->bucket;
+}
+//-----------------------------------------------------------------
+// hitters_attach: Add entry to bucket
+//-----------------------------------------------------------------
+static void hitters_attach(tHeavyHitters *hh, int32_t idx, int32_t bucket)
+{
+    struct hitter_entry *e = &hh->entries[idx];
+    struct hitter_bucket *b = &hh->buckets[bucket];
+
+    e->bucket = bucket;
+    e->prev   = HITTERS_NONE;
+    e->next   = b->first;
+    if (b->first != HITTERS_NONE)
+        hh->entries[b->first].prev = idx;
+    b->first  = idx;
+}
+//-----------------------------------------------------------------
+// hitters_increment: Move entry to the next count up
+//-----------------------------------------------------------------
+static void hitters_increment(tHeavyHitters *hh, int32_t idx)
+{
+    struct hitter_entry *e = &hh->entries[idx];
+    int32_t  cur   = e->bucket;
+    uint64_t count = hh->buckets[cur].count + 1;
+    int32_t  next  = hh->buckets[cur].next;
+    int32_t  after = cur;
+
+    // Current bucket goes away if this was its only entry
+    if (hh->buckets[cur].first == idx && e->next == HITTERS_NONE)
+        after = hh->buckets[cur].prev;
+
+    hitters_detach(hh, idx);
+
+    if (next == HITTERS_NONE || hh->buckets[next].count != count)
+        next = hitters_bucket_alloc(hh, count, after);
+
+    hitters_attach(hh, idx, next);
+    e->h.count = count;
+}
+//-----------------------------------------------------------------
+// hitters_unhash: Remove entry from hash table
+//-----------------------------------------------------------------
+static void hitters_unhash(tHeavyHitters *hh, int32_t idx)
+{
+    int32_t *link = &hh->table[hh->entries[idx].hash % HITTERS_HASH_SIZE];
+
+    while (*link != idx)
+        link = &hh->entries[*link].hash_next;
+
+    *link = hh->entries[idx].hash_next;
+}
+//-----------------------------------------------------------------
+// heavy_hitters_create: prefix = payload bytes in key (0 = endpoints)
+//-----------------------------------------------------------------
+tHeavyHitters* heavy_hitters_create(int prefix)
+{
+    tHeavyHitters *hh;
+    int i;
+
+    if (prefix < 0 || prefix > HITTERS_MAX_PREFIX)
+    {
+        fprintf(stderr, "ERROR: Payload prefix must be 0 to %d bytes\n", HITTERS_MAX_PREFIX);
+        return NULL;
+    }
+
+    hh = (tHeavyHitters *)calloc(1, sizeof(tHeavyHitters));
+    assert(hh);
+
+    hh->prefix     = prefix;
+    hh->min_bucket = HITTERS_NONE;
+
+    for (i=0;i<HITTERS_HASH_SIZE;i++)
+        hh->table[i] = HITTERS_NONE;
+
+    for (i=0;i<HITTERS_ENTRIES;i++)
+        hh->buckets[i].next = (i + 1 < HITTERS_ENTRIES) ? (i + 1) : HITTERS_NONE;
+    hh->free_bucket = 0;
+
+    return hh;
+}
+//-----------------------------------------------------------------
+// heavy_hitters_add: Count data packet (other records ignored).
+// O(1): hash lookup, then either a bucket step or replacing one of
+// the minimum count entries.
+//-----------------------------------------------------------------
+int heavy_hitters_add(tHeavyHitters *hh, const tLogRecord *rec)
+{
+    struct hitter_entry *e;
+    tHitterKey key;
+    int payload;
+    int32_t idx;
+    uint64_t hash;
+
+    if (rec->type != LOG_CTRL_TYPE_DATA || !rec->has_addr)
+        return 0;
+
+    payload = (rec->length >= 2) ? (rec->length - 2) : 0;
+
+    memset(&key, 0, sizeof(key));
+    key.device   = rec->device;
+    key.endpoint = rec->endpoint;
+    key.length   = (payload < hh->prefix) ? payload : hh->prefix;
+    memcpy(key.prefix, rec->data, key.length);
+
+    hash = payload_hash((const uint8_t *)&key, sizeof(key), 0);
+    hh->packets++;
+
+    for (idx = hh->table[hash % HITTERS_HASH_SIZE]; idx != HITTERS_NONE; idx = hh->entries[idx].hash_next)
+        if (hh->entries[idx].hash == hash && hitters_key_equal(&hh->entries[idx].h.key, &key))
+            break;
+
+    if (idx == HITTERS_NONE)
+    {
+        uint64_t min = 0;
+
+        if (hh->used < HITTERS_ENTRIES)
+        {
+            idx = hh->used++;
+
+            // Enter at count 0, stepped to 1 below
+            if (hh->min_bucket == HITTERS_NONE || hh->buckets[hh->min_bucket].count != 0)
+                hitters_bucket_alloc(hh, 0, HITTERS_NONE);
+        }
+        else
+        {
+            // Take over a minimum entry, inheriting its count as error
+            idx = hh->buckets[hh->min_bucket].first;
+            min = hh->buckets[hh->min_bucket].count;
+            hitters_unhash(hh, idx);
+            hitters_detach(hh, idx);
+
+            if (hh->min_bucket == HITTERS_NONE || hh->buckets[hh->min_bucket].count != min)
+                hitters_bucket_alloc(hh, min, HITTERS_NONE);
+        }
+
+        e = &hh->entries[idx];
+        e->h.key   = key;
+        e->h.count = min;
+        e->h.error = min;
+        e->h.bytes = 0;
+        e->hash    = hash;
+        e->hash_next = hh->table[hash % HITTERS_HASH_SIZE];
+        hh->table[hash % HITTERS_HASH_SIZE] = idx;
+
+        hitters_attach(hh, idx, hh->min_bucket);
+    }
+
+    e = &hh->entries[idx];
+    e->h.bytes += payload;
+    hitters_increment(hh, idx);
+    return 0;
+}
+//-----------------------------------------------------------------
+// heavy_hitters_top: Copy up to max entries, highest count first.
+// Returns number copied.
+//-----------------------------------------------------------------
+int heavy_hitters_top(tHeavyHitters *hh, tHitter *out, int max)
+{
+    int32_t b;
+    int32_t last = HITTERS_NONE;
+    int32_t idx;
+    int count = 0;
+
+    // Walk buckets from the highest count down
+    for (b = hh->min_bucket; b != HITTERS_NONE; b = hh->buckets[b].next)
+        last = b;
+
+    for (b = last; b != HITTERS_NONE && count < max; b = hh->buckets[b].prev)
+        for (idx = hh->buckets[b].first; idx != HITTERS_NONE && count < max; idx = hh->entries[idx].next)
+            out[count++] = hh->entries[idx].h;
+
+    return count;
+}
+//-----------------------------------------------------------------
+// heavy_hitters_report: Print top entries with share of data packets
+//-----------------------------------------------------------------
+void heavy_hitters_report(FILE *f, tHeavyHitters *hh, int max)
+{
+    tHitter top[HITTERS_REPORT];
+    int count;
+    int i;
+    int j;
+
+    if (max > HITTERS_REPORT)
+        max = HITTERS_REPORT;
+
+    count = heavy_hitters_top(hh, top, max);
+    if (!count)
+        return;
+
+    fprintf(f, "  Top payloads (%llu data packets):\n", (unsigned long long)hh->packets);
+    for (i=0;i<count;i++)
+    {
+        fprintf(f, "    dev %3d ep %2d  %5.1f%%  n=%-9llu err %-7llu %9llu bytes ",
+                top[i].key.device, top[i].key.endpoint,
+                top[i].count * 100.0 / hh->packets,
+                (unsigned long long)top[i].count, (unsigned long long)top[i].error,
+                (unsigned long long)top[i].bytes);
+
+        for (j=0;j<top[i].key.length;j++)
+            fprintf(f, " %02x", top[i].key.prefix[j]);
+        fprintf(f, "\n");
+    }
+}
+//-----------------------------------------------------------------
+// heavy_hitters_destroy
+//-----------------------------------------------------------------
+void heavy_hitters_destroy(tHeavyHitters *hh)
+{
+    free(hh);
+}
@@ -0,0 +1,55 @@
+#ifndef __HEAVY_HITTERS_H__
+#define __HEAVY_HITTERS_H__
+
+//--------------------------------------------------------------------
+// Defines
+//--------------------------------------------------------------------
+// Tracked (device, endpoint, payload prefix) keys, fixed memory
+#define HITTERS_ENTRIES         1024
+#define HITTERS_MAX_PREFIX      16
+#define HITTERS_DEF_PREFIX      8
+
+// Entries shown per report
+#define HITTERS_REPORT          10
+
+//--------------------------------------------------------------------
+// Structures
+//--------------------------------------------------------------------
+typedef struct
+{
+    uint8_t  device;
+    uint8_t  endpoint;
+    uint8_t  length;        // Prefix bytes used (payload may be shorter)
+    uint8_t  reserved;
+    uint8_t  prefix[HITTERS_MAX_PREFIX];
+} tHitterKey;
+
+// Space-saving estimate: true count lies in [count - error, count]
+typedef struct
+{
+    tHitterKey key;
+    uint64_t   count;       // Data packets
+    uint64_t   error;       // Overestimate bound
+    uint64_t   bytes;       // Payload bytes seen while tracked
+} tHitter;
+
+typedef struct heavy_hitters tHeavyHitters;
+
+//--------------------------------------------------------------------
+// Prototypes
+//--------------------------------------------------------------------
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+tHeavyHitters* heavy_hitters_create(int prefix);
+int            heavy_hitters_add(tHeavyHitters *hh, const tLogRecord *rec);
+int            heavy_hitters_top(tHeavyHitters *hh, tHitter *out, int max);
+void           heavy_hitters_report(FILE *f, tHeavyHitters *hh, int max);
+void           heavy_hitters_destroy(tHeavyHitters *hh);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
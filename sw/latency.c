@@ -0,0 +1,307 @@
+//-----------------------------------------------------------------
+//                       USB Sniffer
+//                           V0.1
+//                     Ultra-Embedded.com
+//                       Copyright 2015
+//
+//               Email: admin@ultra-embedded.com
+//
+//                       License: LGPL
+//-----------------------------------------------------------------
+//
+// Copyright (C) 2011 - 2013 Ultra-Embedded.com
+//
+// This source file may be used and distributed without         
+// restriction provided that this copyright statement is not    
+// removed from the file and that any derivative work contains  
+// the original copyright notice and the associated disclaimer. 
+//
+// This source file is free software; you can redistribute it   
+// and/or modify it under the terms of the GNU Lesser General   
+// Public License as published by the Free Software Foundation; 
+// either version 2.1 of the License, or (at your option) any   
+// later version.
+//
+// This source is distributed in the hope that it will be       
+// useful, but WITHOUT ANY WARRANTY; without even the implied   
+// warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR      
+// PURPOSE.  See the GNU Lesser General Public License for more 
+// details.
+//
+// You should have received a copy of the GNU Lesser General    
+// Public License along with this source; if not, write to the 
+// Free Software Foundation, Inc., 59 Temple Place, Suite 330, 
+// Boston, MA  02111-1307  USA
+//-----------------------------------------------------------------
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <assert.h>
+
+#include "usb_defs.h"
+#include "log_format.h"
+#include "log_decode.h"
+#include "latency.h"
+
+//-----------------------------------------------------------------
+// Defines
+//-----------------------------------------------------------------
+#define LATENCY_SLOTS           (128 * 16)
+#define LATENCY_SLOT(dev, ep)   ((((dev) & 0x7F) * 16) + ((ep) & 0xF))
+
+//-----------------------------------------------------------------
+// Structures
+//-----------------------------------------------------------------
+struct latency_stats
+{
+    // Histograms, allocated on first sample for an endpoint
+    tLatencyHist *hist[LATENCY_SLOTS][LATENCY_PHASES];
+
+    // Last token / data on the bus
+    uint8_t       token;        // 0 = none
+    int           slot;
+    uint64_t      token_time;
+    uint64_t      data_time;
+    int           has_data;
+
+    // SETUP awaiting its first answered IN (time + 1, 0 = none)
+    uint64_t      setup_time[LATENCY_SLOTS];
+};
+
+//-----------------------------------------------------------------
+// Locals
+//-----------------------------------------------------------------
+static const char *_phase_names[LATENCY_PHASES] =
+{
+    "IN->DATA",
+    "IN->NAK",
+    "DATA->ACK",
+    "SETUP->IN"
+};
+
+//-----------------------------------------------------------------
+// latency_bucket: Bucket index of value
+//-----------------------------------------------------------------
+static int latency_bucket(uint64_t value)
+{
+    int msb;
+    int group;
+
+    if (value < LATENCY_LINEAR)
+        return (int)value;
+
+    msb   = 63 - __builtin_clzll(value);
+    group = msb - LATENCY_SUB_BITS;
+    if (group >= LATENCY_MAX_GROUP)
+        return LATENCY_BUCKETS - 1;
+
+    return LATENCY_LINEAR + (group - 1) * (1 << LATENCY_SUB_BITS) +
+           (int)((value >> group) - (1 << LATENCY_SUB_BITS));
+}
+//-----------------------------------------------------------------
+// latency_hist_bucket_value: Midpoint of bucket
+//-----------------------------------------------------------------
+uint64_t latency_hist_bucket_value(int idx)
+{
+    int group;
+    uint64_t mant;
+
+    if (idx < LATENCY_LINEAR)
+        return idx;
+
+    group = (idx - LATENCY_LINEAR) / (1 << LATENCY_SUB_BITS) + 1;
+    mant  = (idx - LATENCY_LINEAR) % (1 << LATENCY_SUB_BITS) + (1 << LATENCY_SUB_BITS);
+    return (mant << group) + ((1ULL << group) >> 1);
+}
+//-----------------------------------------------------------------
+// latency_hist_init
+//-----------------------------------------------------------------
+void latency_hist_init(tLatencyHist *h)
+{
+    memset(h, 0, sizeof(*h));
+    h->min = UINT64_MAX;
+}
+//-----------------------------------------------------------------
+// latency_hist_add: Record one value (constant time and memory)
+//-----------------------------------------------------------------
+void latency_hist_add(tLatencyHist *h, uint64_t value)
+{
+    h->buckets[latency_bucket(value)]++;
+    h->count++;
+    h->sum += value;
+    if (value < h->min)
+        h->min = value;
+    if (value > h->max)
+        h->max = value;
+}
+//-----------------------------------------------------------------
+// latency_hist_percentile: Value at percentile (0-100)
+//-----------------------------------------------------------------
+uint64_t latency_hist_percentile(const tLatencyHist *h, double pct)
+{
+    uint64_t target;
+    uint64_t seen = 0;
+    uint64_t value;
+    int i;
+
+    if (h->count == 0)
+        return 0;
+
+    target = (uint64_t)(pct / 100.0 * h->count + 0.5);
+    if (target < 1)
+        target = 1;
+
+    for (i=0;i<LATENCY_BUCKETS;i++)
+    {
+        seen += h->buckets[i];
+        if (seen >= target)
+        {
+            // Bucket midpoint, kept within the values actually seen
+            value = latency_hist_bucket_value(i);
+            if (value < h->min)
+                value = h->min;
+            if (value > h->max)
+                value = h->max;
+            return value;
+        }
+    }
+
+    return h->max;
+}
+//-----------------------------------------------------------------
+// latency_sample: Add sample for endpoint phase
+//-----------------------------------------------------------------
+static void latency_sample(tLatencyStats *lat, int slot, int phase, uint64_t value)
+{
+    tLatencyHist *h = lat->hist[slot][phase];
+
+    if (!h)
+    {
+        h = (tLatencyHist *)malloc(sizeof(tLatencyHist));
+        assert(h);
+        latency_hist_init(h);
+        lat->hist[slot][phase] = h;
+    }
+
+    latency_hist_add(h, value);
+}
+//-----------------------------------------------------------------
+// latency_create: NULL if out of memory
+//-----------------------------------------------------------------
+tLatencyStats* latency_create(void)
+{
+    tLatencyStats *lat = (tLatencyStats *)calloc(1, sizeof(tLatencyStats));
+
+    if (!lat)
+        fprintf(stderr, "ERROR: Out of memory\n");
+    return lat;
+}
+//-----------------------------------------------------------------
+// latency_add: Feed next record
+//-----------------------------------------------------------------
+int latency_add(tLatencyStats *lat, const tLogRecord *rec)
+{
+    switch (rec->type)
+    {
+        case LOG_CTRL_TYPE_TOKEN:
+            lat->token      = rec->pid;
+            lat->slot       = LATENCY_SLOT(rec->device, rec->endpoint);
+            lat->token_time = rec->time;
+            lat->has_data   = 0;
+
+            if (rec->pid == PID_SETUP)
+                lat->setup_time[lat->slot] = rec->time + 1;
+            break;
+        case LOG_CTRL_TYPE_DATA:
+            if (!lat->token || lat->has_data)
+                break;
+
+            lat->has_data  = 1;
+            lat->data_time = rec->time;
+
+            if (lat->token == PID_IN)
+            {
+                latency_sample(lat, lat->slot, LATENCY_IN_DATA, rec->time - lat->token_time);
+
+                if (lat->setup_time[lat->slot])
+                {
+                    latency_sample(lat, lat->slot, LATENCY_SETUP_IN, rec->time - (lat->setup_time[lat->slot] - 1));
+                    lat->setup_time[lat->slot] = 0;
+                }
+            }
+            break;
+        case LOG_CTRL_TYPE_HSHAKE:
+            if (!lat->token)
+                break;
+
+            if (lat->token == PID_IN && !lat->has_data)
+            {
+                latency_sample(lat, lat->slot, LATENCY_IN_NAK, rec->time - lat->token_time);
+
+                if (rec->pid == PID_STALL && lat->setup_time[lat->slot])
+                {
+                    latency_sample(lat, lat->slot, LATENCY_SETUP_IN, rec->time - (lat->setup_time[lat->slot] - 1));
+                    lat->setup_time[lat->slot] = 0;
+                }
+            }
+            else if (lat->token != PID_IN && lat->has_data)
+                latency_sample(lat, lat->slot, LATENCY_DATA_ACK, rec->time - lat->data_time);
+
+            // One handshake per token
+            lat->token = 0;
+            break;
+        case LOG_CTRL_TYPE_RST:
+            memset(lat->setup_time, 0, sizeof(lat->setup_time));
+            lat->token = 0;
+            break;
+        case LOG_CTRL_TYPE_SOF:
+            lat->token = 0;
+            break;
+    }
+
+    return 0;
+}
+//-----------------------------------------------------------------
+// latency_report: Percentiles (us) per endpoint and phase so far
+//-----------------------------------------------------------------
+void latency_report(FILE *f, tLatencyStats *lat)
+{
+    static const double pcts[] = { 50.0, 90.0, 99.0, 99.9 };
+    const tLatencyHist *h;
+    double us = TICKS_PER_SEC / 1e6;
+    int slot;
+    int phase;
+    int i;
+
+    for (slot=0;slot<LATENCY_SLOTS;slot++)
+        for (phase=0;phase<LATENCY_PHASES;phase++)
+        {
+            h = lat->hist[slot][phase];
+            if (!h)
+                continue;
+
+            fprintf(f, "    dev %3d ep %2d  %-9s n=%-9llu min %8.3f",
+                    slot / 16, slot % 16, _phase_names[phase],
+                    (unsigned long long)h->count, h->min / us);
+
+            for (i=0;i<(int)(sizeof(pcts) / sizeof(pcts[0]));i++)
+                fprintf(f, "  p%g %8.3f", pcts[i], latency_hist_percentile(h, pcts[i]) / us);
+
+            fprintf(f, "  max %8.3f us\n", h->max / us);
+        }
+}
+//-----------------------------------------------------------------
+// latency_destroy
+//-----------------------------------------------------------------
+void latency_destroy(tLatencyStats *lat)
+{
+    int slot;
+    int phase;
+
+    for (slot=0;slot<LATENCY_SLOTS;slot++)
+        for (phase=0;phase<LATENCY_PHASES;phase++)
+            free(lat->hist[slot][phase]);
+
+    free(lat);
+}
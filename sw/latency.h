@@ -0,0 +1,61 @@
+#ifndef __LATENCY_H__
+#define __LATENCY_H__
+
+//--------------------------------------------------------------------
+// Defines
+//--------------------------------------------------------------------
+// Log bucketed histogram: values below 32 are exact, above that each
+// power of two is split into 16 buckets (within 1/16 of the value)
+#define LATENCY_SUB_BITS        4
+#define LATENCY_LINEAR          (2 << LATENCY_SUB_BITS)
+#define LATENCY_MAX_GROUP       40
+#define LATENCY_BUCKETS         (LATENCY_LINEAR + (LATENCY_MAX_GROUP - 1) * (1 << LATENCY_SUB_BITS))
+
+//--------------------------------------------------------------------
+// Enums
+//--------------------------------------------------------------------
+typedef enum
+{
+    LATENCY_IN_DATA,        // IN token to DATA
+    LATENCY_IN_NAK,         // IN token to NAK / STALL
+    LATENCY_DATA_ACK,       // OUT / SETUP DATA to handshake
+    LATENCY_SETUP_IN,       // SETUP to first IN not NAKed
+    LATENCY_PHASES
+} tLatencyPhase;
+
+//--------------------------------------------------------------------
+// Structures
+//--------------------------------------------------------------------
+typedef struct
+{
+    uint64_t count;
+    uint64_t sum;
+    uint64_t min;
+    uint64_t max;
+    uint64_t buckets[LATENCY_BUCKETS];
+} tLatencyHist;
+
+typedef struct latency_stats tLatencyStats;
+
+//--------------------------------------------------------------------
+// Prototypes
+//--------------------------------------------------------------------
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+void           latency_hist_init(tLatencyHist *h);
+void           latency_hist_add(tLatencyHist *h, uint64_t value);
+uint64_t       latency_hist_percentile(const tLatencyHist *h, double pct);
+uint64_t       latency_hist_bucket_value(int idx);
+
+tLatencyStats* latency_create(void);
+int            latency_add(tLatencyStats *lat, const tLogRecord *rec);
+void           latency_report(FILE *f, tLatencyStats *lat);
+void           latency_destroy(tLatencyStats *lat);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,239 @@
+//-----------------------------------------------------------------
+//                       USB Sniffer
+//                           V0.1
+//                     Ultra-Embedded.com
+//                       Copyright 2015
+//
+//               Email: admin@ultra-embedded.com
+//
+//                       License: LGPL
+//-----------------------------------------------------------------
+//
+// Copyright (C) 2011 - 2013 Ultra-Embedded.com
+//
+// This source file may be used and distributed without         
+// restriction provided that this copyright statement is not    
+// removed from the file and that any derivative work contains  
+// the original copyright notice and the associated disclaimer. 
+//
+// This source file is free software; you can redistribute it   
+// and/or modify it under the terms of the GNU Lesser General   
+// Public License as published by the Free Software Foundation; 
+// either version 2.1 of the License, or (at your option) any   
+// later version.
+//
+// This source is distributed in the hope that it will be       
+// useful, but WITHOUT ANY WARRANTY; without even the implied   
+// warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR      
+// PURPOSE.  See the GNU Lesser General Public License for more 
+// details.
+//
+// You should have received a copy of the GNU Lesser General    
+// Public License along with this source; if not, write to the 
+// Free Software Foundation, Inc., 59 Temple Place, Suite 330, 
+// Boston, MA  02111-1307  USA
+//-----------------------------------------------------------------
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <assert.h>
+
+#include "usb_defs.h"
+#include "log_format.h"
+#include "log_decode.h"
+#include "live_stats.h"
+
+//-----------------------------------------------------------------
+// Structures
+//-----------------------------------------------------------------
+// Counters are only written by the thread feeding records. Snapshots
+// are double buffered: publish fills the unpublished copy then bumps
+// seq, readers copy the published one and retry if seq moved on.
+struct live_stats
+{
+    tStatsSnapshot  live;
+    uint8_t         seen[STATS_SLOTS];
+    tStatsSnapshot  snap[2];
+    uint64_t        seq;
+};
+
+//-----------------------------------------------------------------
+// live_stats_create
+//-----------------------------------------------------------------
+tLiveStats* live_stats_create(void)
+{
+    tLiveStats *stats = (tLiveStats *)calloc(1, sizeof(tLiveStats));
+    assert(stats);
+    return stats;
+}
+//-----------------------------------------------------------------
+// live_stats_add: Count one record (hot path, no locking)
+//-----------------------------------------------------------------
+int live_stats_add(tLiveStats *stats, const tLogRecord *rec)
+{
+    tStatsSnapshot *s = &stats->live;
+    tStatsEndpoint *ep;
+    int slot;
+    int pid;
+
+    if (s->records++ == 0)
+        s->first_time = rec->time;
+    s->time = rec->time;
+
+    switch (rec->type)
+    {
+        case LOG_CTRL_TYPE_SOF:
+            s->sofs++;
+            return 0;
+        case LOG_CTRL_TYPE_RST:
+            s->resets++;
+            return 0;
+        case LOG_CTRL_TYPE_TOKEN:
+        case LOG_CTRL_TYPE_HSHAKE:
+        case LOG_CTRL_TYPE_DATA:
+            break;
+        default:
+            return 0;
+    }
+
+    if (!rec->has_addr)
+    {
+        s->noaddr++;
+        return 0;
+    }
+
+    slot = STATS_SLOT(rec->device, rec->endpoint);
+    ep   = &s->ep[slot];
+    pid  = rec->pid & 0xF;
+
+    if (!stats->seen[slot])
+    {
+        stats->seen[slot] = 1;
+        s->active_slot[s->active++] = slot;
+    }
+
+    ep->packets[pid]++;
+    if (rec->type == LOG_CTRL_TYPE_DATA)
+        ep->bytes[pid] += rec->length;
+
+    if (!log_decode_pid_valid(rec) || !log_decode_crc_valid(rec))
+        ep->errors++;
+
+    return 0;
+}
+//-----------------------------------------------------------------
+// live_stats_copy: Copy snapshot (active endpoints only)
+//-----------------------------------------------------------------
+static void live_stats_copy(tStatsSnapshot *dst, const tStatsSnapshot *src)
+{
+    uint32_t i;
+
+    // Endpoints only ever become active, so dst's list is a prefix
+    memcpy(dst, src, offsetof(tStatsSnapshot, ep));
+    for (i=0;i<src->active;i++)
+        dst->ep[src->active_slot[i]] = src->ep[src->active_slot[i]];
+}
+//-----------------------------------------------------------------
+// live_stats_publish: Make current counters visible to readers
+//-----------------------------------------------------------------
+void live_stats_publish(tLiveStats *stats)
+{
+    uint64_t seq = stats->seq + 1;
+
+    // Readers of the buffer about to be rewritten see the seq moved
+    // on (published last time) before any of the new contents
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+
+    stats->live.seq = seq;
+    live_stats_copy(&stats->snap[seq & 1], &stats->live);
+    __atomic_store_n(&stats->seq, seq, __ATOMIC_RELEASE);
+}
+//-----------------------------------------------------------------
+// live_stats_snapshot: Latest published counters (any thread)
+//-----------------------------------------------------------------
+void live_stats_snapshot(tLiveStats *stats, tStatsSnapshot *snap)
+{
+    uint64_t seq;
+
+    do
+    {
+        seq = __atomic_load_n(&stats->seq, __ATOMIC_ACQUIRE);
+        live_stats_copy(snap, &stats->snap[seq & 1]);
+
+        // Copy completes before seq is checked again
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    }
+    // Publisher may have started on this buffer as soon as seq moved
+    while (__atomic_load_n(&stats->seq, __ATOMIC_RELAXED) != seq);
+}
+//-----------------------------------------------------------------
+// live_stats_report: Rates between two snapshots (prev may be NULL
+// for totals since the start)
+//-----------------------------------------------------------------
+void live_stats_report(FILE *f, const tStatsSnapshot *prev, const tStatsSnapshot *cur)
+{
+    static const int data_pids[] = { PID_DATA0 & 0xF, PID_DATA1 & 0xF, PID_DATA2 & 0xF, PID_MDATA & 0xF };
+    uint64_t start = prev ? prev->time : cur->first_time;
+    double secs = (double)(cur->time - start) / TICKS_PER_SEC;
+    double total_bytes = 0;
+    double total_pkts = 0;
+    uint64_t errors = 0;
+    uint32_t i;
+    int p;
+
+    if (secs <= 0)
+        secs = 1.0 / TICKS_PER_SEC;
+
+    for (i=0;i<cur->active;i++)
+    {
+        int slot = cur->active_slot[i];
+        const tStatsEndpoint *c = &cur->ep[slot];
+        const tStatsEndpoint *o = (prev && i < prev->active) ? &prev->ep[slot] : NULL;
+        uint64_t pkts = 0;
+        uint64_t bytes = 0;
+        uint64_t hshakes;
+        uint64_t naks;
+        uint64_t stalls;
+        uint64_t errs;
+
+        for (p=0;p<16;p++)
+            pkts += c->packets[p] - (o ? o->packets[p] : 0);
+        for (p=0;p<4;p++)
+            bytes += c->bytes[data_pids[p]] - (o ? o->bytes[data_pids[p]] : 0);
+
+        naks    = c->packets[PID_NAK & 0xF] - (o ? o->packets[PID_NAK & 0xF] : 0);
+        stalls  = c->packets[PID_STALL & 0xF] - (o ? o->packets[PID_STALL & 0xF] : 0);
+        errs    = c->errors - (o ? o->errors : 0);
+        hshakes = naks + stalls +
+                  c->packets[PID_ACK & 0xF] - (o ? o->packets[PID_ACK & 0xF] : 0) +
+                  c->packets[PID_NYET & 0xF] - (o ? o->packets[PID_NYET & 0xF] : 0);
+
+        total_pkts  += pkts;
+        total_bytes += bytes;
+        errors      += stalls + errs;
+
+        if (pkts == 0)
+            continue;
+
+        fprintf(f, "    dev %3d ep %2d  %9.3f MB/s %9.0f pkt/s  NAK %5.1f%%  STALL %llu  errors %llu\n",
+                slot / STATS_ENDPOINTS, slot % STATS_ENDPOINTS,
+                bytes / secs / 1e6, pkts / secs,
+                hshakes ? 100.0 * naks / hshakes : 0.0,
+                (unsigned long long)stalls, (unsigned long long)errs);
+    }
+
+    fprintf(f, "%9.3fs  %9.3f MB/s %9.0f pkt/s  %llu resets  %llu errors\n",
+            (double)(cur->time - cur->first_time) / TICKS_PER_SEC,
+            total_bytes / secs / 1e6, total_pkts / secs,
+            (unsigned long long)(cur->resets - (prev ? prev->resets : 0)),
+            (unsigned long long)errors);
+}
+//-----------------------------------------------------------------
+// live_stats_destroy
+//-----------------------------------------------------------------
+void live_stats_destroy(tLiveStats *stats)
+{
+    free(stats);
+}
@@ -0,0 +1,59 @@
+#ifndef __LIVE_STATS_H__
+#define __LIVE_STATS_H__
+
+//--------------------------------------------------------------------
+// Defines
+//--------------------------------------------------------------------
+#define STATS_DEVICES           128
+#define STATS_ENDPOINTS         16
+#define STATS_SLOTS             (STATS_DEVICES * STATS_ENDPOINTS)
+
+// Index of (device, endpoint) counters
+#define STATS_SLOT(dev, ep)     ((((dev) & 0x7F) * STATS_ENDPOINTS) + ((ep) & 0xF))
+
+//--------------------------------------------------------------------
+// Structures
+//--------------------------------------------------------------------
+// Counters of one (device, endpoint), indexed by 4-bit PID
+typedef struct
+{
+    uint64_t packets[16];
+    uint64_t bytes[16];     // Payload bytes incl. CRC16 (DATA PIDs)
+    uint64_t errors;        // Unexpected PIDs / bad CRC16 (errors in STALL too)
+} tStatsEndpoint;
+
+typedef struct
+{
+    uint64_t       seq;             // Publish count
+    uint64_t       first_time;      // Bus time of first / last record
+    uint64_t       time;
+    uint64_t       records;
+    uint64_t       sofs;
+    uint64_t       resets;
+    uint64_t       noaddr;          // Data / handshakes before any token
+    uint32_t       active;          // Endpoints seen (in first seen order)
+    uint16_t       active_slot[STATS_SLOTS];
+    tStatsEndpoint ep[STATS_SLOTS];
+} tStatsSnapshot;
+
+typedef struct live_stats tLiveStats;
+
+//--------------------------------------------------------------------
+// Prototypes
+//--------------------------------------------------------------------
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+tLiveStats* live_stats_create(void);
+int         live_stats_add(tLiveStats *stats, const tLogRecord *rec);
+void        live_stats_publish(tLiveStats *stats);
+void        live_stats_snapshot(tLiveStats *stats, tStatsSnapshot *snap);
+void        live_stats_report(FILE *f, const tStatsSnapshot *prev, const tStatsSnapshot *cur);
+void        live_stats_destroy(tLiveStats *stats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
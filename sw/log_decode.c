@@ -0,0 +1,423 @@
+//-----------------------------------------------------------------
+//                       USB Sniffer
+//                           V0.1
+//                     Ultra-Embedded.com
+//                       Copyright 2015
+//
+//               Email: admin@ultra-embedded.com
+//
+//                       License: LGPL
+//-----------------------------------------------------------------
+//
+// Copyright (C) 2011 - 2013 Ultra-Embedded.com
+//
+// This source file may be used and distributed without         
+// restriction provided that this copyright statement is not    
+// removed from the file and that any derivative work contains  
+// the original copyright notice and the associated disclaimer. 
+//
+// This source file is free software; you can redistribute it   
+// and/or modify it under the terms of the GNU Lesser General   
+// Public License as published by the Free Software Foundation; 
+// either version 2.1 of the License, or (at your option) any   
+// later version.
+//
+// This source is distributed in the hope that it will be       
+// useful, but WITHOUT ANY WARRANTY; without even the implied   
+// warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR      
+// PURPOSE.  See the GNU Lesser General Public License for more 
+// details.
+//
+// You should have received a copy of the GNU Lesser General    
+// Public License along with this source; if not, write to the 
+// Free Software Foundation, Inc., 59 Temple Place, Suite 330, 
+// Boston, MA  02111-1307  USA
+//-----------------------------------------------------------------
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <stdint.h>
+
+#include "usb_defs.h"
+#include "log_format.h"
+#include "usb_helpers.h"
+#include "log_decode.h"
+#include "payload_store.h"
+
+//-----------------------------------------------------------------
+// log_decode_init: Reset decoder state to start of capture
+//-----------------------------------------------------------------
+void log_decode_init(tLogDecoder *dec, int is_hs)
+{
+    dec->time     = 0;
+    dec->sof_time = 0;
+    dec->token    = LOG_DECODE_NO_TOKEN;
+    dec->in_rst   = -1;
+    dec->is_hs    = is_hs;
+    dec->last_type  = 0;
+    dec->sof_valid  = 0;
+    dec->sof_frame  = 0;
+    dec->sof_phase  = 0;
+    dec->poll_valid = 0;
+    dec->frame_words      = -1;
+    dec->last_frame_words = 0;
+    dec->run_type   = 0;
+    dec->run_left   = 0;
+    dec->run_step   = 0;
+    dec->store      = NULL;
+}
+//-----------------------------------------------------------------
+// log_decode_record_words: Number of dense words making up the
+// next record (0 if the buffer does not hold the whole record)
+//-----------------------------------------------------------------
+int log_decode_record_words(const uint32_t *words, uint32_t count)
+{
+    uint32_t value;
+    int      len;
+
+    if (count == 0)
+        return 0;
+
+    value = words[0];
+    if (((value >> LOG_CTRL_TYPE_L) & LOG_CTRL_CYCLE_MASK) == LOG_CTRL_TYPE_DATA_REF)
+        return (count >= 2) ? 2 : 0;
+    if (((value >> LOG_CTRL_TYPE_L) & LOG_CTRL_CYCLE_MASK) != LOG_CTRL_TYPE_DATA)
+        return 1;
+
+    len = 1 + ((usb_get_data_length(value) + 3) / 4);
+    return (len <= count) ? len : 0;
+}
+//-----------------------------------------------------------------
+// log_decode_predict_sof: Next SOF if it continues the frame
+// sequence (HS repeats each frame number for 8 microframes).
+// Returns 0 if there is no prediction yet
+//-----------------------------------------------------------------
+int log_decode_predict_sof(const tLogDecoder *dec, uint32_t *value)
+{
+    int      reps  = dec->is_hs ? 8 : 1;
+    uint16_t frame = dec->sof_frame;
+
+    if (!dec->sof_valid)
+        return 0;
+
+    if (dec->sof_phase + 1 >= reps)
+        frame = (frame + 1) & LOG_SOF_FRAME_MASK;
+
+    *value = (LOG_CTRL_TYPE_SOF << LOG_CTRL_TYPE_L) | (frame << LOG_SOF_FRAME_L);
+    return 1;
+}
+//-----------------------------------------------------------------
+// log_decode_predict_frame: Next frame if it repeats the current
+// one, SOF continuing the frame sequence then the same token + NAK
+// pairs (out needs room for 1 + LOG_FRAME_POLLS_MAX * 2 words).
+// Returns number of words predicted, 0 if there is no prediction
+//-----------------------------------------------------------------
+int log_decode_predict_frame(const tLogDecoder *dec, uint32_t *out)
+{
+    if (dec->frame_words <= 0 || (dec->frame_words & 1) || !log_decode_predict_sof(dec, &out[0]))
+        return 0;
+
+    memcpy(out + 1, dec->frame_polls, dec->frame_words * sizeof(uint32_t));
+    return 1 + dec->frame_words;
+}
+//-----------------------------------------------------------------
+// log_decode_pid_valid: PID is one the record type can carry
+// (tokens / data / handshakes, other types always valid)
+//-----------------------------------------------------------------
+int log_decode_pid_valid(const tLogRecord *rec)
+{
+    static const uint16_t valid_pids[] =
+    {
+        [LOG_CTRL_TYPE_TOKEN]  = (1 << (PID_OUT & 0xF)) | (1 << (PID_IN & 0xF)) | (1 << (PID_SETUP & 0xF)) |
+                                 (1 << (PID_PING & 0xF)) | (1 << (PID_SPLIT & 0xF)) | (1 << (PID_PRE & 0xF)),
+        [LOG_CTRL_TYPE_HSHAKE] = (1 << (PID_ACK & 0xF)) | (1 << (PID_NAK & 0xF)) | (1 << (PID_STALL & 0xF)) |
+                                 (1 << (PID_NYET & 0xF)) | (1 << (PID_ERR & 0xF)),
+        [LOG_CTRL_TYPE_DATA]   = (1 << (PID_DATA0 & 0xF)) | (1 << (PID_DATA1 & 0xF)) | (1 << (PID_DATA2 & 0xF)) |
+                                 (1 << (PID_MDATA & 0xF)),
+    };
+
+    if (rec->type != LOG_CTRL_TYPE_TOKEN && rec->type != LOG_CTRL_TYPE_HSHAKE && rec->type != LOG_CTRL_TYPE_DATA)
+        return 1;
+
+    return (valid_pids[rec->type] >> (rec->pid & 0xF)) & 1;
+}
+//-----------------------------------------------------------------
+// log_decode_crc_valid: DATA payload CRC16 checks out (other types
+// always valid)
+//-----------------------------------------------------------------
+int log_decode_crc_valid(const tLogRecord *rec)
+{
+    if (rec->type != LOG_CTRL_TYPE_DATA)
+        return 1;
+
+    return usb_data_crc_valid(rec->data, rec->length);
+}
+//-----------------------------------------------------------------
+// log_decode_track_frame: Follow the token + NAK pairs making up
+// each frame (frame run predictor)
+//-----------------------------------------------------------------
+static void log_decode_track_frame(tLogDecoder *dec, const tLogRecord *rec)
+{
+    switch (rec->type)
+    {
+        case LOG_CTRL_TYPE_SOF:
+            // Frame just ended is what the next one is expected to repeat
+            if (dec->frame_words > 0 && !(dec->frame_words & 1))
+            {
+                dec->last_frame_words = dec->frame_words;
+                memcpy(dec->last_frame_polls, dec->frame_polls, dec->frame_words * sizeof(uint32_t));
+            }
+            else
+                dec->last_frame_words = 0;
+            dec->frame_words = 0;
+            break;
+        case LOG_CTRL_TYPE_TOKEN:
+            if (dec->frame_words >= 0 && !(dec->frame_words & 1) && dec->frame_words < (LOG_FRAME_POLLS_MAX * 2))
+                dec->frame_polls[dec->frame_words++] = rec->value;
+            else
+                dec->frame_words = -1;
+            break;
+        case LOG_CTRL_TYPE_HSHAKE:
+            if (dec->frame_words >= 0 && (dec->frame_words & 1) && rec->pid == PID_NAK)
+                dec->frame_polls[dec->frame_words++] = rec->value;
+            else
+                dec->frame_words = -1;
+            break;
+        default:
+            dec->frame_words = -1;
+            break;
+    }
+}
+//-----------------------------------------------------------------
+// log_decode_literal: Decode a record held in the word stream
+//-----------------------------------------------------------------
+static int log_decode_literal(tLogDecoder *dec, const uint32_t *words, uint32_t count, tLogRecord *rec)
+{
+    uint32_t value;
+
+    if (count == 0)
+        return 0;
+
+    value = words[0];
+
+    rec->value    = value;
+    rec->type     = (value >> LOG_CTRL_TYPE_L) & LOG_CTRL_CYCLE_MASK;
+    rec->data     = NULL;
+    rec->length   = 0;
+    rec->has_addr = 0;
+    rec->device   = 0;
+    rec->endpoint = 0;
+    rec->words    = 1;
+
+    switch (rec->type)
+    {
+        case LOG_CTRL_TYPE_SOF:
+        {
+            // Same frame accounting as the .usb writer: next SOF lands on the
+            // frame boundary unless traffic has already run past it.
+            uint64_t tics_per_frame = dec->is_hs ? TICKS_PER_HS_UFRAME : TICKS_PER_FSLS_FRAME;
+            uint64_t next = dec->sof_time + tics_per_frame;
+
+            uint16_t frame = usb_get_sof_frame(value);
+
+            dec->time     = (next > dec->time) ? next : (dec->time + 1);
+            dec->sof_time = dec->time;
+            rec->pid      = PID_SOF;
+
+            dec->sof_phase = (dec->sof_valid && frame == dec->sof_frame) ? (dec->sof_phase + 1) : 0;
+            dec->sof_frame = frame;
+            dec->sof_valid = 1;
+        }
+        break;
+        case LOG_CTRL_TYPE_RST:
+        {
+            int in_rst = usb_get_rst_state(value);
+
+            if (in_rst != dec->in_rst)
+            {
+                dec->time    += in_rst ? usb_get_cycle_delta(value) : (TICKS_PER_FSLS_FRAME * 10);
+                dec->sof_time = dec->time;
+                dec->in_rst   = in_rst;
+            }
+            rec->pid = 0;
+        }
+        break;
+        case LOG_CTRL_TYPE_TOKEN:
+        {
+            dec->time  += usb_get_cycle_delta(value);
+            dec->token  = value;
+            rec->pid    = usb_get_pid(value);
+        }
+        break;
+        case LOG_CTRL_TYPE_HSHAKE:
+        {
+            dec->time  += usb_get_cycle_delta(value);
+            rec->pid    = usb_get_pid(value);
+
+            // Remember token + NAK for polling run records
+            if (dec->last_type == LOG_CTRL_TYPE_TOKEN && rec->pid == PID_NAK)
+            {
+                dec->poll_valid  = 1;
+                dec->poll_token  = dec->token;
+                dec->poll_hshake = value;
+            }
+        }
+        break;
+        case LOG_CTRL_TYPE_DATA:
+        {
+            uint32_t len = usb_get_data_length(value);
+
+            if (len > MAX_PACKET_SIZE)
+            {
+                fprintf(stderr, "ERROR: Bad data length %d\n", len);
+                return -1;
+            }
+
+            rec->words = 1 + ((len + 3) / 4);
+            if (rec->words > count)
+            {
+                fprintf(stderr, "ERROR: Truncated data record\n");
+                return -1;
+            }
+
+            dec->time  += usb_get_cycle_delta(value);
+            rec->pid    = usb_get_pid(value);
+            rec->length = len;
+
+#if defined(__BYTE_ORDER__) && (__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__)
+            // Payload words are already in byte order, no copy
+            rec->data   = (uint8_t *)(words + 1);
+#else
+            uint32_t data;
+            int i,j;
+            int idx = 0;
+
+            for (i = 1; i < rec->words; i++)
+            {
+                data = words[i];
+                for (j=0;j<4 && idx < len;j++)
+                    dec->payload[idx++] = data >> (8 * j);
+            }
+            rec->data   = dec->payload;
+#endif
+        }
+        break;
+        case LOG_CTRL_TYPE_DATA_REF:
+        {
+            const uint8_t *data = NULL;
+            int len = 0;
+
+            if (count >= 2 && dec->store)
+                data = payload_store_get(dec->store, words[1], &len);
+
+            if (!data || len != usb_get_data_length(value))
+            {
+                fprintf(stderr, "ERROR: Bad payload reference %x\n", value);
+                return -1;
+            }
+
+            // Presented as an ordinary DATA record
+            rec->value  = (value & ~(0xFu << LOG_CTRL_TYPE_L)) | ((uint32_t)LOG_CTRL_TYPE_DATA << LOG_CTRL_TYPE_L);
+            rec->type   = LOG_CTRL_TYPE_DATA;
+            rec->words  = 2;
+            dec->time  += usb_get_cycle_delta(value);
+            rec->pid    = usb_get_pid(value);
+            rec->data   = (uint8_t *)data;
+            rec->length = len;
+        }
+        break;
+        default:
+            fprintf(stderr, "ERROR: Unknown ID %x\n", value);
+            return -1;
+    }
+
+    // Handshakes and data belong to the most recent token
+    if (rec->type >= LOG_CTRL_TYPE_TOKEN && dec->token != LOG_DECODE_NO_TOKEN)
+    {
+        rec->has_addr = 1;
+        rec->device   = usb_get_token_device(dec->token);
+        rec->endpoint = usb_get_token_endpoint(dec->token);
+    }
+
+    rec->time      = dec->time;
+    dec->last_type = rec->type;
+
+    log_decode_track_frame(dec, rec);
+
+    return 1;
+}
+//-----------------------------------------------------------------
+// log_decode_next: Decode next record from dense word stream.
+// Run records are expanded back into the SOF / token + NAK records
+// they replaced, one per call; rec->words stays 0 until the last.
+// Returns 1 on success, 0 on end of buffer, -1 on error
+//-----------------------------------------------------------------
+int log_decode_next(tLogDecoder *dec, const uint32_t *words, uint32_t count, tLogRecord *rec)
+{
+    uint32_t frame[1 + (LOG_FRAME_POLLS_MAX * 2)];
+    uint32_t value;
+    int      type;
+
+    if (count == 0)
+        return 0;
+
+    // Start of new run?
+    if (dec->run_left == 0)
+    {
+        type = (words[0] >> LOG_CTRL_TYPE_L) & LOG_CTRL_CYCLE_MASK;
+        if (type != LOG_CTRL_TYPE_SOF_RUN && type != LOG_CTRL_TYPE_POLL_RUN && type != LOG_CTRL_TYPE_FRAME_RUN)
+            return log_decode_literal(dec, words, count, rec);
+
+        dec->run_type = type;
+        dec->run_left = (words[0] >> LOG_RUN_COUNT_L) & LOG_RUN_COUNT_MASK;
+        dec->run_step = 0;
+
+        if (dec->run_left == 0 ||
+            (type == LOG_CTRL_TYPE_POLL_RUN && !dec->poll_valid) ||
+            (type == LOG_CTRL_TYPE_SOF_RUN && !dec->sof_valid) ||
+            (type == LOG_CTRL_TYPE_FRAME_RUN && !log_decode_predict_frame(dec, frame)))
+        {
+            fprintf(stderr, "ERROR: Bad run record %x\n", words[0]);
+            dec->run_left = 0;
+            return -1;
+        }
+    }
+
+    if (dec->run_type == LOG_CTRL_TYPE_SOF_RUN)
+    {
+        log_decode_predict_sof(dec, &value);
+        dec->run_left--;
+    }
+    else if (dec->run_type == LOG_CTRL_TYPE_FRAME_RUN)
+    {
+        // SOF, then the token + NAK pairs of the frame before it
+        if (dec->run_step == 0)
+            log_decode_predict_sof(dec, &value);
+        else
+            value = dec->last_frame_polls[dec->run_step - 1];
+    }
+    else if (dec->run_step == 0)
+    {
+        value = dec->poll_token;
+        dec->run_step = 1;
+    }
+    else
+    {
+        value = dec->poll_hshake;
+        dec->run_step = 0;
+        dec->run_left--;
+    }
+
+    if (log_decode_literal(dec, &value, 1, rec) < 0)
+        return -1;
+
+    if (dec->run_type == LOG_CTRL_TYPE_FRAME_RUN && ++dec->run_step > dec->last_frame_words)
+    {
+        dec->run_step = 0;
+        dec->run_left--;
+    }
+
+    rec->words = (dec->run_left == 0) ? 1 : 0;
+    return 1;
+}
@@ -0,0 +1,92 @@
+#ifndef __LOG_DECODE_H__
+#define __LOG_DECODE_H__
+
+//--------------------------------------------------------------------
+// Defines
+//--------------------------------------------------------------------
+#define TICKS_PER_HS_UFRAME        7500
+#define TICKS_PER_FSLS_FRAME       60000
+#define TICKS_PER_SEC              60000000ULL
+
+// No token seen yet (device / endpoint unknown)
+#define LOG_DECODE_NO_TOKEN        0
+
+//--------------------------------------------------------------------
+// Structures
+//--------------------------------------------------------------------
+struct payload_store;
+
+// Decoder state carried from one record to the next
+typedef struct
+{
+    uint64_t time;          // Current time (ticks)
+    uint64_t sof_time;      // Time of last SOF / reset edge (ticks)
+    uint32_t token;         // Last token control word
+    int      in_rst;        // Last reset state (-1 = unknown)
+    int      is_hs;
+    int      last_type;     // Type of previous record
+
+    // SOF predictor: last frame number and how many SOFs repeated it
+    int      sof_valid;
+    uint16_t sof_frame;
+    int      sof_phase;
+
+    // Last token + NAK pair (polling predictor)
+    int      poll_valid;
+    uint32_t poll_token;
+    uint32_t poll_hshake;
+
+    // Frame predictor: token + NAK pairs seen since the last SOF
+    // (frame_words = -1 once anything else is seen) and those of the
+    // last complete frame
+    int      frame_words;
+    uint32_t frame_polls[LOG_FRAME_POLLS_MAX * 2];
+    int      last_frame_words;
+    uint32_t last_frame_polls[LOG_FRAME_POLLS_MAX * 2];
+
+    // Run record being expanded
+    int      run_type;
+    uint32_t run_left;
+    int      run_step;
+
+    // Payloads referenced by DATA_REF records
+    const struct payload_store *store;
+
+    uint8_t  payload[MAX_PACKET_SIZE];
+} tLogDecoder;
+
+// Single decoded dense log record
+typedef struct
+{
+    uint32_t value;         // Control word
+    int      type;          // LOG_CTRL_TYPE_xxx
+    uint8_t  pid;           // Full 8-bit PID (PID_xxx)
+    int      has_addr;      // Device / endpoint valid
+    uint8_t  device;        // Device of owning token
+    uint8_t  endpoint;      // Endpoint of owning token
+    uint64_t time;          // Absolute time (ticks)
+    uint8_t *data;          // Payload (DATA only, points into input words)
+    int      length;        // Payload length (DATA only)
+    uint32_t words;         // Dense words consumed (0 within a run)
+} tLogRecord;
+
+//--------------------------------------------------------------------
+// Prototypes
+//--------------------------------------------------------------------
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+void log_decode_init(tLogDecoder *dec, int is_hs);
+int  log_decode_record_words(const uint32_t *words, uint32_t count);
+int  log_decode_next(tLogDecoder *dec, const uint32_t *words, uint32_t count, tLogRecord *rec);
+int  log_decode_predict_sof(const tLogDecoder *dec, uint32_t *value);
+int  log_decode_predict_frame(const tLogDecoder *dec, uint32_t *out);
+int  log_decode_pid_valid(const tLogRecord *rec);
+int  log_decode_crc_valid(const tLogRecord *rec);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
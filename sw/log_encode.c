@@ -0,0 +1,223 @@
+//-----------------------------------------------------------------
+//                       USB Sniffer
+//                           V0.1
+//                     Ultra-Embedded.com
+//                       Copyright 2015
+//
+//               Email: admin@ultra-embedded.com
+//
+//                       License: LGPL
+//-----------------------------------------------------------------
+//
+// Copyright (C) 2011 - 2013 Ultra-Embedded.com
+//
+// This source file may be used and distributed without         
+// restriction provided that this copyright statement is not    
+// removed from the file and that any derivative work contains  
+// the original copyright notice and the associated disclaimer. 
+//
+// This source file is free software; you can redistribute it   
+// and/or modify it under the terms of the GNU Lesser General   
+// Public License as published by the Free Software Foundation; 
+// either version 2.1 of the License, or (at your option) any   
+// later version.
+//
+// This source is distributed in the hope that it will be       
+// useful, but WITHOUT ANY WARRANTY; without even the implied   
+// warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR      
+// PURPOSE.  See the GNU Lesser General Public License for more 
+// details.
+//
+// You should have received a copy of the GNU Lesser General    
+// Public License along with this source; if not, write to the 
+// Free Software Foundation, Inc., 59 Temple Place, Suite 330, 
+// Boston, MA  02111-1307  USA
+//-----------------------------------------------------------------
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <stdint.h>
+
+#include "usb_defs.h"
+#include "log_format.h"
+#include "log_decode.h"
+#include "log_encode.h"
+#include "usb_helpers.h"
+#include "payload_store.h"
+
+//-----------------------------------------------------------------
+// log_encode_flush_run
+//-----------------------------------------------------------------
+static uint32_t log_encode_flush_run(uint32_t *out, uint32_t out_idx, int type, uint32_t count)
+{
+    if (count == 0)
+        return out_idx;
+
+    out[out_idx++] = ((uint32_t)type << LOG_CTRL_TYPE_L) | (count << LOG_RUN_COUNT_L);
+    return out_idx;
+}
+//-----------------------------------------------------------------
+// log_encode_record: Literal dense words for a decoded record (run
+// and payload reference records come back as plain records).
+// Returns number of words written to out.
+//-----------------------------------------------------------------
+int log_encode_record(const tLogRecord *rec, uint32_t *out)
+{
+    int i;
+
+    out[0] = rec->value;
+    if (rec->type != LOG_CTRL_TYPE_DATA)
+        return 1;
+
+    for (i=0;i<rec->length;i++)
+    {
+        if (!(i & 3))
+            out[1 + (i / 4)] = 0;
+        out[1 + (i / 4)] |= (uint32_t)rec->data[i] << (8 * (i & 3));
+    }
+
+    return 1 + ((rec->length + 3) / 4);
+}
+//-----------------------------------------------------------------
+// log_encode_runs: Replace frames which repeat the one before (SOF
+// continuing the frame sequence followed by the same token + NAK
+// pairs), other SOFs which continue the sequence and repeated
+// identical token + NAK pairs with counted run records.
+// The decoder passed in must hold the state the reader will have at
+// the same point (run prediction only uses state it can rebuild).
+// Returns number of words written to out (never more than count),
+// -1 on error.
+//-----------------------------------------------------------------
+int log_encode_runs(tLogDecoder *dec, const uint32_t *words, uint32_t count, uint32_t *out)
+{
+    tLogRecord rec;
+    uint32_t   out_idx   = 0;
+    uint32_t   idx       = 0;
+    uint32_t   run_count = 0;
+    int        run_type  = 0;
+    uint32_t   frame[1 + (LOG_FRAME_POLLS_MAX * 2)];
+    uint32_t   predicted;
+    int        kind;
+    int        span;
+    int        n;
+
+    while (idx < count)
+    {
+        n = log_decode_record_words(words + idx, count - idx);
+        if (n == 0)
+        {
+            fprintf(stderr, "ERROR: Truncated record in run encoder\n");
+            return -1;
+        }
+
+        kind = 0;
+        span = 1;
+
+        switch ((words[idx] >> LOG_CTRL_TYPE_L) & LOG_CTRL_CYCLE_MASK)
+        {
+            case LOG_CTRL_TYPE_SOF:
+                predicted = log_decode_predict_frame(dec, frame);
+                if (predicted && predicted <= (count - idx) &&
+                    !memcmp(words + idx, frame, predicted * sizeof(uint32_t)))
+                {
+                    kind = LOG_CTRL_TYPE_FRAME_RUN;
+                    span = predicted;
+                }
+                else if (log_decode_predict_sof(dec, &predicted) && predicted == words[idx])
+                    kind = LOG_CTRL_TYPE_SOF_RUN;
+                break;
+            case LOG_CTRL_TYPE_TOKEN:
+                if (dec->poll_valid && (idx + 1) < count &&
+                    words[idx] == dec->poll_token && words[idx + 1] == dec->poll_hshake)
+                {
+                    kind = LOG_CTRL_TYPE_POLL_RUN;
+                    span = 2;
+                }
+                break;
+            default:
+                break;
+        }
+
+        // End of current run
+        if (run_type && (kind != run_type || run_count == LOG_RUN_COUNT_MASK))
+        {
+            out_idx   = log_encode_flush_run(out, out_idx, run_type, run_count);
+            run_type  = 0;
+            run_count = 0;
+        }
+
+        if (kind)
+        {
+            run_type = kind;
+            run_count++;
+        }
+        else
+        {
+            memcpy(out + out_idx, words + idx, n * sizeof(uint32_t));
+            out_idx += n;
+        }
+
+        // Keep predictor in step with what the reader will see
+        while (span--)
+        {
+            if (log_decode_next(dec, words + idx, count - idx, &rec) <= 0)
+                return -1;
+            idx += rec.words;
+        }
+    }
+
+    return log_encode_flush_run(out, out_idx, run_type, run_count);
+}
+//-----------------------------------------------------------------
+// log_encode_payloads: Replace DATA payloads with references into
+// the payload store. Safe to run in place (out == words).
+// Returns number of words written to out, -1 on error.
+//-----------------------------------------------------------------
+int log_encode_payloads(tPayloadStore *store, const uint32_t *words, uint32_t count, uint32_t *out)
+{
+    uint8_t  payload[MAX_PACKET_SIZE];
+    uint32_t out_idx = 0;
+    uint32_t idx     = 0;
+    uint32_t value;
+    uint32_t id;
+    int      len;
+    int      i,j;
+    int      n;
+
+    while (idx < count)
+    {
+        n = log_decode_record_words(words + idx, count - idx);
+        if (n == 0)
+        {
+            fprintf(stderr, "ERROR: Truncated record in payload encoder\n");
+            return -1;
+        }
+
+        value = words[idx];
+        len   = usb_get_data_length(value);
+
+        if (((value >> LOG_CTRL_TYPE_L) & LOG_CTRL_CYCLE_MASK) == LOG_CTRL_TYPE_DATA &&
+            len >= PAYLOAD_STORE_MIN && len <= MAX_PACKET_SIZE)
+        {
+            for (i=0;i<len;i+=4)
+                for (j=0;j<4 && (i + j) < len;j++)
+                    payload[i + j] = words[idx + 1 + (i / 4)] >> (8 * j);
+
+            if (payload_store_add(store, payload, len, &id) < 0)
+                return -1;
+
+            out[out_idx++] = (value & ~(0xFu << LOG_CTRL_TYPE_L)) | ((uint32_t)LOG_CTRL_TYPE_DATA_REF << LOG_CTRL_TYPE_L);
+            out[out_idx++] = id;
+        }
+        else
+        {
+            memmove(out + out_idx, words + idx, n * sizeof(uint32_t));
+            out_idx += n;
+        }
+
+        idx += n;
+    }
+
+    return out_idx;
+}
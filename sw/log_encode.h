@@ -0,0 +1,19 @@
+#ifndef __LOG_ENCODE_H__
+#define __LOG_ENCODE_H__
+
+//--------------------------------------------------------------------
+// Prototypes
+//--------------------------------------------------------------------
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+int log_encode_record(const tLogRecord *rec, uint32_t *out);
+int log_encode_runs(tLogDecoder *dec, const uint32_t *words, uint32_t count, uint32_t *out);
+int log_encode_payloads(struct payload_store *store, const uint32_t *words, uint32_t count, uint32_t *out);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -53,9 +53,13 @@ struct log_func
     int (*close)(void);
     int (*add_sof)(uint32_t value, int is_hs);
     int (*add_rst)(uint32_t value, int is_hs);
+    int (*add_gap)(uint64_t tic_inc, int is_hs);
     int (*add_token)(uint32_t value);
     int (*add_handshake)(uint32_t value);
     int (*add_data)(uint32_t value, uint8_t *data, int length);
+    FILE* (*set_stream)(FILE *f);
+    void (*get_state)(uint32_t *last_tic, int *in_rst);
+    void (*set_state)(uint32_t last_tic, int in_rst);
 };
 
 enum eLogFormats { LOG_FMT_USB, LOG_FMT_RAW, LOG_FMT_TXT, LOG_FMT_MAX };
@@ -71,9 +75,13 @@ static struct log_func _log_fmts[LOG_FMT_MAX] =
         .close          = usb_file_close,
         .add_sof        = usb_file_add_sof,
         .add_rst        = usb_file_add_rst,
+        .add_gap        = usb_file_add_gap,
         .add_token      = usb_file_add_token,
         .add_handshake  = usb_file_add_handshake,
-        .add_data       = usb_file_add_data
+        .add_data       = usb_file_add_data,
+        .set_stream     = usb_file_set_stream,
+        .get_state      = usb_file_get_state,
+        .set_state      = usb_file_set_state
     },
     [LOG_FMT_RAW] = 
     {
@@ -81,9 +89,13 @@ static struct log_func _log_fmts[LOG_FMT_MAX] =
         .close          = raw_file_close,
         .add_sof        = raw_file_add_sof,
         .add_rst        = raw_file_add_rst,
+        .add_gap        = raw_file_add_gap,
         .add_token      = raw_file_add_token,
         .add_handshake  = raw_file_add_handshake,
-        .add_data       = raw_file_add_data
+        .add_data       = raw_file_add_data,
+        .set_stream     = raw_file_set_stream,
+        .get_state      = raw_file_get_state,
+        .set_state      = raw_file_set_state
     },
     [LOG_FMT_TXT] = 
     {
@@ -91,9 +103,13 @@ static struct log_func _log_fmts[LOG_FMT_MAX] =
         .close          = txt_file_close,
         .add_sof        = txt_file_add_sof,
         .add_rst        = txt_file_add_rst,
+        .add_gap        = txt_file_add_gap,
         .add_token      = txt_file_add_token,
         .add_handshake  = txt_file_add_handshake,
-        .add_data       = txt_file_add_data
+        .add_data       = txt_file_add_data,
+        .set_stream     = txt_file_set_stream,
+        .get_state      = txt_file_get_state,
+        .set_state      = txt_file_set_state
     }
 };
 
@@ -142,6 +158,14 @@ int log_file_add_rst(uint32_t value, int is_hs)
     return _log->add_rst(value, is_hs);
 }
 //-----------------------------------------------------------------
+// log_file_add_gap: Records left out for tic_inc ticks from the last
+// SOF / reset change (the next SOF counts on from there)
+//-----------------------------------------------------------------
+int log_file_add_gap(uint64_t tic_inc, int is_hs)
+{
+    return _log->add_gap(tic_inc, is_hs);
+}
+//-----------------------------------------------------------------
 // log_file_add_token: Add token (IN, OUT, SETUP, PING)
 //-----------------------------------------------------------------
 int log_file_add_token(uint32_t value)
@@ -162,3 +186,25 @@ int log_file_add_data(uint32_t value, uint8_t *data, int length)
 {
     return _log->add_data(value, data, length);
 }
+//-----------------------------------------------------------------
+// log_file_set_stream: Redirect output of the calling thread (NULL
+// leaves it unchanged). Returns the previous stream.
+//-----------------------------------------------------------------
+FILE* log_file_set_stream(FILE *f)
+{
+    return _log->set_stream(f);
+}
+//-----------------------------------------------------------------
+// log_file_get_state: State output depends on (calling thread)
+//-----------------------------------------------------------------
+void log_file_get_state(tLogFileState *state)
+{
+    _log->get_state(&state->last_tic, &state->in_rst);
+}
+//-----------------------------------------------------------------
+// log_file_set_state
+//-----------------------------------------------------------------
+void log_file_set_state(const tLogFileState *state)
+{
+    _log->set_state(state->last_tic, state->in_rst);
+}
@@ -1,6 +1,16 @@
 #ifndef __LOG_FILE_H__
 #define __LOG_FILE_H__
 
+//--------------------------------------------------------------------
+// Structures
+//--------------------------------------------------------------------
+// Output state carried from one record to the next
+typedef struct
+{
+    uint32_t last_tic;      // Ticks since last SOF / reset change
+    int      in_rst;        // Reset state (-1 = none seen)
+} tLogFileState;
+
 //--------------------------------------------------------------------
 // Prototypes
 //--------------------------------------------------------------------
@@ -12,9 +22,13 @@ int log_file_create(const char *filename);
 int log_file_close(void);
 int log_file_add_sof(uint32_t value, int is_hs);
 int log_file_add_rst(uint32_t value, int is_hs);
+int log_file_add_gap(uint64_t tic_inc, int is_hs);
 int log_file_add_token(uint32_t value);
 int log_file_add_handshake(uint32_t value);
 int log_file_add_data(uint32_t value, uint8_t *data, int length);
+FILE* log_file_set_stream(FILE *f);
+void log_file_get_state(tLogFileState *state);
+void log_file_set_state(const tLogFileState *state);
 
 #ifdef __cplusplus
 }
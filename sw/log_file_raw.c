@@ -46,7 +46,8 @@
 //-----------------------------------------------------------------
 // Locals
 //-----------------------------------------------------------------
-static FILE *_file;
+// Per thread so blocks can be converted in parallel
+static __thread FILE *_file;
 
 //-----------------------------------------------------------------
 // raw_file_add_sof: Add start of frame token to log
@@ -78,6 +79,14 @@ int raw_file_add_rst(uint32_t value, int is_hs)
     return 0;
 }
 //-----------------------------------------------------------------
+// raw_file_add_gap: Time passed in records left out (no timing in
+// this format)
+//-----------------------------------------------------------------
+int raw_file_add_gap(uint64_t tic_inc, int is_hs)
+{
+    return 0;
+}
+//-----------------------------------------------------------------
 // raw_file_add_token: Add token (IN, OUT, SETUP, PING)
 //-----------------------------------------------------------------
 int raw_file_add_token(uint32_t value)
@@ -127,6 +136,33 @@ int raw_file_add_data(uint32_t value, uint8_t *data, int length)
     return 0;
 }
 //-----------------------------------------------------------------
+// raw_file_set_stream: Redirect this thread's output (NULL = query
+// only). Returns the previous stream.
+//-----------------------------------------------------------------
+FILE* raw_file_set_stream(FILE *f)
+{
+    FILE *prev = _file;
+
+    if (f)
+        _file = f;
+
+    return prev;
+}
+//-----------------------------------------------------------------
+// raw_file_get_state: No state carried between records
+//-----------------------------------------------------------------
+void raw_file_get_state(uint32_t *last_tic, int *in_rst)
+{
+    *last_tic = 0;
+    *in_rst   = -1;
+}
+//-----------------------------------------------------------------
+// raw_file_set_state
+//-----------------------------------------------------------------
+void raw_file_set_state(uint32_t last_tic, int in_rst)
+{
+}
+//-----------------------------------------------------------------
 // raw_file_create: Create & open empty log file
 //-----------------------------------------------------------------
 int raw_file_create(const char *filename)
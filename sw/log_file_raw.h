@@ -12,9 +12,13 @@ int raw_file_create(const char *filename);
 int raw_file_close(void);
 int raw_file_add_sof(uint32_t value, int is_hs);
 int raw_file_add_rst(uint32_t value, int is_hs);
+int raw_file_add_gap(uint64_t tic_inc, int is_hs);
 int raw_file_add_token(uint32_t value);
 int raw_file_add_handshake(uint32_t value);
 int raw_file_add_data(uint32_t value, uint8_t *data, int length);
+FILE* raw_file_set_stream(FILE *f);
+void raw_file_get_state(uint32_t *last_tic, int *in_rst);
+void raw_file_set_state(uint32_t last_tic, int in_rst);
 
 #ifdef __cplusplus
 }
@@ -52,9 +52,10 @@
 //-----------------------------------------------------------------
 // Locals
 //-----------------------------------------------------------------
-static FILE *_file;
-static uint32_t _last_tic = 0;
-static int _in_rst = -1;
+// Per thread so blocks can be converted in parallel
+static __thread FILE *_file;
+static __thread uint32_t _last_tic = 0;
+static __thread int _in_rst = -1;
 
 //-----------------------------------------------------------------
 // txt_file_add_sof: Add start of frame token to log
@@ -95,6 +96,16 @@ int txt_file_add_rst(uint32_t value, int is_hs)
     return 0;
 }
 //-----------------------------------------------------------------
+// txt_file_add_gap: Time passed in records left out (no timestamps
+// in this format, only the frame reference moves on)
+//-----------------------------------------------------------------
+int txt_file_add_gap(uint64_t tic_inc, int is_hs)
+{
+    _last_tic = 0;
+
+    return 0;
+}
+//-----------------------------------------------------------------
 // txt_file_add_token: Add token (IN, OUT, SETUP, PING)
 //-----------------------------------------------------------------
 int txt_file_add_token(uint32_t value)
@@ -134,11 +145,46 @@ int txt_file_add_data(uint32_t value, uint8_t *data, int length)
         if (!((i+1) & 0xF) || ((i+1) == (length-2)))
             fprintf(_file, "\n  ");
     }
-    fprintf(_file, "CRC = %02x%02x\n", data[length-2], data[length-1]);
+    fprintf(_file, "CRC = %02x%02x", data[length-2], data[length-1]);
+    if (!usb_data_crc_valid(data, length))
+    {
+        uint16_t crc = usb_crc16(data, length-2);
+        fprintf(_file, " (BAD, expected %02x%02x)", crc & 0xFF, crc >> 8);
+    }
+    fprintf(_file, "\n");
 
     return 0;
 }
 //-----------------------------------------------------------------
+// txt_file_set_stream: Redirect this thread's output (NULL = query
+// only). Returns the previous stream.
+//-----------------------------------------------------------------
+FILE* txt_file_set_stream(FILE *f)
+{
+    FILE *prev = _file;
+
+    if (f)
+        _file = f;
+
+    return prev;
+}
+//-----------------------------------------------------------------
+// txt_file_get_state: Timing / reset state carried between records
+//-----------------------------------------------------------------
+void txt_file_get_state(uint32_t *last_tic, int *in_rst)
+{
+    *last_tic = _last_tic;
+    *in_rst   = _in_rst;
+}
+//-----------------------------------------------------------------
+// txt_file_set_state
+//-----------------------------------------------------------------
+void txt_file_set_state(uint32_t last_tic, int in_rst)
+{
+    _last_tic = last_tic;
+    _in_rst   = in_rst;
+}
+//-----------------------------------------------------------------
 // txt_file_create: Create & open empty log file
 //-----------------------------------------------------------------
 int txt_file_create(const char *filename)
@@ -68,9 +68,10 @@
 //-----------------------------------------------------------------
 // Locals
 //-----------------------------------------------------------------
-static FILE *_file;
-static uint32_t _last_tic = 0;
-static int _in_rst = -1;
+// Per thread so blocks can be converted in parallel
+static __thread FILE *_file;
+static __thread uint32_t _last_tic = 0;
+static __thread int _in_rst = -1;
 
 //-----------------------------------------------------------------
 // usb_file_add_time: Add large time offset (>= 4096 ticks)
@@ -193,6 +194,36 @@ int usb_file_add_sof(uint32_t value, int is_hs)
     return 0;
 }
 //-----------------------------------------------------------------
+// usb_file_add_gap: Time passed in records left out (skipped blocks),
+// tic_inc from the last SOF to the frame output resumes in. Written
+// as idle line state so later SOFs keep their place.
+//-----------------------------------------------------------------
+int usb_file_add_gap(uint64_t tic_inc, int is_hs)
+{
+    #define GAP_INC_MAX     0x0FFFFFFF
+    #define SOF_TICS        4   // SOF data bytes + closing rxcmd
+
+    int tics_per_frame = is_hs ? TICKS_PER_HS_UFRAME : TICKS_PER_FSLS_FRAME;
+    uint64_t remain;
+    uint32_t inc;
+
+    if (tic_inc > _last_tic)
+    {
+        // Each SOF left out would have taken SOF_TICS on top of its frame
+        remain = tic_inc - _last_tic + (tic_inc / tics_per_frame) * SOF_TICS;
+        while (remain)
+        {
+            inc = (remain > GAP_INC_MAX) ? GAP_INC_MAX : (uint32_t)remain;
+            usb_file_add_rxcmd(inc, LINESTATE_IDLE, 0, 0, 0);
+            remain -= inc;
+        }
+    }
+
+    _last_tic = 0;
+
+    return 0;
+}
+//-----------------------------------------------------------------
 // usb_file_add_rst: Add reset event to the log
 //-----------------------------------------------------------------
 int usb_file_add_rst(uint32_t value, int is_hs)
@@ -274,6 +305,35 @@ int usb_file_add_data(uint32_t value, uint8_t *data, int length)
     return 0;
 }
 //-----------------------------------------------------------------
+// usb_file_set_stream: Redirect this thread's output (NULL = query
+// only). Returns the previous stream.
+//-----------------------------------------------------------------
+FILE* usb_file_set_stream(FILE *f)
+{
+    FILE *prev = _file;
+
+    if (f)
+        _file = f;
+
+    return prev;
+}
+//-----------------------------------------------------------------
+// usb_file_get_state: Timing / reset state carried between records
+//-----------------------------------------------------------------
+void usb_file_get_state(uint32_t *last_tic, int *in_rst)
+{
+    *last_tic = _last_tic;
+    *in_rst   = _in_rst;
+}
+//-----------------------------------------------------------------
+// usb_file_set_state
+//-----------------------------------------------------------------
+void usb_file_set_state(uint32_t last_tic, int in_rst)
+{
+    _last_tic = last_tic;
+    _in_rst   = in_rst;
+}
+//-----------------------------------------------------------------
 // usb_file_create: Create & open empty log file
 //-----------------------------------------------------------------
 int usb_file_create(const char *filename)
@@ -12,9 +12,13 @@ int usb_file_create(const char *filename);
 int usb_file_close(void);
 int usb_file_add_sof(uint32_t value, int is_hs);
 int usb_file_add_rst(uint32_t value, int is_hs);
+int usb_file_add_gap(uint64_t tic_inc, int is_hs);
 int usb_file_add_token(uint32_t value);
 int usb_file_add_handshake(uint32_t value);
 int usb_file_add_data(uint32_t value, uint8_t *data, int length);
+FILE* usb_file_set_stream(FILE *f);
+void usb_file_get_state(uint32_t *last_tic, int *in_rst);
+void usb_file_set_state(uint32_t last_tic, int in_rst);
 
 #ifdef __cplusplus
 }
@@ -27,12 +27,19 @@
 #define LOG_TOKEN_DATA_L        (LOG_TOKEN_PID_H + 1)
 #define LOG_TOKEN_DATA_H        (LOG_TOKEN_DATA_L + LOG_TOKEN_DATA_W - 1)
 
-// TYPE = LOG_CTRL_TYPE_DATA
+// TYPE = LOG_CTRL_TYPE_DATA | LOG_CTRL_TYPE_DATA_REF
+// (DATA_REF is followed by a single payload store id word)
 #define LOG_DATA_LEN_W          16
 #define LOG_DATA_LEN_MASK       ((1 << LOG_DATA_LEN_W) - 1)
 #define LOG_DATA_LEN_L          (LOG_TOKEN_PID_H + 1)
 #define LOG_DATA_LEN_H          (LOG_DATA_LEN_L + LOG_DATA_LEN_W - 1)
 
+// TYPE = LOG_CTRL_TYPE_SOF_RUN | LOG_CTRL_TYPE_POLL_RUN | LOG_CTRL_TYPE_FRAME_RUN
+#define LOG_RUN_COUNT_W         16
+#define LOG_RUN_COUNT_MASK      ((1 << LOG_RUN_COUNT_W) - 1)
+#define LOG_RUN_COUNT_L         0
+#define LOG_RUN_COUNT_H         (LOG_RUN_COUNT_L + LOG_RUN_COUNT_W - 1)
+
 // TYPE = LOG_CTRL_TYPE_TOKEN | LOG_CTRL_TYPE_HSHAKE | LOG_CTRL_TYPE_DATA
 #define LOG_CTRL_CYCLE_W         8
 #define LOG_CTRL_CYCLE_MASK      ((1 << LOG_CTRL_CYCLE_W) - 1)
@@ -48,4 +55,13 @@
 #define LOG_CTRL_TYPE_HSHAKE     0x4
 #define LOG_CTRL_TYPE_DATA       0x5
 
+// Host side only (never produced by the capture hardware)
+#define LOG_CTRL_TYPE_SOF_RUN    0x8
+#define LOG_CTRL_TYPE_POLL_RUN   0x9
+#define LOG_CTRL_TYPE_DATA_REF   0xA
+#define LOG_CTRL_TYPE_FRAME_RUN  0xB
+
+// Most token + NAK pairs a frame run can repeat after its SOF
+#define LOG_FRAME_POLLS_MAX      8
+
 #endif
@@ -0,0 +1,348 @@
+//-----------------------------------------------------------------
+//                       USB Sniffer
+//                           V0.1
+//                     Ultra-Embedded.com
+//                       Copyright 2015
+//
+//               Email: admin@ultra-embedded.com
+//
+//                       License: LGPL
+//-----------------------------------------------------------------
+//
+// Copyright (C) 2011 - 2013 Ultra-Embedded.com
+//
+// This source file may be used and distributed without         
+// restriction provided that this copyright statement is not    
+// removed from the file and that any derivative work contains  
+// the original copyright notice and the associated disclaimer. 
+//
+// This source file is free software; you can redistribute it   
+// and/or modify it under the terms of the GNU Lesser General   
+// Public License as published by the Free Software Foundation; 
+// either version 2.1 of the License, or (at your option) any   
+// later version.
+//
+// This source is distributed in the hope that it will be       
+// useful, but WITHOUT ANY WARRANTY; without even the implied   
+// warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR      
+// PURPOSE.  See the GNU Lesser General Public License for more 
+// details.
+//
+// You should have received a copy of the GNU Lesser General    
+// Public License along with this source; if not, write to the 
+// Free Software Foundation, Inc., 59 Temple Place, Suite 330, 
+// Boston, MA  02111-1307  USA
+//-----------------------------------------------------------------
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "usb_defs.h"
+#include "log_format.h"
+#include "log_decode.h"
+#include "capture_filter.h"
+#include "payload_store.h"
+#include "capture_file.h"
+#include "log_import.h"
+
+//-----------------------------------------------------------------
+// Defines
+//-----------------------------------------------------------------
+// .usb entry layout (see log_file_usb.c), as a little endian word:
+// [7:0] time inc[11:4], [11:8] time inc[3:0], [13:12] length,
+// [15:14] payload type, [31:24] payload
+#define USB_ENTRY_TYPE(w)       (((w) >> 14) & 0x3)
+    #define USB_ENTRY_TIME          0x0
+    #define USB_ENTRY_EVENT         0x1
+    #define USB_ENTRY_DATA          0x2
+    #define USB_ENTRY_RXCMD         0x3
+#define USB_ENTRY_TICS(w)       ((((w) >> 8) & 0xF) | (((w) & 0xFF) << 4))
+#define USB_ENTRY_BYTE(w)       ((w) >> 24)
+
+// Data byte one tick after the last (the common case)
+#define USB_DATA_BYTE_MASK      0x00FFFFFF
+#define USB_DATA_BYTE           0x00009100
+
+#define RXCMD_LINESTATE_SE0     0x0
+#define RXCMD_ACTIVE            (1 << 4)
+
+// Dense words gathered before handing to the capture writer
+#define IMPORT_BUF_WORDS        (64 * 1024)
+
+//-----------------------------------------------------------------
+// Structures
+//-----------------------------------------------------------------
+struct log_import
+{
+    tCaptureFile *cap;
+    uint32_t     *buf;
+    uint32_t      used;
+    int           err;
+
+    // Packet being assembled (PID + payload)
+    uint8_t       pkt[MAX_PACKET_SIZE + 1];
+    int           pkt_len;
+    int           in_pkt;
+    uint32_t      pkt_tics;
+};
+
+//-----------------------------------------------------------------
+// log_import_flush: Pass gathered dense words to the capture
+//-----------------------------------------------------------------
+static void log_import_flush(struct log_import *imp)
+{
+    if (imp->used && capture_file_write(imp->cap, imp->buf, imp->used) != 0)
+        imp->err = 1;
+
+    imp->used = 0;
+}
+//-----------------------------------------------------------------
+// log_import_cycle: Time gap as dense cycle field (256 tick units)
+//-----------------------------------------------------------------
+static uint32_t log_import_cycle(uint32_t tics)
+{
+    tics >>= 8;
+    if (tics > LOG_CTRL_CYCLE_MASK)
+        tics = LOG_CTRL_CYCLE_MASK;
+
+    return tics << LOG_CTRL_CYCLE_L;
+}
+//-----------------------------------------------------------------
+// log_import_packet: Add dense record(s) for a complete packet
+//-----------------------------------------------------------------
+static void log_import_packet(struct log_import *imp, const uint8_t *pkt, int len, uint32_t tics)
+{
+    uint32_t *out;
+    uint8_t pid = pkt[0];
+    uint32_t value;
+    int words = 1;
+    int i;
+
+    if (len == 0)
+        return;
+
+    if (imp->used + 1 + (MAX_PACKET_SIZE + 3) / 4 > IMPORT_BUF_WORDS)
+        log_import_flush(imp);
+
+    out = imp->buf + imp->used;
+
+    // SOF: frame only, spacing is implied
+    if (pid == PID_SOF && len == 3)
+    {
+        value  = (uint32_t)LOG_CTRL_TYPE_SOF << LOG_CTRL_TYPE_L;
+        value |= (pkt[1] | ((pkt[2] & 0x7) << 8)) << LOG_SOF_FRAME_L;
+    }
+    // Data PIDs end in binary 11
+    else if ((pid & 0x3) == 0x3)
+    {
+        len -= 1;
+
+        value  = (uint32_t)LOG_CTRL_TYPE_DATA << LOG_CTRL_TYPE_L;
+        value |= log_import_cycle(tics);
+        value |= (uint32_t)len << LOG_DATA_LEN_L;
+        value |= (pid & LOG_TOKEN_PID_MASK) << LOG_TOKEN_PID_L;
+
+        for (i=0;i<len;i++)
+        {
+            if (!(i & 3))
+                out[1 + (i / 4)] = 0;
+            out[1 + (i / 4)] |= (uint32_t)pkt[1 + i] << (8 * (i & 3));
+        }
+        words += (len + 3) / 4;
+    }
+    else if (len == 1)
+    {
+        value  = (uint32_t)LOG_CTRL_TYPE_HSHAKE << LOG_CTRL_TYPE_L;
+        value |= log_import_cycle(tics);
+        value |= (pid & LOG_TOKEN_PID_MASK) << LOG_TOKEN_PID_L;
+    }
+    else if (len == 3)
+    {
+        uint32_t token = pkt[1] | ((pkt[2] & 0x7) << 8);
+
+        value  = (uint32_t)LOG_CTRL_TYPE_TOKEN << LOG_CTRL_TYPE_L;
+        value |= log_import_cycle(tics);
+        value |= token << LOG_TOKEN_DATA_L;
+        value |= (pid & LOG_TOKEN_PID_MASK) << LOG_TOKEN_PID_L;
+    }
+    else
+    {
+        fprintf(stderr, "ERROR: Unknown %d byte packet (PID %02x)\n", len, pid);
+        imp->err = 1;
+        return;
+    }
+
+    out[0] = value;
+    imp->used += words;
+}
+//-----------------------------------------------------------------
+// log_import_rst: Add reset change
+//-----------------------------------------------------------------
+static void log_import_rst(struct log_import *imp, int in_rst, uint32_t tics)
+{
+    if (imp->used + 1 > IMPORT_BUF_WORDS)
+        log_import_flush(imp);
+
+    imp->buf[imp->used++] = ((uint32_t)LOG_CTRL_TYPE_RST << LOG_CTRL_TYPE_L) |
+                            (in_rst ? log_import_cycle(tics) : 0) |
+                            ((uint32_t)in_rst << LOG_RST_STATE_L);
+}
+//-----------------------------------------------------------------
+// log_import_usb: Parse .usb entries (RXCMD / DATA / time)
+//-----------------------------------------------------------------
+static void log_import_usb(struct log_import *imp, const uint8_t *p, size_t size)
+{
+    size_t count = size / 4;
+    size_t i = 0;
+    uint32_t tics = 0;
+    uint32_t w;
+    uint64_t v;
+
+    while (i < count && !imp->err)
+    {
+        memcpy(&w, p + (i * 4), 4);
+        i++;
+
+        switch (USB_ENTRY_TYPE(w))
+        {
+            // Large time step, followed by the RXCMD it belongs to
+            case USB_ENTRY_TIME:
+                tics += (USB_ENTRY_TICS(w)) | (((w >> 24) & 0xFF) << 12) | (((w >> 16) & 0xFF) << 20);
+                break;
+            case USB_ENTRY_RXCMD:
+                tics += USB_ENTRY_TICS(w);
+
+                // Packet start
+                if (USB_ENTRY_BYTE(w) & RXCMD_ACTIVE)
+                {
+                    imp->in_pkt   = 1;
+                    imp->pkt_len  = 0;
+                    imp->pkt_tics = tics;
+                }
+                // Packet end
+                else if (imp->in_pkt)
+                {
+                    log_import_packet(imp, imp->pkt, imp->pkt_len, imp->pkt_tics);
+                    imp->in_pkt = 0;
+                }
+                // Line state change outside a packet is a reset edge
+                else
+                    log_import_rst(imp, (USB_ENTRY_BYTE(w) & 0x3) == RXCMD_LINESTATE_SE0, tics);
+
+                tics = 0;
+                break;
+            case USB_ENTRY_DATA:
+                if (!imp->in_pkt || imp->pkt_len >= (int)sizeof(imp->pkt))
+                {
+                    fprintf(stderr, "ERROR: Stray data byte in .usb file\n");
+                    imp->err = 1;
+                    break;
+                }
+                imp->pkt[imp->pkt_len++] = USB_ENTRY_BYTE(w);
+
+                // Bulk scan: payload bytes come in long runs of
+                // identical entries, take them two at a time
+                while (i + 2 <= count && imp->pkt_len + 2 <= (int)sizeof(imp->pkt))
+                {
+                    memcpy(&v, p + (i * 4), 8);
+                    if ((v & 0x00FFFFFF00FFFFFFULL) != (((uint64_t)USB_DATA_BYTE << 32) | USB_DATA_BYTE))
+                        break;
+
+                    imp->pkt[imp->pkt_len++] = v >> 24;
+                    imp->pkt[imp->pkt_len++] = v >> 56;
+                    i += 2;
+                }
+                break;
+            default:
+                break;
+        }
+    }
+}
+//-----------------------------------------------------------------
+// log_import_raw: Parse .raw length prefixed packets (no timing,
+// records are given zero gaps; SOFs still set the frame times)
+//-----------------------------------------------------------------
+static void log_import_raw(struct log_import *imp, const uint8_t *p, size_t size)
+{
+    size_t pos = 0;
+    uint16_t len;
+
+    while (pos + 2 <= size && !imp->err)
+    {
+        len = p[pos] | (p[pos + 1] << 8);
+        pos += 2;
+
+        if (len == 0 || len > MAX_PACKET_SIZE + 1 || pos + len > size)
+        {
+            fprintf(stderr, "ERROR: Truncated .raw file\n");
+            imp->err = 1;
+            break;
+        }
+
+        log_import_packet(imp, p + pos, len, 0);
+        pos += len;
+    }
+}
+//-----------------------------------------------------------------
+// log_import: Rebuild dense records from a .usb or .raw file
+//-----------------------------------------------------------------
+int log_import(const char *filename, tCaptureFile *cap)
+{
+    struct log_import imp;
+    const char *ext = strrchr(filename, '.');
+    struct stat st;
+    void *map;
+    int fd;
+
+    if (!ext || (strcmp(ext, ".usb") != 0 && strcmp(ext, ".raw") != 0))
+    {
+        fprintf (stderr,"ERROR: Unsupported input format (check extension)\n");
+        return -1;
+    }
+
+    fd = open(filename, O_RDONLY);
+    if (fd < 0 || fstat(fd, &st) != 0)
+    {
+        fprintf(stderr, "ERROR: Could not open %s\n", filename);
+        if (fd >= 0)
+            close(fd);
+        return -1;
+    }
+
+    memset(&imp, 0, sizeof(imp));
+    imp.cap = cap;
+    imp.buf = (uint32_t *)malloc(IMPORT_BUF_WORDS * sizeof(uint32_t));
+
+    if (st.st_size > 0)
+    {
+        map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (map == MAP_FAILED || !imp.buf)
+        {
+            fprintf(stderr, "ERROR: Could not read %s\n", filename);
+            imp.err = 1;
+        }
+        else
+        {
+            madvise(map, st.st_size, MADV_SEQUENTIAL);
+
+            if (strcmp(ext, ".usb") == 0)
+                log_import_usb(&imp, (const uint8_t *)map, st.st_size);
+            else
+                log_import_raw(&imp, (const uint8_t *)map, st.st_size);
+
+            munmap(map, st.st_size);
+        }
+    }
+
+    if (!imp.err)
+        log_import_flush(&imp);
+
+    free(imp.buf);
+    close(fd);
+    return imp.err ? -1 : 0;
+}
@@ -0,0 +1,17 @@
+#ifndef __LOG_IMPORT_H__
+#define __LOG_IMPORT_H__
+
+//--------------------------------------------------------------------
+// Prototypes
+//--------------------------------------------------------------------
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+int log_import(const char *filename, tCaptureFile *cap);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
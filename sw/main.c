@@ -35,18 +35,46 @@
 //-----------------------------------------------------------------
 #include <stdio.h>
 #include <string.h>
+#include <stdlib.h>
 #include <assert.h>
 #include <sys/time.h> 
+#include <time.h>
 #include <ftdi.h>
 #include <netinet/in.h>
 #include <unistd.h>
 #include <sys/select.h>
+#include <sys/stat.h>
 
 #include "log_format.h"
 #include "usb_defs.h"
 #include "usb_helpers.h"
 #include "usb_sniffer.h"
 #include "log_file.h"
+#include "log_decode.h"
+#include "capture_filter.h"
+#include "payload_store.h"
+#include "capture_file.h"
+#include "capture_codec.h"
+#include "capture_slice.h"
+#include "capture_convert.h"
+#include "log_import.h"
+#include "column_export.h"
+#include "transaction.h"
+#include "txn_cache.h"
+#include "descriptor_snoop.h"
+#include "transfer.h"
+#include "live_stats.h"
+#include "latency.h"
+#include "heavy_hitters.h"
+#include "schedule.h"
+#include "class_decoder.h"
+#include "decoder_host.h"
+#include "pyramid.h"
+#include "anomaly.h"
+#include "parallel.h"
+#include "query.h"
+#include "payload_search.h"
+#include "txn_diff.h"
 
 //-----------------------------------------------------------------
 // Defines:
@@ -55,88 +83,1049 @@
 #define LA_BUFFER_SIZE      (64 * 1024)
 
 //-----------------------------------------------------------------
-// write_usb_file
+// Structures
 //-----------------------------------------------------------------
-static int write_usb_file(const char *output_file, FILE *tmpf, tUsbSpeed speed)
+// Analysis run on records as they are captured
+typedef struct
 {
-    int err = 0;
-    int i,j;
-    uint32_t value = 0;
-    uint32_t data = 0;
-    uint8_t  usb_data[MAX_PACKET_SIZE];
-    int      usb_idx;
-    int      idx = 0;
-    long     buf_size = 0;
-
-    // Get size of temporary file
-    fseek(tmpf, 0, SEEK_END);
-    buf_size = ftell(tmpf);
-    rewind(tmpf);
-
-    // No captured data...
-    if (buf_size == 0)
-        return 0;
+    tLiveStats       *stats;
+    tLatencyStats    *latency;
+    tHeavyHitters    *hitters;
+    tScheduleStats   *schedule;
+    tDecoderHost     *decoders;
+    tPyramidBuilder  *pyramid;
+    tAnomalyDetector *anomaly;
+} tLiveStages;
+
+//-----------------------------------------------------------------
+// live_record: Capture writer observer, feeds live stages
+//-----------------------------------------------------------------
+static int live_record(void *ctx, const tLogRecord *rec)
+{
+    tLiveStages *live = (tLiveStages *)ctx;
 
-    // Create log file
-    if (log_file_create(output_file) != 0)
+    if (live->stats && live_stats_add(live->stats, rec) != 0)
+        return -1;
+    if (live->latency && latency_add(live->latency, rec) != 0)
+        return -1;
+    if (live->hitters && heavy_hitters_add(live->hitters, rec) != 0)
         return -1;
+    if (live->schedule && schedule_add(live->schedule, rec) != 0)
+        return -1;
+    if (live->decoders && decoder_host_add_record(live->decoders, rec) != 0)
+        return -1;
+    if (live->pyramid && pyramid_builder_add(live->pyramid, rec) != 0)
+        return -1;
+    if (live->anomaly && anomaly_add(live->anomaly, rec) != 0)
+        return -1;
+
+    return 0;
+}
+//-----------------------------------------------------------------
+// capture_chunk: Copy records between RD & WR pointers to capture
+//-----------------------------------------------------------------
+static int capture_chunk(tCaptureFile *cap, uint32_t rd_ptr, uint32_t size)
+{
+    int res;
+    uint32_t *buffer = (uint32_t *)malloc(size);
+    assert(buffer);
+
+    res = usb_sniffer_fetch_buffer(buffer, rd_ptr, size);
+    if (res >= 0 && capture_file_write(cap, buffer, size / 4) != 0)
+        res = -1;
+
+    free(buffer);
+    return res;
+}
+//-----------------------------------------------------------------
+// export_capture: Write capture to output file (.usb, .txt, .raw)
+// or column directory (.col)
+//-----------------------------------------------------------------
+static int export_capture(const char *filename, tCaptureFile *cap, const tCaptureFilter *filter)
+{
+    const char *ext = strrchr(filename, '.');
+
+    if (ext && strcmp(ext, ".col") == 0)
+        return column_export(filename, cap, filter);
 
-    // Iterate through log and convert to .usb format file
-    while (idx < (buf_size / 4))
+    return capture_convert(filename, cap, filter);
+}
+//-----------------------------------------------------------------
+// filter_option: Handle export filter option (-D/-E/-P/-t).
+// Returns 1 if handled, 0 if not a filter option, -1 on error
+//-----------------------------------------------------------------
+static int filter_option(tCaptureFilter *filter, int c, const char *arg)
+{
+    switch(c)
     {
-        fread(&value, 4, 1, tmpf);
-        idx++;
+        case 'D': // Export device filter
+            filter->device = (int)strtoul(arg, NULL, 0) & 0x7F;
+            return 1;
+        case 'E': // Export endpoint filter
+            filter->endpoint = (int)strtoul(arg, NULL, 0) & 0xF;
+            return 1;
+        case 'P': // Export PID filter
+            return capture_filter_add_pid(filter, arg) == 0 ? 1 : -1;
+        case 't': // Export time window
+            return capture_filter_parse_time(filter, arg) == 0 ? 1 : -1;
+        default:
+            return 0;
+    }
+}
+//-----------------------------------------------------------------
+// is_capture_file: Output is a saved (.cap) capture
+//-----------------------------------------------------------------
+static int is_capture_file(const char *filename)
+{
+    const char *ext = strrchr(filename, '.');
+    return ext && strcmp(ext, ".cap") == 0;
+}
+//-----------------------------------------------------------------
+// scan_capture_file: Pass the (matching) records of a saved capture
+// to fn
+//-----------------------------------------------------------------
+static int scan_capture_file(const char *filename, const tCaptureFilter *filter, tCaptureObserver fn, void *ctx)
+{
+    tCaptureFile *cap;
+    FILE *f;
+    int res;
 
-        switch ((value >> LOG_CTRL_TYPE_L) & LOG_CTRL_CYCLE_MASK)
-        {
-            case LOG_CTRL_TYPE_SOF:
-            {                
-                log_file_add_sof(value, speed == USB_SPEED_HS);
-            }
-            break;
-            case LOG_CTRL_TYPE_RST:
-            {
-                log_file_add_rst(value, speed == USB_SPEED_HS);
-            }
-            break;
-            case LOG_CTRL_TYPE_TOKEN:
-            {
-                log_file_add_token(value);
-            }
-            break;
-            case LOG_CTRL_TYPE_HSHAKE:
-            {
-                log_file_add_handshake(value);
-            }
-            break;
-            case LOG_CTRL_TYPE_DATA:
-            {
-                uint32_t len = usb_get_data_length(value);
+    f = fopen(filename, "rb");
+    if (!f)
+    {
+        fprintf(stderr, "ERROR: Could not open %s\n", filename);
+        return -1;
+    }
 
-                usb_idx = 0;
-                for (i = 0; i < len; i+= 4)
-                {
-                    fread(&data, 4, 1, tmpf);
-                    idx++;
-                    
-                    for (j=0;j<4 && usb_idx < len;j++)
-                        usb_data[usb_idx++] = data >> (8 * j);
-                }
+    cap = capture_file_open(f);
+    if (!cap)
+    {
+        fclose(f);
+        return -1;
+    }
 
-                log_file_add_data(value, usb_data, len);
-            }
-            break;
+    res = capture_file_scan(cap, filter, fn, ctx);
+
+    capture_file_close(cap);
+    fclose(f);
+    return res < 0 ? -1 : 0;
+}
+//-----------------------------------------------------------------
+// slice_main: usb_sniffer slice [filter] in.cap out.cap
+//-----------------------------------------------------------------
+static int slice_main(int argc, char *argv[])
+{
+    tCaptureFilter filter;
+    int help = 0;
+    int c;
+
+    capture_filter_init(&filter);
+
+    while ((c = getopt (argc, argv, "D:E:P:t:")) != -1)
+    {
+        if (filter_option(&filter, c, optarg) != 1)
+            help = 1;
+    }
+
+    if (help || (argc - optind) != 2)
+    {
+        fprintf (stderr,"Usage: slice [options] in.cap out.cap\n");
+        fprintf (stderr,"-D 0xnn     - Keep only this device ID\n");
+        fprintf (stderr,"-E 0xnn     - Keep only this endpoint\n");
+        fprintf (stderr,"-P pid      - Keep only this PID (name or value, repeatable)\n");
+        fprintf (stderr,"-t a:b      - Keep only records between a and b seconds\n");
+        return -1;
+    }
+
+    return capture_slice(argv[optind], argv[optind + 1], &filter);
+}
+//-----------------------------------------------------------------
+// print_capture_info: Describe a saved capture
+//-----------------------------------------------------------------
+static void print_capture_info(tCaptureFile *cap)
+{
+    static const char *speeds[] = { "HS", "FS", "LS" };
+    const tCaptureInfo *info = capture_file_info(cap);
+    time_t start = (time_t)info->start_time;
+    int speed = capture_file_speed(cap);
+
+    printf("Speed:    %s\n", (speed >= 0 && speed <= USB_SPEED_LS) ? speeds[speed] : "?");
+    if (info->start_time)
+        printf("Captured: %s", ctime(&start));
+    if (info->match_device >= 0)
+        printf("Device:   %s0x%02x\n", info->match_inverse ? "not " : "", info->match_device);
+    if (info->match_endpoint >= 0)
+        printf("Endpoint: %s0x%x\n", info->match_inverse ? "not " : "", info->match_endpoint);
+    if (info->drop_sof)
+        printf("SOF:      not captured\n");
+    if (info->buffer_size)
+        printf("Buffer:   0x%08x (%dKB, %s)\n", info->buffer_base, info->buffer_size / 1024,
+               info->one_shot ? "one shot" : "continuous");
+}
+//-----------------------------------------------------------------
+// decode_main: usb_sniffer decode [filter] in.cap out.{usb,txt,raw}
+//-----------------------------------------------------------------
+static int decode_main(int argc, char *argv[])
+{
+    tCaptureFilter filter;
+    tCaptureFile *cap;
+    FILE *f;
+    int help = 0;
+    int res;
+    int c;
+
+    capture_filter_init(&filter);
+
+    while ((c = getopt (argc, argv, "D:E:P:t:")) != -1)
+    {
+        if (filter_option(&filter, c, optarg) != 1)
+            help = 1;
+    }
+
+    if (help || (argc - optind) != 2)
+    {
+        fprintf (stderr,"Usage: decode [options] in.cap out.{usb,txt,raw,col}\n");
+        fprintf (stderr,"-D 0xnn     - Export only this device ID\n");
+        fprintf (stderr,"-E 0xnn     - Export only this endpoint\n");
+        fprintf (stderr,"-P pid      - Export only this PID (name or value, repeatable)\n");
+        fprintf (stderr,"-t a:b      - Export only records between a and b seconds\n");
+        return -1;
+    }
+
+    f = fopen(argv[optind], "rb");
+    if (!f)
+    {
+        fprintf(stderr, "ERROR: Could not open %s\n", argv[optind]);
+        return -1;
+    }
+
+    cap = capture_file_open(f);
+    if (!cap)
+    {
+        fclose(f);
+        return -1;
+    }
+
+    print_capture_info(cap);
+    res = export_capture(argv[optind + 1], cap, &filter);
+
+    capture_file_close(cap);
+    fclose(f);
+    return res;
+}
+//-----------------------------------------------------------------
+// import_main: usb_sniffer import [options] in.{usb,raw} out.cap
+//-----------------------------------------------------------------
+static int import_main(int argc, char *argv[])
+{
+    tUsbSpeed speed = USB_SPEED_HS;
+    int codec = CAPTURE_CODEC_NONE;
+    int cap_flags = 0;
+    tCaptureFile *cap;
+    FILE *f;
+    int help = 0;
+    int res;
+    int c;
+
+    while ((c = getopt (argc, argv, "u:z:rp")) != -1)
+    {
+        switch(c)
+        {
+            case 'u': // Speed capture was taken at
+                if (strcmp(optarg, "hs") == 0)
+                    speed = USB_SPEED_HS;
+                else if (strcmp(optarg, "fs") == 0)
+                    speed = USB_SPEED_FS;
+                else if (strcmp(optarg, "ls") == 0)
+                    speed = USB_SPEED_LS;
+                else
+                    help = 1;
+                break;
+            case 'r':
+                cap_flags |= CAPTURE_FLAG_RUNS;
+                break;
+            case 'p':
+                cap_flags |= CAPTURE_FLAG_DEDUP;
+                break;
+            case 'z':
+                codec = capture_codec_parse(optarg);
+                if (codec < 0 || !capture_codec_supported(codec))
+                    help = 1;
+                break;
             default:
-                printf("ERROR: Unknown ID %x\n", value);
-                return -1;
+                help = 1;
+                break;
         }
     }
 
-    log_file_close();
+    if (help || (argc - optind) != 2)
+    {
+        fprintf (stderr,"Usage: import [options] in.{usb,raw} out.cap\n");
+        fprintf (stderr,"-u ls|fs|hs - USB speed of capture (default: hs)\n");
+        fprintf (stderr,"-z lz|zstd  - Compress stored capture blocks\n");
+        fprintf (stderr,"-r          - Run encode repeated SOF and IN/NAK polling\n");
+        fprintf (stderr,"-p          - Store each distinct data payload once\n");
+        return -1;
+    }
+
+    f = fopen(argv[optind + 1], "wb");
+    if (!f)
+    {
+        fprintf(stderr, "ERROR: Could not create %s\n", argv[optind + 1]);
+        return -1;
+    }
+
+    cap = capture_file_create(f, speed, codec, cap_flags, NULL);
+    if (!cap)
+    {
+        fclose(f);
+        return -1;
+    }
+
+    res = log_import(argv[optind], cap);
+    if (capture_file_close(cap) != 0)
+        res = -1;
+
+    fclose(f);
+    return res;
+}
+//-----------------------------------------------------------------
+// transactions_main: usb_sniffer transactions [filter] in.cap
+//-----------------------------------------------------------------
+static int transactions_main(int argc, char *argv[])
+{
+    tCaptureFilter filter;
+    const tTransaction *txn;
+    tTxnCache *cache;
+    char line[128];
+    uint64_t count;
+    uint64_t i;
+    int help = 0;
+    int c;
+
+    capture_filter_init(&filter);
+
+    while ((c = getopt (argc, argv, "D:E:P:t:")) != -1)
+    {
+        if (filter_option(&filter, c, optarg) != 1)
+            help = 1;
+    }
+
+    if (help || (argc - optind) != 1)
+    {
+        fprintf (stderr,"Usage: transactions [options] in.cap\n");
+        fprintf (stderr,"-D 0xnn     - List only this device ID\n");
+        fprintf (stderr,"-E 0xnn     - List only this endpoint\n");
+        fprintf (stderr,"-P pid      - List only transactions with this PID (repeatable)\n");
+        fprintf (stderr,"-t a:b      - List only transactions between a and b seconds\n");
+        return -1;
+    }
+
+    // Built on first use, kept beside the capture as in.cap.txn
+    cache = txn_cache_open(argv[optind]);
+    if (!cache)
+        return -1;
+
+    count = txn_cache_count(cache);
+    for (i=0;i<count;i++)
+    {
+        txn = txn_cache_get(cache, i);
+        if (!txn_match_filter(&filter, txn))
+            continue;
+
+        txn_describe(txn, line, sizeof(line));
+        printf("%s\n", line);
+    }
+
+    txn_cache_close(cache);
+    return 0;
+}
+//-----------------------------------------------------------------
+// print_transfer: Transfer assembler callback for transfers_main
+//-----------------------------------------------------------------
+static int print_transfer(void *ctx, const tTransfer *xfer)
+{
+    const tCaptureFilter *filter = (const tCaptureFilter *)ctx;
+    int i;
+
+    if (xfer->start < filter->t_start || xfer->start > filter->t_end ||
+        (filter->device >= 0 && xfer->device != filter->device) ||
+        (filter->endpoint >= 0 && xfer->endpoint != filter->endpoint))
+        return 0;
+
+    printf("%12.6f  dev %3d ep %2d  %-9s %-3s %8u bytes %5u txns %5u NAKs %10.6fs  %s",
+           (double)xfer->start / TICKS_PER_SEC, xfer->device, xfer->endpoint,
+           transfer_type_str(xfer->type), xfer->dir == PID_IN ? "IN" : "OUT",
+           xfer->bytes, xfer->txns, xfer->naks,
+           (double)(xfer->end - xfer->start) / TICKS_PER_SEC, transfer_status_str(xfer->status));
+
+    if (xfer->errors)
+        printf("  %u retried", xfer->errors);
+
+    if (xfer->type == TRANSFER_CONTROL)
+    {
+        printf("  SETUP");
+        for (i=0;i<8;i++)
+            printf(" %02x", xfer->setup[i]);
+    }
+
+    printf("\n");
+    return 0;
+}
+//-----------------------------------------------------------------
+// transfers_main: usb_sniffer transfers [filter] in.cap
+//-----------------------------------------------------------------
+static int transfers_main(int argc, char *argv[])
+{
+    tCaptureFilter filter;
+    tTransferAssembler *xa;
+    const tTransaction *txn;
+    tTxnCache *cache;
+    uint64_t count;
+    uint64_t i;
+    int help = 0;
+    int err = 0;
+    int c;
+
+    capture_filter_init(&filter);
+
+    while ((c = getopt (argc, argv, "D:E:t:")) != -1)
+    {
+        if (filter_option(&filter, c, optarg) != 1)
+            help = 1;
+    }
+
+    if (help || (argc - optind) != 1)
+    {
+        fprintf (stderr,"Usage: transfers [options] in.cap\n");
+        fprintf (stderr,"-D 0xnn     - List only this device ID\n");
+        fprintf (stderr,"-E 0xnn     - List only this endpoint\n");
+        fprintf (stderr,"-t a:b      - List only transfers starting between a and b seconds\n");
+        return -1;
+    }
+
+    cache = txn_cache_open(argv[optind]);
+    if (!cache)
+        return -1;
+
+    xa = transfer_assembler_create(print_transfer, &filter);
+
+    count = txn_cache_count(cache);
+    for (i=0;i<count && !err;i++)
+    {
+        txn = txn_cache_get(cache, i);
+        err = transfer_assembler_add_txn(xa, txn, txn_cache_payload(cache, txn));
+    }
+
+    if (!err)
+        err = transfer_assembler_flush(xa);
 
+    transfer_assembler_destroy(xa);
+    txn_cache_close(cache);
     return err;
 }
 //-----------------------------------------------------------------
+// latency_main: usb_sniffer latency [filter] in.cap
+//-----------------------------------------------------------------
+static int latency_main(int argc, char *argv[])
+{
+    tCaptureFilter filter;
+    tLiveStages stages;
+    int help = 0;
+    int res;
+    int c;
+
+    capture_filter_init(&filter);
+
+    while ((c = getopt (argc, argv, "D:E:t:")) != -1)
+    {
+        if (filter_option(&filter, c, optarg) != 1)
+            help = 1;
+    }
+
+    if (help || (argc - optind) != 1)
+    {
+        fprintf (stderr,"Usage: latency [options] in.cap\n");
+        fprintf (stderr,"-D 0xnn     - Only this device ID\n");
+        fprintf (stderr,"-E 0xnn     - Only this endpoint\n");
+        fprintf (stderr,"-t a:b      - Only between a and b seconds\n");
+        return -1;
+    }
+
+    memset(&stages, 0, sizeof(stages));
+    stages.latency = latency_create();
+    if (!stages.latency)
+        return -1;
+
+    res = scan_capture_file(argv[optind], &filter, live_record, &stages);
+    if (res == 0)
+        latency_report(stdout, stages.latency);
+
+    latency_destroy(stages.latency);
+    return res;
+}
+//-----------------------------------------------------------------
+// hitters_main: usb_sniffer hitters [-n bytes] [-k top] [-D] [-E] [-t a:b] in.cap
+//-----------------------------------------------------------------
+static int hitters_main(int argc, char *argv[])
+{
+    tCaptureFilter filter;
+    tLiveStages stages;
+    int prefix = HITTERS_DEF_PREFIX;
+    int top = HITTERS_REPORT;
+    int help = 0;
+    int res;
+    int c;
+
+    capture_filter_init(&filter);
+
+    while ((c = getopt (argc, argv, "n:k:D:E:t:")) != -1)
+    {
+        if (c == 'n')
+            prefix = atoi(optarg);
+        else if (c == 'k')
+            top = atoi(optarg);
+        else if (filter_option(&filter, c, optarg) != 1)
+            help = 1;
+    }
+
+    if (help || top <= 0 || (argc - optind) != 1)
+    {
+        fprintf (stderr,"Usage: hitters [options] in.cap\n");
+        fprintf (stderr,"-n bytes    - Payload prefix bytes in key (default: %d, 0 = endpoints only)\n", HITTERS_DEF_PREFIX);
+        fprintf (stderr,"-k n        - Entries to list (default: %d, max %d)\n", HITTERS_REPORT, HITTERS_REPORT);
+        fprintf (stderr,"-D 0xnn     - Only this device ID\n");
+        fprintf (stderr,"-E 0xnn     - Only this endpoint\n");
+        fprintf (stderr,"-t a:b      - Only between a and b seconds\n");
+        return -1;
+    }
+
+    memset(&stages, 0, sizeof(stages));
+    stages.hitters = heavy_hitters_create(prefix);
+    if (!stages.hitters)
+        return -1;
+
+    res = scan_capture_file(argv[optind], &filter, live_record, &stages);
+    if (res == 0)
+        heavy_hitters_report(stdout, stages.hitters, top);
+
+    heavy_hitters_destroy(stages.hitters);
+    return res;
+}
+//-----------------------------------------------------------------
+// schedule_main: usb_sniffer schedule [-D dev] [-t a:b] in.cap
+//-----------------------------------------------------------------
+static int schedule_main(int argc, char *argv[])
+{
+    tCaptureFilter filter;
+    tLiveStages stages;
+    tCaptureFile *cap;
+    FILE *f;
+    int help = 0;
+    int res;
+    int c;
+
+    capture_filter_init(&filter);
+
+    while ((c = getopt (argc, argv, "D:t:")) != -1)
+    {
+        if (filter_option(&filter, c, optarg) != 1)
+            help = 1;
+    }
+
+    if (help || (argc - optind) != 1)
+    {
+        fprintf (stderr,"Usage: schedule [options] in.cap\n");
+        fprintf (stderr,"-D 0xnn     - Only this device ID\n");
+        fprintf (stderr,"-t a:b      - Only between a and b seconds\n");
+        return -1;
+    }
+
+    f = fopen(argv[optind], "rb");
+    if (!f)
+    {
+        fprintf(stderr, "ERROR: Could not open %s\n", argv[optind]);
+        return -1;
+    }
+
+    cap = capture_file_open(f);
+    if (!cap)
+    {
+        fclose(f);
+        return -1;
+    }
+
+    // Frame length depends on the capture speed
+    memset(&stages, 0, sizeof(stages));
+    stages.schedule = schedule_create(capture_file_speed(cap));
+    if (!stages.schedule)
+    {
+        capture_file_close(cap);
+        fclose(f);
+        return -1;
+    }
+
+    res = capture_file_scan(cap, &filter, live_record, &stages) < 0 ? -1 : 0;
+    if (res == 0)
+        schedule_report(stdout, stages.schedule);
+
+    schedule_destroy(stages.schedule);
+    capture_file_close(cap);
+    fclose(f);
+    return res;
+}
+//-----------------------------------------------------------------
+// analyze_main: usb_sniffer analyze -X decoder [-X ...] [filter] in.cap
+//-----------------------------------------------------------------
+static int analyze_main(int argc, char *argv[])
+{
+    tCaptureFilter filter;
+    tLiveStages stages;
+    int decoders = 0;
+    int help = 0;
+    int res;
+    int c;
+
+    capture_filter_init(&filter);
+    memset(&stages, 0, sizeof(stages));
+    stages.decoders = decoder_host_create();
+
+    while ((c = getopt (argc, argv, "X:D:E:t:")) != -1)
+    {
+        if (c == 'X')
+        {
+            if (decoder_host_load(stages.decoders, optarg) != 0)
+                help = 1;
+            else
+                decoders++;
+        }
+        else if (filter_option(&filter, c, optarg) != 1)
+            help = 1;
+    }
+
+    if (!help && decoders == 0)
+    {
+        fprintf(stderr, "ERROR: No class decoder given (-X)\n");
+        help = 1;
+    }
+
+    if (help || (argc - optind) != 1)
+    {
+        fprintf (stderr,"Usage: analyze -X name [options] in.cap\n");
+        fprintf (stderr,"-X name[:args] - Class decoder, built in or plugin path (repeatable, at least one)\n");
+        fprintf (stderr,"-D 0xnn     - Only this device ID\n");
+        fprintf (stderr,"-E 0xnn     - Only this endpoint\n");
+        fprintf (stderr,"-t a:b      - Only between a and b seconds\n");
+        fprintf (stderr,"\nBuilt in decoders:\n");
+        fprintf (stderr,"storage[:ms] - Bulk-Only Transport per SCSI opcode latency / throughput\n");
+        fprintf (stderr,"media[:prefix] - UVC video frames / UAC audio samples to prefix_dev_epdir.video / .audio,\n");
+        fprintf (stderr,"               with dropped / missing frames and audio underruns (bad packets as\n");
+        fprintf (stderr,"               silence); needs the enumeration in the capture\n");
+        fprintf (stderr,"\nA plugin is a shared object (gcc -shared -fPIC) exporting usb_sniffer_class_decoder, see\n");
+        fprintf (stderr,"class_decoder.h. Decoders subscribe per endpoint (given the interface\n");
+        fprintf (stderr,"class when enumeration was captured) and get reassembled transfers on\n");
+        fprintf (stderr,"their own thread; endpoints nobody subscribed to are not reassembled.\n");
+        fprintf (stderr,"While capturing, a decoder that falls behind loses batches (counted in\n");
+        fprintf (stderr,"its report) rather than stalling acquisition.\n");
+        decoder_host_finish(stages.decoders, stderr);
+        decoder_host_destroy(stages.decoders);
+        return -1;
+    }
+
+    res = scan_capture_file(argv[optind], &filter, live_record, &stages);
+    if (decoder_host_finish(stages.decoders, stdout) != 0)
+        res = -1;
+
+    decoder_host_destroy(stages.decoders);
+    return res;
+}
+//-----------------------------------------------------------------
+// file_size: Size of file in bytes (0 if missing)
+//-----------------------------------------------------------------
+static uint64_t file_size(const char *filename)
+{
+    struct stat st;
+    return stat(filename, &st) == 0 ? (uint64_t)st.st_size : 0;
+}
+//-----------------------------------------------------------------
+// timeline_main: usb_sniffer timeline [-D dev] [-t a:b] [-w n] in.cap
+//-----------------------------------------------------------------
+static int timeline_main(int argc, char *argv[])
+{
+    tCaptureFilter filter;
+    tLiveStages stages;
+    tPyramid *pyr;
+    tPyramidColumn *cols;
+    uint64_t size;
+    uint64_t width;
+    char path[1024];
+    int columns = 80;
+    int help = 0;
+    int level;
+    int c;
+    int i;
+
+    capture_filter_init(&filter);
+
+    while ((c = getopt (argc, argv, "D:t:w:")) != -1)
+    {
+        if (c == 'w')
+            columns = atoi(optarg);
+        else if (filter_option(&filter, c, optarg) != 1)
+            help = 1;
+    }
+
+    if (help || columns <= 0 || (argc - optind) != 1)
+    {
+        fprintf (stderr,"Usage: timeline [options] in.cap\n");
+        fprintf (stderr,"-D 0xnn     - Only this device ID (default: whole bus)\n");
+        fprintf (stderr,"-t a:b      - Time range in seconds (default: whole capture)\n");
+        fprintf (stderr,"-w n        - Number of time columns (default: 80)\n");
+        return -1;
+    }
+
+    // Summary is kept beside the capture (in.cap.pyr), built on demand
+    snprintf(path, sizeof(path), "%s%s", argv[optind], PYRAMID_SUFFIX);
+    size = file_size(argv[optind]);
+
+    pyr = pyramid_open(path, size);
+    if (!pyr)
+    {
+        FILE *f = fopen(argv[optind], "rb");
+        tCaptureFile *cap = f ? capture_file_open(f) : NULL;
+
+        if (!cap)
+        {
+            if (f)
+                fclose(f);
+            else
+                fprintf(stderr, "ERROR: Could not open %s\n", argv[optind]);
+            return -1;
+        }
+
+        memset(&stages, 0, sizeof(stages));
+        stages.pyramid = pyramid_builder_create(path);
+
+        if (!stages.pyramid || capture_file_scan(cap, NULL, live_record, &stages) < 0)
+        {
+            capture_file_close(cap);
+            fclose(f);
+            return -1;
+        }
+
+        capture_file_close(cap);
+        fclose(f);
+
+        if (pyramid_builder_finish(stages.pyramid, size) != 0)
+            return -1;
+
+        pyr = pyramid_open(path, size);
+        if (!pyr)
+            return -1;
+    }
+
+    // Whole capture unless a window was given
+    if (filter.t_end == CAPTURE_TIME_MAX)
+    {
+        uint64_t first;
+        pyramid_time_range(pyr, &first, &filter.t_end);
+        if (filter.t_start < first)
+            filter.t_start = first;
+    }
+
+    cols = (tPyramidColumn *)malloc(columns * sizeof(tPyramidColumn));
+    assert(cols);
+
+    level = pyramid_query(pyr, filter.t_start, filter.t_end, filter.device, columns, cols);
+    width = (filter.t_end - filter.t_start) / columns + 1;
+
+    printf("Level %d, %.6fs per column\n", level, (double)width / TICKS_PER_SEC);
+    for (i=0;i<columns;i++)
+        printf("%12.6f  %9.3f MB/s  %9.0f pkt/s  %llu errors\n",
+               (double)(filter.t_start + i * width) / TICKS_PER_SEC,
+               cols[i].bytes * (double)TICKS_PER_SEC / width / 1e6,
+               cols[i].packets * (double)TICKS_PER_SEC / width, (unsigned long long)cols[i].errors);
+
+    free(cols);
+    pyramid_close(pyr);
+    return 0;
+}
+//-----------------------------------------------------------------
+// print_anomaly_summary: Anomaly counts by type
+//-----------------------------------------------------------------
+static void print_anomaly_summary(const tAnomalyHeader *hdr)
+{
+    int i;
+
+    printf("Anomalies: %llu in %llu records", (unsigned long long)hdr->count, (unsigned long long)hdr->records);
+    for (i=0;i<ANOMALY_TYPES;i++)
+        if (hdr->type_count[i])
+            printf(", %s %llu", anomaly_type_str(i), (unsigned long long)hdr->type_count[i]);
+    printf("\n");
+}
+//-----------------------------------------------------------------
+// anomalies_main: usb_sniffer anomalies [filter] in.cap
+//-----------------------------------------------------------------
+static int anomalies_main(int argc, char *argv[])
+{
+    tCaptureFilter filter;
+    tAnomalyHeader hdr;
+    tLiveStages stages;
+    tAnomaly a;
+    char path[1024];
+    uint64_t size;
+    FILE *f;
+    int help = 0;
+    int c;
+
+    capture_filter_init(&filter);
+
+    while ((c = getopt (argc, argv, "D:E:t:")) != -1)
+    {
+        if (filter_option(&filter, c, optarg) != 1)
+            help = 1;
+    }
+
+    if (help || (argc - optind) != 1)
+    {
+        fprintf (stderr,"Usage: anomalies [options] in.cap\n");
+        fprintf (stderr,"-D 0xnn     - List only this device ID\n");
+        fprintf (stderr,"-E 0xnn     - List only this endpoint\n");
+        fprintf (stderr,"-t a:b      - List only between a and b seconds\n");
+        return -1;
+    }
+
+    // Index is kept beside the capture (in.cap.anm), built on demand
+    snprintf(path, sizeof(path), "%s%s", argv[optind], ANOMALY_SUFFIX);
+    size = file_size(argv[optind]);
+
+    f = fopen(path, "rb");
+    if (!f || anomaly_read_header(f, &hdr) != 0 || hdr.source_size != size)
+    {
+        if (f)
+            fclose(f);
+
+        memset(&stages, 0, sizeof(stages));
+        stages.anomaly = anomaly_create(path);
+        if (!stages.anomaly)
+            return -1;
+
+        if (scan_capture_file(argv[optind], NULL, live_record, &stages) != 0)
+        {
+            anomaly_finish(stages.anomaly, 0, NULL);
+            return -1;
+        }
+
+        if (anomaly_finish(stages.anomaly, size, NULL) != 0)
+            return -1;
+
+        f = fopen(path, "rb");
+        if (!f || anomaly_read_header(f, &hdr) != 0)
+        {
+            fprintf(stderr, "ERROR: Could not read %s\n", path);
+            if (f)
+                fclose(f);
+            return -1;
+        }
+    }
+
+    while (fread(&a, sizeof(a), 1, f) == 1)
+    {
+        if (a.time < filter.t_start || a.time > filter.t_end ||
+            (filter.device >= 0 && a.device != filter.device) ||
+            (filter.endpoint >= 0 && a.endpoint != filter.endpoint))
+            continue;
+
+        printf("%12.6f  record %10llu  dev %3d ep %2d  %-9s %s\n",
+               (double)a.time / TICKS_PER_SEC, (unsigned long long)a.record,
+               a.device, a.endpoint, anomaly_type_str(a.type), a.pid ? usb_get_pid_str(a.pid) : "");
+    }
+
+    print_anomaly_summary(&hdr);
+    fclose(f);
+    return 0;
+}
+//-----------------------------------------------------------------
+// query_main: usb_sniffer query "aggregates [where ...] [by ...]" in.cap
+//-----------------------------------------------------------------
+static int query_main(int argc, char *argv[])
+{
+    tCaptureFile *cap;
+    tQuery *q;
+    FILE *f;
+    int help = 0;
+    int res;
+    int c;
+
+    while ((c = getopt (argc, argv, "j:")) != -1)
+    {
+        if (c == 'j')
+            parallel_set_threads(atoi(optarg));
+        else
+            help = 1;
+    }
+
+    if (help || (argc - optind) != 2)
+    {
+        fprintf (stderr,"Usage: query [options] \"aggregates [where condition] [by keys]\" in.cap\n");
+        fprintf (stderr,"-j n        - Worker threads (default: one per CPU)\n");
+        fprintf (stderr,"Fields:     time (s), dev, ep, pid, len (DATA payload bytes)\n");
+        fprintf (stderr,"Aggregates: count, sum(f), min(f), max(f), avg(f)\n");
+        fprintf (stderr,"Condition:  f op value (== != < <= > >=), f in (a, b), not, and, or, ()\n");
+        fprintf (stderr,"Keys:       f or f/step, e.g. time/0.1\n");
+        fprintf (stderr,"Example:    query \"count, sum(len) where dev == 3 and pid in (DATA0, DATA1) by ep, time/1\" in.cap\n");
+        return -1;
+    }
+
+    q = query_compile(argv[optind]);
+    if (!q)
+        return -1;
+
+    f = fopen(argv[optind + 1], "rb");
+    if (!f)
+    {
+        fprintf(stderr, "ERROR: Could not open %s\n", argv[optind + 1]);
+        query_destroy(q);
+        return -1;
+    }
+
+    cap = capture_file_open(f);
+    if (!cap)
+    {
+        fclose(f);
+        query_destroy(q);
+        return -1;
+    }
+
+    res = query_run(q, cap);
+    if (res == 0)
+        query_report(stdout, q);
+
+    query_destroy(q);
+    capture_file_close(cap);
+    fclose(f);
+    return res;
+}
+//-----------------------------------------------------------------
+// search_main: usb_sniffer search [options] pattern in.cap
+//-----------------------------------------------------------------
+static int search_main(int argc, char *argv[])
+{
+    tCaptureFilter filter;
+    tSearchPattern pattern;
+    tCaptureFile *cap;
+    int context = SEARCH_DEF_CONTEXT;
+    int ascii = 0;
+    int64_t matches;
+    FILE *f;
+    int help = 0;
+    int c;
+
+    capture_filter_init(&filter);
+
+    while ((c = getopt (argc, argv, "aC:j:D:E:t:")) != -1)
+    {
+        if (c == 'a')
+            ascii = 1;
+        else if (c == 'C')
+            context = atoi(optarg);
+        else if (c == 'j')
+            parallel_set_threads(atoi(optarg));
+        else if (filter_option(&filter, c, optarg) != 1)
+            help = 1;
+    }
+
+    if (help || context < 0 || (argc - optind) != 2)
+    {
+        fprintf (stderr,"Usage: search [options] pattern in.cap\n");
+        fprintf (stderr,"-a          - Pattern is ASCII text (default: hex bytes, e.g. \"55 53 42 43\")\n");
+        fprintf (stderr,"-C n        - Payload bytes shown either side (default: %d, max %d)\n", SEARCH_DEF_CONTEXT, SEARCH_MAX_CONTEXT);
+        fprintf (stderr,"-j n        - Worker threads (default: one per CPU)\n");
+        fprintf (stderr,"-D 0xnn     - Only this device ID\n");
+        fprintf (stderr,"-E 0xnn     - Only this endpoint\n");
+        fprintf (stderr,"-t a:b      - Only between a and b seconds\n");
+        return -1;
+    }
+
+    if (search_pattern_parse(&pattern, argv[optind], ascii) != 0)
+        return -1;
+
+    f = fopen(argv[optind + 1], "rb");
+    if (!f)
+    {
+        fprintf(stderr, "ERROR: Could not open %s\n", argv[optind + 1]);
+        return -1;
+    }
+
+    cap = capture_file_open(f);
+    if (!cap)
+    {
+        fclose(f);
+        return -1;
+    }
+
+    matches = search_capture(stdout, cap, &filter, &pattern, context);
+    if (matches >= 0)
+        printf("%lld matches (%s)\n", (long long)matches, search_impl_name());
+
+    capture_file_close(cap);
+    fclose(f);
+    return matches >= 0 ? 0 : -1;
+}
+//-----------------------------------------------------------------
+// diff_main: usb_sniffer diff [filter] a.cap b.cap
+//-----------------------------------------------------------------
+static int diff_main(int argc, char *argv[])
+{
+    tCaptureFilter filter;
+    tTxnCache *a;
+    tTxnCache *b;
+    int64_t differ;
+    int help = 0;
+    int c;
+
+    capture_filter_init(&filter);
+
+    while ((c = getopt (argc, argv, "D:E:t:")) != -1)
+    {
+        if (filter_option(&filter, c, optarg) != 1)
+            help = 1;
+    }
+
+    if (help || (argc - optind) != 2)
+    {
+        fprintf (stderr,"Usage: diff [options] a.cap b.cap\n");
+        fprintf (stderr,"-D 0xnn     - Only this device ID\n");
+        fprintf (stderr,"-E 0xnn     - Only this endpoint\n");
+        fprintf (stderr,"-t a:b      - Only between a and b seconds (in each capture)\n");
+        fprintf (stderr,"Transactions are compared per endpoint ignoring timing, NAKed retries and\n");
+        fprintf (stderr,"DATA0/DATA1 toggles, aligned with Myers diff (unique runs as anchors).\n");
+        fprintf (stderr,"Exits 1 if the captures differ.\n");
+        return -1;
+    }
+
+    a = txn_cache_open(argv[optind]);
+    if (!a)
+        return -1;
+
+    b = txn_cache_open(argv[optind + 1]);
+    if (!b)
+    {
+        txn_cache_close(a);
+        return -1;
+    }
+
+    differ = txn_diff(stdout, a, b, &filter);
+
+    txn_cache_close(a);
+    txn_cache_close(b);
+
+    if (differ < 0)
+        return -1;
+
+    return differ ? 1 : 0;
+}
+//-----------------------------------------------------------------
 // user_abort_check
 //-----------------------------------------------------------------
 static int user_abort_check(void)
@@ -167,9 +1156,56 @@ int main(int argc, char *argv[])
     int decode_log_file = 0;
     int inverse_match = 0;
     tUsbSpeed speed = USB_SPEED_HS;
+    int codec = CAPTURE_CODEC_NONE;
+    int cap_flags = 0;
+    int stats_interval = 1;
+    int latency = 0;
+    int hitters = -1;
+    int schedule = 0;
+    tDecoderHost *decoders = NULL;
+    tCaptureFilter filter;
+
+    capture_filter_init(&filter);
+
+    if (argc > 1 && strcmp(argv[1], "slice") == 0)
+        return slice_main(argc - 1, argv + 1);
+    if (argc > 1 && strcmp(argv[1], "decode") == 0)
+        return decode_main(argc - 1, argv + 1);
+    if (argc > 1 && strcmp(argv[1], "import") == 0)
+        return import_main(argc - 1, argv + 1);
+    if (argc > 1 && strcmp(argv[1], "transactions") == 0)
+        return transactions_main(argc - 1, argv + 1);
+    if (argc > 1 && strcmp(argv[1], "transfers") == 0)
+        return transfers_main(argc - 1, argv + 1);
+    if (argc > 1 && strcmp(argv[1], "latency") == 0)
+        return latency_main(argc - 1, argv + 1);
+    if (argc > 1 && strcmp(argv[1], "hitters") == 0)
+        return hitters_main(argc - 1, argv + 1);
+    if (argc > 1 && strcmp(argv[1], "schedule") == 0)
+        return schedule_main(argc - 1, argv + 1);
+    if (argc > 1 && strcmp(argv[1], "analyze") == 0)
+        return analyze_main(argc - 1, argv + 1);
+    if (argc > 1 && strcmp(argv[1], "timeline") == 0)
+        return timeline_main(argc - 1, argv + 1);
+    if (argc > 1 && strcmp(argv[1], "anomalies") == 0)
+        return anomalies_main(argc - 1, argv + 1);
+    if (argc > 1 && strcmp(argv[1], "query") == 0)
+        return query_main(argc - 1, argv + 1);
+    if (argc > 1 && strcmp(argv[1], "search") == 0)
+        return search_main(argc - 1, argv + 1);
+    if (argc > 1 && strcmp(argv[1], "diff") == 0)
+        return diff_main(argc - 1, argv + 1);
     
-    while ((c = getopt (argc, argv, "d:e:slf:nu:")) != -1)
+    while ((c = getopt (argc, argv, "d:e:slf:nu:D:E:P:t:z:rpi:LH:IX:")) != -1)
     {
+        res = filter_option(&filter, c, optarg);
+        if (res != 0)
+        {
+            if (res < 0)
+                help = 1;
+            continue;
+        }
+
         switch(c)
         {
             case 'd': // Device
@@ -203,6 +1239,43 @@ int main(int argc, char *argv[])
                     help = 1;
                 }
                 break;
+            case 'r': // Run encode predictable SOF / IN-NAK polling
+                cap_flags |= CAPTURE_FLAG_RUNS;
+                break;
+            case 'p': // Deduplicate data payloads
+                cap_flags |= CAPTURE_FLAG_DEDUP;
+                break;
+            case 'i': // Live statistics interval
+                stats_interval = atoi(optarg);
+                break;
+            case 'L': // Turnaround latency histograms
+                latency = 1;
+                break;
+            case 'H': // Top payload prefixes
+                hitters = atoi(optarg);
+                if (hitters < 0 || hitters > HITTERS_MAX_PREFIX)
+                    help = 1;
+                break;
+            case 'I': // Periodic endpoint schedule
+                schedule = 1;
+                break;
+            case 'X': // Class decoder
+                if (!decoders)
+                {
+                    decoders = decoder_host_create();
+                    decoder_host_set_live(decoders, 1);
+                }
+                if (decoder_host_load(decoders, optarg) != 0)
+                    help = 1;
+                break;
+            case 'z': // Capture block compression
+                codec = capture_codec_parse(optarg);
+                if (codec < 0 || !capture_codec_supported(codec))
+                {
+                    fprintf (stderr,"ERROR: Unsupported compression\n");
+                    help = 1;
+                }
+                break;
             default:
                 help = 1;
                 break;
@@ -218,7 +1291,33 @@ int main(int argc, char *argv[])
         fprintf (stderr,"-n          - Inverse matching (exclude device / endpoint)\n");
         fprintf (stderr,"-s          - Disable SOF collection (breaks timing info)\n");
         fprintf (stderr,"-l          - One shot mode (stop on single buffer full)\n");
-        fprintf (stderr,"-f          - Capture file to either .txt, .raw, .usb (default: capture.usb)\n");
+        fprintf (stderr,"-f          - Capture file to either .txt, .raw, .usb, .cap, .col (default: capture.usb)\n");
+        fprintf (stderr,"-D 0xnn     - Export only this device ID\n");
+        fprintf (stderr,"-E 0xnn     - Export only this endpoint\n");
+        fprintf (stderr,"-P pid      - Export only this PID (name or value, repeatable)\n");
+        fprintf (stderr,"-t a:b      - Export only records between a and b seconds\n");
+        fprintf (stderr,"-z lz|zstd  - Compress stored capture blocks\n");
+        fprintf (stderr,"-r          - Run encode repeated SOF and IN/NAK polling (keeps timing)\n");
+        fprintf (stderr,"-p          - Store each distinct data payload once\n");
+        fprintf (stderr,"-i secs     - Live per endpoint statistics interval (default: 1, 0 = off)\n");
+        fprintf (stderr,"-L          - Turnaround latency histograms (reported with statistics)\n");
+        fprintf (stderr,"-H bytes    - Top (device, endpoint, payload prefix) keys (reported with statistics)\n");
+        fprintf (stderr,"-I          - Interrupt / iso polling interval and jitter (reported with statistics)\n");
+        fprintf (stderr,"-X name[:args] - Class decoder, built in or plugin path (repeatable)\n");
+        fprintf (stderr,"\n%s decode [options] in.cap out.usb - Convert saved capture\n", argv[0]);
+        fprintf (stderr,"%s slice [options] in.cap out.cap - Cut saved capture\n", argv[0]);
+        fprintf (stderr,"%s import [options] in.usb out.cap - Load .usb / .raw file\n", argv[0]);
+        fprintf (stderr,"%s transactions [options] in.cap - List transactions\n", argv[0]);
+        fprintf (stderr,"%s transfers [options] in.cap - List control / bulk / iso transfers\n", argv[0]);
+        fprintf (stderr,"%s latency [options] in.cap - Turnaround latency percentiles\n", argv[0]);
+        fprintf (stderr,"%s hitters [options] in.cap - Most frequent payload prefixes\n", argv[0]);
+        fprintf (stderr,"%s schedule [options] in.cap - Periodic endpoint polling conformance\n", argv[0]);
+        fprintf (stderr,"%s analyze [options] in.cap - Run class decoders\n", argv[0]);
+        fprintf (stderr,"%s timeline [options] in.cap - Bus utilization over time\n", argv[0]);
+        fprintf (stderr,"%s anomalies [options] in.cap - List protocol anomalies\n", argv[0]);
+        fprintf (stderr,"%s query \"expr\" in.cap - Aggregate query (filter, group by)\n", argv[0]);
+        fprintf (stderr,"%s search [options] pattern in.cap - Find byte sequence in payloads\n", argv[0]);
+        fprintf (stderr,"%s diff [options] a.cap b.cap - Compare transactions per endpoint\n", argv[0]);
         exit(-1);
     }
 
@@ -243,7 +1342,51 @@ int main(int argc, char *argv[])
     uint32_t rd_ptr = 0;
     usb_sniffer_set_rd_ptr(rd_ptr);
 
-    FILE *fout = tmpfile();
+    // Saved captures (.cap) keep the block container as is
+    int save_cap = is_capture_file(filename);
+    FILE *fout = save_cap ? fopen(filename, "w+b") : tmpfile();
+    if (!fout)
+    {
+        fprintf(stderr, "ERROR: Could not create %s\n", save_cap ? filename : "temp file");
+        return -1;
+    }
+
+    tCaptureInfo info;
+    capture_info_init(&info);
+    info.match_device   = dev_addr;
+    info.match_endpoint = endpoint;
+    info.match_inverse  = inverse_match;
+    info.drop_sof       = disable_sof;
+    info.one_shot       = !cont_mode;
+    info.buffer_base    = LA_BUFFER_BASE;
+    info.buffer_size    = LA_BUFFER_SIZE;
+    info.start_time     = (uint64_t)time(NULL);
+
+    tCaptureFile *cap = capture_file_create(fout, speed, codec, cap_flags, &info);
+    assert(cap);
+
+    tLiveStages live;
+    memset(&live, 0, sizeof(live));
+    live.stats = live_stats_create();
+    live.latency = latency ? latency_create() : NULL;
+    live.hitters = (hitters >= 0) ? heavy_hitters_create(hitters) : NULL;
+    live.schedule = schedule ? schedule_create(speed) : NULL;
+    live.decoders = decoders;
+
+    // Saved captures get a utilization summary beside them
+    char pyramid_path[1024];
+    snprintf(pyramid_path, sizeof(pyramid_path), "%s%s", filename, PYRAMID_SUFFIX);
+    live.pyramid = save_cap ? pyramid_builder_create(pyramid_path) : NULL;
+
+    // Cheap enough to always run; the index is kept for saved captures
+    char anomaly_path[1024];
+    snprintf(anomaly_path, sizeof(anomaly_path), "%s%s", filename, ANOMALY_SUFFIX);
+    live.anomaly = anomaly_create(save_cap ? anomaly_path : "/dev/null");
+    capture_file_set_observer(cap, live_record, &live);
+
+    tStatsSnapshot *snap_prev = (tStatsSnapshot *)calloc(1, sizeof(tStatsSnapshot));
+    tStatsSnapshot *snap_cur  = (tStatsSnapshot *)calloc(1, sizeof(tStatsSnapshot));
+    assert(snap_prev && snap_cur);
 
     // Enable probe
     usb_sniffer_start();
@@ -274,7 +1417,7 @@ int main(int argc, char *argv[])
         printf("Captured %d bytes of data\n", size);
 
         if (size != 0)
-            usb_sniffer_extract_buffer(fout, rd_ptr, size);
+            capture_chunk(cap, rd_ptr, size);
     }
     // Continuous capture mode
     else
@@ -283,6 +1426,8 @@ int main(int argc, char *argv[])
         uint32_t data_count = 0;
         int overflow = 0;
         uint32_t last_wr = 0;
+        struct timeval tv_report;
+        gettimeofday(&tv_report, NULL);
         do
         {
             if (user_abort_check())
@@ -303,7 +1448,7 @@ int main(int argc, char *argv[])
             // Copy data between RD & WR pointers to capture file
             if (size != 0 && wr_ptr != last_wr)
             {
-                if (usb_sniffer_extract_buffer(fout, rd_ptr, size) == -1)
+                if (capture_chunk(cap, rd_ptr, size) == -1)
                     break;
 
                 // Update read pointer
@@ -312,12 +1457,35 @@ int main(int argc, char *argv[])
                 
                 last_wr = wr_ptr;
 
-                if ((data_count / 1024) != ((data_count + size) / 1024))
-                    printf("\r%dKB ", ((data_count + size) / 1024));
-
                 data_count += size;
             }
 
+            // Periodic per endpoint rates
+            struct timeval tv;
+            gettimeofday(&tv, NULL);
+            if (stats_interval > 0 && tv.tv_sec - tv_report.tv_sec >= stats_interval)
+            {
+                tStatsSnapshot *swap = snap_prev;
+
+                live_stats_publish(live.stats);
+                live_stats_snapshot(live.stats, snap_cur);
+
+                printf("\n%dKB captured\n", data_count / 1024);
+                live_stats_report(stdout, snap_prev->seq ? snap_prev : NULL, snap_cur);
+                if (live.latency)
+                    latency_report(stdout, live.latency);
+                if (live.hitters)
+                    heavy_hitters_report(stdout, live.hitters, HITTERS_REPORT);
+                if (live.schedule)
+                    schedule_report(stdout, live.schedule);
+                if (live.decoders)
+                    decoder_host_flush(live.decoders);
+
+                snap_prev  = snap_cur;
+                snap_cur   = swap;
+                tv_report  = tv;
+            }
+
             // Buffer overflow - data not trusted
             if (overflow)
             {
@@ -328,10 +1496,62 @@ int main(int argc, char *argv[])
         while (1);
     }
 
+    // Totals for the whole capture
+    live_stats_publish(live.stats);
+    live_stats_snapshot(live.stats, snap_cur);
+    if (snap_cur->records)
+    {
+        printf("\nTotal:\n");
+        live_stats_report(stdout, NULL, snap_cur);
+        if (live.latency)
+            latency_report(stdout, live.latency);
+        if (live.hitters)
+            heavy_hitters_report(stdout, live.hitters, HITTERS_REPORT);
+        if (live.schedule)
+            schedule_report(stdout, live.schedule);
+    }
+
+    tPayloadStats pstats;
+    if (capture_file_payload_stats(cap, &pstats) == 0 && pstats.bytes_kept != 0)
+        printf("Payload dedup: %llu of %llu payloads unique (%.1fx)\n",
+               (unsigned long long)pstats.unique, (unsigned long long)pstats.refs,
+               (double)pstats.bytes_in / pstats.bytes_kept);
+
+    capture_file_close(cap);
+    fflush(fout);
+
+    // Sidecars are tagged with the size of the saved capture
+    if (live.pyramid)
+        pyramid_builder_finish(live.pyramid, file_size(filename));
+
+    tAnomalyHeader anomalies;
+    if (live.anomaly && anomaly_finish(live.anomaly, save_cap ? file_size(filename) : 0, &anomalies) == 0)
+        print_anomaly_summary(&anomalies);
+
+    live_stats_destroy(live.stats);
+    if (live.latency)
+        latency_destroy(live.latency);
+    if (live.hitters)
+        heavy_hitters_destroy(live.hitters);
+    if (live.schedule)
+        schedule_destroy(live.schedule);
+    if (live.decoders)
+    {
+        decoder_host_finish(live.decoders, stdout);
+        decoder_host_destroy(live.decoders);
+    }
+    free(snap_prev);
+    free(snap_cur);
+
     // Write output file
-    write_usb_file(filename, fout, speed);
+    cap = save_cap ? NULL : capture_file_open(fout);
+    if (cap)
+    {
+        export_capture(filename, cap, &filter);
+        capture_file_close(cap);
+    }
 
-    // Close temp file
+    // Close temp / saved capture file
     fclose(fout);
 
     // Disable probe
@@ -0,0 +1,630 @@
+//-----------------------------------------------------------------
+//                       USB Sniffer
+//                           V0.1
+//                     Ultra-Embedded.com
+//                       Copyright 2015
+//
+//               Email: admin@ultra-embedded.com
+//
+//                       License: LGPL
+//-----------------------------------------------------------------
+//
+// Copyright (C) 2011 - 2013 Ultra-Embedded.com
+//
+// This source file may be used and distributed without         
+// restriction provided that this copyright statement is not    
+// removed from the file and that any derivative work contains  
+// the original copyright notice and the associated disclaimer. 
+//
+// This source file is free software; you can redistribute it   
+// and/or modify it under the terms of the GNU Lesser General   
+// Public License as published by the Free Software Foundation; 
+// either version 2.1 of the License, or (at your option) any   
+// later version.
+//
+// This source is distributed in the hope that it will be       
+// useful, but WITHOUT ANY WARRANTY; without even the implied   
+// warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR      
+// PURPOSE.  See the GNU Lesser General Public License for more 
+// details.
+//
+// You should have received a copy of the GNU Lesser General    
+// Public License along with this source; if not, write to the 
+// Free Software Foundation, Inc., 59 Temple Place, Suite 330, 
+// Boston, MA  02111-1307  USA
+//-----------------------------------------------------------------
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <assert.h>
+
+#include "usb_defs.h"
+#include "log_format.h"
+#include "log_decode.h"
+#include "capture_filter.h"
+#include "transaction.h"
+#include "descriptor_snoop.h"
+#include "transfer.h"
+#include "latency.h"
+#include "class_decoder.h"
+#include "media_decoder.h"
+
+//-----------------------------------------------------------------
+// Defines
+//-----------------------------------------------------------------
+#define USB_CLASS_AUDIO         0x01
+#define USB_CLASS_VIDEO         0x0E
+#define STREAMING_SUBCLASS      0x02    // AUDIOSTREAMING / VIDEOSTREAMING
+
+// UVC payload header bmHeaderInfo
+#define UVC_HDR_FID             (1 << 0)
+#define UVC_HDR_EOF             (1 << 1)
+#define UVC_HDR_PTS             (1 << 2)
+#define UVC_HDR_SCR             (1 << 3)
+#define UVC_HDR_ERR             (1 << 6)
+#define UVC_HDR_EOH             (1 << 7)
+
+// High bandwidth iso: up to 3 packets per microframe
+#define ISO_MAX_UFRAME          (3 * 1024)
+
+//-----------------------------------------------------------------
+// Enums
+//-----------------------------------------------------------------
+enum
+{
+    MEDIA_NONE,
+    MEDIA_VIDEO,
+    MEDIA_AUDIO
+};
+
+//-----------------------------------------------------------------
+// Structures
+//-----------------------------------------------------------------
+struct media_stream
+{
+    int          kind;
+    uint8_t      device;
+    uint8_t      endpoint;
+    uint8_t      dir;
+    FILE        *f;
+    char         filename[256];
+    int          failed;        // Output could not be written
+
+    // Output buffer: [0, committed) is ready to be written, the
+    // rest is the video frame being reassembled
+    uint8_t     *buf;
+    uint32_t     size;
+    uint32_t     committed;
+    uint32_t     len;
+    uint64_t     written;
+
+    // Iso packets of the current (high bandwidth) microframe
+    uint8_t      uframe[ISO_MAX_UFRAME];
+    uint32_t     uframe_len;
+    uint32_t     uframe_count;
+    uint8_t      uframe_pid;    // PID of last packet
+    int          uframe_bad;
+    uint64_t     uframe_time;
+
+    // Video frame in progress
+    int          open;
+    int          fid;
+    int          errored;
+    int          last_fid;      // FID of last frame (-1 = none)
+    int          continued;     // Bulk payload transfer split by assembler
+    uint64_t     frame_start;
+    uint64_t     last_frame;
+
+    uint64_t     frames;
+    uint64_t     dropped;       // Errored, truncated or oversize frames
+    uint64_t     skipped;       // Whole frames missing (FID not toggled)
+    uint64_t     bad_headers;
+    uint64_t     min_frame;
+    uint64_t     max_frame;
+    tLatencyHist interval;      // Frame to frame (ticks)
+
+    // Audio
+    uint64_t     packets;
+    uint64_t     underruns;     // Zero length packets
+    uint64_t     missed;        // Service intervals without a packet
+    uint64_t     bad_packets;   // CRC errors, written as silence
+    uint64_t     gap;           // Shortest packet to packet time
+    uint64_t     last_packet;
+
+    uint64_t     first_time;
+    uint64_t     last_time;
+};
+
+struct media_decoder
+{
+    char                 prefix[200];
+
+    // Set by subscribe (host thread) before the first transfer of
+    // the endpoint is queued, read by decode
+    uint8_t              kind[SNOOP_SLOTS];
+    struct media_stream *streams[SNOOP_SLOTS];
+};
+
+//-----------------------------------------------------------------
+// media_create: args = output file prefix
+//-----------------------------------------------------------------
+static void* media_create(const char *args)
+{
+    struct media_decoder *md = (struct media_decoder *)calloc(1, sizeof(struct media_decoder));
+    assert(md);
+
+    snprintf(md->prefix, sizeof(md->prefix), "%s", (args && *args) ? args : MEDIA_DEF_PREFIX);
+    return md;
+}
+//-----------------------------------------------------------------
+// media_subscribe: Audio / video streaming interface endpoints
+// (needs the configuration descriptor in the capture)
+//-----------------------------------------------------------------
+static int media_subscribe(void *inst, const tDecoderEndpoint *ep)
+{
+    struct media_decoder *md = (struct media_decoder *)inst;
+    int slot = SNOOP_SLOT(ep->device, ep->endpoint, ep->dir == PID_IN);
+    int type = ep->attributes & 0x3;
+    int kind = MEDIA_NONE;
+
+    if (!ep->described || ep->endpoint == 0 || ep->iface_subclass != STREAMING_SUBCLASS)
+        return 0;
+
+    if (ep->iface_class == USB_CLASS_VIDEO && (type == SNOOP_EP_ISO || type == SNOOP_EP_BULK))
+        kind = MEDIA_VIDEO;
+    else if (ep->iface_class == USB_CLASS_AUDIO && type == SNOOP_EP_ISO)
+        kind = MEDIA_AUDIO;
+
+    // Only written once per endpoint unless re-enumerated differently
+    if (kind != MEDIA_NONE && md->kind[slot] != kind)
+        md->kind[slot] = kind;
+
+    return kind != MEDIA_NONE;
+}
+//-----------------------------------------------------------------
+// media_flush: Write out completed data
+//-----------------------------------------------------------------
+static int media_flush(struct media_stream *s)
+{
+    if (s->committed && !s->failed)
+    {
+        if (fwrite(s->buf, 1, s->committed, s->f) != s->committed)
+        {
+            fprintf(stderr, "ERROR: Could not write %s\n", s->filename);
+            s->failed = 1;
+        }
+        else
+            s->written += s->committed;
+    }
+
+    memmove(s->buf, s->buf + s->committed, s->len - s->committed);
+    s->len      -= s->committed;
+    s->committed = 0;
+    return s->failed ? -1 : 0;
+}
+//-----------------------------------------------------------------
+// media_append: Add bytes to the output buffer
+//-----------------------------------------------------------------
+static int media_append(struct media_stream *s, const uint8_t *data, uint32_t len)
+{
+    if (s->len + len > s->size)
+    {
+        uint32_t size = s->size;
+
+        while (s->len + len > size)
+            size *= 2;
+
+        s->buf  = (uint8_t *)realloc(s->buf, size);
+        assert(s->buf);
+        s->size = size;
+    }
+
+    if (data)
+        memcpy(s->buf + s->len, data, len);
+    else
+        memset(s->buf + s->len, 0, len);
+
+    s->len += len;
+    return 0;
+}
+//-----------------------------------------------------------------
+// media_commit: Data up to the end of the buffer is complete
+//-----------------------------------------------------------------
+static int media_commit(struct media_stream *s)
+{
+    s->committed = s->len;
+    if (s->committed >= MEDIA_WRITE_BATCH)
+        return media_flush(s);
+
+    return 0;
+}
+//-----------------------------------------------------------------
+// media_stream_get: Stream of endpoint, output opened on first use
+//-----------------------------------------------------------------
+static struct media_stream* media_stream_get(struct media_decoder *md, const tDecoderTransfer *x)
+{
+    int slot = SNOOP_SLOT(x->device, x->endpoint, x->dir == PID_IN);
+    struct media_stream *s = md->streams[slot];
+
+    if (s)
+        return s->failed ? NULL : s;
+
+    s = md->streams[slot] = (struct media_stream *)calloc(1, sizeof(struct media_stream));
+    assert(s);
+
+    s->kind     = md->kind[slot];
+    s->device   = x->device;
+    s->endpoint = x->endpoint;
+    s->dir      = x->dir;
+    s->last_fid = -1;
+    s->min_frame= ~0ULL;
+    s->size     = 2 * MEDIA_WRITE_BATCH;
+    s->buf      = (uint8_t *)malloc(s->size);
+    assert(s->buf);
+    latency_hist_init(&s->interval);
+
+    snprintf(s->filename, sizeof(s->filename), "%s_%d_%d%s.%s", md->prefix, x->device, x->endpoint,
+             (x->dir == PID_IN) ? "in" : "out", (s->kind == MEDIA_VIDEO) ? "video" : "audio");
+
+    s->f = fopen(s->filename, "wb");
+    if (!s->f)
+    {
+        fprintf(stderr, "ERROR: Could not create %s\n", s->filename);
+        s->failed = 1;
+        return NULL;
+    }
+
+    return s;
+}
+//-----------------------------------------------------------------
+// media_frame_end: Video frame finished (complete or not)
+//-----------------------------------------------------------------
+static int media_frame_end(struct media_stream *s, int complete)
+{
+    uint64_t bytes = s->len - s->committed;
+    int errored = s->errored;
+
+    s->open     = 0;
+    s->errored  = 0;
+    s->last_fid = s->fid;
+
+    if (!complete || errored || !bytes)
+    {
+        s->dropped++;
+        s->len = s->committed;
+        return 0;
+    }
+
+    if (s->frames)
+        latency_hist_add(&s->interval, s->frame_start - s->last_frame);
+
+    s->last_frame = s->frame_start;
+    s->frames++;
+    if (bytes < s->min_frame)
+        s->min_frame = bytes;
+    if (bytes > s->max_frame)
+        s->max_frame = bytes;
+
+    return media_commit(s);
+}
+//-----------------------------------------------------------------
+// media_video: UVC payload (iso packet or bulk payload transfer)
+//-----------------------------------------------------------------
+static int media_video(struct media_stream *s, const uint8_t *p, uint32_t len, uint64_t time, int bad, int header)
+{
+    int hlen = 0;
+    int info = 0;
+
+    if (bad)
+    {
+        if (s->open)
+            s->errored = 1;
+        return 0;
+    }
+
+    if (header)
+    {
+        if (len < 2)
+        {
+            s->bad_headers++;
+            return 0;
+        }
+
+        hlen = p[0];
+        info = p[1];
+
+        if (hlen > (int)len || hlen != 2 + ((info & UVC_HDR_PTS) ? 4 : 0) + ((info & UVC_HDR_SCR) ? 6 : 0))
+        {
+            s->bad_headers++;
+            if (s->open)
+                s->errored = 1;
+            return 0;
+        }
+
+        // FID toggled without EOF: previous frame was cut short
+        if (s->open && (info & UVC_HDR_FID) != s->fid)
+        {
+            if (media_frame_end(s, 0) != 0)
+                return -1;
+        }
+
+        if (!s->open)
+        {
+            // Same FID as the last frame: an odd number of frames went missing
+            if (s->last_fid == (info & UVC_HDR_FID))
+                s->skipped++;
+
+            s->open        = 1;
+            s->fid         = info & UVC_HDR_FID;
+            s->frame_start = time;
+        }
+
+        if (info & UVC_HDR_ERR)
+            s->errored = 1;
+    }
+    else if (!s->open)
+        return 0;
+
+    if (!s->errored)
+    {
+        if (s->len - s->committed + (len - hlen) > MEDIA_MAX_FRAME)
+            s->errored = 1;
+        else
+            media_append(s, p + hlen, len - hlen);
+    }
+
+    if (info & UVC_HDR_EOF)
+        return media_frame_end(s, 1);
+
+    return 0;
+}
+//-----------------------------------------------------------------
+// media_audio: UAC iso packet, raw samples (no header)
+//-----------------------------------------------------------------
+static int media_audio(struct media_stream *s, const uint8_t *p, uint32_t len, uint64_t time, int bad)
+{
+    uint64_t gap;
+
+    s->packets++;
+
+    if (s->last_packet && time > s->last_packet)
+    {
+        gap = time - s->last_packet;
+        if (!s->gap || gap < s->gap)
+            s->gap = gap;
+        else if (gap >= 2 * s->gap)
+            s->missed += (gap + s->gap / 2) / s->gap - 1;
+    }
+    s->last_packet = time;
+
+    if (!len)
+    {
+        s->underruns++;
+        return 0;
+    }
+
+    // Keep later samples in place
+    if (bad)
+        s->bad_packets++;
+
+    media_append(s, bad ? NULL : p, len);
+    return media_commit(s);
+}
+//-----------------------------------------------------------------
+// media_uframe_end: Hand the payload of one microframe on
+//-----------------------------------------------------------------
+static int media_uframe_end(struct media_stream *s)
+{
+    int err;
+
+    if (!s->uframe_count)
+        return 0;
+
+    if (s->kind == MEDIA_VIDEO)
+        err = media_video(s, s->uframe, s->uframe_len, s->uframe_time, s->uframe_bad, 1);
+    else
+        err = media_audio(s, s->uframe, s->uframe_len, s->uframe_time, s->uframe_bad);
+
+    s->uframe_len   = 0;
+    s->uframe_count = 0;
+    s->uframe_bad   = 0;
+    return err;
+}
+//-----------------------------------------------------------------
+// media_iso_packet: Join the packets of a microframe. High bandwidth
+// IN endpoints send DATA2, DATA1, DATA0 (3 packets) or DATA1, DATA0,
+// OUT endpoints MDATA.. then DATAx; only the first packet carries
+// the UVC header.
+//-----------------------------------------------------------------
+static int media_iso_packet(struct media_stream *s, const tDecoderPacket *pkt, const uint8_t *p)
+{
+    int err = 0;
+    int last;
+
+    // Packet starting a microframe while one is pending: the rest of
+    // the pending one was lost
+    if (s->uframe_count &&
+        (pkt->time - s->uframe_time >= TICKS_PER_HS_UFRAME ||
+         (s->dir == PID_IN && !((s->uframe_pid == PID_DATA2 && pkt->pid == PID_DATA1) ||
+                                ((s->uframe_pid == PID_DATA2 || s->uframe_pid == PID_DATA1) && pkt->pid == PID_DATA0)))))
+    {
+        s->uframe_bad = 1;
+        err = media_uframe_end(s);
+    }
+
+    if (!s->uframe_count)
+        s->uframe_time = pkt->time;
+
+    // Lost DATA1 between DATA2 and DATA0
+    if (s->uframe_pid == PID_DATA2 && pkt->pid == PID_DATA0 && s->uframe_count)
+        s->uframe_bad = 1;
+
+    if (s->uframe_len + pkt->length > ISO_MAX_UFRAME)
+        s->uframe_bad = 1;
+    else
+    {
+        memcpy(s->uframe + s->uframe_len, p, pkt->length);
+        s->uframe_len += pkt->length;
+    }
+
+    if (pkt->flags & TXN_FLAG_CRC_ERROR)
+        s->uframe_bad = 1;
+
+    s->uframe_pid = pkt->pid;
+    s->uframe_count++;
+
+    if (s->dir == PID_IN)
+        last = (pkt->pid == PID_DATA0);
+    else
+        last = (pkt->pid != PID_MDATA);
+
+    if (last)
+        err |= media_uframe_end(s);
+
+    return err;
+}
+//-----------------------------------------------------------------
+// media_decode
+//-----------------------------------------------------------------
+static int media_decode(void *inst, const tDecoderTransfer *xfers, int count)
+{
+    struct media_decoder *md = (struct media_decoder *)inst;
+    int err = 0;
+    int i;
+    uint32_t j;
+
+    for (i=0;i<count;i++)
+    {
+        const tDecoderTransfer *x = &xfers[i];
+        struct media_stream *s = media_stream_get(md, x);
+        int bad = 0;
+
+        if (!s)
+            continue;
+
+        if (!s->first_time)
+            s->first_time = x->start;
+        s->last_time = x->end;
+
+        // Bulk video: one header per payload transfer
+        if (x->type != TRANSFER_ISO)
+        {
+            for (j=0;j<x->packets;j++)
+                if (x->packet[j].flags & TXN_FLAG_CRC_ERROR)
+                    bad = 1;
+
+            if (s->kind == MEDIA_VIDEO && media_video(s, x->data, x->bytes, x->start, bad, !s->continued) != 0)
+                err = -1;
+
+            s->continued = (x->status == TRANSFER_PARTIAL);
+            continue;
+        }
+
+        // Each iso packet arrives as its own transfer
+        for (j=0;j<x->packets;j++)
+            err |= media_iso_packet(s, &x->packet[j], x->data + x->packet[j].offset);
+    }
+
+    return err;
+}
+//-----------------------------------------------------------------
+// media_report: Flush outputs and print per stream statistics
+//-----------------------------------------------------------------
+static void media_report(void *inst, FILE *f)
+{
+    struct media_decoder *md = (struct media_decoder *)inst;
+    int slot;
+
+    for (slot=0;slot<SNOOP_SLOTS;slot++)
+    {
+        struct media_stream *s = md->streams[slot];
+        double secs;
+
+        if (!s || !s->f)
+            continue;
+
+        // Partial frame at end of capture is not written
+        if (s->uframe_count)
+        {
+            s->uframe_bad = 1;
+            media_uframe_end(s);
+        }
+        if (s->kind == MEDIA_VIDEO && s->open)
+            media_frame_end(s, 0);
+        media_flush(s);
+
+        secs = (s->last_time > s->first_time) ? (double)(s->last_time - s->first_time) / TICKS_PER_SEC : 0.0;
+
+        fprintf(f, "  %s: %llu bytes%s\n", s->filename, (unsigned long long)s->written,
+                s->failed ? " (write failed)" : "");
+
+        if (s->kind == MEDIA_VIDEO)
+        {
+            fprintf(f, "    %llu frames", (unsigned long long)s->frames);
+            if (s->frames)
+                fprintf(f, " (%llu-%llu bytes)", (unsigned long long)s->min_frame, (unsigned long long)s->max_frame);
+            if (secs > 0.0)
+                fprintf(f, ", %.2f fps", s->frames / secs);
+            fprintf(f, ", dropped %llu, missing %llu, bad headers %llu\n",
+                    (unsigned long long)s->dropped, (unsigned long long)s->skipped,
+                    (unsigned long long)s->bad_headers);
+
+            if (s->interval.count)
+                fprintf(f, "    Frame interval: p50 %.3f  p99 %.3f  max %.3f ms\n",
+                        latency_hist_percentile(&s->interval, 50.0) / (TICKS_PER_SEC / 1e3),
+                        latency_hist_percentile(&s->interval, 99.0) / (TICKS_PER_SEC / 1e3),
+                        s->interval.max / (TICKS_PER_SEC / 1e3));
+        }
+        else
+        {
+            fprintf(f, "    %llu packets", (unsigned long long)s->packets);
+            if (secs > 0.0)
+                fprintf(f, ", %.1f bytes/s", s->written / secs);
+            fprintf(f, ", underruns %llu, missed intervals %llu, bad packets %llu\n",
+                    (unsigned long long)s->underruns, (unsigned long long)s->missed,
+                    (unsigned long long)s->bad_packets);
+        }
+    }
+}
+//-----------------------------------------------------------------
+// media_destroy
+//-----------------------------------------------------------------
+static void media_destroy(void *inst)
+{
+    struct media_decoder *md = (struct media_decoder *)inst;
+    int slot;
+
+    for (slot=0;slot<SNOOP_SLOTS;slot++)
+    {
+        struct media_stream *s = md->streams[slot];
+
+        if (!s)
+            continue;
+
+        if (s->f)
+            fclose(s->f);
+        free(s->buf);
+        free(s);
+    }
+
+    free(md);
+}
+//-----------------------------------------------------------------
+// media_decoder: UVC / UAC stream extractor
+//-----------------------------------------------------------------
+const tClassDecoder* media_decoder(void)
+{
+    static const tClassDecoder dec =
+    {
+        CLASS_DECODER_VERSION,
+        "media",
+        media_create,
+        media_subscribe,
+        media_decode,
+        media_report,
+        media_destroy
+    };
+
+    return &dec;
+}
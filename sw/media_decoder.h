@@ -0,0 +1,28 @@
+#ifndef __MEDIA_DECODER_H__
+#define __MEDIA_DECODER_H__
+
+//--------------------------------------------------------------------
+// Defines
+//--------------------------------------------------------------------
+// Output written in chunks of at least this size
+#define MEDIA_WRITE_BATCH       (1024 * 1024)
+
+// Largest video frame reassembled (bigger frames are dropped)
+#define MEDIA_MAX_FRAME         (32 * 1024 * 1024)
+
+#define MEDIA_DEF_PREFIX        "stream"
+
+//--------------------------------------------------------------------
+// Prototypes
+//--------------------------------------------------------------------
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+const tClassDecoder* media_decoder(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,133 @@
+//-----------------------------------------------------------------
+//                       USB Sniffer
+//                           V0.1
+//                     Ultra-Embedded.com
+//                       Copyright 2015
+//
+//               Email: admin@ultra-embedded.com
+//
+//                       License: LGPL
+//-----------------------------------------------------------------
+//
+// Copyright (C) 2011 - 2013 Ultra-Embedded.com
+//
+// This source file may be used and distributed without         
+// restriction provided that this copyright statement is not    
+// removed from the file and that any derivative work contains  
+// the original copyright notice and the associated disclaimer. 
+//
+// This source file is free software; you can redistribute it   
+// and/or modify it under the terms of the GNU Lesser General   
+// Public License as published by the Free Software Foundation; 
+// either version 2.1 of the License, or (at your option) any   
+// later version.
+//
+// This source is distributed in the hope that it will be       
+// useful, but WITHOUT ANY WARRANTY; without even the implied   
+// warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR      
+// PURPOSE.  See the GNU Lesser General Public License for more 
+// details.
+//
+// You should have received a copy of the GNU Lesser General    
+// Public License along with this source; if not, write to the 
+// Free Software Foundation, Inc., 59 Temple Place, Suite 330, 
+// Boston, MA  02111-1307  USA
+//-----------------------------------------------------------------
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "parallel.h"
+
+//-----------------------------------------------------------------
+// Structures
+//-----------------------------------------------------------------
+struct parallel_job
+{
+    void (*func)(void *ctx, int idx);
+    void  *ctx;
+    int    count;
+    int    next;
+};
+
+//-----------------------------------------------------------------
+// Locals
+//-----------------------------------------------------------------
+static int _threads = 0;
+
+//-----------------------------------------------------------------
+// parallel_set_threads: Override worker count (0 = one per CPU)
+//-----------------------------------------------------------------
+void parallel_set_threads(int threads)
+{
+    if (threads > PARALLEL_MAX_THREADS)
+        threads = PARALLEL_MAX_THREADS;
+
+    _threads = threads;
+}
+//-----------------------------------------------------------------
+// parallel_threads: Number of worker threads to use
+//-----------------------------------------------------------------
+int parallel_threads(void)
+{
+    if (_threads <= 0)
+    {
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+
+        _threads = (cpus > 0) ? (int)cpus : 1;
+        if (_threads > PARALLEL_MAX_THREADS)
+            _threads = PARALLEL_MAX_THREADS;
+    }
+
+    return _threads;
+}
+//-----------------------------------------------------------------
+// parallel_worker: Claim and run items until none remain
+//-----------------------------------------------------------------
+static void *parallel_worker(void *arg)
+{
+    struct parallel_job *job = (struct parallel_job *)arg;
+    int idx;
+
+    while ((idx = __atomic_fetch_add(&job->next, 1, __ATOMIC_RELAXED)) < job->count)
+        job->func(job->ctx, idx);
+
+    return NULL;
+}
+//-----------------------------------------------------------------
+// parallel_for: Run func(ctx, 0..count-1) across worker threads,
+// returning once every item has completed.
+//-----------------------------------------------------------------
+void parallel_for(int count, void (*func)(void *ctx, int idx), void *ctx)
+{
+    pthread_t threads[PARALLEL_MAX_THREADS];
+    struct parallel_job job;
+    int workers = parallel_threads();
+    int started = 0;
+    int i;
+
+    job.func  = func;
+    job.ctx   = ctx;
+    job.count = count;
+    job.next  = 0;
+
+    if (workers > count)
+        workers = count;
+
+    // Calling thread is one of the workers
+    for (i=1;i<workers;i++)
+    {
+        if (pthread_create(&threads[started], NULL, parallel_worker, &job) != 0)
+            break;
+        started++;
+    }
+
+    parallel_worker(&job);
+
+    for (i=0;i<started;i++)
+        pthread_join(threads[i], NULL);
+}
@@ -0,0 +1,24 @@
+#ifndef __PARALLEL_H__
+#define __PARALLEL_H__
+
+//--------------------------------------------------------------------
+// Defines
+//--------------------------------------------------------------------
+#define PARALLEL_MAX_THREADS    64
+
+//--------------------------------------------------------------------
+// Prototypes
+//--------------------------------------------------------------------
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+void parallel_set_threads(int threads);
+int  parallel_threads(void);
+void parallel_for(int count, void (*func)(void *ctx, int idx), void *ctx);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
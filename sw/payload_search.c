@@ -0,0 +1,422 @@
+//-----------------------------------------------------------------
+//                       USB Sniffer
+//                           V0.1
+//                     Ultra-Embedded.com
+//                       Copyright 2015
+//
+//               Email: admin@ultra-embedded.com
+//
+//                       License: LGPL
+//-----------------------------------------------------------------
+//
+// Copyright (C) 2011 - 2013 Ultra-Embedded.com
+//
+// This source file may be used and distributed without         
+// restriction provided that this copyright statement is not    
+// removed from the file and that any derivative work contains  
+// the original copyright notice and the associated disclaimer. 
+//
+// This source file is free software; you can redistribute it   
+// and/or modify it under the terms of the GNU Lesser General   
+// Public License as published by the Free Software Foundation; 
+// either version 2.1 of the License, or (at your option) any   
+// later version.
+//
+// This source is distributed in the hope that it will be       
+// useful, but WITHOUT ANY WARRANTY; without even the implied   
+// warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR      
+// PURPOSE.  See the GNU Lesser General Public License for more 
+// details.
+//
+// You should have received a copy of the GNU Lesser General    
+// Public License along with this source; if not, write to the 
+// Free Software Foundation, Inc., 59 Temple Place, Suite 330, 
+// Boston, MA  02111-1307  USA
+//-----------------------------------------------------------------
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <ctype.h>
+#include <assert.h>
+#include <pthread.h>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define SEARCH_X86
+#endif
+
+#include "usb_defs.h"
+#include "log_format.h"
+#include "usb_helpers.h"
+#include "log_decode.h"
+#include "capture_filter.h"
+#include "payload_store.h"
+#include "capture_codec.h"
+#include "capture_file.h"
+#include "parallel.h"
+#include "payload_search.h"
+
+//-----------------------------------------------------------------
+// Structures
+//-----------------------------------------------------------------
+typedef int (*tSearchImpl)(const tSearchPattern *p, const uint8_t *data, int length, int start);
+
+// Output of one block, joined in block order
+struct search_slot
+{
+    char     *buf;
+    size_t    size;
+    int64_t   matches;
+    int       err;
+};
+
+struct search_job
+{
+    tCaptureFile         *cap;
+    const tCaptureFilter *filter;
+    const tSearchPattern *pattern;
+    int                   context;
+    tCaptureBlock         blks[CAPTURE_BATCH_BLOCKS];
+    uint32_t             *words[CAPTURE_BATCH_BLOCKS];
+    struct search_slot    slots[CAPTURE_BATCH_BLOCKS];
+};
+
+//-----------------------------------------------------------------
+// Locals
+//-----------------------------------------------------------------
+static tSearchImpl    _search_impl;
+static const char    *_search_impl_name;
+static pthread_once_t _search_once = PTHREAD_ONCE_INIT;
+
+//-----------------------------------------------------------------
+// search_match_at: Full compare once first and last bytes match
+//-----------------------------------------------------------------
+static inline int search_match_at(const tSearchPattern *p, const uint8_t *at)
+{
+    return p->length <= 2 || memcmp(at + 1, p->bytes + 1, p->length - 2) == 0;
+}
+//-----------------------------------------------------------------
+// search_find_scalar: Offset of pattern at or after start, or -1
+//-----------------------------------------------------------------
+static int search_find_scalar(const tSearchPattern *p, const uint8_t *data, int length, int start)
+{
+    const uint8_t *at;
+    int last = p->length - 1;
+    int i;
+
+    for (i = start; i + last < length; i++)
+    {
+        at = memchr(data + i, p->bytes[0], length - last - i);
+        if (!at)
+            return -1;
+
+        i = (int)(at - data);
+        if (at[last] == p->bytes[last] && search_match_at(p, at))
+            return i;
+    }
+
+    return -1;
+}
+
+#ifdef SEARCH_X86
+//-----------------------------------------------------------------
+// search_find_sse2: Compare 16 candidate positions at once against
+// the first and last pattern bytes, verify the survivors
+//-----------------------------------------------------------------
+__attribute__((target("sse2")))
+static int search_find_sse2(const tSearchPattern *p, const uint8_t *data, int length, int start)
+{
+    const __m128i first = _mm_set1_epi8((char)p->bytes[0]);
+    const __m128i last  = _mm_set1_epi8((char)p->bytes[p->length - 1]);
+    int n = p->length;
+    int i = start;
+
+    for (; i + n - 1 + 16 <= length; i += 16)
+    {
+        __m128i a = _mm_loadu_si128((const __m128i *)(data + i));
+        __m128i b = _mm_loadu_si128((const __m128i *)(data + i + n - 1));
+        uint32_t mask = _mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(a, first), _mm_cmpeq_epi8(b, last)));
+
+        while (mask)
+        {
+            int bit = __builtin_ctz(mask);
+
+            if (search_match_at(p, data + i + bit))
+                return i + bit;
+            mask &= mask - 1;
+        }
+    }
+
+    return search_find_scalar(p, data, length, i);
+}
+//-----------------------------------------------------------------
+// search_find_avx2: As SSE2, 32 positions per step
+//-----------------------------------------------------------------
+__attribute__((target("avx2")))
+static int search_find_avx2(const tSearchPattern *p, const uint8_t *data, int length, int start)
+{
+    const __m256i first = _mm256_set1_epi8((char)p->bytes[0]);
+    const __m256i last  = _mm256_set1_epi8((char)p->bytes[p->length - 1]);
+    int n = p->length;
+    int i = start;
+
+    for (; i + n - 1 + 32 <= length; i += 32)
+    {
+        __m256i a = _mm256_loadu_si256((const __m256i *)(data + i));
+        __m256i b = _mm256_loadu_si256((const __m256i *)(data + i + n - 1));
+        uint32_t mask = (uint32_t)_mm256_movemask_epi8(_mm256_and_si256(_mm256_cmpeq_epi8(a, first),
+                                                                          _mm256_cmpeq_epi8(b, last)));
+
+        while (mask)
+        {
+            int bit = __builtin_ctz(mask);
+
+            if (search_match_at(p, data + i + bit))
+                return i + bit;
+            mask &= mask - 1;
+        }
+    }
+
+    // Short payloads / tail
+    return search_find_sse2(p, data, length, i);
+}
+#endif
+
+//-----------------------------------------------------------------
+// search_select: Pick the widest matcher the CPU supports
+//-----------------------------------------------------------------
+static void search_select(void)
+{
+    _search_impl      = search_find_scalar;
+    _search_impl_name = "scalar";
+
+#ifdef SEARCH_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+    {
+        _search_impl      = search_find_avx2;
+        _search_impl_name = "avx2";
+    }
+    else if (__builtin_cpu_supports("sse2"))
+    {
+        _search_impl      = search_find_sse2;
+        _search_impl_name = "sse2";
+    }
+#endif
+}
+//-----------------------------------------------------------------
+// search_impl_name: Matcher in use
+//-----------------------------------------------------------------
+const char* search_impl_name(void)
+{
+    pthread_once(&_search_once, search_select);
+    return _search_impl_name;
+}
+//-----------------------------------------------------------------
+// search_find: Offset of first match at or after start, or -1
+//-----------------------------------------------------------------
+int search_find(const tSearchPattern *pattern, const uint8_t *data, int length, int start)
+{
+    pthread_once(&_search_once, search_select);
+
+    if (start < 0 || pattern->length <= 0 || length - start < pattern->length)
+        return -1;
+
+    return _search_impl(pattern, data, length, start);
+}
+//-----------------------------------------------------------------
+// search_pattern_parse: Hex bytes ("dead beef", "0xDEADBEEF") or
+// ASCII text
+//-----------------------------------------------------------------
+int search_pattern_parse(tSearchPattern *pattern, const char *text, int ascii)
+{
+    int hi = -1;
+    int v;
+
+    pattern->length = 0;
+
+    if (ascii)
+    {
+        if (strlen(text) > SEARCH_MAX_PATTERN)
+        {
+            fprintf(stderr, "ERROR: Pattern longer than %d bytes\n", SEARCH_MAX_PATTERN);
+            return -1;
+        }
+
+        pattern->length = (int)strlen(text);
+        memcpy(pattern->bytes, text, pattern->length);
+    }
+    else
+    {
+        for (; *text; text++)
+        {
+            if (text[0] == '0' && (text[1] == 'x' || text[1] == 'X') && hi < 0)
+            {
+                text++;
+                continue;
+            }
+
+            if (isspace((unsigned char)*text) || *text == ':' || *text == ',')
+                continue;
+
+            if (!isxdigit((unsigned char)*text))
+            {
+                fprintf(stderr, "ERROR: Bad hex digit '%c' in pattern\n", *text);
+                return -1;
+            }
+
+            v = isdigit((unsigned char)*text) ? (*text - '0') : (tolower((unsigned char)*text) - 'a' + 10);
+            if (hi < 0)
+            {
+                hi = v;
+                continue;
+            }
+
+            if (pattern->length == SEARCH_MAX_PATTERN)
+            {
+                fprintf(stderr, "ERROR: Pattern longer than %d bytes\n", SEARCH_MAX_PATTERN);
+                return -1;
+            }
+
+            pattern->bytes[pattern->length++] = (uint8_t)((hi << 4) | v);
+            hi = -1;
+        }
+
+        if (hi >= 0)
+        {
+            fprintf(stderr, "ERROR: Odd number of hex digits in pattern\n");
+            return -1;
+        }
+    }
+
+    if (!pattern->length)
+    {
+        fprintf(stderr, "ERROR: Empty pattern\n");
+        return -1;
+    }
+
+    return 0;
+}
+//-----------------------------------------------------------------
+// search_print: Match with surrounding payload bytes
+//-----------------------------------------------------------------
+static void search_print(FILE *f, const struct search_job *job, const tLogRecord *rec, int length, int offset)
+{
+    int from = (offset > job->context) ? (offset - job->context) : 0;
+    int end  = offset + job->pattern->length;
+    int to   = (end + job->context < length) ? (end + job->context) : length;
+    int i;
+
+    fprintf(f, "%12.6f  dev %3d ep %2d  %-5s  offset %4d/%-4d ",
+            (double)rec->time / TICKS_PER_SEC, rec->device, rec->endpoint,
+            usb_get_pid_str(rec->pid), offset, length);
+
+    for (i=from;i<to;i++)
+        fprintf(f, "%s%02x%s", (i == offset) ? " [" : " ", rec->data[i], (i == end - 1) ? "]" : "");
+    fprintf(f, "\n");
+}
+//-----------------------------------------------------------------
+// search_block: Search DATA payloads of one block (worker)
+//-----------------------------------------------------------------
+static void search_block(void *ctx, int idx)
+{
+    struct search_job *job = (struct search_job *)ctx;
+    struct search_slot *s = &job->slots[idx];
+    const uint32_t *words = job->words[idx];
+    uint32_t count = job->blks[idx].raw_words;
+    tLogDecoder dec;
+    tLogRecord rec;
+    uint32_t i;
+    int length;
+    int pos;
+    FILE *f;
+
+    f = open_memstream(&s->buf, &s->size);
+    if (!f)
+    {
+        s->err = 1;
+        return;
+    }
+
+    capture_file_block_decoder(job->cap, &job->blks[idx], &dec);
+
+    for (i = 0; i < count; i += rec.words)
+    {
+        if (log_decode_next(&dec, words + i, count - i, &rec) <= 0)
+        {
+            s->err = 1;
+            break;
+        }
+
+        if (rec.type != LOG_CTRL_TYPE_DATA || !capture_filter_match_record(job->filter, &rec))
+            continue;
+
+        // Payload excl. CRC16
+        length = rec.length - 2;
+
+        for (pos = search_find(job->pattern, rec.data, length, 0); pos >= 0;
+             pos = search_find(job->pattern, rec.data, length, pos + 1))
+        {
+            search_print(f, job, &rec, length, pos);
+            s->matches++;
+        }
+    }
+
+    fclose(f);
+}
+//-----------------------------------------------------------------
+// search_capture: Print every occurrence of pattern in the DATA
+// payloads passing filter. Blocks are searched in parallel and
+// printed in capture order. Returns matches found or -1.
+//-----------------------------------------------------------------
+int64_t search_capture(FILE *f, tCaptureFile *cap, const tCaptureFilter *filter,
+                       const tSearchPattern *pattern, int context)
+{
+    struct search_job *job;
+    int64_t matches = 0;
+    int count;
+    int err = 0;
+    int i;
+
+    job = (struct search_job *)calloc(1, sizeof(struct search_job));
+    assert(job);
+
+    job->cap     = cap;
+    job->filter  = filter;
+    job->pattern = pattern;
+    job->context = (context < SEARCH_MAX_CONTEXT) ? context : SEARCH_MAX_CONTEXT;
+
+    // Blocks without the wanted device / endpoint / time are skipped
+    capture_file_set_filter(cap, filter);
+
+    while (!err && (count = capture_file_next_batch(cap, job->blks, job->words)) > 0)
+    {
+        memset(job->slots, 0, sizeof(job->slots));
+        parallel_for(count, search_block, job);
+
+        for (i=0;i<count;i++)
+        {
+            struct search_slot *s = &job->slots[i];
+
+            if (s->err && !err)
+            {
+                fprintf(stderr, "ERROR: Corrupt capture block\n");
+                err = -1;
+            }
+            else if (!err)
+            {
+                fwrite(s->buf, 1, s->size, f);
+                matches += s->matches;
+            }
+
+            free(s->buf);
+        }
+    }
+
+    if (count < 0 || err)
+        matches = -1;
+
+    free(job);
+    return matches;
+}
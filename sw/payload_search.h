@@ -0,0 +1,37 @@
+#ifndef __PAYLOAD_SEARCH_H__
+#define __PAYLOAD_SEARCH_H__
+
+//--------------------------------------------------------------------
+// Defines
+//--------------------------------------------------------------------
+#define SEARCH_MAX_PATTERN      256
+#define SEARCH_MAX_CONTEXT      64
+#define SEARCH_DEF_CONTEXT      8
+
+//--------------------------------------------------------------------
+// Structures
+//--------------------------------------------------------------------
+typedef struct
+{
+    uint8_t bytes[SEARCH_MAX_PATTERN];
+    int     length;
+} tSearchPattern;
+
+//--------------------------------------------------------------------
+// Prototypes
+//--------------------------------------------------------------------
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+int         search_pattern_parse(tSearchPattern *pattern, const char *text, int ascii);
+int         search_find(const tSearchPattern *pattern, const uint8_t *data, int length, int start);
+const char* search_impl_name(void);
+int64_t     search_capture(FILE *f, tCaptureFile *cap, const tCaptureFilter *filter,
+                           const tSearchPattern *pattern, int context);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
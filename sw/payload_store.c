@@ -0,0 +1,371 @@
+//-----------------------------------------------------------------
+//                       USB Sniffer
+//                           V0.1
+//                     Ultra-Embedded.com
+//                       Copyright 2015
+//
+//               Email: admin@ultra-embedded.com
+//
+//                       License: LGPL
+//-----------------------------------------------------------------
+//
+// Copyright (C) 2011 - 2013 Ultra-Embedded.com
+//
+// This source file may be used and distributed without         
+// restriction provided that this copyright statement is not    
+// removed from the file and that any derivative work contains  
+// the original copyright notice and the associated disclaimer. 
+//
+// This source file is free software; you can redistribute it   
+// and/or modify it under the terms of the GNU Lesser General   
+// Public License as published by the Free Software Foundation; 
+// either version 2.1 of the License, or (at your option) any   
+// later version.
+//
+// This source is distributed in the hope that it will be       
+// useful, but WITHOUT ANY WARRANTY; without even the implied   
+// warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR      
+// PURPOSE.  See the GNU Lesser General Public License for more 
+// details.
+//
+// You should have received a copy of the GNU Lesser General    
+// Public License along with this source; if not, write to the 
+// Free Software Foundation, Inc., 59 Temple Place, Suite 330, 
+// Boston, MA  02111-1307  USA
+//-----------------------------------------------------------------
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <stdint.h>
+
+#include "payload_store.h"
+
+//-----------------------------------------------------------------
+// Defines
+//-----------------------------------------------------------------
+#define PAYLOAD_TABLE_INIT      (1 << 12)
+#define PAYLOAD_EMPTY           0xFFFFFFFF
+
+// Second hash seed, the writer matches payloads on both hashes
+#define PAYLOAD_SEED2           0x5851F42D4C957F2DULL
+
+//-----------------------------------------------------------------
+// Structures
+//-----------------------------------------------------------------
+struct payload_store
+{
+    // Payload bytes: every payload (reader), or those added since
+    // the last segment was written (writer)
+    uint8_t  *heap;
+    uint64_t  heap_size;
+    uint64_t  heap_alloc;
+    uint64_t *offsets;
+    uint32_t *lengths;
+    uint32_t  entries;
+    uint32_t  entries_alloc;
+
+    // Writer: 128-bit fingerprint per id, payloads are not kept
+    uint64_t *hashes;
+    uint32_t  count;
+    uint32_t  alloc;
+
+    // Open addressed hash -> id table
+    uint32_t *table;
+    uint32_t  table_size;
+
+    tPayloadStats stats;
+};
+
+//-----------------------------------------------------------------
+// payload_hash: Fast non-cryptographic 64-bit hash
+//-----------------------------------------------------------------
+uint64_t payload_hash(const uint8_t *p, uint32_t len, uint64_t seed)
+{
+    const uint64_t k1 = 0x9E3779B185EBCA87ULL;
+    const uint64_t k2 = 0xC2B2AE3D27D4EB4FULL;
+    uint64_t h = (k2 + seed) ^ (uint64_t)len;
+    uint64_t v;
+
+    while (len >= 8)
+    {
+        memcpy(&v, p, 8);
+        h ^= v * k1;
+        h  = ((h << 31) | (h >> 33)) * k2;
+        p   += 8;
+        len -= 8;
+    }
+
+    if (len > 0)
+    {
+        v = 0;
+        memcpy(&v, p, len);
+        h ^= v * k1;
+        h  = ((h << 31) | (h >> 33)) * k2;
+    }
+
+    // Final avalanche
+    h ^= h >> 33;
+    h *= k1;
+    h ^= h >> 29;
+    h *= k2;
+    h ^= h >> 32;
+    return h;
+}
+//-----------------------------------------------------------------
+// payload_store_grow_table: Double hash table and reinsert ids
+//-----------------------------------------------------------------
+static int payload_store_grow_table(tPayloadStore *store)
+{
+    uint32_t size = store->table_size ? (store->table_size * 2) : PAYLOAD_TABLE_INIT;
+    uint32_t *table = (uint32_t *)malloc(size * sizeof(uint32_t));
+    uint32_t i;
+
+    if (!table)
+        return -1;
+
+    memset(table, 0xFF, size * sizeof(uint32_t));
+
+    for (i=0;i<store->count;i++)
+    {
+        uint32_t slot = store->hashes[i * 2] & (size - 1);
+        while (table[slot] != PAYLOAD_EMPTY)
+            slot = (slot + 1) & (size - 1);
+        table[slot] = i;
+    }
+
+    free(store->table);
+    store->table      = table;
+    store->table_size = size;
+    return 0;
+}
+//-----------------------------------------------------------------
+// payload_store_append: Add entry to the payload bytes held
+//-----------------------------------------------------------------
+static int payload_store_append(tPayloadStore *store, const uint8_t *data, uint32_t length)
+{
+    if (store->entries == store->entries_alloc)
+    {
+        uint32_t alloc = store->entries_alloc ? (store->entries_alloc * 2) : 1024;
+        void *o = realloc(store->offsets, alloc * sizeof(uint64_t));
+        void *l = o ? realloc(store->lengths, alloc * sizeof(uint32_t)) : NULL;
+
+        if (o) store->offsets = (uint64_t *)o;
+        if (l) store->lengths = (uint32_t *)l;
+        if (!l)
+            return -1;
+
+        store->entries_alloc = alloc;
+    }
+
+    if (store->heap_size + length > store->heap_alloc)
+    {
+        uint64_t alloc = store->heap_alloc ? (store->heap_alloc * 2) : (1 << 16);
+        uint8_t *heap;
+
+        while (alloc < store->heap_size + length)
+            alloc *= 2;
+
+        heap = (uint8_t *)realloc(store->heap, alloc);
+        if (!heap)
+            return -1;
+
+        store->heap       = heap;
+        store->heap_alloc = alloc;
+    }
+
+    store->offsets[store->entries] = store->heap_size;
+    store->lengths[store->entries] = length;
+    store->entries++;
+
+    memcpy(store->heap + store->heap_size, data, length);
+    store->heap_size += length;
+    return 0;
+}
+//-----------------------------------------------------------------
+// payload_store_reserve: Room for one more id
+//-----------------------------------------------------------------
+static int payload_store_reserve(tPayloadStore *store)
+{
+    if (store->count == store->alloc)
+    {
+        uint32_t alloc = store->alloc ? (store->alloc * 2) : 1024;
+        uint64_t *h = (uint64_t *)realloc(store->hashes, alloc * 2 * sizeof(uint64_t));
+
+        if (!h)
+            return -1;
+
+        store->hashes = h;
+        store->alloc  = alloc;
+    }
+
+    // Keep table load under 50%
+    if ((store->count + 1) * 2 > store->table_size)
+        return payload_store_grow_table(store);
+
+    return 0;
+}
+//-----------------------------------------------------------------
+// payload_store_create
+//-----------------------------------------------------------------
+tPayloadStore* payload_store_create(void)
+{
+    tPayloadStore *store = (tPayloadStore *)calloc(1, sizeof(tPayloadStore));
+    assert(store);
+    return store;
+}
+//-----------------------------------------------------------------
+// payload_store_destroy
+//-----------------------------------------------------------------
+void payload_store_destroy(tPayloadStore *store)
+{
+    if (!store)
+        return;
+
+    free(store->heap);
+    free(store->offsets);
+    free(store->lengths);
+    free(store->hashes);
+    free(store->table);
+    free(store);
+}
+//-----------------------------------------------------------------
+// payload_store_add: Look up payload, adding it if not yet seen.
+// Payloads are matched on two 64-bit hashes (length is mixed in),
+// new ones are held until the next payload_store_write_segment.
+// Returns 1 if new, 0 if duplicate, -1 on error
+//-----------------------------------------------------------------
+int payload_store_add(tPayloadStore *store, const uint8_t *data, int length, uint32_t *id)
+{
+    uint64_t hash  = payload_hash(data, length, 0);
+    uint64_t hash2 = payload_hash(data, length, PAYLOAD_SEED2);
+    uint32_t slot;
+    uint32_t idx;
+
+    store->stats.refs++;
+    store->stats.bytes_in += length;
+
+    if (payload_store_reserve(store) != 0)
+    {
+        fprintf(stderr, "ERROR: Out of memory\n");
+        return -1;
+    }
+
+    slot = hash & (store->table_size - 1);
+    while ((idx = store->table[slot]) != PAYLOAD_EMPTY)
+    {
+        if (store->hashes[idx * 2] == hash && store->hashes[idx * 2 + 1] == hash2)
+        {
+            *id = idx;
+            return 0;
+        }
+        slot = (slot + 1) & (store->table_size - 1);
+    }
+
+    if (payload_store_append(store, data, length) != 0)
+    {
+        fprintf(stderr, "ERROR: Out of memory\n");
+        return -1;
+    }
+
+    idx = store->count++;
+    store->hashes[idx * 2]     = hash;
+    store->hashes[idx * 2 + 1] = hash2;
+    store->table[slot]         = idx;
+
+    store->stats.unique++;
+    store->stats.bytes_kept += length;
+
+    *id = idx;
+    return 1;
+}
+//-----------------------------------------------------------------
+// payload_store_get: Payload by id (NULL if invalid, or a writer's
+// store, which does not keep them)
+//-----------------------------------------------------------------
+const uint8_t* payload_store_get(const tPayloadStore *store, uint32_t id, int *length)
+{
+    if (store->hashes || id >= store->entries)
+        return NULL;
+
+    *length = store->lengths[id];
+    return store->heap + store->offsets[id];
+}
+//-----------------------------------------------------------------
+// payload_store_stats
+//-----------------------------------------------------------------
+void payload_store_stats(const tPayloadStore *store, tPayloadStats *stats)
+{
+    *stats = store->stats;
+}
+//-----------------------------------------------------------------
+// payload_store_pending: Payloads added since the last segment was
+// written, and the size of the segment holding them
+//-----------------------------------------------------------------
+uint32_t payload_store_pending(const tPayloadStore *store, uint32_t *size)
+{
+    *size = store->entries * sizeof(uint32_t) + (uint32_t)store->heap_size;
+    return store->entries;
+}
+//-----------------------------------------------------------------
+// payload_store_write_segment: Write the pending payloads (lengths,
+// then data) and drop them from memory
+//-----------------------------------------------------------------
+int payload_store_write_segment(tPayloadStore *store, FILE *f)
+{
+    if (fwrite(store->lengths, sizeof(uint32_t), store->entries, f) != store->entries ||
+        fwrite(store->heap, 1, store->heap_size, f) != store->heap_size)
+    {
+        fprintf(stderr, "ERROR: Failed to write payload store\n");
+        return -1;
+    }
+
+    store->entries   = 0;
+    store->heap_size = 0;
+    return 0;
+}
+//-----------------------------------------------------------------
+// payload_store_load_segment: Append a segment of count payloads
+// (size bytes) to a store being read. Ids follow on from the
+// previous segment.
+//-----------------------------------------------------------------
+int payload_store_load_segment(tPayloadStore *store, const uint8_t *seg, uint32_t count, uint32_t size)
+{
+    const uint8_t *data;
+    uint32_t length;
+    uint64_t total = 0;
+    uint32_t i;
+
+    if ((uint64_t)count * sizeof(uint32_t) > size)
+    {
+        fprintf(stderr, "ERROR: Corrupt payload store\n");
+        return -1;
+    }
+
+    // Every entry must lie within the segment
+    for (i=0;i<count;i++)
+    {
+        memcpy(&length, seg + i * sizeof(uint32_t), sizeof(length));
+        total += length;
+    }
+
+    if (total != size - count * sizeof(uint32_t))
+    {
+        fprintf(stderr, "ERROR: Corrupt payload store\n");
+        return -1;
+    }
+
+    data = seg + count * sizeof(uint32_t);
+    for (i=0;i<count;i++)
+    {
+        memcpy(&length, seg + i * sizeof(uint32_t), sizeof(length));
+        if (payload_store_append(store, data, length) != 0)
+        {
+            fprintf(stderr, "ERROR: Out of memory\n");
+            return -1;
+        }
+        data += length;
+    }
+
+    return 0;
+}
@@ -0,0 +1,47 @@
+#ifndef __PAYLOAD_STORE_H__
+#define __PAYLOAD_STORE_H__
+
+//--------------------------------------------------------------------
+// Defines
+//--------------------------------------------------------------------
+// Magic of the payload segments written ahead of capture blocks
+#define PAYLOAD_STORE_MAGIC     0x59415055  // "UPAY"
+
+// Payloads shorter than this stay inline (a reference costs 8 bytes)
+#define PAYLOAD_STORE_MIN       16
+
+//--------------------------------------------------------------------
+// Structures
+//--------------------------------------------------------------------
+typedef struct payload_store tPayloadStore;
+
+typedef struct
+{
+    uint64_t refs;          // Payloads added
+    uint64_t unique;        // Distinct payloads kept
+    uint64_t bytes_in;      // Bytes added
+    uint64_t bytes_kept;    // Bytes stored
+} tPayloadStats;
+
+//--------------------------------------------------------------------
+// Prototypes
+//--------------------------------------------------------------------
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+tPayloadStore* payload_store_create(void);
+void           payload_store_destroy(tPayloadStore *store);
+int            payload_store_add(tPayloadStore *store, const uint8_t *data, int length, uint32_t *id);
+const uint8_t* payload_store_get(const tPayloadStore *store, uint32_t id, int *length);
+void           payload_store_stats(const tPayloadStore *store, tPayloadStats *stats);
+uint32_t       payload_store_pending(const tPayloadStore *store, uint32_t *size);
+int            payload_store_write_segment(tPayloadStore *store, FILE *f);
+int            payload_store_load_segment(tPayloadStore *store, const uint8_t *seg, uint32_t count, uint32_t size);
+uint64_t       payload_hash(const uint8_t *p, uint32_t len, uint64_t seed);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,529 @@
+//-----------------------------------------------------------------
+//                       USB Sniffer
+//                           V0.1
+//                     Ultra-Embedded.com
+//                       Copyright 2015
+//
+//               Email: admin@ultra-embedded.com
+//
+//                       License: LGPL
+//-----------------------------------------------------------------
+//
+// Copyright (C) 2011 - 2013 Ultra-Embedded.com
+//
+// This source file may be used and distributed without         
+// restriction provided that this copyright statement is not    
+// removed from the file and that any derivative work contains  
+// the original copyright notice and the associated disclaimer. 
+//
+// This source file is free software; you can redistribute it   
+// and/or modify it under the terms of the GNU Lesser General   
+// Public License as published by the Free Software Foundation; 
+// either version 2.1 of the License, or (at your option) any   
+// later version.
+//
+// This source is distributed in the hope that it will be       
+// useful, but WITHOUT ANY WARRANTY; without even the implied   
+// warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR      
+// PURPOSE.  See the GNU Lesser General Public License for more 
+// details.
+//
+// You should have received a copy of the GNU Lesser General    
+// Public License along with this source; if not, write to the 
+// Free Software Foundation, Inc., 59 Temple Place, Suite 330, 
+// Boston, MA  02111-1307  USA
+//-----------------------------------------------------------------
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <assert.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "usb_defs.h"
+#include "log_format.h"
+#include "usb_sniffer.h"
+#include "log_decode.h"
+#include "pyramid.h"
+
+//-----------------------------------------------------------------
+// Defines
+//-----------------------------------------------------------------
+// Accumulator slot for whole bus totals
+#define PYRAMID_TOTAL           128
+
+//-----------------------------------------------------------------
+// Structures
+//-----------------------------------------------------------------
+struct pyramid_accum
+{
+    uint64_t bytes;
+    uint64_t packets;
+    uint64_t errors;
+};
+
+// Cell being accumulated at one level, finished cells and their
+// entries are spooled to temporary files until the sidecar is
+// assembled
+struct pyramid_level
+{
+    uint64_t             index;
+    int                  valid;
+    struct pyramid_accum acc[PYRAMID_TOTAL + 1];
+    FILE                *spool;
+    FILE                *entry_spool;
+    uint64_t             base;
+    uint32_t             count;
+    uint32_t             entries;
+};
+
+struct pyramid_builder
+{
+    char                *filename;
+    uint64_t             base_ticks;
+    uint64_t             first_time;
+    uint64_t             last_time;
+    int                  started;
+    struct pyramid_level level[PYRAMID_LEVELS];
+};
+
+struct pyramid
+{
+    tPyramidHeader       hdr;
+    const uint8_t       *map;
+    size_t               map_size;
+};
+
+//-----------------------------------------------------------------
+// pyramid_builder_create: Summarise records into filename
+//-----------------------------------------------------------------
+tPyramidBuilder* pyramid_builder_create(const char *filename)
+{
+    tPyramidBuilder *pb;
+    int i;
+
+    pb = (tPyramidBuilder *)calloc(1, sizeof(tPyramidBuilder));
+    assert(pb);
+
+    pb->filename   = strdup(filename);
+    pb->base_ticks = TICKS_PER_FSLS_FRAME;
+
+    for (i=0;i<PYRAMID_LEVELS;i++)
+    {
+        pb->level[i].spool       = tmpfile();
+        pb->level[i].entry_spool = tmpfile();
+        if (!pb->level[i].spool || !pb->level[i].entry_spool)
+        {
+            fprintf(stderr, "ERROR: Could not create temp file\n");
+            do
+            {
+                if (pb->level[i].spool)
+                    fclose(pb->level[i].spool);
+                if (pb->level[i].entry_spool)
+                    fclose(pb->level[i].entry_spool);
+            }
+            while (i--);
+            free(pb->filename);
+            free(pb);
+            return NULL;
+        }
+    }
+
+    return pb;
+}
+//-----------------------------------------------------------------
+// pyramid_flush_level: Write out level's current cell and fold it
+// into the level above
+//-----------------------------------------------------------------
+static int pyramid_flush_level(tPyramidBuilder *pb, int l)
+{
+    struct pyramid_level *lvl = &pb->level[l];
+    struct pyramid_level *up  = (l + 1 < PYRAMID_LEVELS) ? &pb->level[l + 1] : NULL;
+    int shift = (l < PYRAMID_EXACT_LEVELS) ? 0 : 3 * (l - PYRAMID_EXACT_LEVELS + 1);
+    uint64_t round = shift ? (1ULL << (shift - 1)) : 0;
+    tPyramidEntry entry;
+    tPyramidCell cell;
+    int dev;
+
+    if (!lvl->valid)
+        return 0;
+
+    // Parent moves on to a new cell
+    if (up && up->valid && up->index != (lvl->index >> PYRAMID_FANOUT_BITS))
+    {
+        if (pyramid_flush_level(pb, l + 1) != 0)
+            return -1;
+    }
+
+    if (up)
+    {
+        up->index = lvl->index >> PYRAMID_FANOUT_BITS;
+        up->valid = 1;
+    }
+
+    if (!lvl->count)
+        lvl->base = lvl->index;
+
+    if (lvl->index - lvl->base > 0xFFFFFFFE)
+    {
+        fprintf(stderr, "ERROR: Capture too long for utilization summary\n");
+        return -1;
+    }
+
+    cell.index = (uint32_t)(lvl->index - lvl->base);
+    cell.entry = lvl->entries;
+    if (fwrite(&cell, sizeof(cell), 1, lvl->spool) != 1)
+    {
+        fprintf(stderr, "ERROR: Could not write utilization summary\n");
+        return -1;
+    }
+    lvl->count++;
+
+    memset(&entry, 0, sizeof(entry));
+    for (dev=0;dev<=PYRAMID_TOTAL;dev++)
+    {
+        struct pyramid_accum *acc = &lvl->acc[dev];
+
+        if (!acc->packets)
+            continue;
+
+        entry.device  = (dev == PYRAMID_TOTAL) ? PYRAMID_ALL_DEVICES : dev;
+        entry.bytes   = (uint32_t)((acc->bytes + round) >> shift);
+        entry.packets = acc->packets;
+        entry.errors  = acc->errors;
+
+        if (fwrite(&entry, sizeof(entry), 1, lvl->entry_spool) != 1)
+        {
+            fprintf(stderr, "ERROR: Could not write utilization summary\n");
+            return -1;
+        }
+        lvl->entries++;
+
+        if (up)
+        {
+            up->acc[dev].bytes   += acc->bytes;
+            up->acc[dev].packets += acc->packets;
+            up->acc[dev].errors  += acc->errors;
+        }
+
+        memset(acc, 0, sizeof(*acc));
+    }
+
+    lvl->valid = 0;
+    return 0;
+}
+//-----------------------------------------------------------------
+// pyramid_builder_add: Account record in its level 0 cell
+//-----------------------------------------------------------------
+int pyramid_builder_add(tPyramidBuilder *pb, const tLogRecord *rec)
+{
+    struct pyramid_level *lvl = &pb->level[0];
+    uint64_t index = rec->time / pb->base_ticks;
+    uint32_t bytes = 0;
+    uint32_t error = 0;
+
+    if (rec->type != LOG_CTRL_TYPE_SOF && rec->type != LOG_CTRL_TYPE_TOKEN &&
+        rec->type != LOG_CTRL_TYPE_HSHAKE && rec->type != LOG_CTRL_TYPE_DATA)
+        return 0;
+
+    if (lvl->valid && lvl->index != index)
+    {
+        if (pyramid_flush_level(pb, 0) != 0)
+            return -1;
+    }
+
+    lvl->index = index;
+    lvl->valid = 1;
+
+    if (!pb->started)
+        pb->first_time = rec->time;
+    pb->started   = 1;
+    pb->last_time = rec->time;
+
+    if (rec->type == LOG_CTRL_TYPE_DATA && rec->length >= 2)
+        bytes = rec->length - 2;
+    if (!log_decode_pid_valid(rec) || !log_decode_crc_valid(rec) ||
+        (rec->type == LOG_CTRL_TYPE_HSHAKE && rec->pid == PID_STALL))
+        error = 1;
+
+    lvl->acc[PYRAMID_TOTAL].bytes   += bytes;
+    lvl->acc[PYRAMID_TOTAL].packets++;
+    lvl->acc[PYRAMID_TOTAL].errors  += error;
+
+    if (rec->has_addr)
+    {
+        lvl->acc[rec->device].bytes   += bytes;
+        lvl->acc[rec->device].packets++;
+        lvl->acc[rec->device].errors  += error;
+    }
+
+    return 0;
+}
+//-----------------------------------------------------------------
+// pyramid_builder_finish: Flush all levels and write the sidecar
+// (tagged with the size of the capture it summarises)
+//-----------------------------------------------------------------
+int pyramid_builder_finish(tPyramidBuilder *pb, uint64_t source_size)
+{
+    tPyramidHeader hdr;
+    tPyramidCell end;
+    uint8_t buf[64 * 1024];
+    uint64_t offset;
+    size_t n;
+    FILE *f = NULL;
+    FILE *spool;
+    int err = 0;
+    int l;
+    int part;
+
+    for (l=0;l<PYRAMID_LEVELS && !err;l++)
+        err = pyramid_flush_level(pb, l);
+
+    // End marker: last cell's entries run up to it
+    for (l=0;l<PYRAMID_LEVELS && !err;l++)
+    {
+        end.index = 0xFFFFFFFF;
+        end.entry = pb->level[l].entries;
+        if (fwrite(&end, sizeof(end), 1, pb->level[l].spool) != 1)
+            err = -1;
+    }
+
+    memset(&hdr, 0, sizeof(hdr));
+    hdr.magic       = PYRAMID_MAGIC;
+    hdr.version     = PYRAMID_VERSION;
+    hdr.levels      = PYRAMID_LEVELS;
+    hdr.source_size = source_size;
+    hdr.base_ticks  = pb->base_ticks;
+    hdr.first_time  = pb->first_time;
+    hdr.last_time   = pb->last_time;
+
+    offset = sizeof(hdr);
+    for (l=0;l<PYRAMID_LEVELS;l++)
+    {
+        hdr.level[l].base         = pb->level[l].base;
+        hdr.level[l].count        = pb->level[l].count;
+        hdr.level[l].shift        = (l < PYRAMID_EXACT_LEVELS) ? 0 : 3 * (l - PYRAMID_EXACT_LEVELS + 1);
+        hdr.level[l].offset       = offset;
+        offset += (pb->level[l].count + 1) * (uint64_t)sizeof(tPyramidCell);
+        hdr.level[l].entry_offset = offset;
+        offset += pb->level[l].entries * (uint64_t)sizeof(tPyramidEntry);
+    }
+
+    if (!err)
+    {
+        f = fopen(pb->filename, "wb");
+        if (!f)
+        {
+            fprintf(stderr, "ERROR: Could not create %s\n", pb->filename);
+            err = -1;
+        }
+    }
+
+    if (!err && fwrite(&hdr, sizeof(hdr), 1, f) != 1)
+        err = -1;
+
+    for (l=0;l<PYRAMID_LEVELS && !err;l++)
+        for (part=0;part<2 && !err;part++)
+        {
+            spool = part ? pb->level[l].entry_spool : pb->level[l].spool;
+            rewind(spool);
+            while ((n = fread(buf, 1, sizeof(buf), spool)) > 0)
+                if (fwrite(buf, 1, n, f) != n)
+                {
+                    err = -1;
+                    break;
+                }
+        }
+
+    if (f && fclose(f) != 0)
+        err = -1;
+
+    if (err)
+        fprintf(stderr, "ERROR: Could not write %s\n", pb->filename);
+
+    for (l=0;l<PYRAMID_LEVELS;l++)
+    {
+        fclose(pb->level[l].spool);
+        fclose(pb->level[l].entry_spool);
+    }
+    free(pb->filename);
+    free(pb);
+    return err;
+}
+//-----------------------------------------------------------------
+// pyramid_open: Map sidecar, NULL if missing or not built from a
+// capture of source_size bytes
+//-----------------------------------------------------------------
+tPyramid* pyramid_open(const char *filename, uint64_t source_size)
+{
+    struct stat st;
+    tPyramid *pyr;
+    void *map;
+    FILE *f;
+    int l;
+
+    f = fopen(filename, "rb");
+    if (!f)
+        return NULL;
+
+    pyr = (tPyramid *)calloc(1, sizeof(tPyramid));
+    assert(pyr);
+
+    if (fread(&pyr->hdr, sizeof(pyr->hdr), 1, f) != 1 ||
+        pyr->hdr.magic != PYRAMID_MAGIC || pyr->hdr.version != PYRAMID_VERSION ||
+        pyr->hdr.levels != PYRAMID_LEVELS || pyr->hdr.source_size != source_size ||
+        fstat(fileno(f), &st) != 0)
+    {
+        fclose(f);
+        free(pyr);
+        return NULL;
+    }
+
+    for (l=0;l<PYRAMID_LEVELS;l++)
+    {
+        const tPyramidLevel *lvl = &pyr->hdr.level[l];
+
+        if (lvl->offset + (lvl->count + 1) * (uint64_t)sizeof(tPyramidCell) > (uint64_t)st.st_size ||
+            lvl->entry_offset > (uint64_t)st.st_size || lvl->shift >= 32)
+        {
+            fclose(f);
+            free(pyr);
+            return NULL;
+        }
+    }
+
+    map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fileno(f), 0);
+    fclose(f);
+    if (map == MAP_FAILED)
+    {
+        free(pyr);
+        return NULL;
+    }
+
+    pyr->map      = (const uint8_t *)map;
+    pyr->map_size = st.st_size;
+
+    // Entries referenced by each level's end marker must be present
+    for (l=0;l<PYRAMID_LEVELS;l++)
+    {
+        const tPyramidLevel *lvl = &pyr->hdr.level[l];
+        const tPyramidCell *end = (const tPyramidCell *)(pyr->map + lvl->offset) + lvl->count;
+
+        if (lvl->entry_offset + end->entry * (uint64_t)sizeof(tPyramidEntry) > (uint64_t)st.st_size)
+        {
+            pyramid_close(pyr);
+            return NULL;
+        }
+    }
+
+    return pyr;
+}
+//-----------------------------------------------------------------
+// pyramid_query: Summarise [t_start, t_end] into columns for device
+// (-1 = whole bus), read from the coarsest level whose cells are no
+// wider than a column (so O(columns) cells are visited).
+// Returns the level used.
+//-----------------------------------------------------------------
+int pyramid_query(tPyramid *pyr, uint64_t t_start, uint64_t t_end, int device, int columns, tPyramidColumn *out)
+{
+    const tPyramidLevel *lvl;
+    const tPyramidCell *cells;
+    const tPyramidEntry *entries;
+    const tPyramidEntry *e;
+    uint64_t width;
+    uint64_t cell_ticks;
+    uint64_t first;
+    uint64_t last;
+    uint64_t index;
+    uint64_t lo;
+    uint64_t hi;
+    uint64_t mid;
+    uint64_t col;
+    uint64_t cell_start;
+    uint64_t cell_end;
+    uint8_t match = (device < 0) ? PYRAMID_ALL_DEVICES : (uint8_t)device;
+    uint32_t k;
+    int l = 0;
+
+    if (t_end < t_start || columns <= 0)
+        return -1;
+
+    width = (t_end - t_start) / columns + 1;
+
+    while (l + 1 < PYRAMID_LEVELS && (pyr->hdr.base_ticks << ((l + 1) * PYRAMID_FANOUT_BITS)) <= width)
+        l++;
+
+    lvl        = &pyr->hdr.level[l];
+    cell_ticks = pyr->hdr.base_ticks << (l * PYRAMID_FANOUT_BITS);
+    first      = t_start / cell_ticks;
+    last       = t_end / cell_ticks;
+    cells      = (const tPyramidCell *)(pyr->map + lvl->offset);
+    entries    = (const tPyramidEntry *)(pyr->map + lvl->entry_offset);
+
+    memset(out, 0, columns * sizeof(tPyramidColumn));
+
+    // First cell in range
+    lo = 0;
+    hi = lvl->count;
+    while (lo < hi)
+    {
+        mid = (lo + hi) / 2;
+        if (lvl->base + cells[mid].index < first)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    for (;lo < lvl->count && (index = lvl->base + cells[lo].index) <= last;lo++)
+    {
+        // Device's entry in cell
+        e = NULL;
+        for (k=cells[lo].entry;k<cells[lo + 1].entry && k<cells[lvl->count].entry;k++)
+            if (entries[k].device == match)
+                e = &entries[k];
+
+        if (!e)
+            continue;
+
+        cell_start = index * cell_ticks;
+        cell_end   = cell_start + cell_ticks;
+
+        // Cells are spread over the (at most two) columns they overlap
+        for (col = (cell_start > t_start) ? (cell_start - t_start) / width : 0;
+             col < (uint64_t)columns && t_start + col * width < cell_end; col++)
+        {
+            uint64_t from = t_start + col * width;
+            uint64_t to   = from + width;
+            double   frac;
+
+            if (from < cell_start)
+                from = cell_start;
+            if (to > cell_end)
+                to = cell_end;
+
+            frac = (double)(to - from) / cell_ticks;
+            out[col].bytes   += (uint64_t)(((uint64_t)e->bytes << lvl->shift) * frac + 0.5);
+            out[col].packets += (uint64_t)(e->packets * frac + 0.5);
+            out[col].errors  += (uint64_t)(e->errors * frac + 0.5);
+        }
+    }
+
+    return l;
+}
+//-----------------------------------------------------------------
+// pyramid_time_range: Span of the summarised capture
+//-----------------------------------------------------------------
+void pyramid_time_range(tPyramid *pyr, uint64_t *first, uint64_t *last)
+{
+    *first = pyr->hdr.first_time;
+    *last  = pyr->hdr.last_time;
+}
+//-----------------------------------------------------------------
+// pyramid_close
+//-----------------------------------------------------------------
+void pyramid_close(tPyramid *pyr)
+{
+    munmap((void *)pyr->map, pyr->map_size);
+    free(pyr);
+}
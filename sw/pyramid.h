@@ -0,0 +1,101 @@
+#ifndef __PYRAMID_H__
+#define __PYRAMID_H__
+
+//--------------------------------------------------------------------
+// Defines
+//--------------------------------------------------------------------
+#define PYRAMID_MAGIC           0x52595055  // "UPYR"
+#define PYRAMID_VERSION         4
+
+// Sidecar file name is the capture path plus this suffix
+#define PYRAMID_SUFFIX          ".pyr"
+
+// Level 0 cells are one 1ms frame (8 microframes at high speed),
+// each level up covers 8 cells
+#define PYRAMID_LEVELS          10
+#define PYRAMID_FANOUT_BITS     3
+
+// Levels above this store bytes scaled down (>> 3 per level) to
+// keep them within 32 bits, packet and error counts stay exact
+#define PYRAMID_EXACT_LEVELS    6
+
+// Entry device for whole bus totals (incl. SOF / unaddressed packets)
+#define PYRAMID_ALL_DEVICES     0xFF
+
+//--------------------------------------------------------------------
+// Structures
+//--------------------------------------------------------------------
+// Summary of one device over one cell period (bytes >> level shift)
+typedef struct
+{
+    uint64_t packets;
+    uint64_t errors;        // STALLs, unexpected PIDs and bad CRC16s
+    uint32_t bytes;         // Data payload bytes (excl. CRC16)
+    uint8_t  device;        // Device or PYRAMID_ALL_DEVICES
+    uint8_t  reserved[3];
+} tPyramidEntry;
+
+// Cell with traffic, its entries run up to the next cell's first
+typedef struct
+{
+    uint32_t index;         // Cell number (time / cell ticks) - level base
+    uint32_t entry;         // First entry
+} tPyramidCell;
+
+typedef struct
+{
+    uint64_t base;          // Cell number of first cell
+    uint64_t offset;        // File offset of level's cells
+    uint64_t entry_offset;  // File offset of level's entries
+    uint32_t count;         // Cells (followed by an end marker cell)
+    uint32_t shift;         // Bytes stored >> shift
+} tPyramidLevel;
+
+// Query result for one time column
+typedef struct
+{
+    uint64_t bytes;
+    uint64_t packets;
+    uint64_t errors;
+} tPyramidColumn;
+
+// Sidecar header, followed by each level's cells (sorted by index)
+// then their entries
+typedef struct
+{
+    uint32_t      magic;
+    uint16_t      version;
+    uint16_t      levels;
+    uint64_t      source_size;  // Size of capture summarised
+    uint64_t      base_ticks;   // Level 0 cell period
+    uint64_t      first_time;   // Time of first / last record
+    uint64_t      last_time;
+    tPyramidLevel level[PYRAMID_LEVELS];
+} tPyramidHeader;
+
+typedef struct pyramid_builder tPyramidBuilder;
+typedef struct pyramid tPyramid;
+
+//--------------------------------------------------------------------
+// Prototypes
+//--------------------------------------------------------------------
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Writer
+tPyramidBuilder* pyramid_builder_create(const char *filename);
+int              pyramid_builder_add(tPyramidBuilder *pb, const tLogRecord *rec);
+int              pyramid_builder_finish(tPyramidBuilder *pb, uint64_t source_size);
+
+// Reader
+tPyramid*        pyramid_open(const char *filename, uint64_t source_size);
+int              pyramid_query(tPyramid *pyr, uint64_t t_start, uint64_t t_end, int device, int columns, tPyramidColumn *out);
+void             pyramid_time_range(tPyramid *pyr, uint64_t *first, uint64_t *last);
+void             pyramid_close(tPyramid *pyr);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,1118 @@
+//-----------------------------------------------------------------
+//                       USB Sniffer
+//                           V0.1
+//                     Ultra-Embedded.com
+//                       Copyright 2015
+//
+//               Email: admin@ultra-embedded.com
+//
+//                       License: LGPL
+//-----------------------------------------------------------------
+//
+// Copyright (C) 2011 - 2013 Ultra-Embedded.com
+//
+// This source file may be used and distributed without         
+// restriction provided that this copyright statement is not    
+// removed from the file and that any derivative work contains  
+// the original copyright notice and the associated disclaimer. 
+//
+// This source file is free software; you can redistribute it   
+// and/or modify it under the terms of the GNU Lesser General   
+// Public License as published by the Free Software Foundation; 
+// either version 2.1 of the License, or (at your option) any   
+// later version.
+//
+// This source is distributed in the hope that it will be       
+// useful, but WITHOUT ANY WARRANTY; without even the implied   
+// warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR      
+// PURPOSE.  See the GNU Lesser General Public License for more 
+// details.
+//
+// You should have received a copy of the GNU Lesser General    
+// Public License along with this source; if not, write to the 
+// Free Software Foundation, Inc., 59 Temple Place, Suite 330, 
+// Boston, MA  02111-1307  USA
+//-----------------------------------------------------------------
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <ctype.h>
+#include <assert.h>
+
+#include "usb_defs.h"
+#include "log_format.h"
+#include "usb_helpers.h"
+#include "log_decode.h"
+#include "capture_filter.h"
+#include "payload_store.h"
+#include "capture_codec.h"
+#include "capture_file.h"
+#include "parallel.h"
+#include "query.h"
+
+//-----------------------------------------------------------------
+// Query language:
+//
+//   aggregates [where condition] [by key, ...]
+//
+//   aggregate: count | sum(f) | min(f) | max(f) | avg(f)
+//   condition: f op value, f in (value, ...), not, and, or, ( )
+//   op:        == = != < <= > >=
+//   key:       f or f/step (buckets, e.g. time/0.1)
+//   f:         time (seconds), dev, ep, pid (name or value), len
+//
+// Rows are packets (resets are not included). len is the payload
+// length of DATA packets (excl. CRC16), 0 otherwise. dev and ep are
+// -1 for packets not following a token.
+//-----------------------------------------------------------------
+
+//-----------------------------------------------------------------
+// Enums
+//-----------------------------------------------------------------
+enum
+{
+    FIELD_TIME,
+    FIELD_DEV,
+    FIELD_EP,
+    FIELD_PID,
+    FIELD_LEN,
+    FIELD_MAX
+};
+
+enum
+{
+    AGG_COUNT,
+    AGG_SUM,
+    AGG_MIN,
+    AGG_MAX,
+    AGG_AVG
+};
+
+enum
+{
+    NODE_CMP,
+    NODE_AND,
+    NODE_OR,
+    NODE_NOT
+};
+
+enum
+{
+    OP_EQ,
+    OP_NE,
+    OP_LT,
+    OP_LE,
+    OP_GT,
+    OP_GE
+};
+
+enum
+{
+    TOK_END,
+    TOK_IDENT,
+    TOK_NUM,
+    TOK_PUNCT
+};
+
+//-----------------------------------------------------------------
+// Structures
+//-----------------------------------------------------------------
+struct query_node
+{
+    int                 kind;
+    int                 field;
+    int                 op;
+    int64_t             value;
+    struct query_node  *left;
+    struct query_node  *right;
+};
+
+struct query_agg
+{
+    int                 func;
+    int                 field;
+};
+
+struct query_key
+{
+    int                 field;
+    int64_t             step;       // Bucket size in field units (1 = exact)
+};
+
+// Group: key values (bucket index) and running aggregates
+struct query_group
+{
+    int                 used;
+    int64_t             key[QUERY_MAX_KEYS];
+    uint64_t            count;
+    double              acc[QUERY_MAX_AGGS];
+};
+
+struct query_table
+{
+    struct query_group *groups;
+    uint32_t            size;       // Power of 2
+    uint32_t            used;
+};
+
+// Per block worker state
+struct query_slot
+{
+    struct query_table  table;
+    int64_t             col[FIELD_MAX][QUERY_BATCH];
+    uint8_t             mask[QUERY_MAX_DEPTH][QUERY_BATCH];
+    int                 rows;
+    int                 err;
+};
+
+struct query
+{
+    struct query_agg    aggs[QUERY_MAX_AGGS];
+    int                 num_aggs;
+    struct query_key    keys[QUERY_MAX_KEYS];
+    int                 num_keys;
+    struct query_node  *where;
+
+    // Run state
+    tCaptureFile       *cap;
+    tCaptureBlock       blks[CAPTURE_BATCH_BLOCKS];
+    uint32_t           *words[CAPTURE_BATCH_BLOCKS];
+    struct query_slot  *slots[CAPTURE_BATCH_BLOCKS];
+};
+
+struct query_parser
+{
+    const char         *p;
+    int                 type;
+    char                tok[64];
+    double              num;
+    int                 depth;
+};
+
+//-----------------------------------------------------------------
+// Locals
+//-----------------------------------------------------------------
+static const char *_field_names[FIELD_MAX] = { "time", "dev", "ep", "pid", "len" };
+static const char *_agg_names[]            = { "count", "sum", "min", "max", "avg" };
+
+//-----------------------------------------------------------------
+// query_next: Advance to next token
+//-----------------------------------------------------------------
+static void query_next(struct query_parser *ps)
+{
+    const char *start;
+    char *end;
+    int len;
+
+    while (isspace((unsigned char)*ps->p))
+        ps->p++;
+
+    start = ps->p;
+    ps->tok[0] = 0;
+
+    if (!*ps->p)
+    {
+        ps->type = TOK_END;
+        return;
+    }
+
+    if (isalpha((unsigned char)*ps->p) || *ps->p == '_')
+    {
+        while (isalnum((unsigned char)*ps->p) || *ps->p == '_')
+            ps->p++;
+        ps->type = TOK_IDENT;
+    }
+    else if (isdigit((unsigned char)*ps->p) || *ps->p == '.')
+    {
+        ps->num  = strtod(ps->p, &end);
+        ps->p    = (end > ps->p) ? end : ps->p + 1;
+        ps->type = TOK_NUM;
+    }
+    else
+    {
+        // Two character operators
+        if ((ps->p[0] == '=' || ps->p[0] == '!' || ps->p[0] == '<' || ps->p[0] == '>') && ps->p[1] == '=')
+            ps->p += 2;
+        else
+            ps->p++;
+        ps->type = TOK_PUNCT;
+    }
+
+    len = (int)(ps->p - start);
+    if (len >= (int)sizeof(ps->tok))
+        len = sizeof(ps->tok) - 1;
+    memcpy(ps->tok, start, len);
+    ps->tok[len] = 0;
+}
+//-----------------------------------------------------------------
+// query_error
+//-----------------------------------------------------------------
+static int query_error(struct query_parser *ps, const char *what)
+{
+    fprintf(stderr, "ERROR: Query: expected %s at '%s'\n", what, ps->type == TOK_END ? "end" : ps->tok);
+    return -1;
+}
+//-----------------------------------------------------------------
+// query_is: Current token is keyword / punctuation
+//-----------------------------------------------------------------
+static int query_is(struct query_parser *ps, const char *s)
+{
+    return ps->type != TOK_END && ps->type != TOK_NUM && strcasecmp(ps->tok, s) == 0;
+}
+//-----------------------------------------------------------------
+// query_expect: Consume keyword / punctuation
+//-----------------------------------------------------------------
+static int query_expect(struct query_parser *ps, const char *s)
+{
+    char what[16];
+
+    if (!query_is(ps, s))
+    {
+        snprintf(what, sizeof(what), "'%s'", s);
+        return query_error(ps, what);
+    }
+
+    query_next(ps);
+    return 0;
+}
+//-----------------------------------------------------------------
+// query_field: Parse field name
+//-----------------------------------------------------------------
+static int query_field(struct query_parser *ps)
+{
+    int i;
+
+    if (ps->type == TOK_IDENT)
+        for (i=0;i<FIELD_MAX;i++)
+            if (strcasecmp(ps->tok, _field_names[i]) == 0)
+            {
+                query_next(ps);
+                return i;
+            }
+
+    return query_error(ps, "field (time, dev, ep, pid, len)");
+}
+//-----------------------------------------------------------------
+// query_value: Constant for field, in column units
+//-----------------------------------------------------------------
+static int query_value(struct query_parser *ps, int field, int64_t *value)
+{
+    int i;
+
+    if (field == FIELD_PID && ps->type == TOK_IDENT)
+    {
+        for (i=0;i<16;i++)
+        {
+            uint8_t full_pid = i | ((~(i << 4)) & 0xF0);
+            if (strcasecmp(usb_get_pid_str(full_pid), ps->tok) == 0)
+            {
+                *value = full_pid;
+                query_next(ps);
+                return 0;
+            }
+        }
+        return query_error(ps, "PID name");
+    }
+
+    if (ps->type != TOK_NUM)
+        return query_error(ps, "number");
+
+    if (field == FIELD_TIME)
+        *value = (int64_t)(ps->num * TICKS_PER_SEC);
+    else if (field == FIELD_PID)
+        *value = ((int)ps->num & 0xF) | ((~((int)ps->num << 4)) & 0xF0);
+    else
+        *value = (int64_t)ps->num;
+
+    query_next(ps);
+    return 0;
+}
+//-----------------------------------------------------------------
+// query_node_new
+//-----------------------------------------------------------------
+static struct query_node* query_node_new(int kind, struct query_node *left, struct query_node *right)
+{
+    struct query_node *n = (struct query_node *)calloc(1, sizeof(struct query_node));
+    assert(n);
+
+    n->kind  = kind;
+    n->left  = left;
+    n->right = right;
+    return n;
+}
+//-----------------------------------------------------------------
+// query_node_free
+//-----------------------------------------------------------------
+static void query_node_free(struct query_node *n)
+{
+    if (!n)
+        return;
+
+    query_node_free(n->left);
+    query_node_free(n->right);
+    free(n);
+}
+//-----------------------------------------------------------------
+// query_node_depth: Extra mask levels query_eval needs for a node
+// (each right hand and / or operand is evaluated one level down)
+//-----------------------------------------------------------------
+static int query_node_depth(const struct query_node *n)
+{
+    int l;
+    int r;
+
+    if (n->kind == NODE_CMP)
+        return 0;
+
+    l = query_node_depth(n->left);
+    if (n->kind == NODE_NOT)
+        return l;
+
+    r = query_node_depth(n->right) + 1;
+    return (l > r) ? l : r;
+}
+
+static struct query_node* query_parse_or(struct query_parser *ps);
+
+//-----------------------------------------------------------------
+// query_parse_cmp: f op value | f in (values) | not x | ( x )
+//-----------------------------------------------------------------
+static struct query_node* query_parse_cmp(struct query_parser *ps)
+{
+    static const char *ops[] = { "==", "!=", "<", "<=", ">", ">=" };
+    struct query_node *n = NULL;
+    struct query_node *eq;
+    int field;
+    int i;
+
+    if (++ps->depth >= QUERY_MAX_DEPTH - 1)
+    {
+        fprintf(stderr, "ERROR: Query: condition nested too deeply\n");
+        return NULL;
+    }
+
+    if (query_is(ps, "not"))
+    {
+        query_next(ps);
+        n = query_parse_cmp(ps);
+        n = n ? query_node_new(NODE_NOT, n, NULL) : NULL;
+    }
+    else if (query_is(ps, "("))
+    {
+        query_next(ps);
+        n = query_parse_or(ps);
+        if (n && query_expect(ps, ")") != 0)
+        {
+            query_node_free(n);
+            n = NULL;
+        }
+    }
+    else if ((field = query_field(ps)) >= 0)
+    {
+        // f in (a, b, ...) is f == a or f == b ...
+        if (query_is(ps, "in"))
+        {
+            query_next(ps);
+            if (query_expect(ps, "(") != 0)
+                return NULL;
+
+            do
+            {
+                eq = query_node_new(NODE_CMP, NULL, NULL);
+                eq->field = field;
+                eq->op    = OP_EQ;
+                n = n ? query_node_new(NODE_OR, n, eq) : eq;
+
+                if (query_value(ps, field, &eq->value) != 0)
+                    break;
+
+                if (!query_is(ps, ","))
+                {
+                    if (query_expect(ps, ")") == 0)
+                    {
+                        ps->depth--;
+                        return n;
+                    }
+                    break;
+                }
+                query_next(ps);
+            }
+            while (1);
+
+            query_node_free(n);
+            return NULL;
+        }
+
+        n = query_node_new(NODE_CMP, NULL, NULL);
+        n->field = field;
+        n->op    = -1;
+
+        for (i=0;i<6;i++)
+            if (query_is(ps, ops[i]))
+                n->op = i;
+        if (query_is(ps, "="))
+            n->op = OP_EQ;
+
+        if (n->op < 0)
+        {
+            query_error(ps, "comparison");
+            query_node_free(n);
+            return NULL;
+        }
+
+        query_next(ps);
+        if (query_value(ps, field, &n->value) != 0)
+        {
+            query_node_free(n);
+            return NULL;
+        }
+    }
+
+    ps->depth--;
+    return n;
+}
+//-----------------------------------------------------------------
+// query_parse_and
+//-----------------------------------------------------------------
+static struct query_node* query_parse_and(struct query_parser *ps)
+{
+    struct query_node *n = query_parse_cmp(ps);
+    struct query_node *r;
+
+    while (n && query_is(ps, "and"))
+    {
+        query_next(ps);
+        r = query_parse_cmp(ps);
+        if (!r)
+        {
+            query_node_free(n);
+            return NULL;
+        }
+        n = query_node_new(NODE_AND, n, r);
+    }
+
+    return n;
+}
+//-----------------------------------------------------------------
+// query_parse_or
+//-----------------------------------------------------------------
+static struct query_node* query_parse_or(struct query_parser *ps)
+{
+    struct query_node *n = query_parse_and(ps);
+    struct query_node *r;
+
+    while (n && query_is(ps, "or"))
+    {
+        query_next(ps);
+        r = query_parse_and(ps);
+        if (!r)
+        {
+            query_node_free(n);
+            return NULL;
+        }
+        n = query_node_new(NODE_OR, n, r);
+    }
+
+    return n;
+}
+//-----------------------------------------------------------------
+// query_parse_agg: count | func(field)
+//-----------------------------------------------------------------
+static int query_parse_agg(struct query_parser *ps, struct query_agg *agg)
+{
+    int i;
+
+    agg->func  = -1;
+    agg->field = FIELD_LEN;
+
+    for (i=0;i<(int)(sizeof(_agg_names) / sizeof(_agg_names[0]));i++)
+        if (query_is(ps, _agg_names[i]))
+            agg->func = i;
+
+    if (agg->func < 0)
+        return query_error(ps, "aggregate (count, sum, min, max, avg)");
+
+    query_next(ps);
+
+    if (agg->func == AGG_COUNT)
+    {
+        // Optional "()"
+        if (query_is(ps, "("))
+        {
+            query_next(ps);
+            return query_expect(ps, ")");
+        }
+        return 0;
+    }
+
+    if (query_expect(ps, "(") != 0 || (agg->field = query_field(ps)) < 0)
+        return -1;
+
+    return query_expect(ps, ")");
+}
+//-----------------------------------------------------------------
+// query_parse_key: field or field/step
+//-----------------------------------------------------------------
+static int query_parse_key(struct query_parser *ps, struct query_key *key)
+{
+    if ((key->field = query_field(ps)) < 0)
+        return -1;
+
+    key->step = 1;
+
+    if (query_is(ps, "/"))
+    {
+        query_next(ps);
+        if (ps->type != TOK_NUM)
+            return query_error(ps, "bucket size");
+
+        key->step = (key->field == FIELD_TIME) ? (int64_t)(ps->num * TICKS_PER_SEC) : (int64_t)ps->num;
+        if (key->step <= 0)
+            return query_error(ps, "bucket size > 0");
+
+        query_next(ps);
+    }
+
+    return 0;
+}
+//-----------------------------------------------------------------
+// query_compile: Parse query text
+//-----------------------------------------------------------------
+tQuery* query_compile(const char *text)
+{
+    struct query_parser ps;
+    tQuery *q = (tQuery *)calloc(1, sizeof(tQuery));
+    assert(q);
+
+    memset(&ps, 0, sizeof(ps));
+    ps.p = text;
+    query_next(&ps);
+
+    do
+    {
+        if (q->num_aggs == QUERY_MAX_AGGS)
+        {
+            fprintf(stderr, "ERROR: Query: too many aggregates (max %d)\n", QUERY_MAX_AGGS);
+            goto fail;
+        }
+
+        if (query_parse_agg(&ps, &q->aggs[q->num_aggs++]) != 0)
+            goto fail;
+    }
+    while (query_is(&ps, ",") && (query_next(&ps), 1));
+
+    if (query_is(&ps, "where"))
+    {
+        query_next(&ps);
+        q->where = query_parse_or(&ps);
+        if (!q->where)
+            goto fail;
+
+        if (query_node_depth(q->where) >= QUERY_MAX_DEPTH)
+        {
+            fprintf(stderr, "ERROR: Query: condition nested too deeply\n");
+            goto fail;
+        }
+    }
+
+    if (query_is(&ps, "by"))
+    {
+        query_next(&ps);
+        do
+        {
+            if (q->num_keys == QUERY_MAX_KEYS)
+            {
+                fprintf(stderr, "ERROR: Query: too many keys (max %d)\n", QUERY_MAX_KEYS);
+                goto fail;
+            }
+
+            if (query_parse_key(&ps, &q->keys[q->num_keys++]) != 0)
+                goto fail;
+        }
+        while (query_is(&ps, ",") && (query_next(&ps), 1));
+    }
+
+    if (ps.type != TOK_END)
+    {
+        query_error(&ps, "'where', 'by' or end");
+        goto fail;
+    }
+
+    return q;
+
+fail:
+    query_destroy(q);
+    return NULL;
+}
+//-----------------------------------------------------------------
+// query_filter_node: Narrow block filter from a condition which
+// must hold (top level 'and' terms)
+//-----------------------------------------------------------------
+static void query_filter_node(const struct query_node *n, tCaptureFilter *filter)
+{
+    const struct query_node *o;
+    uint16_t pid_map = 0;
+
+    if (n->kind == NODE_AND)
+    {
+        query_filter_node(n->left, filter);
+        query_filter_node(n->right, filter);
+        return;
+    }
+
+    // pid == a or pid == b ...
+    for (o = n; o->kind == NODE_OR; o = o->left)
+    {
+        if (o->right->kind != NODE_CMP || o->right->field != FIELD_PID || o->right->op != OP_EQ)
+            return;
+        pid_map |= 1 << (o->right->value & 0xF);
+    }
+
+    if (o->kind != NODE_CMP)
+        return;
+
+    if (o->field == FIELD_PID && o->op == OP_EQ)
+    {
+        pid_map |= 1 << (o->value & 0xF);
+        if (!filter->pid_map || (filter->pid_map & pid_map))
+            filter->pid_map = filter->pid_map ? (filter->pid_map & pid_map) : pid_map;
+        return;
+    }
+
+    if (n != o)
+        return;
+
+    if (o->field == FIELD_DEV && o->op == OP_EQ && o->value >= 0 && o->value < 128)
+        filter->device = (int)o->value;
+    else if (o->field == FIELD_EP && o->op == OP_EQ && o->value >= 0 && o->value < 16)
+        filter->endpoint = (int)o->value;
+    else if (o->field == FIELD_TIME && (o->op == OP_GT || o->op == OP_GE) && o->value > (int64_t)filter->t_start)
+        filter->t_start = o->value;
+    else if (o->field == FIELD_TIME && (o->op == OP_LT || o->op == OP_LE) && o->value >= 0 && (uint64_t)o->value < filter->t_end)
+        filter->t_end = o->value;
+}
+//-----------------------------------------------------------------
+// query_filter: Block filter implied by the query (blocks which
+// cannot match are skipped using their zone maps)
+//-----------------------------------------------------------------
+void query_filter(const tQuery *q, tCaptureFilter *filter)
+{
+    capture_filter_init(filter);
+
+    if (q->where)
+        query_filter_node(q->where, filter);
+}
+//-----------------------------------------------------------------
+// query_eval: Evaluate condition over a batch of rows into mask
+//-----------------------------------------------------------------
+static void query_eval(struct query_slot *s, const struct query_node *n, int depth, int rows)
+{
+    uint8_t *m = s->mask[depth];
+    uint8_t *r;
+    const int64_t *col;
+    int64_t v;
+    int i;
+
+    switch (n->kind)
+    {
+        case NODE_CMP:
+            col = s->col[n->field];
+            v   = n->value;
+            switch (n->op)
+            {
+                case OP_EQ: for (i=0;i<rows;i++) m[i] = col[i] == v; break;
+                case OP_NE: for (i=0;i<rows;i++) m[i] = col[i] != v; break;
+                case OP_LT: for (i=0;i<rows;i++) m[i] = col[i] <  v; break;
+                case OP_LE: for (i=0;i<rows;i++) m[i] = col[i] <= v; break;
+                case OP_GT: for (i=0;i<rows;i++) m[i] = col[i] >  v; break;
+                case OP_GE: for (i=0;i<rows;i++) m[i] = col[i] >= v; break;
+            }
+            break;
+        case NODE_NOT:
+            query_eval(s, n->left, depth, rows);
+            for (i=0;i<rows;i++)
+                m[i] ^= 1;
+            break;
+        case NODE_AND:
+        case NODE_OR:
+            query_eval(s, n->left, depth, rows);
+            query_eval(s, n->right, depth + 1, rows);
+            r = s->mask[depth + 1];
+            if (n->kind == NODE_AND)
+                for (i=0;i<rows;i++) m[i] &= r[i];
+            else
+                for (i=0;i<rows;i++) m[i] |= r[i];
+            break;
+    }
+}
+//-----------------------------------------------------------------
+// query_hash
+//-----------------------------------------------------------------
+static uint32_t query_hash(const int64_t *key, int count)
+{
+    uint64_t h = 0x9E3779B97F4A7C15ULL;
+    int i;
+
+    for (i=0;i<count;i++)
+    {
+        h ^= (uint64_t)key[i];
+        h *= 0xBF58476D1CE4E5B9ULL;
+        h ^= h >> 31;
+    }
+
+    return (uint32_t)h;
+}
+//-----------------------------------------------------------------
+// query_group_get: Find / add group in table
+//-----------------------------------------------------------------
+static struct query_group* query_group_get(tQuery *q, struct query_table *t, const int64_t *key)
+{
+    struct query_group *g;
+    uint32_t idx;
+    uint32_t i;
+    int k;
+
+    // Grow at half full
+    if ((t->used + 1) * 2 > t->size)
+    {
+        struct query_table old = *t;
+
+        t->size   = old.size ? old.size * 2 : 64;
+        t->used   = 0;
+        t->groups = (struct query_group *)calloc(t->size, sizeof(struct query_group));
+        assert(t->groups);
+
+        for (i=0;i<old.size;i++)
+            if (old.groups[i].used)
+                *query_group_get(q, t, old.groups[i].key) = old.groups[i];
+
+        free(old.groups);
+    }
+
+    for (idx = query_hash(key, q->num_keys) & (t->size - 1);; idx = (idx + 1) & (t->size - 1))
+    {
+        g = &t->groups[idx];
+
+        if (!g->used)
+            break;
+
+        if (memcmp(g->key, key, q->num_keys * sizeof(int64_t)) == 0)
+            return g;
+    }
+
+    g->used = 1;
+    memcpy(g->key, key, q->num_keys * sizeof(int64_t));
+    for (k=0;k<q->num_aggs;k++)
+    {
+        if (q->aggs[k].func == AGG_MIN)
+            g->acc[k] = 1e300;
+        else if (q->aggs[k].func == AGG_MAX)
+            g->acc[k] = -1e300;
+    }
+    t->used++;
+    return g;
+}
+//-----------------------------------------------------------------
+// query_accumulate: Fold value into group aggregate
+//-----------------------------------------------------------------
+static void query_accumulate(const struct query_agg *agg, double *acc, double v)
+{
+    switch (agg->func)
+    {
+        case AGG_SUM:
+        case AGG_AVG:
+            *acc += v;
+            break;
+        case AGG_MIN:
+            if (v < *acc)
+                *acc = v;
+            break;
+        case AGG_MAX:
+            if (v > *acc)
+                *acc = v;
+            break;
+    }
+}
+//-----------------------------------------------------------------
+// query_batch: Filter and aggregate one batch of rows
+//-----------------------------------------------------------------
+static void query_batch(tQuery *q, struct query_slot *s)
+{
+    const uint8_t *m = s->mask[0];
+    int64_t key[QUERY_MAX_KEYS];
+    struct query_group *g = NULL;
+    int i;
+    int k;
+
+    if (q->where)
+        query_eval(s, q->where, 0, s->rows);
+    else
+        memset(s->mask[0], 1, s->rows);
+
+    // Single group
+    if (!q->num_keys)
+        g = query_group_get(q, &s->table, key);
+
+    for (i=0;i<s->rows;i++)
+    {
+        if (!m[i])
+            continue;
+
+        if (q->num_keys)
+        {
+            for (k=0;k<q->num_keys;k++)
+            {
+                int64_t v = s->col[q->keys[k].field][i];
+
+                // Floor division so negative values (dev -1) bucket sensibly
+                key[k] = (v >= 0) ? (v / q->keys[k].step) : -((-v + q->keys[k].step - 1) / q->keys[k].step);
+            }
+            g = query_group_get(q, &s->table, key);
+        }
+
+        g->count++;
+        for (k=0;k<q->num_aggs;k++)
+            query_accumulate(&q->aggs[k], &g->acc[k], (double)s->col[q->aggs[k].field][i]);
+    }
+
+    s->rows = 0;
+}
+//-----------------------------------------------------------------
+// query_block: Decode one block into column batches (worker)
+//-----------------------------------------------------------------
+static void query_block(void *ctx, int idx)
+{
+    tQuery *q = (tQuery *)ctx;
+    struct query_slot *s = q->slots[idx];
+    const uint32_t *words = q->words[idx];
+    uint32_t count = q->blks[idx].raw_words;
+    tLogDecoder dec;
+    tLogRecord rec;
+    uint32_t i;
+    int r;
+
+    capture_file_block_decoder(q->cap, &q->blks[idx], &dec);
+
+    for (i = 0; i < count; i += rec.words)
+    {
+        if (log_decode_next(&dec, words + i, count - i, &rec) <= 0)
+        {
+            s->err = 1;
+            return;
+        }
+
+        if (rec.type == LOG_CTRL_TYPE_RST)
+            continue;
+
+        r = s->rows++;
+        s->col[FIELD_TIME][r] = (int64_t)rec.time;
+        s->col[FIELD_DEV][r]  = rec.has_addr ? rec.device : -1;
+        s->col[FIELD_EP][r]   = rec.has_addr ? rec.endpoint : -1;
+        s->col[FIELD_PID][r]  = rec.pid;
+        s->col[FIELD_LEN][r]  = (rec.type == LOG_CTRL_TYPE_DATA && rec.length >= 2) ? (rec.length - 2) : 0;
+
+        if (s->rows == QUERY_BATCH)
+            query_batch(q, s);
+    }
+
+    if (s->rows)
+        query_batch(q, s);
+}
+//-----------------------------------------------------------------
+// query_run: Scan capture, blocks decoded and aggregated in
+// parallel (one group table per batch slot, merged at the end)
+//-----------------------------------------------------------------
+int query_run(tQuery *q, tCaptureFile *cap)
+{
+    int64_t none[QUERY_MAX_KEYS] = { 0 };
+    tCaptureFilter filter;
+    struct query_table *t;
+    struct query_group *g;
+    int count;
+    int err = 0;
+    int i;
+    uint32_t j;
+    int k;
+
+    query_filter(q, &filter);
+    capture_file_set_filter(cap, &filter);
+    q->cap = cap;
+
+    for (i=0;i<CAPTURE_BATCH_BLOCKS;i++)
+        if (!q->slots[i])
+        {
+            q->slots[i] = (struct query_slot *)calloc(1, sizeof(struct query_slot));
+            assert(q->slots[i]);
+        }
+
+    // Without keys there is always one row, even if nothing matched
+    if (!q->num_keys)
+        query_group_get(q, &q->slots[0]->table, none);
+
+    while (!err && (count = capture_file_next_batch(cap, q->blks, q->words)) > 0)
+    {
+        parallel_for(count, query_block, q);
+
+        for (i=0;i<count;i++)
+            if (q->slots[i]->err)
+            {
+                fprintf(stderr, "ERROR: Corrupt capture block\n");
+                err = -1;
+            }
+    }
+
+    if (count < 0)
+        err = -1;
+
+    // Merge into slot 0
+    t = &q->slots[0]->table;
+    for (i=1;i<CAPTURE_BATCH_BLOCKS;i++)
+    {
+        struct query_table *o = &q->slots[i]->table;
+
+        for (j=0;j<o->size;j++)
+        {
+            if (!o->groups[j].used)
+                continue;
+
+            g = query_group_get(q, t, o->groups[j].key);
+            g->count += o->groups[j].count;
+            for (k=0;k<q->num_aggs;k++)
+            {
+                if (q->aggs[k].func == AGG_COUNT)
+                    continue;
+                if (q->aggs[k].func == AGG_SUM || q->aggs[k].func == AGG_AVG)
+                    g->acc[k] += o->groups[j].acc[k];
+                else
+                    query_accumulate(&q->aggs[k], &g->acc[k], o->groups[j].acc[k]);
+            }
+        }
+
+        free(o->groups);
+        memset(o, 0, sizeof(*o));
+    }
+
+    return err;
+}
+//-----------------------------------------------------------------
+// query_group_cmp: Order groups by key
+//-----------------------------------------------------------------
+static int query_group_cmp(const void *a, const void *b)
+{
+    const struct query_group *ga = *(const struct query_group **)a;
+    const struct query_group *gb = *(const struct query_group **)b;
+    int k;
+
+    // Unused keys are zero in every group
+    for (k=0;k<QUERY_MAX_KEYS;k++)
+        if (ga->key[k] != gb->key[k])
+            return ga->key[k] < gb->key[k] ? -1 : 1;
+
+    return 0;
+}
+//-----------------------------------------------------------------
+// query_print_value: Field value in display units
+//-----------------------------------------------------------------
+static void query_print_value(FILE *f, int field, double v)
+{
+    if (field == FIELD_TIME)
+        fprintf(f, " %14.6f", v / TICKS_PER_SEC);
+    else if (field == FIELD_PID && v >= 0)
+        fprintf(f, " %14s", usb_get_pid_str((uint8_t)v));
+    else if ((field == FIELD_DEV || field == FIELD_EP) && v < 0)
+        fprintf(f, " %14s", "-");
+    else
+        fprintf(f, " %14.0f", v);
+}
+//-----------------------------------------------------------------
+// query_report: Print result table
+//-----------------------------------------------------------------
+void query_report(FILE *f, tQuery *q)
+{
+    struct query_table *t = &q->slots[0]->table;
+    struct query_group **rows;
+    char label[32];
+    uint32_t count = 0;
+    uint32_t i;
+    int k;
+
+    for (k=0;k<q->num_keys;k++)
+    {
+        if (q->keys[k].step == 1)
+            snprintf(label, sizeof(label), "%s", _field_names[q->keys[k].field]);
+        else if (q->keys[k].field == FIELD_TIME)
+            snprintf(label, sizeof(label), "time/%g", (double)q->keys[k].step / TICKS_PER_SEC);
+        else
+            snprintf(label, sizeof(label), "%s/%lld", _field_names[q->keys[k].field], (long long)q->keys[k].step);
+        fprintf(f, " %14s", label);
+    }
+    for (k=0;k<q->num_aggs;k++)
+    {
+        if (q->aggs[k].func == AGG_COUNT)
+            snprintf(label, sizeof(label), "count");
+        else
+            snprintf(label, sizeof(label), "%s(%s)", _agg_names[q->aggs[k].func], _field_names[q->aggs[k].field]);
+        fprintf(f, " %14s", label);
+    }
+    fprintf(f, "\n");
+
+    rows = (struct query_group **)malloc((t->used + 1) * sizeof(struct query_group *));
+    assert(rows);
+
+    for (i=0;i<t->size;i++)
+        if (t->groups[i].used)
+            rows[count++] = &t->groups[i];
+
+    qsort(rows, count, sizeof(rows[0]), query_group_cmp);
+
+    for (i=0;i<count;i++)
+    {
+        struct query_group *g = rows[i];
+
+        for (k=0;k<q->num_keys;k++)
+            query_print_value(f, q->keys[k].field, (double)g->key[k] * q->keys[k].step);
+
+        for (k=0;k<q->num_aggs;k++)
+        {
+            if (q->aggs[k].func == AGG_COUNT)
+                fprintf(f, " %14llu", (unsigned long long)g->count);
+            else if (q->aggs[k].func == AGG_SUM && q->aggs[k].field == FIELD_TIME)
+                fprintf(f, " %14.6f", g->acc[k] / TICKS_PER_SEC);
+            else if (q->aggs[k].func == AGG_SUM)
+                fprintf(f, " %14.0f", g->acc[k]);
+            else if (!g->count)
+                fprintf(f, " %14s", "-");
+            else if (q->aggs[k].func == AGG_AVG && q->aggs[k].field == FIELD_TIME)
+                fprintf(f, " %14.6f", g->acc[k] / g->count / TICKS_PER_SEC);
+            else if (q->aggs[k].func == AGG_AVG)
+                fprintf(f, " %14.3f", g->acc[k] / g->count);
+            else
+                query_print_value(f, q->aggs[k].field, g->acc[k]);
+        }
+        fprintf(f, "\n");
+    }
+
+    free(rows);
+}
+//-----------------------------------------------------------------
+// query_destroy
+//-----------------------------------------------------------------
+void query_destroy(tQuery *q)
+{
+    int i;
+
+    if (!q)
+        return;
+
+    for (i=0;i<CAPTURE_BATCH_BLOCKS;i++)
+        if (q->slots[i])
+        {
+            free(q->slots[i]->table.groups);
+            free(q->slots[i]);
+        }
+
+    query_node_free(q->where);
+    free(q);
+}
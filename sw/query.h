@@ -0,0 +1,38 @@
+#ifndef __QUERY_H__
+#define __QUERY_H__
+
+//--------------------------------------------------------------------
+// Defines
+//--------------------------------------------------------------------
+// Rows decoded into columns and filtered together
+#define QUERY_BATCH             1024
+
+#define QUERY_MAX_AGGS          8
+#define QUERY_MAX_KEYS          4
+
+// Expression nesting limit (one mask per level)
+#define QUERY_MAX_DEPTH         32
+
+//--------------------------------------------------------------------
+// Structures
+//--------------------------------------------------------------------
+typedef struct query tQuery;
+
+//--------------------------------------------------------------------
+// Prototypes
+//--------------------------------------------------------------------
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+tQuery* query_compile(const char *text);
+void    query_filter(const tQuery *q, tCaptureFilter *filter);
+int     query_run(tQuery *q, tCaptureFile *cap);
+void    query_report(FILE *f, tQuery *q);
+void    query_destroy(tQuery *q);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
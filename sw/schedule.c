@@ -0,0 +1,354 @@
+//-----------------------------------------------------------------
+//                       USB Sniffer
+//                           V0.1
+//                     Ultra-Embedded.com
+//                       Copyright 2015
+//
+//               Email: admin@ultra-embedded.com
+//
+//                       License: LGPL
+//-----------------------------------------------------------------
+//
+// Copyright (C) 2011 - 2013 Ultra-Embedded.com
+//
+// This source file may be used and distributed without         
+// restriction provided that this copyright statement is not    
+// removed from the file and that any derivative work contains  
+// the original copyright notice and the associated disclaimer. 
+//
+// This source file is free software; you can redistribute it   
+// and/or modify it under the terms of the GNU Lesser General   
+// Public License as published by the Free Software Foundation; 
+// either version 2.1 of the License, or (at your option) any   
+// later version.
+//
+// This source is distributed in the hope that it will be       
+// useful, but WITHOUT ANY WARRANTY; without even the implied   
+// warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR      
+// PURPOSE.  See the GNU Lesser General Public License for more 
+// details.
+//
+// You should have received a copy of the GNU Lesser General    
+// Public License along with this source; if not, write to the 
+// Free Software Foundation, Inc., 59 Temple Place, Suite 330, 
+// Boston, MA  02111-1307  USA
+//-----------------------------------------------------------------
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+
+#include "usb_defs.h"
+#include "usb_sniffer.h"
+#include "log_format.h"
+#include "usb_helpers.h"
+#include "log_decode.h"
+#include "latency.h"
+#include "descriptor_snoop.h"
+#include "schedule.h"
+
+//-----------------------------------------------------------------
+// Structures
+//-----------------------------------------------------------------
+// Polling of one endpoint. Service opportunities are (micro)frames,
+// numbered from the SOF sequence.
+struct sched_endpoint
+{
+    uint64_t     polls;         // Tokens seen
+    uint64_t     extra;         // Tokens in an already serviced frame
+    uint64_t     last_frame;    // Frame index of last serviced frame
+    uint64_t     last_offset;   // Ticks from SOF to its first token
+
+    tLatencyHist gap;           // Frames between serviced frames
+    tLatencyHist offset;        // Ticks from SOF to first token
+    tLatencyHist jitter;        // Change in offset between services
+};
+
+struct schedule_stats
+{
+    int                    is_hs;
+    uint64_t               frame_ticks;
+
+    // Frame index from SOFs (HS repeats each frame number 8 times)
+    uint64_t               sofs;
+    uint64_t               frame;
+    uint64_t               sof_time;
+    uint16_t               sof_frame;
+    int                    sof_phase;
+    int                    sof_synced;  // Microframe phase known
+    uint64_t               sof_gaps;    // Frames missing from SOF sequence
+
+    // Allocated on first token for an endpoint
+    struct sched_endpoint *eps[SNOOP_SLOTS];
+
+    // Endpoint descriptors seen during enumeration
+    tDescriptorSnoop       snoop;
+};
+
+//-----------------------------------------------------------------
+// schedule_create: speed = capture tUsbSpeed (NULL if out of memory)
+//-----------------------------------------------------------------
+tScheduleStats* schedule_create(int speed)
+{
+    tScheduleStats *sched = (tScheduleStats *)calloc(1, sizeof(tScheduleStats));
+
+    if (!sched)
+    {
+        fprintf(stderr, "ERROR: Out of memory\n");
+        return NULL;
+    }
+
+    sched->is_hs       = (speed == USB_SPEED_HS);
+    sched->frame_ticks = sched->is_hs ? TICKS_PER_HS_UFRAME : TICKS_PER_FSLS_FRAME;
+    descriptor_snoop_init(&sched->snoop);
+    return sched;
+}
+//-----------------------------------------------------------------
+// schedule_sof: Advance frame index, counting frames the SOF
+// sequence skipped
+//-----------------------------------------------------------------
+static void schedule_sof(tScheduleStats *sched, const tLogRecord *rec)
+{
+    uint16_t frame = usb_get_sof_frame(rec->value);
+    int      reps  = sched->is_hs ? 8 : 1;
+    uint64_t advance;
+
+    if (sched->sofs++ == 0)
+    {
+        sched->sof_frame = frame;
+        sched->sof_phase = 0;
+    }
+    else if (frame == sched->sof_frame)
+    {
+        sched->frame++;
+        sched->sof_phase++;
+    }
+    else
+    {
+        advance = ((frame - sched->sof_frame) & LOG_SOF_FRAME_MASK) * reps - sched->sof_phase;
+
+        // Microframe phase is only known after the first frame change
+        if (!sched->sof_synced && sched->is_hs)
+            advance = 1;
+        else if (advance > 1)
+            sched->sof_gaps += advance - 1;
+
+        sched->frame     += advance;
+        sched->sof_frame  = frame;
+        sched->sof_phase  = 0;
+        sched->sof_synced = 1;
+    }
+
+    sched->sof_time = rec->time;
+}
+//-----------------------------------------------------------------
+// schedule_poll: Token to a non-control endpoint
+//-----------------------------------------------------------------
+static int schedule_poll(tScheduleStats *sched, const tLogRecord *rec)
+{
+    int slot = SNOOP_SLOT(rec->device, rec->endpoint, rec->pid == PID_IN);
+    struct sched_endpoint *ep = sched->eps[slot];
+    uint64_t frame;
+    uint64_t offset;
+
+    if (!ep)
+    {
+        ep = (struct sched_endpoint *)calloc(1, sizeof(struct sched_endpoint));
+        if (!ep)
+        {
+            fprintf(stderr, "ERROR: Out of memory\n");
+            return -1;
+        }
+        latency_hist_init(&ep->gap);
+        latency_hist_init(&ep->offset);
+        latency_hist_init(&ep->jitter);
+        sched->eps[slot] = ep;
+    }
+
+    // Without SOFs (-s) fall back to the frame grid of the bus time
+    if (sched->sofs)
+    {
+        uint64_t since = (rec->time > sched->sof_time) ? (rec->time - sched->sof_time) : 0;
+        frame  = sched->frame + since / sched->frame_ticks;
+        offset = since % sched->frame_ticks;
+    }
+    else
+    {
+        frame  = rec->time / sched->frame_ticks;
+        offset = rec->time % sched->frame_ticks;
+    }
+
+    if (ep->polls++ && frame == ep->last_frame)
+    {
+        ep->extra++;
+        return 0;
+    }
+
+    if (ep->polls > 1)
+    {
+        latency_hist_add(&ep->gap, frame - ep->last_frame);
+        latency_hist_add(&ep->jitter, (offset > ep->last_offset) ? (offset - ep->last_offset) : (ep->last_offset - offset));
+    }
+    latency_hist_add(&ep->offset, offset);
+
+    ep->last_frame  = frame;
+    ep->last_offset = offset;
+    return 0;
+}
+//-----------------------------------------------------------------
+// schedule_add: Feed next record
+//-----------------------------------------------------------------
+int schedule_add(tScheduleStats *sched, const tLogRecord *rec)
+{
+    descriptor_snoop_add(&sched->snoop, rec);
+
+    if (rec->type == LOG_CTRL_TYPE_SOF)
+        schedule_sof(sched, rec);
+    else if (rec->type == LOG_CTRL_TYPE_TOKEN && rec->endpoint != 0 &&
+             (rec->pid == PID_IN || rec->pid == PID_OUT))
+        return schedule_poll(sched, rec);
+
+    return 0;
+}
+//-----------------------------------------------------------------
+// schedule_mode: Most common gap (expected interval if undescribed),
+// count = number of gaps of that length
+//-----------------------------------------------------------------
+static uint64_t schedule_mode(const tLatencyHist *h, uint64_t *count)
+{
+    uint64_t best = 0;
+    uint64_t value;
+    int idx = 0;
+    int i;
+
+    for (i=0;i<LATENCY_BUCKETS;i++)
+        if (h->buckets[i] > best)
+        {
+            best = h->buckets[i];
+            idx  = i;
+        }
+
+    // Bucket midpoint, kept within the gaps actually seen
+    value = latency_hist_bucket_value(idx);
+    if (value < h->min)
+        value = h->min;
+    if (value > h->max)
+        value = h->max;
+
+    *count = best;
+    return value;
+}
+//-----------------------------------------------------------------
+// schedule_missed: Service opportunities skipped for an interval
+//-----------------------------------------------------------------
+static uint64_t schedule_missed(const tLatencyHist *h, uint64_t interval)
+{
+    uint64_t missed = 0;
+    uint64_t value;
+    int i;
+
+    for (i=0;i<LATENCY_BUCKETS;i++)
+    {
+        if (!h->buckets[i])
+            continue;
+
+        value = latency_hist_bucket_value(i);
+        if (value >= 2 * interval)
+            missed += h->buckets[i] * (value / interval - 1);
+    }
+
+    return missed;
+}
+//-----------------------------------------------------------------
+// schedule_interval: Frames between service opportunities from
+// bInterval (FS / LS interrupt is linear, the rest 2^(n-1))
+//-----------------------------------------------------------------
+static uint64_t schedule_interval(tScheduleStats *sched, const tSnoopEndpoint *desc)
+{
+    int binterval = desc->interval;
+
+    if (binterval < 1)
+        binterval = 1;
+
+    if (!sched->is_hs && (desc->attributes & 0x3) == SNOOP_EP_INTERRUPT)
+        return binterval;
+
+    return 1ULL << ((binterval > 16 ? 16 : binterval) - 1);
+}
+//-----------------------------------------------------------------
+// schedule_report: Interval, missed frames and SOF relative jitter
+// of each periodic endpoint. Endpoints without a descriptor are
+// shown if they look periodic (at most one token per frame, mostly
+// at the same interval).
+//-----------------------------------------------------------------
+void schedule_report(FILE *f, tScheduleStats *sched)
+{
+    double us = TICKS_PER_SEC / 1e6;
+    const char *unit = sched->is_hs ? "uframes" : "frames";
+    int header = 0;
+    int slot;
+
+    for (slot=0;slot<SNOOP_SLOTS;slot++)
+    {
+        struct sched_endpoint *ep = sched->eps[slot];
+        const tSnoopEndpoint *desc = &sched->snoop.ep[slot];
+        uint64_t interval;
+        uint64_t missed;
+        const char *type;
+
+        if (!ep || ep->gap.count == 0)
+            continue;
+
+        if (desc->valid && (desc->attributes & 0x3) != SNOOP_EP_ISO && (desc->attributes & 0x3) != SNOOP_EP_INTERRUPT)
+            continue;
+
+        if (desc->valid)
+        {
+            interval = schedule_interval(sched, desc);
+            type     = ((desc->attributes & 0x3) == SNOOP_EP_ISO) ? "ISO" : "INT";
+        }
+        else
+        {
+            uint64_t regular;
+
+            // Bulk style traffic: several tokens a frame or no usual gap
+            interval = schedule_mode(&ep->gap, &regular);
+            if (ep->extra * 100 > ep->polls || regular * 2 < ep->gap.count)
+                continue;
+
+            type     = "?";
+        }
+
+        if (!header)
+        {
+            fprintf(f, "  Periodic endpoints (%llu SOFs, %llu %s missing):\n",
+                    (unsigned long long)sched->sofs, (unsigned long long)sched->sof_gaps, unit);
+            header = 1;
+        }
+
+        missed = schedule_missed(&ep->gap, interval);
+
+        fprintf(f, "    dev %3d ep %2d %-3s %-3s every %5llu %-7s polls %-9llu gap p50 %llu p99 %llu max %llu  missed %llu (%.1f%%)  "
+                   "at +%.3f us  jitter p99 %.3f max %.3f us\n",
+                slot / 32, (slot / 2) % 16, (slot & 1) ? "IN" : "OUT", type,
+                (unsigned long long)interval, unit, (unsigned long long)ep->polls,
+                (unsigned long long)latency_hist_percentile(&ep->gap, 50.0),
+                (unsigned long long)latency_hist_percentile(&ep->gap, 99.0),
+                (unsigned long long)ep->gap.max,
+                (unsigned long long)missed, missed * 100.0 / (missed + ep->gap.count + 1),
+                latency_hist_percentile(&ep->offset, 50.0) / us,
+                latency_hist_percentile(&ep->jitter, 99.0) / us, ep->jitter.max / us);
+    }
+}
+//-----------------------------------------------------------------
+// schedule_destroy
+//-----------------------------------------------------------------
+void schedule_destroy(tScheduleStats *sched)
+{
+    int slot;
+
+    for (slot=0;slot<SNOOP_SLOTS;slot++)
+        free(sched->eps[slot]);
+
+    free(sched);
+}
@@ -0,0 +1,25 @@
+#ifndef __SCHEDULE_H__
+#define __SCHEDULE_H__
+
+//--------------------------------------------------------------------
+// Structures
+//--------------------------------------------------------------------
+typedef struct schedule_stats tScheduleStats;
+
+//--------------------------------------------------------------------
+// Prototypes
+//--------------------------------------------------------------------
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+tScheduleStats* schedule_create(int speed);
+int             schedule_add(tScheduleStats *sched, const tLogRecord *rec);
+void            schedule_report(FILE *f, tScheduleStats *sched);
+void            schedule_destroy(tScheduleStats *sched);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,521 @@
+//-----------------------------------------------------------------
+//                       USB Sniffer
+//                           V0.1
+//                     Ultra-Embedded.com
+//                       Copyright 2015
+//
+//               Email: admin@ultra-embedded.com
+//
+//                       License: LGPL
+//-----------------------------------------------------------------
+//
+// Copyright (C) 2011 - 2013 Ultra-Embedded.com
+//
+// This source file may be used and distributed without         
+// restriction provided that this copyright statement is not    
+// removed from the file and that any derivative work contains  
+// the original copyright notice and the associated disclaimer. 
+//
+// This source file is free software; you can redistribute it   
+// and/or modify it under the terms of the GNU Lesser General   
+// Public License as published by the Free Software Foundation; 
+// either version 2.1 of the License, or (at your option) any   
+// later version.
+//
+// This source is distributed in the hope that it will be       
+// useful, but WITHOUT ANY WARRANTY; without even the implied   
+// warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR      
+// PURPOSE.  See the GNU Lesser General Public License for more 
+// details.
+//
+// You should have received a copy of the GNU Lesser General    
+// Public License along with this source; if not, write to the 
+// Free Software Foundation, Inc., 59 Temple Place, Suite 330, 
+// Boston, MA  02111-1307  USA
+//-----------------------------------------------------------------
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <assert.h>
+
+#include "usb_defs.h"
+#include "log_format.h"
+#include "log_decode.h"
+#include "capture_filter.h"
+#include "transaction.h"
+#include "latency.h"
+#include "class_decoder.h"
+#include "storage_decoder.h"
+
+//-----------------------------------------------------------------
+// Defines
+//-----------------------------------------------------------------
+// Bulk-Only Transport wrappers
+#define BOT_CBW_SIGNATURE       0x43425355  // "USBC"
+#define BOT_CSW_SIGNATURE       0x53425355  // "USBS"
+#define BOT_CBW_LENGTH          31
+#define BOT_CSW_LENGTH          13
+
+#define BOT_CSW_PASSED          0
+#define BOT_CSW_FAILED          1
+#define BOT_CSW_PHASE_ERROR     2
+
+// Mass storage, SCSI transparent command set, Bulk-Only Transport
+#define STORAGE_CLASS           0x08
+#define STORAGE_SUBCLASS_SCSI   0x06
+#define STORAGE_PROTOCOL_BOT    0x50
+
+// Completed commands kept to place data delivered after the CSW
+// (a data phase of whole packets only ends with the next CBW)
+#define STORAGE_HISTORY         32
+
+// Queue depth histogram size (last entry counts deeper queues)
+#define STORAGE_DEPTHS          8
+
+//-----------------------------------------------------------------
+// Structures
+//-----------------------------------------------------------------
+// Command between its CBW and CSW
+struct storage_cmd
+{
+    int      valid;
+    uint8_t  device;
+    uint8_t  opcode;
+    uint8_t  dir;           // PID_IN = data to host
+    uint32_t tag;
+    uint32_t length;        // dCBWDataTransferLength
+    uint64_t start;         // CBW time
+    uint64_t end;           // CSW time (completed commands)
+    uint64_t bytes;         // Data phase bytes seen
+};
+
+// Totals per SCSI opcode
+struct storage_opcode
+{
+    tLatencyHist latency;   // CBW to CSW (ticks)
+    uint64_t     bytes;
+    uint64_t     busy;      // Sum of latencies (ticks)
+    uint64_t     failed;
+    uint64_t     phase_errors;
+};
+
+struct storage_timeline
+{
+    uint64_t read;
+    uint64_t write;
+};
+
+struct storage_decoder
+{
+    struct storage_cmd      cmds[STORAGE_OUTSTANDING];
+    int                     outstanding;
+    struct storage_cmd      done[STORAGE_HISTORY];
+    int                     done_next;
+    struct storage_opcode  *ops[256];
+
+    // Queue behaviour
+    uint64_t                depth[STORAGE_DEPTHS];  // Outstanding at each CBW
+    tLatencyHist            idle;                   // CSW to next CBW (ticks)
+    uint64_t                last_csw;               // 0 = none
+
+    uint64_t                evicted;        // CBWs dropped, table full
+    uint64_t                orphan_csw;     // CSW without its CBW
+    uint64_t                orphan_data;    // Data outside any command
+
+    // Throughput by time, bucket width doubles when full
+    int                     started;
+    uint64_t                first_time;
+    uint64_t                bucket_ticks;
+    int                     buckets;
+    struct storage_timeline timeline[STORAGE_TIMELINE_MAX];
+};
+
+//-----------------------------------------------------------------
+// storage_get32: Little endian word
+//-----------------------------------------------------------------
+static uint32_t storage_get32(const uint8_t *p)
+{
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+//-----------------------------------------------------------------
+// storage_opcode_str
+//-----------------------------------------------------------------
+static const char* storage_opcode_str(int opcode)
+{
+    switch (opcode)
+    {
+        case 0x00: return "TEST_UNIT_READY";
+        case 0x03: return "REQUEST_SENSE";
+        case 0x12: return "INQUIRY";
+        case 0x1A: return "MODE_SENSE(6)";
+        case 0x1B: return "START_STOP_UNIT";
+        case 0x1E: return "PREVENT_ALLOW";
+        case 0x23: return "READ_FORMAT_CAP";
+        case 0x25: return "READ_CAPACITY(10)";
+        case 0x28: return "READ(10)";
+        case 0x2A: return "WRITE(10)";
+        case 0x2F: return "VERIFY(10)";
+        case 0x35: return "SYNC_CACHE(10)";
+        case 0x5A: return "MODE_SENSE(10)";
+        case 0x88: return "READ(16)";
+        case 0x8A: return "WRITE(16)";
+        case 0x9E: return "READ_CAPACITY(16)";
+        case 0xA0: return "REPORT_LUNS";
+        case 0xA8: return "READ(12)";
+        case 0xAA: return "WRITE(12)";
+        default:   return NULL;
+    }
+}
+//-----------------------------------------------------------------
+// storage_create: args = timeline resolution in ms
+//-----------------------------------------------------------------
+static void* storage_create(const char *args)
+{
+    struct storage_decoder *sd;
+    int ms = args ? atoi(args) : STORAGE_DEF_BUCKET_MS;
+
+    if (ms <= 0)
+    {
+        fprintf(stderr, "ERROR: storage timeline resolution must be > 0 ms\n");
+        return NULL;
+    }
+
+    sd = (struct storage_decoder *)calloc(1, sizeof(struct storage_decoder));
+    assert(sd);
+
+    sd->bucket_ticks = (uint64_t)ms * (TICKS_PER_SEC / 1000);
+    latency_hist_init(&sd->idle);
+    return sd;
+}
+//-----------------------------------------------------------------
+// storage_subscribe: Mass storage bulk endpoints, or any bulk
+// endpoint not described (wrappers are recognised by signature)
+//-----------------------------------------------------------------
+static int storage_subscribe(void *inst, const tDecoderEndpoint *ep)
+{
+    if (ep->endpoint == 0)
+        return 0;
+
+    if (!ep->described)
+        return 1;
+
+    return ep->iface_class == STORAGE_CLASS && (ep->attributes & 0x3) == 2;
+}
+//-----------------------------------------------------------------
+// storage_account: Add data bytes to the throughput timeline
+//-----------------------------------------------------------------
+static void storage_account(struct storage_decoder *sd, uint64_t time, uint32_t bytes, int read)
+{
+    uint64_t idx;
+    int i;
+
+    if (!sd->started)
+    {
+        sd->started    = 1;
+        sd->first_time = time;
+    }
+
+    idx = (time > sd->first_time) ? (time - sd->first_time) / sd->bucket_ticks : 0;
+
+    // Halve the resolution until the capture so far fits
+    while (idx >= STORAGE_TIMELINE_MAX)
+    {
+        for (i=0;i<STORAGE_TIMELINE_MAX / 2;i++)
+        {
+            sd->timeline[i].read  = sd->timeline[2*i].read  + sd->timeline[2*i+1].read;
+            sd->timeline[i].write = sd->timeline[2*i].write + sd->timeline[2*i+1].write;
+        }
+        memset(&sd->timeline[STORAGE_TIMELINE_MAX / 2], 0, sizeof(sd->timeline) / 2);
+
+        sd->bucket_ticks *= 2;
+        sd->buckets       = (sd->buckets + 1) / 2;
+        idx /= 2;
+    }
+
+    if (read)
+        sd->timeline[idx].read += bytes;
+    else
+        sd->timeline[idx].write += bytes;
+
+    if ((int)idx >= sd->buckets)
+        sd->buckets = (int)idx + 1;
+}
+//-----------------------------------------------------------------
+// storage_find: Outstanding command of device by tag
+//-----------------------------------------------------------------
+static struct storage_cmd* storage_find(struct storage_decoder *sd, uint8_t device, uint32_t tag)
+{
+    int i;
+
+    for (i=0;i<STORAGE_OUTSTANDING;i++)
+        if (sd->cmds[i].valid && sd->cmds[i].device == device && sd->cmds[i].tag == tag)
+            return &sd->cmds[i];
+
+    return NULL;
+}
+//-----------------------------------------------------------------
+// storage_cbw: Command block wrapper, open command
+//-----------------------------------------------------------------
+static void storage_cbw(struct storage_decoder *sd, uint8_t device, uint64_t time, const uint8_t *p)
+{
+    struct storage_cmd *cmd = storage_find(sd, device, storage_get32(p + 4));
+    int i;
+
+    // Tag reused: previous command never completed
+    if (cmd)
+    {
+        cmd->valid = 0;
+        sd->outstanding--;
+    }
+
+    sd->depth[(sd->outstanding < STORAGE_DEPTHS - 1) ? sd->outstanding : (STORAGE_DEPTHS - 1)]++;
+    if (sd->last_csw && time >= sd->last_csw && !sd->outstanding)
+        latency_hist_add(&sd->idle, time - sd->last_csw);
+
+    for (i=0;i<STORAGE_OUTSTANDING;i++)
+        if (!sd->cmds[i].valid)
+        {
+            cmd = &sd->cmds[i];
+            break;
+        }
+
+    // Table full: drop the oldest
+    if (!cmd)
+    {
+        cmd = &sd->cmds[0];
+        for (i=1;i<STORAGE_OUTSTANDING;i++)
+            if (sd->cmds[i].start < cmd->start)
+                cmd = &sd->cmds[i];
+
+        sd->evicted++;
+        sd->outstanding--;
+    }
+
+    cmd->valid  = 1;
+    cmd->device = device;
+    cmd->tag    = storage_get32(p + 4);
+    cmd->length = storage_get32(p + 8);
+    cmd->dir    = (p[12] & 0x80) ? PID_IN : PID_OUT;
+    cmd->opcode = p[15];
+    cmd->start  = time;
+    cmd->end    = 0;
+    cmd->bytes  = 0;
+    sd->outstanding++;
+}
+//-----------------------------------------------------------------
+// storage_csw: Command status wrapper, complete command
+//-----------------------------------------------------------------
+static void storage_csw(struct storage_decoder *sd, uint8_t device, uint64_t time, const uint8_t *p)
+{
+    struct storage_cmd *cmd = storage_find(sd, device, storage_get32(p + 4));
+    struct storage_opcode *op;
+    uint64_t latency;
+
+    if (!cmd)
+    {
+        sd->orphan_csw++;
+        return;
+    }
+
+    op = sd->ops[cmd->opcode];
+    if (!op)
+    {
+        op = sd->ops[cmd->opcode] = (struct storage_opcode *)calloc(1, sizeof(struct storage_opcode));
+        assert(op);
+        latency_hist_init(&op->latency);
+    }
+
+    latency = (time > cmd->start) ? (time - cmd->start) : 0;
+    latency_hist_add(&op->latency, latency);
+    op->bytes += cmd->bytes;
+    op->busy  += latency;
+
+    if (p[12] == BOT_CSW_FAILED)
+        op->failed++;
+    else if (p[12] == BOT_CSW_PHASE_ERROR)
+        op->phase_errors++;
+
+    cmd->end   = time;
+    sd->done[sd->done_next] = *cmd;
+    sd->done_next = (sd->done_next + 1) % STORAGE_HISTORY;
+
+    cmd->valid = 0;
+    sd->outstanding--;
+    sd->last_csw = time;
+}
+//-----------------------------------------------------------------
+// storage_data: Data phase packet, belongs to the latest command of
+// the device started before it (open, or completed after it)
+//-----------------------------------------------------------------
+static void storage_data(struct storage_decoder *sd, uint8_t device, uint8_t dir, const tDecoderPacket *pkt)
+{
+    struct storage_cmd *cmd = NULL;
+    int i;
+
+    for (i=0;i<STORAGE_OUTSTANDING;i++)
+    {
+        struct storage_cmd *c = &sd->cmds[i];
+
+        if (c->valid && c->device == device && c->start <= pkt->time && (!cmd || c->start > cmd->start))
+            cmd = c;
+    }
+
+    for (i=0;i<STORAGE_HISTORY;i++)
+    {
+        struct storage_cmd *c = &sd->done[i];
+
+        if (c->valid && c->device == device && c->start <= pkt->time && pkt->time <= c->end &&
+            (!cmd || c->start > cmd->start))
+            cmd = c;
+    }
+
+    if (!cmd || cmd->dir != dir)
+    {
+        sd->orphan_data++;
+        return;
+    }
+
+    // Completed commands have already been added to their opcode
+    if (cmd->end)
+        sd->ops[cmd->opcode]->bytes += pkt->length;
+    else
+        cmd->bytes += pkt->length;
+
+    storage_account(sd, pkt->time, pkt->length, dir == PID_IN);
+}
+//-----------------------------------------------------------------
+// storage_decode: Wrappers may share a transfer with data (a CSW
+// after a data phase of whole packets), so look at every packet
+//-----------------------------------------------------------------
+static int storage_decode(void *inst, const tDecoderTransfer *xfers, int count)
+{
+    struct storage_decoder *sd = (struct storage_decoder *)inst;
+    int i;
+    uint32_t j;
+
+    for (i=0;i<count;i++)
+    {
+        const tDecoderTransfer *x = &xfers[i];
+
+        for (j=0;j<x->packets;j++)
+        {
+            const tDecoderPacket *pkt = &x->packet[j];
+            const uint8_t *p = x->data + pkt->offset;
+
+            if (pkt->flags & TXN_FLAG_CRC_ERROR)
+                continue;
+
+            if (x->dir == PID_OUT && pkt->length == BOT_CBW_LENGTH && storage_get32(p) == BOT_CBW_SIGNATURE)
+                storage_cbw(sd, x->device, pkt->time, p);
+            else if (x->dir == PID_IN && pkt->length == BOT_CSW_LENGTH && storage_get32(p) == BOT_CSW_SIGNATURE)
+                storage_csw(sd, x->device, pkt->time, p);
+            else if (pkt->length)
+                storage_data(sd, x->device, x->dir, pkt);
+        }
+    }
+
+    return 0;
+}
+//-----------------------------------------------------------------
+// storage_report: Per opcode latency / throughput, queueing and
+// throughput timeline
+//-----------------------------------------------------------------
+static void storage_report(void *inst, FILE *f)
+{
+    struct storage_decoder *sd = (struct storage_decoder *)inst;
+    double us = TICKS_PER_SEC / 1e6;
+    uint64_t commands = 0;
+    int i;
+
+    for (i=0;i<256;i++)
+    {
+        struct storage_opcode *op = sd->ops[i];
+        const char *name = storage_opcode_str(i);
+        char unknown[16];
+
+        if (!op)
+            continue;
+
+        if (!name)
+        {
+            snprintf(unknown, sizeof(unknown), "OPCODE_%02X", i);
+            name = unknown;
+        }
+
+        commands += op->latency.count;
+        fprintf(f, "  %-18s n=%-8llu p50 %9.1f  p99 %9.1f  max %9.1f us  %10.3f MB  %8.3f MB/s busy",
+                name, (unsigned long long)op->latency.count,
+                latency_hist_percentile(&op->latency, 50.0) / us,
+                latency_hist_percentile(&op->latency, 99.0) / us,
+                op->latency.max / us, op->bytes / 1e6,
+                op->busy ? (op->bytes / 1e6) / ((double)op->busy / TICKS_PER_SEC) : 0.0);
+        if (op->failed || op->phase_errors)
+            fprintf(f, "  failed %llu phase errors %llu",
+                    (unsigned long long)op->failed, (unsigned long long)op->phase_errors);
+        fprintf(f, "\n");
+    }
+
+    if (!commands)
+        return;
+
+    fprintf(f, "  Queue depth at CBW:");
+    for (i=0;i<STORAGE_DEPTHS;i++)
+        if (sd->depth[i])
+            fprintf(f, " %d%s=%llu", i, (i == STORAGE_DEPTHS - 1) ? "+" : "", (unsigned long long)sd->depth[i]);
+    fprintf(f, "\n");
+
+    if (sd->idle.count)
+        fprintf(f, "  Idle CSW->CBW: p50 %.1f  p99 %.1f  max %.1f us\n",
+                latency_hist_percentile(&sd->idle, 50.0) / us,
+                latency_hist_percentile(&sd->idle, 99.0) / us, sd->idle.max / us);
+
+    if (sd->evicted || sd->orphan_csw || sd->orphan_data)
+        fprintf(f, "  Unpaired: %llu CBWs dropped, %llu CSWs, %llu data packets\n",
+                (unsigned long long)sd->evicted, (unsigned long long)sd->orphan_csw,
+                (unsigned long long)sd->orphan_data);
+
+    fprintf(f, "  Throughput (%.3fs buckets):\n", (double)sd->bucket_ticks / TICKS_PER_SEC);
+    for (i=0;i<sd->buckets;i++)
+    {
+        double secs = (double)sd->bucket_ticks / TICKS_PER_SEC;
+
+        if (!sd->timeline[i].read && !sd->timeline[i].write)
+            continue;
+
+        fprintf(f, "    %12.6f  read %9.3f MB/s  write %9.3f MB/s\n",
+                (double)(sd->first_time + i * sd->bucket_ticks) / TICKS_PER_SEC,
+                sd->timeline[i].read / 1e6 / secs, sd->timeline[i].write / 1e6 / secs);
+    }
+}
+//-----------------------------------------------------------------
+// storage_destroy
+//-----------------------------------------------------------------
+static void storage_destroy(void *inst)
+{
+    struct storage_decoder *sd = (struct storage_decoder *)inst;
+    int i;
+
+    for (i=0;i<256;i++)
+        free(sd->ops[i]);
+
+    free(sd);
+}
+//-----------------------------------------------------------------
+// storage_decoder: Mass storage Bulk-Only Transport analyzer
+//-----------------------------------------------------------------
+const tClassDecoder* storage_decoder(void)
+{
+    static const tClassDecoder dec =
+    {
+        CLASS_DECODER_VERSION,
+        "storage",
+        storage_create,
+        storage_subscribe,
+        storage_decode,
+        storage_report,
+        storage_destroy
+    };
+
+    return &dec;
+}
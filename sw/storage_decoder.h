@@ -0,0 +1,27 @@
+#ifndef __STORAGE_DECODER_H__
+#define __STORAGE_DECODER_H__
+
+//--------------------------------------------------------------------
+// Defines
+//--------------------------------------------------------------------
+// Commands awaiting their status wrapper (memory bound)
+#define STORAGE_OUTSTANDING     32
+
+// Throughput timeline buckets; the bucket width doubles when full
+#define STORAGE_TIMELINE_MAX    512
+#define STORAGE_DEF_BUCKET_MS   100
+
+//--------------------------------------------------------------------
+// Prototypes
+//--------------------------------------------------------------------
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+const tClassDecoder* storage_decoder(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,123 @@
+#ifndef __TEST_COMMON_H__
+#define __TEST_COMMON_H__
+
+//--------------------------------------------------------------------
+// Test helpers: build dense record streams and check results
+//--------------------------------------------------------------------
+static int _test_failed = 0;
+
+#define TEST_CHECK(cond) \
+    do { if (!(cond)) { fprintf(stderr, "FAIL: %s:%d: %s\n", __FILE__, __LINE__, #cond); _test_failed = 1; } } while (0)
+
+typedef struct
+{
+    uint32_t *words;
+    uint32_t  count;
+    uint32_t  size;
+} tTestStream;
+
+//-----------------------------------------------------------------
+// test_put: Append a dense word
+//-----------------------------------------------------------------
+static void test_put(tTestStream *s, uint32_t value)
+{
+    if (s->count == s->size)
+    {
+        s->size  = s->size ? s->size * 2 : 65536;
+        s->words = (uint32_t *)realloc(s->words, s->size * sizeof(uint32_t));
+    }
+    s->words[s->count++] = value;
+}
+//-----------------------------------------------------------------
+// test_ctrl: Control word with cycle delta (ticks)
+//-----------------------------------------------------------------
+static uint32_t test_ctrl(int type, int cycle)
+{
+    return ((uint32_t)type << LOG_CTRL_TYPE_L) | ((((uint32_t)cycle >> 8) & LOG_CTRL_CYCLE_MASK) << LOG_CTRL_CYCLE_L);
+}
+//-----------------------------------------------------------------
+// test_sof: Start of frame
+//-----------------------------------------------------------------
+static void test_sof(tTestStream *s, int frame)
+{
+    test_put(s, test_ctrl(LOG_CTRL_TYPE_SOF, 0) | (frame & LOG_SOF_FRAME_MASK));
+}
+//-----------------------------------------------------------------
+// test_token: IN / OUT / SETUP token to device / endpoint
+//-----------------------------------------------------------------
+static void test_token(tTestStream *s, int pid, int dev, int ep, int cycle)
+{
+    uint32_t data = (dev & 0x7F) | ((ep & 0xF) << 7);
+
+    test_put(s, test_ctrl(LOG_CTRL_TYPE_TOKEN, cycle) | (data << LOG_TOKEN_DATA_L) | (pid & 0xF));
+}
+//-----------------------------------------------------------------
+// test_hshake: Handshake (ACK / NAK / STALL)
+//-----------------------------------------------------------------
+static void test_hshake(tTestStream *s, int pid, int cycle)
+{
+    test_put(s, test_ctrl(LOG_CTRL_TYPE_HSHAKE, cycle) | (pid & 0xF));
+}
+//-----------------------------------------------------------------
+// test_data: Data packet (CRC appended, corrupted if bad_crc)
+//-----------------------------------------------------------------
+static void test_data(tTestStream *s, int pid, const uint8_t *data, int len, int cycle, int bad_crc)
+{
+    uint8_t buf[MAX_PACKET_SIZE + 2];
+    uint16_t crc = usb_crc16(data, len) ^ (bad_crc ? 1 : 0);
+    uint32_t w;
+    int i;
+    int j;
+
+    memcpy(buf, data, len);
+    buf[len++] = crc & 0xFF;
+    buf[len++] = crc >> 8;
+
+    test_put(s, test_ctrl(LOG_CTRL_TYPE_DATA, cycle) | ((uint32_t)len << LOG_DATA_LEN_L) | (pid & 0xF));
+    for (i=0;i<len;i+=4)
+    {
+        w = 0;
+        for (j=0;j<4 && (i+j)<len;j++)
+            w |= (uint32_t)buf[i+j] << (8*j);
+        test_put(s, w);
+    }
+}
+//-----------------------------------------------------------------
+// test_capture_file: Write stream out as a capture to filename (a
+// temporary file if NULL), rewound ready to open for reading
+//-----------------------------------------------------------------
+static FILE *test_capture_file(const char *filename, const tTestStream *s, int flags)
+{
+    tCaptureFile *cap;
+    FILE *f = filename ? fopen(filename, "w+b") : tmpfile();
+
+    if (!f)
+        return NULL;
+
+    cap = capture_file_create(f, USB_SPEED_HS, CAPTURE_CODEC_NONE, flags, NULL);
+    if (!cap || capture_file_write(cap, s->words, s->count) != 0 || capture_file_close(cap) != 0)
+    {
+        fclose(f);
+        return NULL;
+    }
+
+    rewind(f);
+    return f;
+}
+//-----------------------------------------------------------------
+// test_capture: Write stream out as a temporary capture
+//-----------------------------------------------------------------
+static FILE *test_capture(const tTestStream *s, int flags)
+{
+    return test_capture_file(NULL, s, flags);
+}
+//-----------------------------------------------------------------
+// test_result: Report and exit code
+//-----------------------------------------------------------------
+static int test_result(const char *name)
+{
+    printf("%s: %s\n", name, _test_failed ? "FAIL" : "PASS");
+    return _test_failed ? 1 : 0;
+}
+
+#endif
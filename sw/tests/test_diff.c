@@ -0,0 +1,187 @@
+//-----------------------------------------------------------------
+//                       USB Sniffer
+//                           V0.1
+//                     Ultra-Embedded.com
+//                       Copyright 2015
+//
+//               Email: admin@ultra-embedded.com
+//
+//                       License: LGPL
+//-----------------------------------------------------------------
+//
+// Copyright (C) 2011 - 2013 Ultra-Embedded.com
+//
+// This source file may be used and distributed without         
+// restriction provided that this copyright statement is not    
+// removed from the file and that any derivative work contains  
+// the original copyright notice and the associated disclaimer. 
+//
+// This source file is free software; you can redistribute it   
+// and/or modify it under the terms of the GNU Lesser General   
+// Public License as published by the Free Software Foundation; 
+// either version 2.1 of the License, or (at your option) any   
+// later version.
+//
+// This source is distributed in the hope that it will be       
+// useful, but WITHOUT ANY WARRANTY; without even the implied   
+// warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR      
+// PURPOSE.  See the GNU Lesser General Public License for more 
+// details.
+//
+// You should have received a copy of the GNU Lesser General    
+// Public License along with this source; if not, write to the 
+// Free Software Foundation, Inc., 59 Temple Place, Suite 330, 
+// Boston, MA  02111-1307  USA
+//-----------------------------------------------------------------
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+
+#include "log_format.h"
+#include "usb_defs.h"
+#include "usb_helpers.h"
+#include "usb_sniffer.h"
+#include "log_decode.h"
+#include "capture_filter.h"
+#include "payload_store.h"
+#include "capture_file.h"
+#include "capture_codec.h"
+#include "capture_slice.h"
+#include "transaction.h"
+#include "txn_cache.h"
+#include "txn_diff.h"
+#include "test_common.h"
+
+#define TEST_FULL           "test_diff_full.cap"
+#define TEST_SLICE          "test_diff_slice.cap"
+#define TEST_OTHER          "test_diff_other.cap"
+
+//-----------------------------------------------------------------
+// make_capture: Interrupt IN every 1ms frame for seconds, payload
+// from seed + transaction number (period of 256 if mask is 0xFF)
+//-----------------------------------------------------------------
+static int make_capture(const char *filename, int seconds, uint32_t seed, uint32_t mask)
+{
+    tTestStream s;
+    uint8_t payload[8];
+    uint32_t v;
+    FILE *f;
+    int uf;
+    int n = 0;
+
+    memset(&s, 0, sizeof(s));
+    for (uf=0;uf<seconds * 8000;uf++)
+    {
+        test_sof(&s, uf / 8);
+        if (uf % 8)
+            continue;
+
+        v = (seed + n) & mask;
+        v = v * 2654435761u;
+        memcpy(payload, &v, 4);
+        memcpy(payload + 4, &v, 4);
+
+        test_token(&s, PID_IN, 3, 1, 1024);
+        test_data(&s, (n & 1) ? PID_DATA1 : PID_DATA0, payload, sizeof(payload), 512, 0);
+        test_hshake(&s, PID_ACK, 256);
+        n++;
+    }
+
+    f = test_capture_file(filename, &s, 0);
+    free(s.words);
+    if (!f)
+        return -1;
+
+    fclose(f);
+    return 0;
+}
+//-----------------------------------------------------------------
+// run_diff: Diff two captures, count output lines starting with each
+// mark and whether a hunk was left unaligned
+//-----------------------------------------------------------------
+static int64_t run_diff(const char *file_a, const char *file_b, int *removed, int *added, int *changed, int *unaligned)
+{
+    tCaptureFilter all;
+    char line[256];
+    tTxnCache *a;
+    tTxnCache *b;
+    int64_t res;
+    FILE *f;
+
+    *removed = *added = *changed = *unaligned = 0;
+
+    a = txn_cache_open(file_a);
+    b = txn_cache_open(file_b);
+    f = tmpfile();
+    if (!a || !b || !f)
+        return -1;
+
+    capture_filter_init(&all);
+    res = txn_diff(f, a, b, &all);
+
+    rewind(f);
+    while (fgets(line, sizeof(line), f))
+    {
+        *removed += line[0] == '-';
+        *added   += line[0] == '+';
+        *changed += line[0] == '~';
+        if (strstr(line, "@@ unaligned"))
+            *unaligned = 1;
+    }
+
+    fclose(f);
+    txn_cache_close(a);
+    txn_cache_close(b);
+    return res;
+}
+//-----------------------------------------------------------------
+// cleanup: Remove captures and their sidecars
+//-----------------------------------------------------------------
+static void cleanup(void)
+{
+    remove(TEST_FULL);
+    remove(TEST_FULL TXN_CACHE_SUFFIX);
+    remove(TEST_SLICE);
+    remove(TEST_SLICE TXN_CACHE_SUFFIX);
+    remove(TEST_OTHER);
+    remove(TEST_OTHER TXN_CACHE_SUFFIX);
+}
+//-----------------------------------------------------------------
+// main: A slice of periodic traffic differs from the whole only by
+// deletions; sequences with nothing in common are not paired up
+//-----------------------------------------------------------------
+int main(int argc, char *argv[])
+{
+    tCaptureFilter filter;
+    int removed;
+    int added;
+    int changed;
+    int unaligned;
+    int64_t res;
+
+    cleanup();
+
+    // 10s of traffic repeating every 256 transactions, 1s slice of it
+    TEST_CHECK(make_capture(TEST_FULL, 10, 0, 0xFF) == 0);
+
+    capture_filter_init(&filter);
+    TEST_CHECK(capture_filter_parse_time(&filter, "3:4") == 0);
+    TEST_CHECK(capture_slice(TEST_FULL, TEST_SLICE, &filter) == 0);
+
+    res = run_diff(TEST_FULL, TEST_SLICE, &removed, &added, &changed, &unaligned);
+    TEST_CHECK(res == 9000);
+    TEST_CHECK(removed == 9000 && added == 0 && changed == 0 && !unaligned);
+
+    // Nothing in common and too far apart for Myers
+    TEST_CHECK(make_capture(TEST_OTHER, 30, 1000000, 0xFFFFFFFF) == 0);
+    TEST_CHECK(make_capture(TEST_FULL, 30, 0, 0xFFFFFFFF) == 0);
+    remove(TEST_FULL TXN_CACHE_SUFFIX);
+
+    res = run_diff(TEST_FULL, TEST_OTHER, &removed, &added, &changed, &unaligned);
+    TEST_CHECK(res == 60000);
+    TEST_CHECK(removed == 30000 && added == 30000 && changed == 0 && unaligned);
+
+    cleanup();
+    return test_result("test_diff");
+}
@@ -0,0 +1,161 @@
+//-----------------------------------------------------------------
+//                       USB Sniffer
+//                           V0.1
+//                     Ultra-Embedded.com
+//                       Copyright 2015
+//
+//               Email: admin@ultra-embedded.com
+//
+//                       License: LGPL
+//-----------------------------------------------------------------
+//
+// Copyright (C) 2011 - 2013 Ultra-Embedded.com
+//
+// This source file may be used and distributed without         
+// restriction provided that this copyright statement is not    
+// removed from the file and that any derivative work contains  
+// the original copyright notice and the associated disclaimer. 
+//
+// This source file is free software; you can redistribute it   
+// and/or modify it under the terms of the GNU Lesser General   
+// Public License as published by the Free Software Foundation; 
+// either version 2.1 of the License, or (at your option) any   
+// later version.
+//
+// This source is distributed in the hope that it will be       
+// useful, but WITHOUT ANY WARRANTY; without even the implied   
+// warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR      
+// PURPOSE.  See the GNU Lesser General Public License for more 
+// details.
+//
+// You should have received a copy of the GNU Lesser General    
+// Public License along with this source; if not, write to the 
+// Free Software Foundation, Inc., 59 Temple Place, Suite 330, 
+// Boston, MA  02111-1307  USA
+//-----------------------------------------------------------------
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <sys/stat.h>
+
+#include "log_format.h"
+#include "usb_defs.h"
+#include "usb_helpers.h"
+#include "usb_sniffer.h"
+#include "log_file.h"
+#include "log_decode.h"
+#include "capture_filter.h"
+#include "payload_store.h"
+#include "capture_file.h"
+#include "capture_codec.h"
+#include "capture_convert.h"
+#include "test_common.h"
+
+#define TEST_UFRAMES        200000
+#define TEST_DEV_POLL       3
+#define TEST_DEV_BURST      9
+#define TEST_BURST_START    100000
+#define TEST_BURST_END      100010
+#define TEST_OUTPUT         "test_filter.txt"
+
+//-----------------------------------------------------------------
+// count_blocks: Blocks a reader with this filter does not skip
+//-----------------------------------------------------------------
+static int count_blocks(FILE *f, const tCaptureFilter *filter)
+{
+    tCaptureFile *cap;
+    tCaptureBlock blk;
+    int blocks = 0;
+    int res;
+
+    rewind(f);
+    cap = capture_file_open(f);
+    if (!cap)
+        return -1;
+
+    capture_file_set_filter(cap, filter);
+    while ((res = capture_file_next_block(cap, &blk)) > 0)
+        blocks++;
+
+    capture_file_close(cap);
+    return res < 0 ? -1 : blocks;
+}
+//-----------------------------------------------------------------
+// convert_size: Size of a text export with this filter
+//-----------------------------------------------------------------
+static long convert_size(FILE *f, const tCaptureFilter *filter)
+{
+    tCaptureFile *cap;
+    struct stat st;
+    int res;
+
+    rewind(f);
+    cap = capture_file_open(f);
+    if (!cap)
+        return -1;
+
+    res = capture_convert(TEST_OUTPUT, cap, filter);
+    capture_file_close(cap);
+
+    if (res != 0 || stat(TEST_OUTPUT, &st) != 0)
+        return -1;
+
+    remove(TEST_OUTPUT);
+    return (long)st.st_size;
+}
+//-----------------------------------------------------------------
+// main: Device filters skip every block without that device
+//-----------------------------------------------------------------
+int main(int argc, char *argv[])
+{
+    tTestStream s;
+    tCaptureFilter filter;
+    int total;
+    int blocks;
+    FILE *f;
+    int uf;
+
+    // Interrupt polling on one device throughout, a short burst on another
+    memset(&s, 0, sizeof(s));
+    for (uf=0;uf<TEST_UFRAMES;uf++)
+    {
+        test_sof(&s, uf / 8);
+        test_token(&s, PID_IN, TEST_DEV_POLL, 1, 1024);
+        test_hshake(&s, PID_NAK, 512);
+
+        if (uf >= TEST_BURST_START && uf < TEST_BURST_END)
+        {
+            test_token(&s, PID_IN, TEST_DEV_BURST, 2, 1024);
+            test_hshake(&s, PID_NAK, 512);
+        }
+    }
+
+    f = test_capture(&s, 0);
+    TEST_CHECK(f != NULL);
+    if (!f)
+        return test_result("test_filter");
+
+    capture_filter_init(&filter);
+    total = count_blocks(f, &filter);
+    TEST_CHECK(total > 2);
+
+    // No such device: nothing to read, nothing to decode
+    filter.device = 0x50;
+    TEST_CHECK(count_blocks(f, &filter) == 0);
+    TEST_CHECK(convert_size(f, &filter) == 0);
+
+    // Burst device: only the blocks around the burst
+    filter.device = TEST_DEV_BURST;
+    blocks = count_blocks(f, &filter);
+    TEST_CHECK(blocks >= 1 && blocks <= 2);
+    TEST_CHECK(convert_size(f, &filter) > 0);
+
+    // Polled device: all of them
+    filter.device = TEST_DEV_POLL;
+    TEST_CHECK(count_blocks(f, &filter) == total);
+
+    fclose(f);
+    free(s.words);
+    return test_result("test_filter");
+}
@@ -0,0 +1,198 @@
+//-----------------------------------------------------------------
+//                       USB Sniffer
+//                           V0.1
+//                     Ultra-Embedded.com
+//                       Copyright 2015
+//
+//               Email: admin@ultra-embedded.com
+//
+//                       License: LGPL
+//-----------------------------------------------------------------
+//
+// Copyright (C) 2011 - 2013 Ultra-Embedded.com
+//
+// This source file may be used and distributed without         
+// restriction provided that this copyright statement is not    
+// removed from the file and that any derivative work contains  
+// the original copyright notice and the associated disclaimer. 
+//
+// This source file is free software; you can redistribute it   
+// and/or modify it under the terms of the GNU Lesser General   
+// Public License as published by the Free Software Foundation; 
+// either version 2.1 of the License, or (at your option) any   
+// later version.
+//
+// This source is distributed in the hope that it will be       
+// useful, but WITHOUT ANY WARRANTY; without even the implied   
+// warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR      
+// PURPOSE.  See the GNU Lesser General Public License for more 
+// details.
+//
+// You should have received a copy of the GNU Lesser General    
+// Public License along with this source; if not, write to the 
+// Free Software Foundation, Inc., 59 Temple Place, Suite 330, 
+// Boston, MA  02111-1307  USA
+//-----------------------------------------------------------------
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <unistd.h>
+
+#include "log_format.h"
+#include "usb_defs.h"
+#include "usb_helpers.h"
+#include "usb_sniffer.h"
+#include "log_decode.h"
+#include "capture_filter.h"
+#include "payload_store.h"
+#include "capture_file.h"
+#include "capture_codec.h"
+#include "test_common.h"
+
+#define TEST_PACKETS        40000
+#define TEST_PAYLOAD        64
+
+//-----------------------------------------------------------------
+// fill_payload: Distinct payload per packet number
+//-----------------------------------------------------------------
+static void fill_payload(uint8_t *p, uint32_t n)
+{
+    int i;
+
+    for (i=0;i<TEST_PAYLOAD;i++)
+        p[i] = (uint8_t)((n * 2654435761u) >> (8 * (i & 3))) ^ (uint8_t)i;
+}
+//-----------------------------------------------------------------
+// check_payloads: Decode capture, every DATA record must carry the
+// payload of its packet. Returns packets seen, -1 on error.
+//-----------------------------------------------------------------
+static int check_payloads(FILE *f)
+{
+    uint8_t expect[TEST_PAYLOAD];
+    tCaptureFile *cap;
+    tCaptureBlock blk;
+    tLogDecoder dec;
+    tLogRecord rec;
+    uint32_t *words;
+    int packets = 0;
+    int count;
+    int idx;
+    int res;
+
+    rewind(f);
+    cap = capture_file_open(f);
+    if (!cap)
+        return -1;
+
+    while ((res = capture_file_next_block(cap, &blk)) > 0)
+    {
+        count = capture_file_read_block(cap, &blk, &words);
+        capture_file_block_decoder(cap, &blk, &dec);
+
+        for (idx = 0; idx < count; idx += rec.words)
+        {
+            if (log_decode_next(&dec, words + idx, count - idx, &rec) <= 0)
+            {
+                res = -1;
+                break;
+            }
+
+            if (rec.type != LOG_CTRL_TYPE_DATA)
+                continue;
+
+            fill_payload(expect, packets++);
+            if (rec.length != TEST_PAYLOAD + 2 || memcmp(rec.data, expect, TEST_PAYLOAD) != 0)
+                res = -1;
+        }
+
+        if (res < 0)
+            break;
+    }
+
+    capture_file_close(cap);
+    return res < 0 ? -1 : packets;
+}
+//-----------------------------------------------------------------
+// main: Deduplicated captures hold unique payloads on disk, not in
+// memory, and stay readable if the writer never closes them
+//-----------------------------------------------------------------
+int main(int argc, char *argv[])
+{
+    uint8_t payload[TEST_PAYLOAD];
+    tPayloadStore *store;
+    tCaptureFile *cap;
+    tTestStream s;
+    uint32_t size;
+    uint32_t id;
+    uint8_t *buf;
+    long len;
+    FILE *f;
+    FILE *g;
+    int seen;
+    int n;
+
+    // Writer keeps new payloads only until the next segment
+    store = payload_store_create();
+    for (n=0;n<1000;n++)
+    {
+        fill_payload(payload, n);
+        TEST_CHECK(payload_store_add(store, payload, TEST_PAYLOAD, &id) == 1 && id == (uint32_t)n);
+    }
+    fill_payload(payload, 7);
+    TEST_CHECK(payload_store_add(store, payload, TEST_PAYLOAD, &id) == 0 && id == 7);
+    TEST_CHECK(payload_store_pending(store, &size) == 1000);
+
+    g = tmpfile();
+    TEST_CHECK(g && payload_store_write_segment(store, g) == 0);
+    TEST_CHECK(payload_store_pending(store, &size) == 0 && size == 0);
+    payload_store_destroy(store);
+    fclose(g);
+
+    // Unique payload in every packet
+    memset(&s, 0, sizeof(s));
+    for (n=0;n<TEST_PACKETS;n++)
+    {
+        if ((n % 4) == 0)
+            test_sof(&s, n / 32);
+        fill_payload(payload, n);
+        test_token(&s, PID_OUT, 5, 2, 1024);
+        test_data(&s, (n & 1) ? PID_DATA1 : PID_DATA0, payload, TEST_PAYLOAD, 512, 0);
+        test_hshake(&s, PID_ACK, 256);
+    }
+
+    f = test_capture(&s, CAPTURE_FLAG_DEDUP);
+    TEST_CHECK(f != NULL);
+    if (!f)
+        return test_result("test_payload_store");
+
+    TEST_CHECK(check_payloads(f) == TEST_PACKETS);
+
+    // Writer stopped without closing: copy what reached the file
+    g = tmpfile();
+    f = tmpfile();
+    cap = capture_file_create(g, USB_SPEED_HS, CAPTURE_CODEC_NONE, CAPTURE_FLAG_DEDUP, NULL);
+    TEST_CHECK(cap && capture_file_write(cap, s.words, s.count) == 0);
+    fflush(g);
+
+    len = ftell(g);
+    buf = (uint8_t *)malloc(len);
+    rewind(g);
+    TEST_CHECK(fread(buf, 1, len, g) == (size_t)len);
+    TEST_CHECK(fwrite(buf, 1, len, f) == (size_t)len);
+
+    seen = check_payloads(f);
+    TEST_CHECK(seen > 0 && seen < TEST_PACKETS);
+
+    // ... and with the last block cut short
+    rewind(f);
+    TEST_CHECK(ftruncate(fileno(f), len - 100) == 0);
+    TEST_CHECK(check_payloads(f) > 0);
+
+    capture_file_close(cap);
+    free(buf);
+    fclose(f);
+    fclose(g);
+    free(s.words);
+    return test_result("test_payload_store");
+}
@@ -0,0 +1,121 @@
+//-----------------------------------------------------------------
+//                       USB Sniffer
+//                           V0.1
+//                     Ultra-Embedded.com
+//                       Copyright 2015
+//
+//               Email: admin@ultra-embedded.com
+//
+//                       License: LGPL
+//-----------------------------------------------------------------
+//
+// Copyright (C) 2011 - 2013 Ultra-Embedded.com
+//
+// This source file may be used and distributed without         
+// restriction provided that this copyright statement is not    
+// removed from the file and that any derivative work contains  
+// the original copyright notice and the associated disclaimer. 
+//
+// This source file is free software; you can redistribute it   
+// and/or modify it under the terms of the GNU Lesser General   
+// Public License as published by the Free Software Foundation; 
+// either version 2.1 of the License, or (at your option) any   
+// later version.
+//
+// This source is distributed in the hope that it will be       
+// useful, but WITHOUT ANY WARRANTY; without even the implied   
+// warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR      
+// PURPOSE.  See the GNU Lesser General Public License for more 
+// details.
+//
+// You should have received a copy of the GNU Lesser General    
+// Public License along with this source; if not, write to the 
+// Free Software Foundation, Inc., 59 Temple Place, Suite 330, 
+// Boston, MA  02111-1307  USA
+//-----------------------------------------------------------------
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+
+#include "log_format.h"
+#include "usb_defs.h"
+#include "usb_helpers.h"
+#include "usb_sniffer.h"
+#include "log_decode.h"
+#include "capture_filter.h"
+#include "payload_store.h"
+#include "capture_file.h"
+#include "capture_codec.h"
+#include "pyramid.h"
+#include "test_common.h"
+
+#define TEST_HOURS          8
+#define TEST_COLUMNS        80
+#define TEST_PYRAMID        "test_pyramid.pyr"
+
+//-----------------------------------------------------------------
+// add_record: Feed one bus record to the builder
+//-----------------------------------------------------------------
+static int add_record(tPyramidBuilder *pb, int type, uint8_t pid, int device, uint64_t time)
+{
+    tLogRecord rec;
+
+    memset(&rec, 0, sizeof(rec));
+    rec.type     = type;
+    rec.pid      = pid;
+    rec.has_addr = (device >= 0);
+    rec.device   = (device >= 0) ? device : 0;
+    rec.time     = time;
+    return pyramid_builder_add(pb, &rec);
+}
+//-----------------------------------------------------------------
+// main: A single error in a long capture survives the coarse levels
+//-----------------------------------------------------------------
+int main(int argc, char *argv[])
+{
+    tPyramidColumn cols[TEST_COLUMNS];
+    tPyramidBuilder *pb;
+    tPyramid *pyr;
+    uint64_t end = (uint64_t)TEST_HOURS * 3600 * TICKS_PER_SEC;
+    uint64_t packets = 0;
+    uint64_t errors = 0;
+    uint64_t t;
+    int level;
+    int i;
+
+    // Polled device once a second, one STALL half way through
+    pb = pyramid_builder_create(TEST_PYRAMID);
+    TEST_CHECK(pb != NULL);
+    if (!pb)
+        return test_result("test_pyramid");
+
+    for (t=0;t<end;t+=TICKS_PER_SEC)
+    {
+        TEST_CHECK(add_record(pb, LOG_CTRL_TYPE_TOKEN, PID_IN, 3, t) == 0);
+        TEST_CHECK(add_record(pb, LOG_CTRL_TYPE_HSHAKE, (t == end / 2) ? PID_STALL : PID_NAK, 3, t + 100) == 0);
+    }
+    TEST_CHECK(pyramid_builder_finish(pb, 1234) == 0);
+
+    pyr = pyramid_open(TEST_PYRAMID, 1234);
+    TEST_CHECK(pyr != NULL);
+    if (!pyr)
+        return test_result("test_pyramid");
+
+    level = pyramid_query(pyr, 0, end, 3, TEST_COLUMNS, cols);
+    TEST_CHECK(level >= PYRAMID_EXACT_LEVELS);
+
+    for (i=0;i<TEST_COLUMNS;i++)
+    {
+        packets += cols[i].packets;
+        errors  += cols[i].errors;
+    }
+
+    TEST_CHECK(errors >= 1 && errors <= 2);
+    TEST_CHECK(packets >= (uint64_t)TEST_HOURS * 3600 * 2 - TEST_COLUMNS &&
+               packets <= (uint64_t)TEST_HOURS * 3600 * 2 + TEST_COLUMNS);
+
+    pyramid_close(pyr);
+    remove(TEST_PYRAMID);
+    return test_result("test_pyramid");
+}
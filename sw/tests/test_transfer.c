@@ -0,0 +1,139 @@
+//-----------------------------------------------------------------
+//                       USB Sniffer
+//                           V0.1
+//                     Ultra-Embedded.com
+//                       Copyright 2015
+//
+//               Email: admin@ultra-embedded.com
+//
+//                       License: LGPL
+//-----------------------------------------------------------------
+//
+// Copyright (C) 2011 - 2013 Ultra-Embedded.com
+//
+// This source file may be used and distributed without         
+// restriction provided that this copyright statement is not    
+// removed from the file and that any derivative work contains  
+// the original copyright notice and the associated disclaimer. 
+//
+// This source file is free software; you can redistribute it   
+// and/or modify it under the terms of the GNU Lesser General   
+// Public License as published by the Free Software Foundation; 
+// either version 2.1 of the License, or (at your option) any   
+// later version.
+//
+// This source is distributed in the hope that it will be       
+// useful, but WITHOUT ANY WARRANTY; without even the implied   
+// warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR      
+// PURPOSE.  See the GNU Lesser General Public License for more 
+// details.
+//
+// You should have received a copy of the GNU Lesser General    
+// Public License along with this source; if not, write to the 
+// Free Software Foundation, Inc., 59 Temple Place, Suite 330, 
+// Boston, MA  02111-1307  USA
+//-----------------------------------------------------------------
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+
+#include "log_format.h"
+#include "usb_defs.h"
+#include "usb_helpers.h"
+#include "usb_sniffer.h"
+#include "log_decode.h"
+#include "capture_filter.h"
+#include "payload_store.h"
+#include "capture_file.h"
+#include "capture_codec.h"
+#include "transaction.h"
+#include "descriptor_snoop.h"
+#include "transfer.h"
+#include "test_common.h"
+
+#define TEST_MAX_XFERS      16
+
+static tTransfer _xfers[TEST_MAX_XFERS];
+static int       _num_xfers;
+static uint64_t  _time;
+
+//-----------------------------------------------------------------
+// collect: Transfer assembler callback
+//-----------------------------------------------------------------
+static int collect(void *ctx, const tTransfer *xfer)
+{
+    if (_num_xfers < TEST_MAX_XFERS)
+        _xfers[_num_xfers++] = *xfer;
+    return 0;
+}
+//-----------------------------------------------------------------
+// add_txn: Feed a data transaction (len payload bytes)
+//-----------------------------------------------------------------
+static void add_txn(tTransferAssembler *xa, int token, int dev, int ep, int len, int hshake, int bad_crc)
+{
+    uint8_t data[MAX_PACKET_SIZE];
+    tTransaction txn;
+
+    memset(&txn, 0, sizeof(txn));
+    memset(data, 0x5A, sizeof(data));
+    txn.time     = _time;
+    txn.duration = 100;
+    txn.token    = token;
+    txn.data     = PID_DATA0;
+    txn.length   = len + 2;
+    txn.hshake   = hshake;
+    txn.device   = dev;
+    txn.endpoint = ep;
+    txn.flags    = bad_crc ? TXN_FLAG_CRC_ERROR : 0;
+    _time += 1000;
+
+    TEST_CHECK(transfer_assembler_add_txn(xa, &txn, data) == 0);
+}
+//-----------------------------------------------------------------
+// main
+//-----------------------------------------------------------------
+int main(int argc, char *argv[])
+{
+    static tDescriptorSnoop snoop;
+    tTransferAssembler *xa;
+
+    // Bulk OUT without a descriptor, corrupt packet retried mid transfer
+    xa = transfer_assembler_create(collect, NULL);
+    add_txn(xa, PID_OUT, 5, 2, 512, PID_ACK, 0);
+    add_txn(xa, PID_OUT, 5, 2, 512, 0, 1);
+    add_txn(xa, PID_OUT, 5, 2, 512, PID_ACK, 0);
+    add_txn(xa, PID_OUT, 5, 2, 10, PID_ACK, 0);
+    TEST_CHECK(transfer_assembler_flush(xa) == 0);
+
+    TEST_CHECK(_num_xfers == 1);
+    TEST_CHECK(_xfers[0].type == TRANSFER_BULK_INT && _xfers[0].status == TRANSFER_OK);
+    TEST_CHECK(_xfers[0].bytes == 1034 && _xfers[0].txns == 3 && _xfers[0].errors == 1);
+
+    // Unhandshaked packet with no descriptor and nothing open: isochronous
+    _num_xfers = 0;
+    add_txn(xa, PID_IN, 6, 1, 188, 0, 0);
+    TEST_CHECK(_num_xfers == 1 && _xfers[0].type == TRANSFER_ISO && _xfers[0].bytes == 188);
+    transfer_assembler_destroy(xa);
+
+    // Described bulk endpoint: an unanswered first packet is retried, not isochronous
+    snoop.ep[SNOOP_SLOT(5, 2, 0)].valid      = 1;
+    snoop.ep[SNOOP_SLOT(5, 2, 0)].attributes = SNOOP_EP_BULK;
+    snoop.ep[SNOOP_SLOT(5, 2, 0)].max_packet = 512;
+
+    _num_xfers = 0;
+    xa = transfer_assembler_create(collect, NULL);
+    transfer_assembler_set_snoop(xa, &snoop);
+    add_txn(xa, PID_OUT, 5, 2, 512, 0, 0);
+    add_txn(xa, PID_OUT, 5, 2, 512, PID_ACK, 0);
+    add_txn(xa, PID_OUT, 5, 2, 100, 0, 1);
+    add_txn(xa, PID_OUT, 5, 2, 100, PID_ACK, 0);
+    TEST_CHECK(transfer_assembler_flush(xa) == 0);
+
+    TEST_CHECK(_num_xfers == 1);
+    TEST_CHECK(_xfers[0].type == TRANSFER_BULK && _xfers[0].status == TRANSFER_OK);
+    TEST_CHECK(_xfers[0].bytes == 612 && _xfers[0].txns == 2 && _xfers[0].errors == 1);
+    transfer_assembler_destroy(xa);
+
+    return test_result("test_transfer");
+}
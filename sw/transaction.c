@@ -0,0 +1,171 @@
+//-----------------------------------------------------------------
+//                       USB Sniffer
+//                           V0.1
+//                     Ultra-Embedded.com
+//                       Copyright 2015
+//
+//               Email: admin@ultra-embedded.com
+//
+//                       License: LGPL
+//-----------------------------------------------------------------
+//
+// Copyright (C) 2011 - 2013 Ultra-Embedded.com
+//
+// This source file may be used and distributed without         
+// restriction provided that this copyright statement is not    
+// removed from the file and that any derivative work contains  
+// the original copyright notice and the associated disclaimer. 
+//
+// This source file is free software; you can redistribute it   
+// and/or modify it under the terms of the GNU Lesser General   
+// Public License as published by the Free Software Foundation; 
+// either version 2.1 of the License, or (at your option) any   
+// later version.
+//
+// This source is distributed in the hope that it will be       
+// useful, but WITHOUT ANY WARRANTY; without even the implied   
+// warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR      
+// PURPOSE.  See the GNU Lesser General Public License for more 
+// details.
+//
+// You should have received a copy of the GNU Lesser General    
+// Public License along with this source; if not, write to the 
+// Free Software Foundation, Inc., 59 Temple Place, Suite 330, 
+// Boston, MA  02111-1307  USA
+//-----------------------------------------------------------------
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+
+#include "log_format.h"
+#include "usb_defs.h"
+#include "usb_helpers.h"
+#include "log_decode.h"
+#include "capture_filter.h"
+#include "transaction.h"
+
+//-----------------------------------------------------------------
+// txn_builder_init
+//-----------------------------------------------------------------
+void txn_builder_init(tTxnBuilder *b)
+{
+    memset(b, 0, sizeof(*b));
+}
+//-----------------------------------------------------------------
+// txn_builder_flush: Complete any open transaction
+//-----------------------------------------------------------------
+int txn_builder_flush(tTxnBuilder *b, tTxnEmit emit, void *ctx)
+{
+    if (!b->open)
+        return 0;
+
+    b->open = 0;
+    return emit(ctx, &b->cur, b->data);
+}
+//-----------------------------------------------------------------
+// txn_builder_start: Open a transaction at record
+//-----------------------------------------------------------------
+static void txn_builder_start(tTxnBuilder *b, const tLogRecord *rec)
+{
+    memset(&b->cur, 0, sizeof(b->cur));
+    b->cur.time     = rec->time;
+    b->cur.frame    = b->frame;
+    b->cur.device   = rec->has_addr ? rec->device : 0;
+    b->cur.endpoint = rec->has_addr ? rec->endpoint : 0;
+    b->open = 1;
+}
+//-----------------------------------------------------------------
+// txn_builder_add: Feed next record. A token opens a transaction,
+// data and handshake attach to it, the handshake completes it.
+// Packets without an open transaction form one of their own.
+//-----------------------------------------------------------------
+int txn_builder_add(tTxnBuilder *b, const tLogRecord *rec, tTxnEmit emit, void *ctx)
+{
+    int err = 0;
+
+    switch (rec->type)
+    {
+        case LOG_CTRL_TYPE_SOF:
+            err = txn_builder_flush(b, emit, ctx);
+            b->frame = usb_get_sof_frame(rec->value);
+            break;
+        case LOG_CTRL_TYPE_RST:
+            err = txn_builder_flush(b, emit, ctx);
+            break;
+        case LOG_CTRL_TYPE_TOKEN:
+            err = txn_builder_flush(b, emit, ctx);
+            txn_builder_start(b, rec);
+            b->cur.token = rec->pid;
+            break;
+        case LOG_CTRL_TYPE_DATA:
+            if (b->open && (b->cur.data || b->cur.hshake))
+                err = txn_builder_flush(b, emit, ctx);
+            if (!b->open)
+                txn_builder_start(b, rec);
+
+            b->cur.data     = rec->pid;
+            b->cur.length   = rec->length;
+            b->cur.duration = (uint32_t)(rec->time - b->cur.time);
+            memcpy(b->data, rec->data, rec->length);
+
+            if (!usb_data_crc_valid(rec->data, rec->length))
+                b->cur.flags |= TXN_FLAG_CRC_ERROR;
+            break;
+        case LOG_CTRL_TYPE_HSHAKE:
+            if (b->open && b->cur.hshake)
+                err = txn_builder_flush(b, emit, ctx);
+            if (!b->open)
+                txn_builder_start(b, rec);
+
+            b->cur.hshake   = rec->pid;
+            b->cur.duration = (uint32_t)(rec->time - b->cur.time);
+            if (!err)
+                err = txn_builder_flush(b, emit, ctx);
+            break;
+    }
+
+    return err;
+}
+//-----------------------------------------------------------------
+// txn_match_filter: Transaction passes device / endpoint / PID /
+// time filter (any of its PIDs may match)
+//-----------------------------------------------------------------
+int txn_match_filter(const tCaptureFilter *filter, const tTransaction *txn)
+{
+    if (txn->time < filter->t_start || txn->time > filter->t_end)
+        return 0;
+
+    if (filter->device >= 0 && txn->device != filter->device)
+        return 0;
+
+    if (filter->endpoint >= 0 && txn->endpoint != filter->endpoint)
+        return 0;
+
+    if (filter->pid_map != 0 &&
+        !(txn->token  && (filter->pid_map & (1 << (txn->token & 0xF)))) &&
+        !(txn->data   && (filter->pid_map & (1 << (txn->data & 0xF)))) &&
+        !(txn->hshake && (filter->pid_map & (1 << (txn->hshake & 0xF)))))
+        return 0;
+
+    return 1;
+}
+//-----------------------------------------------------------------
+// txn_describe: One line summary of transaction
+//-----------------------------------------------------------------
+void txn_describe(const tTransaction *txn, char *str, int size)
+{
+    int len;
+
+    len = snprintf(str, size, "%12.6f  frame %4d  dev %3d ep %2d ",
+                   (double)txn->time / TICKS_PER_SEC, txn->frame, txn->device, txn->endpoint);
+
+    if (len < size && txn->token)
+        len += snprintf(str + len, size - len, " %s", usb_get_pid_str(txn->token));
+    if (len < size && txn->data)
+        len += snprintf(str + len, size - len, " %s(%d)", usb_get_pid_str(txn->data), txn->length >= 2 ? txn->length - 2 : 0);
+    if (len < size && txn->hshake)
+        len += snprintf(str + len, size - len, " %s", usb_get_pid_str(txn->hshake));
+    if (len < size && (txn->flags & TXN_FLAG_CRC_ERROR))
+        len += snprintf(str + len, size - len, " BAD_CRC");
+}
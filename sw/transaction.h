@@ -0,0 +1,60 @@
+#ifndef __TRANSACTION_H__
+#define __TRANSACTION_H__
+
+//--------------------------------------------------------------------
+// Defines
+//--------------------------------------------------------------------
+#define TXN_FLAG_CRC_ERROR      (1 << 0)    // Data payload failed CRC16
+
+//--------------------------------------------------------------------
+// Structures
+//--------------------------------------------------------------------
+// Token / data / handshake packets of one bus transaction (fixed
+// size, stored as is in the transaction sidecar)
+typedef struct
+{
+    uint64_t time;          // Time of first packet (ticks)
+    uint64_t payload;       // Data payload location (owner defined)
+    uint32_t duration;      // Ticks from first to last packet
+    uint16_t length;        // Data length incl. CRC16 (0 = no data)
+    uint16_t frame;         // Frame number of preceding SOF
+    uint8_t  token;         // Token PID (0 = none seen)
+    uint8_t  data;          // Data PID (0 = none)
+    uint8_t  hshake;        // Handshake PID (0 = none)
+    uint8_t  device;
+    uint8_t  endpoint;
+    uint8_t  flags;         // TXN_FLAG_xxx
+    uint8_t  reserved[2];
+} tTransaction;
+
+// Pairs decoded records into transactions
+typedef struct
+{
+    int          open;      // cur holds an incomplete transaction
+    tTransaction cur;
+    uint8_t      data[MAX_PACKET_SIZE];
+    uint16_t     frame;
+} tTxnBuilder;
+
+// Called for each completed transaction (data valid during call)
+typedef int (*tTxnEmit)(void *ctx, const tTransaction *txn, const uint8_t *data);
+
+//--------------------------------------------------------------------
+// Prototypes
+//--------------------------------------------------------------------
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+void txn_builder_init(tTxnBuilder *b);
+int  txn_builder_add(tTxnBuilder *b, const tLogRecord *rec, tTxnEmit emit, void *ctx);
+int  txn_builder_flush(tTxnBuilder *b, tTxnEmit emit, void *ctx);
+
+int  txn_match_filter(const tCaptureFilter *filter, const tTransaction *txn);
+void txn_describe(const tTransaction *txn, char *str, int size);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,558 @@
+//-----------------------------------------------------------------
+//                       USB Sniffer
+//                           V0.1
+//                     Ultra-Embedded.com
+//                       Copyright 2015
+//
+//               Email: admin@ultra-embedded.com
+//
+//                       License: LGPL
+//-----------------------------------------------------------------
+//
+// Copyright (C) 2011 - 2013 Ultra-Embedded.com
+//
+// This source file may be used and distributed without         
+// restriction provided that this copyright statement is not    
+// removed from the file and that any derivative work contains  
+// the original copyright notice and the associated disclaimer. 
+//
+// This source file is free software; you can redistribute it   
+// and/or modify it under the terms of the GNU Lesser General   
+// Public License as published by the Free Software Foundation; 
+// either version 2.1 of the License, or (at your option) any   
+// later version.
+//
+// This source is distributed in the hope that it will be       
+// useful, but WITHOUT ANY WARRANTY; without even the implied   
+// warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR      
+// PURPOSE.  See the GNU Lesser General Public License for more 
+// details.
+//
+// You should have received a copy of the GNU Lesser General    
+// Public License along with this source; if not, write to the 
+// Free Software Foundation, Inc., 59 Temple Place, Suite 330, 
+// Boston, MA  02111-1307  USA
+//-----------------------------------------------------------------
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <assert.h>
+
+#include "usb_defs.h"
+#include "log_format.h"
+#include "usb_helpers.h"
+#include "log_decode.h"
+#include "capture_filter.h"
+#include "transaction.h"
+#include "descriptor_snoop.h"
+#include "transfer.h"
+
+//-----------------------------------------------------------------
+// Defines
+//-----------------------------------------------------------------
+#define TRANSFER_DEVICES        128
+#define TRANSFER_ENDPOINTS      16
+
+// Pipe within an endpoint entry (control transfers use PIPE_OUT)
+#define PIPE_OUT                0
+#define PIPE_IN                 1
+
+//-----------------------------------------------------------------
+// Structures
+//-----------------------------------------------------------------
+// Transfer in progress in one direction of an endpoint
+struct xfer_pipe
+{
+    tTransfer  xfer;
+    tTxnNode  *last;
+    int        open;
+    uint16_t   max_packet;  // Largest payload seen (no descriptor)
+    uint16_t   remaining;   // Control: data stage bytes still expected
+    int        status_stage;// Control: data stage done
+};
+
+struct xfer_endpoint
+{
+    struct xfer_pipe pipe[2];
+    int              control;   // SETUP seen on endpoint
+};
+
+struct transfer_assembler
+{
+    tTxnBuilder          builder;
+    tTransferEmit        emit;
+    void                *ctx;
+
+    // Free transaction nodes
+    tTxnNode            *pool;
+
+    // Endpoint descriptors: shared from the caller, else picked out
+    // of the transactions fed here
+    const tDescriptorSnoop *snoop;
+    tDescriptorSnoop     own_snoop;
+
+    // Flat per (device, endpoint) state
+    struct xfer_endpoint eps[TRANSFER_DEVICES * TRANSFER_ENDPOINTS];
+};
+
+//-----------------------------------------------------------------
+// transfer_node_alloc: Take a node from the pool (grown on demand,
+// so steady state traffic does not allocate)
+//-----------------------------------------------------------------
+static tTxnNode* transfer_node_alloc(tTransferAssembler *xa)
+{
+    tTxnNode *node = xa->pool;
+
+    if (node)
+        xa->pool = node->next;
+    else
+    {
+        node = (tTxnNode *)malloc(sizeof(tTxnNode));
+        assert(node);
+    }
+
+    node->next = NULL;
+    return node;
+}
+//-----------------------------------------------------------------
+// transfer_release: Return transfer's nodes to the pool
+//-----------------------------------------------------------------
+static void transfer_release(tTransferAssembler *xa, struct xfer_pipe *pipe)
+{
+    if (pipe->xfer.first)
+    {
+        pipe->last->next = xa->pool;
+        xa->pool = pipe->xfer.first;
+    }
+
+    pipe->xfer.first = NULL;
+    pipe->last       = NULL;
+}
+//-----------------------------------------------------------------
+// transfer_open: Start transfer on pipe
+//-----------------------------------------------------------------
+static void transfer_open(struct xfer_pipe *pipe, const tTransaction *txn, int type, uint8_t dir)
+{
+    memset(&pipe->xfer, 0, sizeof(pipe->xfer));
+    pipe->xfer.start    = txn->time;
+    pipe->xfer.end      = txn->time + txn->duration;
+    pipe->xfer.device   = txn->device;
+    pipe->xfer.endpoint = txn->endpoint;
+    pipe->xfer.type     = type;
+    pipe->xfer.dir      = dir;
+    pipe->last          = NULL;
+    pipe->status_stage  = 0;
+    pipe->open          = 1;
+}
+//-----------------------------------------------------------------
+// transfer_close: Pass on completed transfer
+//-----------------------------------------------------------------
+static int transfer_close(tTransferAssembler *xa, struct xfer_pipe *pipe, int status)
+{
+    int err;
+
+    pipe->xfer.status = status;
+    err = xa->emit(xa->ctx, &pipe->xfer);
+
+    transfer_release(xa, pipe);
+    pipe->open = 0;
+    return err;
+}
+//-----------------------------------------------------------------
+// transfer_append: Add data transaction to open transfer. Returns
+// payload length (excl. CRC16).
+//-----------------------------------------------------------------
+static int transfer_append(tTransferAssembler *xa, struct xfer_pipe *pipe, const tTransaction *txn, const uint8_t *data)
+{
+    int len = txn->length >= 2 ? txn->length - 2 : 0;
+    tTxnNode *node = transfer_node_alloc(xa);
+
+    node->txn = *txn;
+    memcpy(node->data, data, txn->length);
+
+    if (pipe->last)
+        pipe->last->next = node;
+    else
+        pipe->xfer.first = node;
+    pipe->last = node;
+
+    pipe->xfer.bytes += len;
+    pipe->xfer.txns++;
+    pipe->xfer.end = txn->time + txn->duration;
+    return len;
+}
+//-----------------------------------------------------------------
+// transfer_short_packet: Payload ends a transfer - less than the
+// endpoint's max packet size (from its descriptor, else taken as
+// the largest power of two payload seen so far)
+//-----------------------------------------------------------------
+static int transfer_short_packet(struct xfer_pipe *pipe, const tSnoopEndpoint *desc, int len)
+{
+    if (desc && (desc->max_packet & 0x7FF))
+        return len < (desc->max_packet & 0x7FF);
+
+    if (len < 8 || (len & (len - 1)))
+        return 1;
+
+    if (len > pipe->max_packet)
+        pipe->max_packet = len;
+
+    return len < pipe->max_packet;
+}
+//-----------------------------------------------------------------
+// transfer_split: Pass on a long transfer in parts
+//-----------------------------------------------------------------
+static int transfer_split(tTransferAssembler *xa, struct xfer_pipe *pipe)
+{
+    int err = 0;
+
+    if (pipe->xfer.txns >= TRANSFER_MAX_TXNS)
+    {
+        pipe->xfer.status = TRANSFER_PARTIAL;
+        err = xa->emit(xa->ctx, &pipe->xfer);
+        transfer_release(xa, pipe);
+
+        pipe->xfer.start = pipe->xfer.end;
+        pipe->xfer.bytes = 0;
+        pipe->xfer.txns  = 0;
+        pipe->xfer.naks  = 0;
+        pipe->xfer.errors = 0;
+    }
+
+    return err;
+}
+//-----------------------------------------------------------------
+// transfer_control: Transaction on endpoint with a control transfer
+// open (data stage then status stage in the other direction)
+//-----------------------------------------------------------------
+static int transfer_control(tTransferAssembler *xa, struct xfer_pipe *pipe, const tTransaction *txn, const uint8_t *data, uint8_t dir)
+{
+    int length = pipe->xfer.setup[6] | (pipe->xfer.setup[7] << 8);
+    uint8_t status_dir = (pipe->xfer.dir == PID_IN && length) ? PID_OUT : PID_IN;
+    int len;
+
+    if (!pipe->status_stage && pipe->remaining && dir == pipe->xfer.dir)
+    {
+        len = transfer_append(xa, pipe, txn, data);
+        pipe->remaining -= (len < pipe->remaining) ? len : pipe->remaining;
+
+        if (pipe->remaining == 0 || transfer_short_packet(pipe, NULL, len))
+            pipe->status_stage = 1;
+        return transfer_split(xa, pipe);
+    }
+
+    // Status stage (possibly ending the data stage early)
+    if (dir == status_dir)
+    {
+        pipe->xfer.txns++;
+        pipe->xfer.end = txn->time + txn->duration;
+        return transfer_close(xa, pipe, TRANSFER_OK);
+    }
+
+    // Data beyond wLength
+    transfer_append(xa, pipe, txn, data);
+    return transfer_split(xa, pipe);
+}
+//-----------------------------------------------------------------
+// transfer_snoop_txn: Feed transaction to own descriptor snoop
+//-----------------------------------------------------------------
+static void transfer_snoop_txn(tTransferAssembler *xa, const tTransaction *txn, const uint8_t *data)
+{
+    tLogRecord rec;
+
+    memset(&rec, 0, sizeof(rec));
+    rec.type     = LOG_CTRL_TYPE_TOKEN;
+    rec.pid      = txn->token;
+    rec.has_addr = 1;
+    rec.device   = txn->device;
+    rec.endpoint = txn->endpoint;
+    rec.time     = txn->time;
+    descriptor_snoop_add(&xa->own_snoop, &rec);
+
+    if (txn->data && !(txn->flags & TXN_FLAG_CRC_ERROR))
+    {
+        rec.type   = LOG_CTRL_TYPE_DATA;
+        rec.pid    = txn->data;
+        rec.data   = (uint8_t *)data;
+        rec.length = txn->length;
+        descriptor_snoop_add(&xa->own_snoop, &rec);
+    }
+}
+//-----------------------------------------------------------------
+// transfer_type: Transfer type of a (non control) endpoint
+//-----------------------------------------------------------------
+static int transfer_type(const tSnoopEndpoint *desc)
+{
+    if (!desc)
+        return TRANSFER_BULK_INT;
+
+    switch (desc->attributes & 0x3)
+    {
+        case SNOOP_EP_ISO:       return TRANSFER_ISO;
+        case SNOOP_EP_INTERRUPT: return TRANSFER_INTERRUPT;
+        case SNOOP_EP_BULK:      return TRANSFER_BULK;
+        default:                 return TRANSFER_BULK_INT;
+    }
+}
+//-----------------------------------------------------------------
+// transfer_is_iso: Data transaction on an isochronous endpoint?
+//-----------------------------------------------------------------
+static int transfer_is_iso(const struct xfer_endpoint *ep, const struct xfer_pipe *pipe, const tSnoopEndpoint *desc, const tTransaction *txn)
+{
+    if (ep->control)
+        return 0;
+
+    if (desc)
+        return transfer_type(desc) == TRANSFER_ISO;
+
+    // No descriptor seen: a clean unhandshaked packet outside a
+    // transfer in progress is taken to be isochronous
+    return !pipe->open && txn->data && !(txn->flags & TXN_FLAG_CRC_ERROR);
+}
+//-----------------------------------------------------------------
+// transfer_assembler_add_txn: Feed next transaction
+//-----------------------------------------------------------------
+int transfer_assembler_add_txn(tTransferAssembler *xa, const tTransaction *txn, const uint8_t *data)
+{
+    const tSnoopEndpoint *desc;
+    struct xfer_endpoint *ep;
+    struct xfer_pipe *pipe;
+    uint8_t dir;
+    int err = 0;
+
+    if (xa->snoop == &xa->own_snoop && txn->token)
+        transfer_snoop_txn(xa, txn, data);
+
+    // Only token led IN / OUT / SETUP transactions belong to transfers
+    if (txn->token != PID_IN && txn->token != PID_OUT && txn->token != PID_SETUP)
+        return 0;
+
+    ep = &xa->eps[(txn->device & 0x7F) * TRANSFER_ENDPOINTS + (txn->endpoint & 0xF)];
+
+    if (txn->token == PID_SETUP)
+    {
+        pipe = &ep->pipe[PIPE_OUT];
+        ep->control = 1;
+
+        // A new SETUP abandons whatever was in progress
+        if (pipe->open)
+            err = transfer_close(xa, pipe, TRANSFER_INCOMPLETE);
+
+        if (txn->data == 0 || txn->length < 10)
+            return err;
+
+        transfer_open(pipe, txn, TRANSFER_CONTROL, (data[0] & 0x80) ? PID_IN : PID_OUT);
+        memcpy(pipe->xfer.setup, data, 8);
+        pipe->xfer.txns  = 1;
+        pipe->remaining  = data[6] | (data[7] << 8);
+        return err;
+    }
+
+    dir  = txn->token;
+    pipe = &ep->pipe[(ep->control || dir == PID_OUT) ? PIPE_OUT : PIPE_IN];
+    desc = &xa->snoop->ep[SNOOP_SLOT(txn->device, txn->endpoint, dir == PID_IN)];
+    if (!desc->valid || txn->endpoint == 0)
+        desc = NULL;
+
+    if (txn->hshake == PID_NAK)
+    {
+        if (pipe->open)
+            pipe->xfer.naks++;
+        return 0;
+    }
+
+    // No handshake on a non isochronous endpoint: the transaction
+    // failed (timeout / corrupt packet) and the host retries it
+    if (!txn->hshake && !transfer_is_iso(ep, pipe, desc, txn))
+    {
+        if (pipe->open)
+            pipe->xfer.errors++;
+        return 0;
+    }
+
+    if (pipe->open && pipe->xfer.type == TRANSFER_CONTROL)
+    {
+        if (txn->hshake == PID_STALL)
+        {
+            pipe->xfer.end = txn->time + txn->duration;
+            return transfer_close(xa, pipe, TRANSFER_STALL);
+        }
+
+        return transfer_control(xa, pipe, txn, data, dir);
+    }
+
+    if (txn->hshake == PID_STALL)
+    {
+        if (!pipe->open)
+            transfer_open(pipe, txn, transfer_type(desc), dir);
+
+        pipe->xfer.txns++;
+        pipe->xfer.end = txn->time + txn->duration;
+        return transfer_close(xa, pipe, TRANSFER_STALL);
+    }
+
+    // No transfer without data (e.g. timed out token)
+    if (!txn->data)
+        return 0;
+
+    // Isochronous data is never handshaked, each packet stands alone
+    if (!txn->hshake)
+    {
+        if (pipe->open)
+            err = transfer_close(xa, pipe, TRANSFER_INCOMPLETE);
+
+        transfer_open(pipe, txn, TRANSFER_ISO, dir);
+        transfer_append(xa, pipe, txn, data);
+        if (transfer_close(xa, pipe, TRANSFER_OK) != 0)
+            err = -1;
+        return err;
+    }
+
+    if (pipe->open && pipe->xfer.dir != dir)
+        err = transfer_close(xa, pipe, TRANSFER_INCOMPLETE);
+
+    if (!pipe->open)
+        transfer_open(pipe, txn, transfer_type(desc), dir);
+
+    if (transfer_short_packet(pipe, desc, transfer_append(xa, pipe, txn, data)))
+    {
+        if (transfer_close(xa, pipe, TRANSFER_OK) != 0)
+            err = -1;
+    }
+    else if (transfer_split(xa, pipe) != 0)
+        err = -1;
+
+    return err;
+}
+//-----------------------------------------------------------------
+// transfer_assembler_emit_txn: Transaction builder callback
+//-----------------------------------------------------------------
+static int transfer_assembler_emit_txn(void *ctx, const tTransaction *txn, const uint8_t *data)
+{
+    return transfer_assembler_add_txn((tTransferAssembler *)ctx, txn, data);
+}
+//-----------------------------------------------------------------
+// transfer_assembler_reset: Close everything in progress
+//-----------------------------------------------------------------
+static int transfer_assembler_reset(tTransferAssembler *xa)
+{
+    int err = 0;
+    int i;
+    int p;
+
+    for (i=0;i<TRANSFER_DEVICES * TRANSFER_ENDPOINTS;i++)
+    {
+        for (p=0;p<2;p++)
+            if (xa->eps[i].pipe[p].open && transfer_close(xa, &xa->eps[i].pipe[p], TRANSFER_INCOMPLETE) != 0)
+                err = -1;
+
+        // Addresses are reassigned after reset
+        xa->eps[i].control = 0;
+        xa->eps[i].pipe[PIPE_OUT].max_packet = 0;
+        xa->eps[i].pipe[PIPE_IN].max_packet  = 0;
+    }
+
+    return err;
+}
+//-----------------------------------------------------------------
+// transfer_assembler_add_record: Feed next decoded record
+//-----------------------------------------------------------------
+int transfer_assembler_add_record(tTransferAssembler *xa, const tLogRecord *rec)
+{
+    if (txn_builder_add(&xa->builder, rec, transfer_assembler_emit_txn, xa) != 0)
+        return -1;
+
+    if (rec->type == LOG_CTRL_TYPE_RST && xa->snoop == &xa->own_snoop)
+        descriptor_snoop_add(&xa->own_snoop, rec);
+
+    // Bus reset aborts all transfers
+    if (rec->type == LOG_CTRL_TYPE_RST && usb_get_rst_state(rec->value))
+        return transfer_assembler_reset(xa);
+
+    return 0;
+}
+//-----------------------------------------------------------------
+// transfer_assembler_flush: End of stream, pass on incomplete
+// transfers
+//-----------------------------------------------------------------
+int transfer_assembler_flush(tTransferAssembler *xa)
+{
+    if (txn_builder_flush(&xa->builder, transfer_assembler_emit_txn, xa) != 0)
+        return -1;
+
+    return transfer_assembler_reset(xa);
+}
+//-----------------------------------------------------------------
+// transfer_assembler_create
+//-----------------------------------------------------------------
+tTransferAssembler* transfer_assembler_create(tTransferEmit emit, void *ctx)
+{
+    tTransferAssembler *xa = (tTransferAssembler *)calloc(1, sizeof(tTransferAssembler));
+    assert(xa);
+
+    txn_builder_init(&xa->builder);
+    descriptor_snoop_init(&xa->own_snoop);
+    xa->snoop = &xa->own_snoop;
+    xa->emit  = emit;
+    xa->ctx   = ctx;
+    return xa;
+}
+//-----------------------------------------------------------------
+// transfer_assembler_set_snoop: Take endpoint descriptors from a
+// snoop the caller feeds (e.g. with traffic not passed on here)
+//-----------------------------------------------------------------
+void transfer_assembler_set_snoop(tTransferAssembler *xa, const tDescriptorSnoop *snoop)
+{
+    xa->snoop = snoop ? snoop : &xa->own_snoop;
+}
+//-----------------------------------------------------------------
+// transfer_assembler_destroy
+//-----------------------------------------------------------------
+void transfer_assembler_destroy(tTransferAssembler *xa)
+{
+    tTxnNode *node;
+    int i;
+    int p;
+
+    for (i=0;i<TRANSFER_DEVICES * TRANSFER_ENDPOINTS;i++)
+        for (p=0;p<2;p++)
+            transfer_release(xa, &xa->eps[i].pipe[p]);
+
+    while ((node = xa->pool) != NULL)
+    {
+        xa->pool = node->next;
+        free(node);
+    }
+
+    free(xa);
+}
+//-----------------------------------------------------------------
+// transfer_type_str
+//-----------------------------------------------------------------
+const char* transfer_type_str(int type)
+{
+    switch (type)
+    {
+        case TRANSFER_CONTROL:   return "CONTROL";
+        case TRANSFER_BULK:      return "BULK";
+        case TRANSFER_ISO:       return "ISO";
+        case TRANSFER_INTERRUPT: return "INTERRUPT";
+        case TRANSFER_BULK_INT:  return "BULK/INT";
+        default:                 return "UNKNOWN";
+    }
+}
+//-----------------------------------------------------------------
+// transfer_status_str
+//-----------------------------------------------------------------
+const char* transfer_status_str(int status)
+{
+    switch (status)
+    {
+        case TRANSFER_OK:         return "OK";
+        case TRANSFER_STALL:      return "STALL";
+        case TRANSFER_INCOMPLETE: return "INCOMPLETE";
+        case TRANSFER_PARTIAL:    return "PARTIAL";
+        default:                  return "UNKNOWN";
+    }
+}
@@ -0,0 +1,87 @@
+#ifndef __TRANSFER_H__
+#define __TRANSFER_H__
+
+//--------------------------------------------------------------------
+// Defines
+//--------------------------------------------------------------------
+// Data transactions held per transfer; longer transfers are passed
+// on in parts (TRANSFER_PARTIAL) to bound memory per endpoint
+#define TRANSFER_MAX_TXNS       64
+
+//--------------------------------------------------------------------
+// Enums
+//--------------------------------------------------------------------
+typedef enum
+{
+    TRANSFER_CONTROL,
+    TRANSFER_BULK,
+    TRANSFER_ISO,
+    TRANSFER_INTERRUPT,
+    TRANSFER_BULK_INT       // Bulk or interrupt, no endpoint descriptor seen
+} tTransferType;
+
+typedef enum
+{
+    TRANSFER_OK,
+    TRANSFER_STALL,
+    TRANSFER_INCOMPLETE,    // Cut short by SETUP, reset or end of capture
+    TRANSFER_PARTIAL        // Part of a transfer, more follows
+} tTransferStatus;
+
+//--------------------------------------------------------------------
+// Structures
+//--------------------------------------------------------------------
+// Pooled data transaction
+typedef struct txn_node
+{
+    tTransaction     txn;
+    struct txn_node *next;
+    uint8_t          data[MAX_PACKET_SIZE];
+} tTxnNode;
+
+// Control / bulk / isochronous transfer on one endpoint
+typedef struct
+{
+    uint64_t  start;        // Time of first transaction
+    uint64_t  end;          // Time of last packet
+    uint32_t  bytes;        // Payload bytes (excl. CRC16)
+    uint16_t  txns;         // Transactions (excl. NAKed)
+    uint16_t  naks;
+    uint8_t   device;
+    uint8_t   endpoint;
+    uint8_t   type;         // tTransferType
+    uint8_t   dir;          // PID_IN / PID_OUT (data stage for control)
+    uint8_t   status;       // tTransferStatus
+    uint8_t   reserved;
+    uint16_t  errors;       // Unanswered / corrupt transactions (retried)
+    uint8_t   setup[8];     // SETUP packet (control only)
+    tTxnNode *first;        // Data transactions (valid during callback)
+} tTransfer;
+
+// Called for each completed transfer
+typedef int (*tTransferEmit)(void *ctx, const tTransfer *xfer);
+
+typedef struct transfer_assembler tTransferAssembler;
+
+//--------------------------------------------------------------------
+// Prototypes
+//--------------------------------------------------------------------
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+tTransferAssembler* transfer_assembler_create(tTransferEmit emit, void *ctx);
+void                transfer_assembler_set_snoop(tTransferAssembler *xa, const tDescriptorSnoop *snoop);
+int                 transfer_assembler_add_record(tTransferAssembler *xa, const tLogRecord *rec);
+int                 transfer_assembler_add_txn(tTransferAssembler *xa, const tTransaction *txn, const uint8_t *data);
+int                 transfer_assembler_flush(tTransferAssembler *xa);
+void                transfer_assembler_destroy(tTransferAssembler *xa);
+
+const char*         transfer_type_str(int type);
+const char*         transfer_status_str(int status);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
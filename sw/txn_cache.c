@@ -0,0 +1,553 @@
+//-----------------------------------------------------------------
+//                       USB Sniffer
+//                           V0.1
+//                     Ultra-Embedded.com
+//                       Copyright 2015
+//
+//               Email: admin@ultra-embedded.com
+//
+//                       License: LGPL
+//-----------------------------------------------------------------
+//
+// Copyright (C) 2011 - 2013 Ultra-Embedded.com
+//
+// This source file may be used and distributed without         
+// restriction provided that this copyright statement is not    
+// removed from the file and that any derivative work contains  
+// the original copyright notice and the associated disclaimer. 
+//
+// This source file is free software; you can redistribute it   
+// and/or modify it under the terms of the GNU Lesser General   
+// Public License as published by the Free Software Foundation; 
+// either version 2.1 of the License, or (at your option) any   
+// later version.
+//
+// This source is distributed in the hope that it will be       
+// useful, but WITHOUT ANY WARRANTY; without even the implied   
+// warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR      
+// PURPOSE.  See the GNU Lesser General Public License for more 
+// details.
+//
+// You should have received a copy of the GNU Lesser General    
+// Public License along with this source; if not, write to the 
+// Free Software Foundation, Inc., 59 Temple Place, Suite 330, 
+// Boston, MA  02111-1307  USA
+//-----------------------------------------------------------------
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <assert.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "usb_defs.h"
+#include "log_format.h"
+#include "log_decode.h"
+#include "capture_filter.h"
+#include "payload_store.h"
+#include "capture_file.h"
+#include "transaction.h"
+#include "txn_cache.h"
+
+//-----------------------------------------------------------------
+// Structures
+//-----------------------------------------------------------------
+struct txn_segment_ref
+{
+    uint64_t            first;      // Index of first transaction
+    uint32_t            count;
+    const tTransaction *txns;
+};
+
+struct txn_cache
+{
+    tTxnCacheHeader         hdr;
+
+    // Mapped sidecar
+    const uint8_t          *map;
+    size_t                  map_size;
+    struct txn_segment_ref *segs;
+    uint32_t                seg_count;
+};
+
+// Segment being built
+struct txn_writer
+{
+    FILE         *file;
+    uint64_t      pos;          // File offset of next segment
+    uint64_t      total;        // Transactions written
+    uint32_t      segments;
+
+    tTransaction *txns;
+    uint32_t      count;
+    uint8_t      *heap;
+    uint64_t      heap_size;
+    uint64_t      heap_alloc;
+};
+
+//-----------------------------------------------------------------
+// txn_cache_hash_source: Hash of the capture after each block, over
+// the file header and each block header with its offset (payloads
+// are not read). hashes[0] covers the header only, hashes[n] the
+// first n blocks.
+//-----------------------------------------------------------------
+static int txn_cache_hash_source(const char *filename, uint64_t **hashes, uint32_t *blocks)
+{
+    FILE *f;
+    tCaptureFile *cap;
+    tCaptureBlock blk;
+    uint64_t offset;
+    uint32_t key[3];
+    uint32_t alloc = 1024;
+    uint64_t h;
+    int res;
+
+    f = fopen(filename, "rb");
+    if (!f)
+    {
+        fprintf(stderr, "ERROR: Could not open %s\n", filename);
+        return -1;
+    }
+
+    cap = capture_file_open(f);
+    if (!cap)
+    {
+        fclose(f);
+        return -1;
+    }
+
+    key[0] = capture_file_speed(cap);
+    key[1] = capture_file_flags(cap);
+    key[2] = capture_file_codec(cap);
+    h = payload_hash((const uint8_t *)key, sizeof(key), 0);
+    h = payload_hash((const uint8_t *)capture_file_info(cap), sizeof(tCaptureInfo), h);
+
+    *hashes = (uint64_t *)malloc(alloc * sizeof(uint64_t));
+    assert(*hashes);
+    (*hashes)[0] = h;
+    *blocks = 0;
+
+    while ((res = capture_file_next_header(cap, &blk, &offset)) > 0)
+    {
+        h = payload_hash((const uint8_t *)&offset, sizeof(offset), h);
+        h = payload_hash((const uint8_t *)&blk, sizeof(blk), h);
+
+        if (++(*blocks) >= alloc)
+        {
+            alloc *= 2;
+            *hashes = (uint64_t *)realloc(*hashes, alloc * sizeof(uint64_t));
+            assert(*hashes);
+        }
+        (*hashes)[*blocks] = h;
+    }
+
+    capture_file_close(cap);
+    fclose(f);
+
+    if (res < 0)
+    {
+        free(*hashes);
+        *hashes = NULL;
+        return -1;
+    }
+
+    return 0;
+}
+//-----------------------------------------------------------------
+// txn_writer_flush: Append buffered transactions as a segment
+//-----------------------------------------------------------------
+static int txn_writer_flush(struct txn_writer *w)
+{
+    tTxnSegment seg;
+    uint64_t heap_base;
+    uint32_t i;
+
+    if (w->count == 0)
+        return 0;
+
+    seg.magic     = TXN_SEGMENT_MAGIC;
+    seg.count     = w->count;
+    seg.heap_size = w->heap_size;
+
+    // Payload offsets were heap relative until now
+    heap_base = w->pos + sizeof(seg) + (uint64_t)w->count * sizeof(tTransaction);
+    for (i=0;i<w->count;i++)
+        if (w->txns[i].length)
+            w->txns[i].payload += heap_base;
+
+    if (fwrite(&seg, sizeof(seg), 1, w->file) != 1 ||
+        fwrite(w->txns, sizeof(tTransaction), w->count, w->file) != w->count ||
+        (w->heap_size && fwrite(w->heap, 1, w->heap_size, w->file) != w->heap_size))
+    {
+        fprintf(stderr, "ERROR: Could not write transaction cache\n");
+        return -1;
+    }
+
+    w->pos      = heap_base + w->heap_size;
+    w->total   += w->count;
+    w->segments++;
+    w->count     = 0;
+    w->heap_size = 0;
+    return 0;
+}
+//-----------------------------------------------------------------
+// txn_writer_emit: Builder callback - buffer one transaction
+//-----------------------------------------------------------------
+static int txn_writer_emit(void *ctx, const tTransaction *txn, const uint8_t *data)
+{
+    struct txn_writer *w = (struct txn_writer *)ctx;
+    tTransaction *t = &w->txns[w->count++];
+
+    *t = *txn;
+    t->payload = 0;
+
+    if (t->length)
+    {
+        // Padded so segments stay 8 byte aligned in the mapping
+        uint32_t size = (t->length + 7) & ~7;
+
+        if (w->heap_size + size > w->heap_alloc)
+        {
+            while (w->heap_size + size > w->heap_alloc)
+                w->heap_alloc = w->heap_alloc ? w->heap_alloc * 2 : (1 << 20);
+            w->heap = (uint8_t *)realloc(w->heap, w->heap_alloc);
+            assert(w->heap);
+        }
+
+        memcpy(w->heap + w->heap_size, data, t->length);
+        memset(w->heap + w->heap_size + t->length, 0, size - t->length);
+        t->payload    = w->heap_size;
+        w->heap_size += size;
+    }
+
+    if (w->count == TXN_SEGMENT_RECORDS)
+        return txn_writer_flush(w);
+
+    return 0;
+}
+//-----------------------------------------------------------------
+// txn_cache_build: Pair the records of capture blocks from
+// hdr->source_blocks up to blocks, appending segments at
+// hdr->file_size
+//-----------------------------------------------------------------
+static int txn_cache_build(const char *filename, FILE *sidecar, tTxnCacheHeader *hdr, uint32_t blocks)
+{
+    struct txn_writer w;
+    tTxnBuilder builder;
+    tLogDecoder dec;
+    tLogRecord rec;
+    tCaptureFile *cap;
+    tCaptureBlock blk;
+    uint32_t *words;
+    uint32_t block;
+    FILE *f;
+    int count;
+    int idx;
+    int res = 0;
+    int err = 0;
+
+    f = fopen(filename, "rb");
+    if (!f)
+    {
+        fprintf(stderr, "ERROR: Could not open %s\n", filename);
+        return -1;
+    }
+
+    cap = capture_file_open(f);
+    if (!cap)
+    {
+        fclose(f);
+        return -1;
+    }
+
+    memset(&w, 0, sizeof(w));
+    w.file  = sidecar;
+    w.pos   = hdr->file_size;
+    w.total = hdr->count;
+    w.segments = hdr->segments;
+    w.txns  = (tTransaction *)malloc(TXN_SEGMENT_RECORDS * sizeof(tTransaction));
+    assert(w.txns);
+
+    // Resume pairing where the last build stopped
+    txn_builder_init(&builder);
+    builder.open  = hdr->open;
+    builder.cur   = hdr->pending;
+    builder.frame = hdr->frame;
+    memcpy(builder.data, hdr->pending_data, sizeof(builder.data));
+
+    capture_file_set_start(cap, hdr->source_blocks);
+
+    // Blocks appended since the capture was hashed are left for later
+    for (block = hdr->source_blocks; !err && block < blocks && (res = capture_file_next_block(cap, &blk)) > 0; block++)
+    {
+        count = capture_file_read_block(cap, &blk, &words);
+        if (count < 0)
+        {
+            err = -1;
+            break;
+        }
+
+        capture_file_block_decoder(cap, &blk, &dec);
+
+        for (idx = 0; idx < count && !err; idx += rec.words)
+        {
+            if (log_decode_next(&dec, words + idx, count - idx, &rec) <= 0)
+                err = -1;
+            else
+                err = txn_builder_add(&builder, &rec, txn_writer_emit, &w);
+        }
+    }
+
+    if (!err && res < 0)
+        err = -1;
+
+    if (!err)
+        err = txn_writer_flush(&w);
+
+    if (!err)
+    {
+        hdr->count     = w.total;
+        hdr->segments  = w.segments;
+        hdr->file_size = w.pos;
+        hdr->open      = builder.open;
+        hdr->pending   = builder.cur;
+        hdr->frame     = builder.frame;
+        memcpy(hdr->pending_data, builder.data, sizeof(hdr->pending_data));
+    }
+
+    free(w.txns);
+    free(w.heap);
+    capture_file_close(cap);
+    fclose(f);
+    return err;
+}
+//-----------------------------------------------------------------
+// txn_cache_update: Bring the sidecar up to date with the capture.
+// A sidecar built from a prefix of the capture is extended, one
+// which does not match is rebuilt.
+//-----------------------------------------------------------------
+static int txn_cache_update(const char *filename, const char *path, tTxnCacheHeader *hdr)
+{
+    uint64_t *hashes;
+    uint32_t blocks;
+    FILE *f;
+    int valid;
+    int err;
+
+    if (txn_cache_hash_source(filename, &hashes, &blocks) != 0)
+        return -1;
+
+    f = fopen(path, "r+b");
+    valid = f && fread(hdr, sizeof(*hdr), 1, f) == 1 &&
+            hdr->magic == TXN_CACHE_MAGIC &&
+            hdr->version == TXN_CACHE_VERSION &&
+            hdr->source_blocks <= blocks &&
+            hdr->source_hash == hashes[hdr->source_blocks];
+
+    // Up to date
+    if (valid && hdr->source_blocks == blocks)
+    {
+        free(hashes);
+        fclose(f);
+        return 0;
+    }
+
+    if (valid)
+        err = ftruncate(fileno(f), hdr->file_size);
+    else
+    {
+        if (f)
+            fclose(f);
+
+        f = fopen(path, "w+b");
+        if (!f)
+        {
+            fprintf(stderr, "ERROR: Could not create %s\n", path);
+            free(hashes);
+            return -1;
+        }
+
+        memset(hdr, 0, sizeof(*hdr));
+        hdr->version   = TXN_CACHE_VERSION;
+        hdr->source_hash = hashes[0];
+        hdr->file_size = sizeof(*hdr);
+        err = 0;
+    }
+
+    // Header is only marked valid once the new segments are in place
+    hdr->magic = 0;
+    if (!err && (fseek(f, 0, SEEK_SET) != 0 || fwrite(hdr, sizeof(*hdr), 1, f) != 1 || fflush(f) != 0))
+        err = -1;
+
+    if (!err && fseek(f, hdr->file_size, SEEK_SET) != 0)
+        err = -1;
+
+    if (!err)
+        err = txn_cache_build(filename, f, hdr, blocks);
+
+    if (!err)
+    {
+        hdr->magic         = TXN_CACHE_MAGIC;
+        hdr->source_blocks = blocks;
+        hdr->source_hash   = hashes[blocks];
+
+        if (fseek(f, 0, SEEK_SET) != 0 || fwrite(hdr, sizeof(*hdr), 1, f) != 1)
+            err = -1;
+    }
+
+    if (fclose(f) != 0)
+        err = -1;
+
+    if (err)
+        fprintf(stderr, "ERROR: Could not update %s\n", path);
+
+    free(hashes);
+    return err;
+}
+//-----------------------------------------------------------------
+// txn_cache_map: Map sidecar and index its segments
+//-----------------------------------------------------------------
+static int txn_cache_map(tTxnCache *cache, const char *path)
+{
+    const tTxnSegment *seg;
+    struct stat st;
+    uint64_t pos;
+    uint64_t first = 0;
+    void *map;
+    FILE *f;
+    uint32_t i;
+
+    f = fopen(path, "rb");
+    if (!f)
+        return -1;
+
+    if (fstat(fileno(f), &st) != 0 || (uint64_t)st.st_size < cache->hdr.file_size)
+    {
+        fclose(f);
+        return -1;
+    }
+
+    map = mmap(NULL, cache->hdr.file_size, PROT_READ, MAP_PRIVATE, fileno(f), 0);
+    fclose(f);
+    if (map == MAP_FAILED)
+        return -1;
+
+    cache->map       = (const uint8_t *)map;
+    cache->map_size  = cache->hdr.file_size;
+    cache->seg_count = cache->hdr.segments;
+    cache->segs      = (struct txn_segment_ref *)calloc(cache->seg_count + 1, sizeof(struct txn_segment_ref));
+    assert(cache->segs);
+
+    pos = sizeof(tTxnCacheHeader);
+    for (i=0;i<cache->seg_count;i++)
+    {
+        if (pos + sizeof(*seg) > cache->map_size)
+            return -1;
+
+        seg = (const tTxnSegment *)(cache->map + pos);
+        if (seg->magic != TXN_SEGMENT_MAGIC)
+            return -1;
+
+        cache->segs[i].first = first;
+        cache->segs[i].count = seg->count;
+        cache->segs[i].txns  = (const tTransaction *)(seg + 1);
+
+        first += seg->count;
+        pos   += sizeof(*seg) + (uint64_t)seg->count * sizeof(tTransaction) + seg->heap_size;
+        if (pos > cache->map_size)
+            return -1;
+    }
+
+    return first == cache->hdr.count ? 0 : -1;
+}
+//-----------------------------------------------------------------
+// txn_cache_open: Transactions of a capture file, from its sidecar
+// (built or extended first if missing / stale)
+//-----------------------------------------------------------------
+tTxnCache* txn_cache_open(const char *capture_file)
+{
+    tTxnCache *cache;
+    char *path;
+
+    path = (char *)malloc(strlen(capture_file) + sizeof(TXN_CACHE_SUFFIX));
+    assert(path);
+    sprintf(path, "%s%s", capture_file, TXN_CACHE_SUFFIX);
+
+    cache = (tTxnCache *)calloc(1, sizeof(tTxnCache));
+    assert(cache);
+
+    if (txn_cache_update(capture_file, path, &cache->hdr) != 0)
+    {
+        free(cache);
+        free(path);
+        return NULL;
+    }
+
+    if (txn_cache_map(cache, path) != 0)
+    {
+        fprintf(stderr, "ERROR: Corrupt transaction cache %s\n", path);
+        txn_cache_close(cache);
+        free(path);
+        return NULL;
+    }
+
+    free(path);
+    return cache;
+}
+//-----------------------------------------------------------------
+// txn_cache_count: Number of transactions (including one left
+// open at the end of the capture)
+//-----------------------------------------------------------------
+uint64_t txn_cache_count(tTxnCache *cache)
+{
+    return cache->hdr.count + (cache->hdr.open ? 1 : 0);
+}
+//-----------------------------------------------------------------
+// txn_cache_get: Transaction by index
+//-----------------------------------------------------------------
+const tTransaction* txn_cache_get(tTxnCache *cache, uint64_t idx)
+{
+    uint32_t lo = 0;
+    uint32_t hi = cache->seg_count;
+    uint32_t mid;
+
+    if (idx >= cache->hdr.count)
+        return (idx == cache->hdr.count && cache->hdr.open) ? &cache->hdr.pending : NULL;
+
+    // Last segment starting at or before idx
+    while (hi - lo > 1)
+    {
+        mid = (lo + hi) / 2;
+        if (cache->segs[mid].first <= idx)
+            lo = mid;
+        else
+            hi = mid;
+    }
+
+    return &cache->segs[lo].txns[idx - cache->segs[lo].first];
+}
+//-----------------------------------------------------------------
+// txn_cache_payload: Data payload of a transaction (incl. CRC16)
+//-----------------------------------------------------------------
+const uint8_t* txn_cache_payload(tTxnCache *cache, const tTransaction *txn)
+{
+    if (!txn->length)
+        return NULL;
+
+    if (txn == &cache->hdr.pending)
+        return cache->hdr.pending_data;
+
+    return cache->map + txn->payload;
+}
+//-----------------------------------------------------------------
+// txn_cache_close
+//-----------------------------------------------------------------
+void txn_cache_close(tTxnCache *cache)
+{
+    if (cache->map)
+        munmap((void *)cache->map, cache->map_size);
+    free(cache->segs);
+    free(cache);
+}
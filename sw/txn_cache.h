@@ -0,0 +1,67 @@
+#ifndef __TXN_CACHE_H__
+#define __TXN_CACHE_H__
+
+//--------------------------------------------------------------------
+// Defines
+//--------------------------------------------------------------------
+#define TXN_CACHE_MAGIC         0x4E585455  // "UTXN"
+#define TXN_SEGMENT_MAGIC       0x53585455  // "UTXS"
+#define TXN_CACHE_VERSION       3
+
+// Sidecar file name is the capture path plus this suffix
+#define TXN_CACHE_SUFFIX        ".txn"
+
+// Transactions per segment (segments are appended as the cache grows)
+#define TXN_SEGMENT_RECORDS     (64 * 1024)
+
+//--------------------------------------------------------------------
+// Structures
+//--------------------------------------------------------------------
+// Sidecar header, rewritten after each build / extension
+typedef struct
+{
+    uint32_t magic;
+    uint16_t version;
+    uint16_t open;          // Transaction open at end of capture
+    uint32_t source_blocks; // Capture blocks covered
+    uint32_t segments;
+    uint64_t source_hash;   // Hash of covered capture block headers
+    uint64_t count;         // Complete transactions in segments
+    uint64_t file_size;     // End of last segment
+
+    // Builder state at end of covered blocks
+    uint16_t frame;
+    uint16_t reserved[3];
+    tTransaction pending;
+    uint8_t  pending_data[MAX_PACKET_SIZE];
+} tTxnCacheHeader;
+
+// Segment header, followed by count transactions then heap_size bytes
+// of payloads (tTransaction.payload is an offset into the sidecar)
+typedef struct
+{
+    uint32_t magic;
+    uint32_t count;
+    uint64_t heap_size;
+} tTxnSegment;
+
+typedef struct txn_cache tTxnCache;
+
+//--------------------------------------------------------------------
+// Prototypes
+//--------------------------------------------------------------------
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+tTxnCache*          txn_cache_open(const char *capture_file);
+uint64_t            txn_cache_count(tTxnCache *cache);
+const tTransaction* txn_cache_get(tTxnCache *cache, uint64_t idx);
+const uint8_t*      txn_cache_payload(tTxnCache *cache, const tTransaction *txn);
+void                txn_cache_close(tTxnCache *cache);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,776 @@
+//-----------------------------------------------------------------
+//                       USB Sniffer
+//                           V0.1
+//                     Ultra-Embedded.com
+//                       Copyright 2015
+//
+//               Email: admin@ultra-embedded.com
+//
+//                       License: LGPL
+//-----------------------------------------------------------------
+//
+// Copyright (C) 2011 - 2013 Ultra-Embedded.com
+//
+// This source file may be used and distributed without         
+// restriction provided that this copyright statement is not    
+// removed from the file and that any derivative work contains  
+// the original copyright notice and the associated disclaimer. 
+//
+// This source file is free software; you can redistribute it   
+// and/or modify it under the terms of the GNU Lesser General   
+// Public License as published by the Free Software Foundation; 
+// either version 2.1 of the License, or (at your option) any   
+// later version.
+//
+// This source is distributed in the hope that it will be       
+// useful, but WITHOUT ANY WARRANTY; without even the implied   
+// warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR      
+// PURPOSE.  See the GNU Lesser General Public License for more 
+// details.
+//
+// You should have received a copy of the GNU Lesser General    
+// Public License along with this source; if not, write to the 
+// Free Software Foundation, Inc., 59 Temple Place, Suite 330, 
+// Boston, MA  02111-1307  USA
+//-----------------------------------------------------------------
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <assert.h>
+
+#include "usb_defs.h"
+#include "usb_helpers.h"
+#include "log_format.h"
+#include "log_decode.h"
+#include "capture_filter.h"
+#include "payload_store.h"
+#include "transaction.h"
+#include "txn_cache.h"
+#include "txn_diff.h"
+
+//-----------------------------------------------------------------
+// Both captures are reduced to one sequence per endpoint of the
+// transactions that carry meaning: NAKed, unanswered, corrupted and
+// PING transactions are dropped, DATA0/DATA1 and ACK/NYET are not told
+// apart and timing is ignored. Each transaction becomes a 64-bit hash
+// and the sequences are aligned on hashes: common prefix / suffix are
+// trimmed, the rest is diffed with Myers' O(ND) algorithm, and
+// regions too different for that are split on windows of
+// transactions that occur once in each side (found with a rolling
+// hash) before diffing the pieces between them. What is left after
+// that is reported as removed and added, not paired up.
+//-----------------------------------------------------------------
+
+//-----------------------------------------------------------------
+// Defines
+//-----------------------------------------------------------------
+#define DIFF_STREAMS            (128 * 16)
+#define DIFF_ROLL_MUL           0x100000001B3ULL
+
+//-----------------------------------------------------------------
+// Structures
+//-----------------------------------------------------------------
+// Normalised transactions of one endpoint
+struct diff_stream
+{
+    uint64_t *hash;
+    uint64_t *idx;          // Transaction index in cache
+    int       count;
+    int       size;
+};
+
+// Region differing between the sides (stream positions)
+struct diff_hunk
+{
+    int a;
+    int alen;
+    int b;
+    int blen;
+    int unaligned;          // No alignment found, sides not paired
+};
+
+struct diff_anchor
+{
+    uint64_t key;
+    int      a_pos;
+    int      b_pos;
+    int      a_count;
+    int      b_count;
+};
+
+struct diff_ctx
+{
+    const uint64_t   *A;
+    const uint64_t   *B;
+
+    struct diff_hunk *hunks;
+    int               count;
+    int               size;
+
+    // Myers furthest points, forward and backward (by diagonal)
+    int              *fv;
+    int              *bv;
+    int               v_size;
+    int64_t           work;
+};
+
+struct diff_side
+{
+    tTxnCache          *cache;
+    struct diff_stream  streams[DIFF_STREAMS];
+};
+
+//-----------------------------------------------------------------
+// diff_keep: Transaction survives normalisation
+//-----------------------------------------------------------------
+static int diff_keep(const tTransaction *txn)
+{
+    if (!txn->token || txn->token == PID_PING || txn->hshake == PID_NAK)
+        return 0;
+
+    if (txn->flags & TXN_FLAG_CRC_ERROR)
+        return 0;
+
+    return txn->data || txn->hshake;
+}
+//-----------------------------------------------------------------
+// diff_txn_hash: Identity of a normalised transaction
+//-----------------------------------------------------------------
+static uint64_t diff_txn_hash(tTxnCache *cache, const tTransaction *txn)
+{
+    uint8_t hshake = (txn->hshake == PID_NYET) ? PID_ACK : txn->hshake;
+    uint64_t seed = ((uint64_t)txn->token << 16) | ((uint64_t)hshake << 8) | (txn->data ? 1 : 0);
+    int length = (txn->length >= 2) ? (txn->length - 2) : 0;
+
+    return payload_hash(length ? txn_cache_payload(cache, txn) : NULL, length, seed);
+}
+//-----------------------------------------------------------------
+// diff_load: Split cache into per endpoint hash sequences
+//-----------------------------------------------------------------
+static int diff_load(struct diff_side *side, const tCaptureFilter *filter)
+{
+    uint64_t count = txn_cache_count(side->cache);
+    uint64_t i;
+
+    for (i=0;i<count;i++)
+    {
+        const tTransaction *txn = txn_cache_get(side->cache, i);
+        struct diff_stream *s;
+
+        if (!diff_keep(txn) || !txn_match_filter(filter, txn))
+            continue;
+
+        s = &side->streams[(txn->device & 0x7F) * 16 + (txn->endpoint & 0xF)];
+        if (s->count == s->size)
+        {
+            if (s->size >= 0x40000000)
+            {
+                fprintf(stderr, "ERROR: Too many transactions on endpoint\n");
+                return -1;
+            }
+
+            s->size = s->size ? s->size * 2 : 1024;
+            s->hash = (uint64_t *)realloc(s->hash, s->size * sizeof(uint64_t));
+            s->idx  = (uint64_t *)realloc(s->idx, s->size * sizeof(uint64_t));
+            assert(s->hash && s->idx);
+        }
+
+        s->hash[s->count] = diff_txn_hash(side->cache, txn);
+        s->idx[s->count]  = i;
+        s->count++;
+    }
+
+    return 0;
+}
+//-----------------------------------------------------------------
+// diff_add_hunk: Append region, merged with an adjoining one
+//-----------------------------------------------------------------
+static void diff_add_hunk(struct diff_ctx *ctx, int a, int alen, int b, int blen)
+{
+    struct diff_hunk *h;
+
+    if (!alen && !blen)
+        return;
+
+    if (ctx->count)
+    {
+        h = &ctx->hunks[ctx->count - 1];
+        if (h->a + h->alen == a && h->b + h->blen == b)
+        {
+            h->alen += alen;
+            h->blen += blen;
+            return;
+        }
+    }
+
+    if (ctx->count == ctx->size)
+    {
+        ctx->size  = ctx->size ? ctx->size * 2 : 64;
+        ctx->hunks = (struct diff_hunk *)realloc(ctx->hunks, ctx->size * sizeof(struct diff_hunk));
+        assert(ctx->hunks);
+    }
+
+    h = &ctx->hunks[ctx->count++];
+    h->a         = a;
+    h->alen      = alen;
+    h->b         = b;
+    h->blen      = blen;
+    h->unaligned = 0;
+}
+//-----------------------------------------------------------------
+// diff_snake: Middle snake of A[a0,a1) / B[b0,b1) (both non-empty,
+// differing first and last), found by running Myers forward and
+// backward until the paths meet. Returns -1 if over DIFF_MAX_WORK.
+//-----------------------------------------------------------------
+static int diff_snake(struct diff_ctx *ctx, int a0, int a1, int b0, int b1, int *sx, int *sy, int *ex, int *ey)
+{
+    const uint64_t *A = ctx->A + a0;
+    const uint64_t *B = ctx->B + b0;
+    int n = a1 - a0;
+    int m = b1 - b0;
+    int delta = n - m;
+    int odd = delta & 1;
+    int max = (n + m + 1) / 2;
+    int *fv = ctx->fv + max + 1;
+    int *bv = ctx->bv + max + 1;
+    int d, k, x, y, x0;
+
+    // Forward: furthest x on diagonal k = x - y. Backward: the same
+    // counted from (n, m), on diagonal k of the reversed sequences
+    fv[1] = 0;
+    bv[1] = 0;
+
+    for (d = 0; d <= max; d++)
+    {
+        for (k = -d; k <= d; k += 2)
+        {
+            if (k == -d || (k != d && fv[k - 1] < fv[k + 1]))
+                x = fv[k + 1];
+            else
+                x = fv[k - 1] + 1;
+
+            y  = x - k;
+            x0 = x;
+            while (x < n && y < m && A[x] == B[y])
+            {
+                x++;
+                y++;
+            }
+            ctx->work += 1 + x - x0;
+            fv[k] = x;
+
+            if (odd && (delta - k) >= -(d - 1) && (delta - k) <= (d - 1) && x + bv[delta - k] >= n)
+            {
+                *sx = x0;
+                *sy = x0 - k;
+                *ex = x;
+                *ey = y;
+                return 0;
+            }
+        }
+
+        for (k = -d; k <= d; k += 2)
+        {
+            if (k == -d || (k != d && bv[k - 1] < bv[k + 1]))
+                x = bv[k + 1];
+            else
+                x = bv[k - 1] + 1;
+
+            y  = x - k;
+            x0 = x;
+            while (x < n && y < m && A[n - 1 - x] == B[m - 1 - y])
+            {
+                x++;
+                y++;
+            }
+            ctx->work += 1 + x - x0;
+            bv[k] = x;
+
+            if (!odd && (delta - k) >= -d && (delta - k) <= d && x + fv[delta - k] >= n)
+            {
+                *sx = n - x;
+                *sy = m - y;
+                *ex = n - x0;
+                *ey = m - (x0 - k);
+                return 0;
+            }
+        }
+
+        if (ctx->work > DIFF_MAX_WORK)
+            return -1;
+    }
+
+    return -1;
+}
+//-----------------------------------------------------------------
+// diff_myers_range: Shortest edit script of A[a0,a1) / B[b0,b1) in
+// linear space, split on middle snakes
+//-----------------------------------------------------------------
+static int diff_myers_range(struct diff_ctx *ctx, int a0, int a1, int b0, int b1)
+{
+    int sx, sy, ex, ey;
+
+    while (a0 < a1 && b0 < b1 && ctx->A[a0] == ctx->B[b0])
+    {
+        a0++;
+        b0++;
+    }
+
+    while (a0 < a1 && b0 < b1 && ctx->A[a1 - 1] == ctx->B[b1 - 1])
+    {
+        a1--;
+        b1--;
+    }
+
+    if (a0 == a1 || b0 == b1)
+    {
+        diff_add_hunk(ctx, a0, a1 - a0, b0, b1 - b0);
+        return 0;
+    }
+
+    if (diff_snake(ctx, a0, a1, b0, b1, &sx, &sy, &ex, &ey) != 0)
+        return -1;
+
+    if (diff_myers_range(ctx, a0, a0 + sx, b0, b0 + sy) != 0)
+        return -1;
+
+    return diff_myers_range(ctx, a0 + ex, a1, b0 + ey, b1);
+}
+//-----------------------------------------------------------------
+// diff_myers: Shortest edit script of A[a0,a1) / B[b0,b1), or -1
+// (nothing added) if more than DIFF_MAX_WORK steps needed
+//-----------------------------------------------------------------
+static int diff_myers(struct diff_ctx *ctx, int a0, int a1, int b0, int b1)
+{
+    struct diff_hunk last;
+    int count = ctx->count;
+    int size = (a1 - a0) + (b1 - b0) + 4;
+
+    if (size > ctx->v_size)
+    {
+        ctx->fv = (int *)realloc(ctx->fv, size * sizeof(int));
+        ctx->bv = (int *)realloc(ctx->bv, size * sizeof(int));
+        assert(ctx->fv && ctx->bv);
+        ctx->v_size = size;
+    }
+
+    // Hunks added are taken back on failure (the first may have been
+    // merged into the one before)
+    if (count)
+        last = ctx->hunks[count - 1];
+
+    ctx->work = 0;
+    if (diff_myers_range(ctx, a0, a1, b0, b1) == 0)
+        return 0;
+
+    ctx->count = count;
+    if (count)
+        ctx->hunks[count - 1] = last;
+    return -1;
+}
+
+static void diff_range(struct diff_ctx *ctx, int a0, int a1, int b0, int b1);
+
+//-----------------------------------------------------------------
+// diff_anchor_cmp: Order anchors by position in A
+//-----------------------------------------------------------------
+static int diff_anchor_cmp(const void *a, const void *b)
+{
+    const struct diff_anchor *x = (const struct diff_anchor *)a;
+    const struct diff_anchor *y = (const struct diff_anchor *)b;
+
+    return (x->a_pos > y->a_pos) - (x->a_pos < y->a_pos);
+}
+//-----------------------------------------------------------------
+// diff_anchors: Split a region on windows found exactly once on
+// each side, in increasing order on both (patience diff on windows).
+// Returns -1 if there are none.
+//-----------------------------------------------------------------
+static int diff_anchors(struct diff_ctx *ctx, int a0, int a1, int b0, int b1, int window)
+{
+    struct diff_anchor *table;
+    struct diff_anchor *list;
+    int *tails;
+    int *links;
+    uint64_t pow = 1;
+    uint64_t sample;
+    uint64_t h;
+    uint32_t size = 1024;
+    uint32_t used = 0;
+    int count = 0;
+    int chain = 0;
+    int ca, cb;
+    int pass;
+    int i;
+    uint32_t j;
+
+    if (a1 - a0 < window || b1 - b0 < window)
+        return -1;
+
+    // Content defined sampling keeps the table bounded: both sides
+    // select the same windows
+    sample = ((uint64_t)(b1 - b0) + DIFF_MAX_ANCHORS - 1) / DIFF_MAX_ANCHORS;
+    while (size < 2 * ((uint64_t)(b1 - b0) / sample + 1))
+        size *= 2;
+
+    table = (struct diff_anchor *)calloc(size, sizeof(struct diff_anchor));
+    assert(table);
+
+    for (i=0;i<window;i++)
+        pow *= DIFF_ROLL_MUL;
+
+    // Pass 0 counts B windows, pass 1 A windows
+    for (pass = 0; pass < 2; pass++)
+    {
+        const uint64_t *S = pass ? ctx->A : ctx->B;
+        int s0 = pass ? a0 : b0;
+        int s1 = pass ? a1 : b1;
+
+        h = 0;
+        for (i = s0; i < s1; i++)
+        {
+            h = h * DIFF_ROLL_MUL + S[i];
+            if (i - s0 >= window)
+                h -= pow * S[i - window];
+
+            if (i - s0 < window - 1 || ((h >> 17) % sample) != 0)
+                continue;
+
+            for (j = (uint32_t)(h ^ (h >> 32)) & (size - 1);; j = (j + 1) & (size - 1))
+            {
+                struct diff_anchor *e = &table[j];
+
+                if (e->b_count && e->key != h)
+                    continue;
+
+                if (!pass)
+                {
+                    // Table full enough, later windows not anchored
+                    if (!e->b_count && used++ >= size / 2)
+                        break;
+
+                    e->key   = h;
+                    e->b_pos = i - window + 1;
+                    e->b_count++;
+                }
+                else if (e->b_count)
+                {
+                    e->a_pos = i - window + 1;
+                    e->a_count++;
+                }
+                break;
+            }
+        }
+    }
+
+    // Unique on both sides and really equal
+    list = table;
+    for (j=0;j<size;j++)
+    {
+        struct diff_anchor *e = &table[j];
+
+        if (e->a_count == 1 && e->b_count == 1 &&
+            memcmp(ctx->A + e->a_pos, ctx->B + e->b_pos, window * sizeof(uint64_t)) == 0)
+            list[count++] = *e;
+    }
+
+    if (!count)
+    {
+        free(table);
+        return -1;
+    }
+
+    qsort(list, count, sizeof(struct diff_anchor), diff_anchor_cmp);
+
+    // Longest chain increasing in B (patience sorting)
+    tails = (int *)malloc(count * sizeof(int));
+    links = (int *)malloc(count * sizeof(int));
+    assert(tails && links);
+
+    for (i=0;i<count;i++)
+    {
+        int lo = 0;
+        int hi = chain;
+
+        while (lo < hi)
+        {
+            int mid = (lo + hi) / 2;
+            if (list[tails[mid]].b_pos < list[i].b_pos)
+                lo = mid + 1;
+            else
+                hi = mid;
+        }
+
+        links[i] = lo ? tails[lo - 1] : -1;
+        tails[lo] = i;
+        if (lo == chain)
+            chain++;
+    }
+
+    // Chain back to front into tails[]
+    for (i = chain - 1, j = tails[chain - 1]; i >= 0; i--, j = links[j])
+        tails[i] = j;
+
+    ca = a0;
+    cb = b0;
+    for (i=0;i<chain;i++)
+    {
+        struct diff_anchor *e = &list[tails[i]];
+        int x = e->a_pos;
+        int y = e->b_pos;
+
+        // Overlaps the previous anchor's match off its diagonal
+        if (x < ca || y < cb)
+            continue;
+
+        diff_range(ctx, ca, x, cb, y);
+
+        while (x < a1 && y < b1 && ctx->A[x] == ctx->B[y])
+        {
+            x++;
+            y++;
+        }
+        ca = x;
+        cb = y;
+    }
+
+    diff_range(ctx, ca, a1, cb, b1);
+
+    free(tails);
+    free(links);
+    free(table);
+    return 0;
+}
+//-----------------------------------------------------------------
+// diff_range: Align A[a0,a1) with B[b0,b1), adding hunks in order
+//-----------------------------------------------------------------
+static void diff_range(struct diff_ctx *ctx, int a0, int a1, int b0, int b1)
+{
+    int window;
+
+    // Common prefix / suffix
+    while (a0 < a1 && b0 < b1 && ctx->A[a0] == ctx->B[b0])
+    {
+        a0++;
+        b0++;
+    }
+
+    while (a0 < a1 && b0 < b1 && ctx->A[a1 - 1] == ctx->B[b1 - 1])
+    {
+        a1--;
+        b1--;
+    }
+
+    if (a0 == a1 || b0 == b1)
+    {
+        diff_add_hunk(ctx, a0, a1 - a0, b0, b1 - b0);
+        return;
+    }
+
+    if (diff_myers(ctx, a0, a1, b0, b1) == 0)
+        return;
+
+    // Repetitive sequences need longer windows to find unique ones
+    for (window = DIFF_WINDOW; window <= DIFF_MAX_WINDOW; window *= 4)
+        if (diff_anchors(ctx, a0, a1, b0, b1, window) == 0)
+            return;
+
+    // Nothing in common found, positions say nothing about pairing
+    diff_add_hunk(ctx, a0, a1 - a0, b0, b1 - b0);
+    ctx->hunks[ctx->count - 1].unaligned = 1;
+}
+//-----------------------------------------------------------------
+// diff_print_txn
+//-----------------------------------------------------------------
+static void diff_print_txn(FILE *f, char mark, const tTransaction *txn)
+{
+    char line[128];
+
+    txn_describe(txn, line, sizeof(line));
+    fprintf(f, "%c %s\n", mark, line);
+}
+//-----------------------------------------------------------------
+// diff_print_pair: Transactions at the same place in both captures.
+// Returns 1 if only the payload differs.
+//-----------------------------------------------------------------
+static int diff_print_pair(FILE *f, struct diff_side *sa, const tTransaction *ta,
+                           struct diff_side *sb, const tTransaction *tb)
+{
+    const uint8_t *pa;
+    const uint8_t *pb;
+    int length;
+    int count = 0;
+    int i;
+
+    if (ta->token != tb->token || ta->length != tb->length || !ta->data != !tb->data)
+    {
+        diff_print_txn(f, '-', ta);
+        diff_print_txn(f, '+', tb);
+        return 0;
+    }
+
+    // Handshake only (e.g. ACK vs STALL)
+    length = (ta->length >= 2) ? (ta->length - 2) : 0;
+    if (!length)
+    {
+        diff_print_txn(f, '-', ta);
+        diff_print_txn(f, '+', tb);
+        return 0;
+    }
+
+    pa = txn_cache_payload(sa->cache, ta);
+    pb = txn_cache_payload(sb->cache, tb);
+
+    diff_print_txn(f, '~', ta);
+    fprintf(f, "   %12.6f (second capture)", (double)tb->time / TICKS_PER_SEC);
+    if (ta->hshake != tb->hshake)
+        fprintf(f, " %s", usb_get_pid_str(tb->hshake));
+
+    for (i=0;i<length;i++)
+    {
+        if (pa[i] == pb[i])
+            continue;
+
+        if (count++ < DIFF_MAX_BYTES)
+            fprintf(f, " [%d] %02x>%02x", i, pa[i], pb[i]);
+    }
+
+    if (count > DIFF_MAX_BYTES)
+        fprintf(f, " ... %d bytes differ", count);
+    fprintf(f, "\n");
+
+    return ta->hshake == tb->hshake || (ta->hshake == PID_NYET && tb->hshake == PID_ACK) ||
+           (ta->hshake == PID_ACK && tb->hshake == PID_NYET);
+}
+//-----------------------------------------------------------------
+// txn_diff: Compare transaction sequences of two captures per
+// endpoint. Prints differences, returns number of differing
+// transactions (0 = same) or -1 on error.
+//-----------------------------------------------------------------
+int64_t txn_diff(FILE *f, tTxnCache *a, tTxnCache *b, const tCaptureFilter *filter)
+{
+    struct diff_side *sa = (struct diff_side *)calloc(1, sizeof(struct diff_side));
+    struct diff_side *sb = (struct diff_side *)calloc(1, sizeof(struct diff_side));
+    struct diff_ctx ctx;
+    const tTransaction *first_a = NULL;
+    const tTransaction *first_b = NULL;
+    uint64_t first_time = ~0ULL;
+    int first_ep = -1;
+    int64_t only_a = 0;
+    int64_t only_b = 0;
+    int64_t payload = 0;
+    int64_t other = 0;
+    int streams = 0;
+    int differ = 0;
+    int ep;
+    int h;
+    int i;
+
+    assert(sa && sb);
+    memset(&ctx, 0, sizeof(ctx));
+
+    sa->cache = a;
+    sb->cache = b;
+
+    if (diff_load(sa, filter) != 0 || diff_load(sb, filter) != 0)
+    {
+        only_a = -1;
+        goto done;
+    }
+
+    for (ep=0;ep<DIFF_STREAMS;ep++)
+    {
+        struct diff_stream *xa = &sa->streams[ep];
+        struct diff_stream *xb = &sb->streams[ep];
+
+        if (!xa->count && !xb->count)
+            continue;
+
+        streams++;
+
+        ctx.A     = xa->hash;
+        ctx.B     = xb->hash;
+        ctx.count = 0;
+        diff_range(&ctx, 0, xa->count, 0, xb->count);
+
+        if (!ctx.count)
+            continue;
+
+        differ++;
+        fprintf(f, "dev %d ep %d: %d / %d transactions, %d hunk%s\n", ep / 16, ep % 16,
+                xa->count, xb->count, ctx.count, ctx.count == 1 ? "" : "s");
+
+        for (h=0;h<ctx.count;h++)
+        {
+            struct diff_hunk *hk = &ctx.hunks[h];
+            int pairs = hk->unaligned ? 0 : ((hk->alen < hk->blen) ? hk->alen : hk->blen);
+            const tTransaction *ta = hk->alen ? txn_cache_get(a, xa->idx[hk->a]) : NULL;
+            const tTransaction *tb = hk->blen ? txn_cache_get(b, xb->idx[hk->b]) : NULL;
+            uint64_t t = ta ? ta->time : tb->time;
+
+            if (t < first_time)
+            {
+                first_time = t;
+                first_ep   = ep;
+                first_a    = ta ? ta : (hk->a < xa->count ? txn_cache_get(a, xa->idx[hk->a]) : NULL);
+                first_b    = tb ? tb : (hk->b < xb->count ? txn_cache_get(b, xb->idx[hk->b]) : NULL);
+            }
+
+            fprintf(f, "@@ -%d,%d +%d,%d @@%s\n", hk->a, hk->alen, hk->b, hk->blen, hk->unaligned ? " unaligned" : "");
+
+            // Same count: show what changed in each pair
+            for (i=0;i<pairs;i++)
+            {
+                ta = txn_cache_get(a, xa->idx[hk->a + i]);
+                tb = txn_cache_get(b, xb->idx[hk->b + i]);
+
+                if (diff_print_pair(f, sa, ta, sb, tb))
+                    payload++;
+                else
+                    other++;
+            }
+
+            for (i=pairs;i<hk->alen;i++)
+                diff_print_txn(f, '-', txn_cache_get(a, xa->idx[hk->a + i]));
+            for (i=pairs;i<hk->blen;i++)
+                diff_print_txn(f, '+', txn_cache_get(b, xb->idx[hk->b + i]));
+
+            only_a += hk->alen - pairs;
+            only_b += hk->blen - pairs;
+        }
+    }
+
+    if (first_ep >= 0)
+    {
+        fprintf(f, "First divergence: dev %d ep %d", first_ep / 16, first_ep % 16);
+        if (first_a)
+            fprintf(f, ", %.6f s in first capture", (double)first_a->time / TICKS_PER_SEC);
+        if (first_b)
+            fprintf(f, ", %.6f s in second capture", (double)first_b->time / TICKS_PER_SEC);
+        fprintf(f, "\n");
+    }
+
+    fprintf(f, "%d endpoints, %d differ: %lld payload changes, %lld other changes, %lld only in first, %lld only in second\n",
+            streams, differ, (long long)payload, (long long)other, (long long)only_a, (long long)only_b);
+
+done:
+    for (ep=0;ep<DIFF_STREAMS;ep++)
+    {
+        free(sa->streams[ep].hash);
+        free(sa->streams[ep].idx);
+        free(sb->streams[ep].hash);
+        free(sb->streams[ep].idx);
+    }
+
+    free(ctx.hunks);
+    free(ctx.fv);
+    free(ctx.bv);
+    free(sa);
+    free(sb);
+
+    if (only_a < 0)
+        return -1;
+
+    return payload + other + only_a + only_b;
+}
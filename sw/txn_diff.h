@@ -0,0 +1,32 @@
+#ifndef __TXN_DIFF_H__
+#define __TXN_DIFF_H__
+
+//--------------------------------------------------------------------
+// Defines
+//--------------------------------------------------------------------
+// Myers steps tried before falling back to anchors
+#define DIFF_MAX_WORK           (64 * 1024 * 1024)
+
+// Transactions per anchor window (grown up to max), anchors kept in
+// the hash table
+#define DIFF_WINDOW             8
+#define DIFF_MAX_WINDOW         512
+#define DIFF_MAX_ANCHORS        (1024 * 1024)
+
+// Differing payload bytes listed per transaction
+#define DIFF_MAX_BYTES          16
+
+//--------------------------------------------------------------------
+// Prototypes
+//--------------------------------------------------------------------
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+int64_t txn_diff(FILE *f, tTxnCache *a, tTxnCache *b, const tCaptureFilter *filter);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -17,6 +17,8 @@ uint8_t  usb_get_token_crc5(uint32_t value);
 uint16_t usb_get_data_length(uint32_t value);
 uint16_t usb_get_sof_frame(uint32_t value);
 uint8_t  usb_get_sof_crc5(uint32_t value);
+uint16_t usb_crc16(const uint8_t *data, int length);
+int      usb_data_crc_valid(const uint8_t *data, int length);
 
 char*    usb_get_pid_str(uint8_t pid);
 
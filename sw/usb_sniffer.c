@@ -351,27 +351,19 @@ int usb_sniffer_read_buffer(uint8_t *buffer, uint32_t base, int size)
     return err ? -1: 0;
 }
 //-----------------------------------------------------------------
-// usb_sniffer_extract_buffer: Extract buffer from target and write to file
+// usb_sniffer_fetch_buffer: Extract buffer from target into memory
 //-----------------------------------------------------------------
-int usb_sniffer_extract_buffer(FILE *f, uint32_t rd_ptr, uint32_t size)
+int usb_sniffer_fetch_buffer(uint32_t *buffer, uint32_t rd_ptr, uint32_t size)
 {
     int err = 0;
-    int i,j;
+    int i;
     uint32_t value = 0;
-    uint32_t data = 0;
-
-    uint32_t *buffer = (uint32_t *)malloc(size);
-    assert(buffer);
 
     assert(!(size & 3));
 
     // Extract buffer from target
     if (usb_sniffer_read_buffer((uint8_t*)buffer, rd_ptr, size) != 0)
-    {
-        free(buffer);
-        buffer = NULL;
         return -1;
-    }
 
     // Fix data packet ordering
     int rd_idx = (size / 4) - 1;
@@ -422,11 +414,25 @@ int usb_sniffer_extract_buffer(FILE *f, uint32_t rd_ptr, uint32_t size)
         }
     }
 
+    return err ? -1 : size;
+}
+//-----------------------------------------------------------------
+// usb_sniffer_extract_buffer: Extract buffer from target and write to file
+//-----------------------------------------------------------------
+int usb_sniffer_extract_buffer(FILE *f, uint32_t rd_ptr, uint32_t size)
+{
+    int res;
+
+    uint32_t *buffer = (uint32_t *)malloc(size);
+    assert(buffer);
+
+    res = usb_sniffer_fetch_buffer(buffer, rd_ptr, size);
+
     // Write fixed buffer to file
-    if (f != NULL && !err)
+    if (f != NULL && res >= 0)
         fwrite(buffer, 1, size, f);
 
     free(buffer);
     buffer = NULL;
-    return err ? -1 : size;
+    return res;
 }
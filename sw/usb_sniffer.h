@@ -38,6 +38,7 @@ uint32_t usb_sniffer_end(void);
 int usb_sniffer_set_rd_ptr(uint32_t addr);
 int usb_sniffer_get_buffer(uint8_t *buffer, int buffer_size);
 int usb_sniffer_read_buffer(uint8_t *buffer, uint32_t base, int size);
+int usb_sniffer_fetch_buffer(uint32_t *buffer, uint32_t rd_ptr, uint32_t size);
 int usb_sniffer_extract_buffer(FILE *f, uint32_t rd_ptr, uint32_t size);
 
 #ifdef __cplusplus